@@ -416,6 +416,7 @@ JNIEXPORT jint JNICALL JNI_OnLoad(JavaVM *jvm, void *reserved)
 %newobject mega::MegaApi::getTransferByTag;
 %newobject mega::MegaApi::getChildTransfers;
 %newobject mega::MegaApi::getChildren;
+%newobject mega::MegaApi::getChildrenAfter;
 %newobject mega::MegaApi::getChildNode;
 %newobject mega::MegaApi::getParentNode;
 %newobject mega::MegaApi::getNodePath;
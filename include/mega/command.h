@@ -50,6 +50,10 @@ public:
     char level;
     bool persistent;
 
+    // the result is processed while the response is still being received
+    // (see MegaClient::procpartialresponse())
+    bool incremental;
+
     void cmd(const char*);
     void notself(MegaClient*);
     virtual void cancel(void);
@@ -426,6 +430,18 @@ public:
     CommandGetFile(MegaClient *client, TransferSlot*, byte*, handle, bool, const char* = NULL, const char* = NULL, const char *chatauth = NULL);
 };
 
+// temp URL of another storage host for a download in progress
+class MEGA_API CommandGetFileSource : public Command
+{
+    TransferSlot* tslot;
+
+public:
+    void cancel();
+    void procresult();
+
+    CommandGetFileSource(MegaClient*, TransferSlot*, handle, bool, const char* = NULL, const char* = NULL, const char* = NULL);
+};
+
 class MEGA_API CommandPutFile : public Command
 {
     TransferSlot* tslot;
@@ -83,6 +83,9 @@
 /* Define to 1 if you have the <string.h> header file. */
 #define HAVE_STRING_H 1
 
+/* Define to 1 if you have the <sys/epoll.h> header file. */
+#define HAVE_SYS_EPOLL_H 1
+
 /* Define to 1 if you have the <sys/inotify.h> header file. */
 #define HAVE_SYS_INOTIFY_H 1
 
@@ -141,6 +144,9 @@
 /* Define to use Berkeley DB */
 #define USE_DB 0
 
+/* Use epoll API */
+#define USE_EPOLL 1
+
 /* Use inotify API */
 //#define USE_INOTIFY 1
 
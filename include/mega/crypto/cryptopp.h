@@ -88,6 +88,9 @@ private:
     CryptoPP::GCM<CryptoPP::AES>::Encryption aesgcm_e;
     CryptoPP::GCM<CryptoPP::AES>::Decryption aesgcm_d;
 
+    // expanded key for the AES-NI kernels
+    byte roundkeys[11 * 16];
+
 public:
     static byte zeroiv[CryptoPP::AES::BLOCKSIZE];
 
@@ -244,6 +247,32 @@ public:
 
     void ctr_crypt(byte *, unsigned, m_off_t, ctr_iv, byte *, bool, bool initmac = true);
 
+    // a chunk of a transfer buffer for the batched ctr_crypt()
+    struct CtrChunk
+    {
+        byte* data;
+        unsigned len;
+        m_off_t pos;
+        byte* mac;
+        bool initmac;
+    };
+
+    /**
+     * @brief Encrypt or decrypt several chunks in CTR mode, computing their CBC-MACs.
+     *
+     * Same as calling ctr_crypt() for each chunk, but the MACs of the chunks are
+     * computed in parallel.
+     *
+     * @param chunks Chunks to process (data padded as required by ctr_crypt()).
+     * @param numchunks Number of chunks.
+     * @param ctriv CTR nonce of the transfer.
+     * @param encrypt true to encrypt, false to decrypt.
+     */
+    void ctr_crypt(CtrChunk* chunks, unsigned numchunks, ctr_iv ctriv, bool encrypt);
+
+    // use the AES-NI kernels for ctr_crypt() (set at startup if the CPU supports them)
+    static bool aesni;
+
     static void setint64(int64_t, byte*);
 
     static void xorblock(const byte*, byte*);
@@ -255,6 +284,10 @@ public:
     SymmCipher(const SymmCipher& ref);
     SymmCipher& operator=(const SymmCipher& ref);
     SymmCipher(const byte*);
+
+private:
+    void ctr_keystream(byte*, unsigned, m_off_t, ctr_iv);
+    void cbc_mac(CtrChunk*, unsigned, bool);
 };
 
 /**
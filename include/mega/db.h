@@ -25,6 +25,29 @@
 #include "filesystem.h"
 
 namespace mega {
+// node properties stored next to an encrypted node record, for lookups
+// without decryption (a copy, so that it can be written after the node has
+// changed or gone)
+struct MEGA_API NodeColumns
+{
+    handle nodehandle;
+
+    // UNDEF for nodes without parent
+    handle parenthandle;
+
+    nodetype_t type;
+
+    // fingerprint (only for files)
+    m_off_t size;
+    m_time_t mtime;
+    int32_t crc[4];
+
+    // has shares or a public link
+    bool shared;
+
+    NodeColumns(const Node*);
+};
+
 // generic host transactional database access interface
 class MEGA_API DbTable
 {
@@ -35,10 +58,20 @@ public:
     // for a full sequential get: rewind to first record
     virtual void rewind() = 0;
 
+    // for a sequential get of all records except nodes (false if node
+    // records can't be skipped)
+    virtual bool rewindrecords();
+
     // get next record in sequence
     virtual bool next(uint32_t*, string*) = 0;
+
+    // get next record, decrypt and unpad (without key, the record is
+    // returned as stored, to be decrypted with decrypt())
     bool next(uint32_t*, string*, SymmCipher*);
 
+    // decrypt and unpad a record (thread-safe with a dedicated key)
+    static bool decrypt(uint32_t, string*, SymmCipher*);
+
     // get specific record by key
     virtual bool get(uint32_t, string*) = 0;
 
@@ -50,6 +83,52 @@ public:
     // delete specific record
     virtual bool del(uint32_t) = 0;
 
+    // serialize, pad and encrypt a record, assigning its index if new
+    // (false if the record can't be serialized)
+    bool encode(uint32_t, Cachable*, SymmCipher*, string*);
+
+    // add/update or delete several encoded records at once - backends may
+    // write them with fewer statements, the default handles them one by one
+    virtual bool putrecords(dbrecord_vector*);
+    virtual bool delrecords(vector<uint32_t>*);
+
+    // add or update node record with padding and encryption - backends
+    // with a node table store it there, along with indexed columns
+    bool putnode(uint32_t, Node*, SymmCipher*);
+    virtual bool putnode(uint32_t, NodeColumns*, string*);
+
+    // delete node record
+    virtual bool delnode(uint32_t);
+
+    // add/update several encoded node records (in the order of their
+    // columns) or delete several node records at once
+    virtual bool putnoderecords(vector<NodeColumns>*, dbrecord_vector*);
+    virtual bool delnoderecords(vector<uint32_t>*);
+
+    // delete the node records of and below several nodes, following the
+    // parent handles without reading the records - the descent stops at
+    // nodes with shares or public links (false if there is no node table)
+    virtual bool delnodetrees(handle_vector*);
+
+    // encrypted node records by handle, parent handle or fingerprint,
+    // without reading the whole table (false if there is no node table)
+    virtual bool getnode(handle, uint32_t*, string*);
+    virtual bool getchildren(handle, dbrecord_vector*);
+    virtual bool getnodesbyfingerprint(FileFingerprint*, dbrecord_vector*);
+
+    // encrypted records of nodes with shares or public links
+    virtual bool getsharednodes(dbrecord_vector*);
+
+    // counters of the subtree below and including a folder, from the node
+    // columns (false if there is no node table)
+    virtual bool getsubtreecounter(handle, NodeCounter*);
+
+    // node records are still stored in the generic table (previous layout)
+    bool legacynodes;
+
+    // node records have been moved to the node table
+    virtual void nodesmigrated();
+
     // delete all records
     virtual void truncate() = 0;
 
@@ -68,6 +147,9 @@ public:
     // autoincrement
     uint32_t nextid;
 
+    // make sure that new records are allocated above an existing index
+    void reserveid(uint32_t);
+
     DbTable(PrnGen &rng);
     virtual ~DbTable() { }
 };
@@ -75,7 +157,10 @@ public:
 struct MEGA_API DbAccess
 {
     static const int LEGACY_DB_VERSION = 11;
-    static const int DB_VERSION = LEGACY_DB_VERSION + 1;
+    static const int DB_VERSION = LEGACY_DB_VERSION + 2;
+
+    // same layout as DB_VERSION, but without node table (upgraded on open)
+    static const int PREVIOUS_DB_VERSION = LEGACY_DB_VERSION + 1;
 
     DbAccess();
     virtual DbTable* open(PrnGen &rng, FileSystemAccess*, string*, bool = false) = 0;
@@ -30,6 +30,9 @@ class MEGA_API SqliteDbAccess : public DbAccess
 {
     string dbpath;
 
+    // rename database file, including WAL and shared memory files
+    bool renamedb(FileSystemAccess*, string*, string*);
+
 public:
     DbTable* open(PrnGen &rng, FileSystemAccess*, string*, bool = false);
 
@@ -44,19 +47,58 @@ class MEGA_API SqliteDbTable : public DbTable
     string dbfile;
     FileSystemAccess *fsaccess;
 
+    // node records are kept in the nodes table
+    bool nodetable;
+
+    // statements prepared on first use and kept for the lifetime of the table
+    enum
+    {
+        STMT_GET, STMT_PUT, STMT_PUTBATCH, STMT_DEL, STMT_DELBATCH,
+        STMT_PUTNODE, STMT_PUTNODEBATCH, STMT_DELNODE, STMT_DELNODEBATCH,
+        STMT_GETNODE, STMT_GETCHILDREN, STMT_DELNODETREE, STMT_GETSUBTREECOUNTER, NUMSTATEMENTS
+    };
+
+    sqlite3_stmt* stmts[NUMSTATEMENTS];
+
+    sqlite3_stmt* statement(int, const char*);
+    sqlite3_stmt* statement(int, const char*, const char*, int, const char* = "");
+    void finalizestatements();
+
+    bool delfrom(const char*, int, int, vector<uint32_t>*);
+    int bindnode(sqlite3_stmt*, int, uint32_t, NodeColumns*, string*);
+
+    bool getnodes(sqlite3_stmt*, dbrecord_vector*);
+
 public:
+    // rows written by a single multi-row statement
+    static const int BATCHROWS = 64;
+
     void rewind();
+    bool rewindrecords();
     bool next(uint32_t*, string*);
     bool get(uint32_t, string*);
     bool put(uint32_t, char*, unsigned);
     bool del(uint32_t);
+    bool putrecords(dbrecord_vector*);
+    bool delrecords(vector<uint32_t>*);
+    bool putnode(uint32_t, NodeColumns*, string*);
+    bool delnode(uint32_t);
+    bool putnoderecords(vector<NodeColumns>*, dbrecord_vector*);
+    bool delnoderecords(vector<uint32_t>*);
+    bool delnodetrees(handle_vector*);
+    bool getnode(handle, uint32_t*, string*);
+    bool getchildren(handle, dbrecord_vector*);
+    bool getnodesbyfingerprint(FileFingerprint*, dbrecord_vector*);
+    bool getsharednodes(dbrecord_vector*);
+    bool getsubtreecounter(handle, NodeCounter*);
+    void nodesmigrated();
     void truncate();
     void begin();
     void commit();
     void abort();
     void remove();
 
-    SqliteDbTable(PrnGen &rng, sqlite3*, FileSystemAccess *fs, string *filepath);
+    SqliteDbTable(PrnGen &rng, sqlite3*, FileSystemAccess *fs, string *filepath, bool = false);
     ~SqliteDbTable();
 };
 } // namespace
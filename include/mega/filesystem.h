@@ -77,6 +77,9 @@ struct MEGA_API FileAccess
     // mtime of a file opened for reading
     m_time_t mtime;
 
+    // inode change time (0 if not available)
+    m_time_t ctime;
+
     // local filesystem record id (survives renames & moves)
     handle fsid;
     bool fsidvalid;
@@ -162,6 +165,19 @@ struct MEGA_API InputStreamAccess
     virtual ~InputStreamAccess() { }
 };
 
+// directory record from DirAccess::dlist() - size, mtime, ctime and fsid
+// are only valid if fsidvalid is set
+struct MEGA_API DirEntry
+{
+    string localname;
+    nodetype_t type;
+    m_off_t size;
+    m_time_t mtime;
+    m_time_t ctime;
+    handle fsid;
+    bool fsidvalid;
+};
+
 // generic host directory enumeration
 struct MEGA_API DirAccess
 {
@@ -171,6 +187,11 @@ struct MEGA_API DirAccess
     // get next record
     virtual bool dnext(string*, string*, bool = true, nodetype_t* = NULL) = 0;
 
+    // get all remaining records with their attributes, without opening the
+    // items (the generic version gets their types through dnext() only,
+    // others also leave out items that can't be opened for reading)
+    virtual void dlist(string*, vector<DirEntry>*, bool = true);
+
     virtual ~DirAccess() { }
 };
 
@@ -301,6 +322,10 @@ struct MEGA_API FileSystemAccess : public EventTrigger
     // delete notification
     virtual void delnotify(LocalNode*) { }
 
+    // start the async I/O queued during this pass and complete the finished
+    // operations (for implementations that batch submissions)
+    virtual void processasync() { }
+
     // get the absolute path corresponding to a path
     virtual bool expanselocalpath(string *path, string *absolutepath) = 0;
 
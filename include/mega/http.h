@@ -193,6 +193,10 @@ struct MEGA_API HttpIO : public EventTrigger
     // get max upload speed
     virtual m_off_t getmaxuploadspeed();
 
+    // use HTTP/2 where the server supports it, multiplexing requests to the
+    // same host over one connection (returns false if not available)
+    virtual bool sethttp2(bool);
+
     HttpIO();
     virtual ~HttpIO() { }
 };
@@ -222,6 +226,12 @@ struct MEGA_API HttpReq
     size_t inpurge;
     size_t outpos;
 
+    // bytes already erased from the start of in (see purge())
+    m_off_t inpurged;
+
+    // the response is consumed while it arrives - don't preallocate it
+    bool incremental;
+
     string outbuf;
 
     byte* buf;
@@ -315,28 +325,92 @@ struct MEGA_API GenericHttpReq : public HttpReq
     BackoffTimer maxbt;
 };
 
+// aligned buffers for downloaded chunks, reused across requests and
+// transfers: the data is received into them, decrypted in place and written
+// to the file from them
+class MEGA_API TransferBufferPool
+{
+    // start of the allocation and capacity of the buffers in use
+    std::map<byte*, pair<byte*, unsigned> > buffers;
+
+    // idle buffers by capacity
+    std::multimap<unsigned, byte*> idle;
+    m_off_t idlebytes;
+
+public:
+    static const unsigned ALIGNMENT = 4096;
+
+    // idle buffers beyond this total are freed
+    m_off_t maxidlebytes;
+    static const m_off_t MAXIDLEBYTES = 32 * 1048576;
+
+    // buffer of at least size bytes - the previous buffer of the caller is
+    // kept if it is large enough and released otherwise
+    byte* get(byte*, unsigned);
+
+    // return a buffer to the pool
+    void release(byte*);
+
+    // buffers allocated from the system and bytes of downloaded data
+    // received into pooled buffers (copies are not counted: HttpReq::put()
+    // copies each received byte once, from the network library's buffer,
+    // and decryption and the file write work in place)
+    struct Stats
+    {
+        m_off_t allocations;
+        m_off_t transferred;
+
+        double allocationspermb() const;
+
+        Stats();
+    };
+
+    // counters since the last resetstats()
+    Stats stats;
+
+    // return the counters and start counting from zero again
+    Stats resetstats();
+
+    TransferBufferPool();
+    ~TransferBufferPool();
+};
+
 // file chunk I/O
 struct MEGA_API HttpReqXfer : public HttpReq
 {
     unsigned size;
 
+    // chunk encryption/decryption queued to a TransferCryptoPool
+    ChunkCrypto* crypto;
+
     virtual void prepare(const char*, SymmCipher*, chunkmac_map*, uint64_t, m_off_t, m_off_t) = 0;
     virtual void finalize(Transfer*) { }
 
-    HttpReqXfer() : HttpReq(true), size(0) { }
+    HttpReqXfer() : HttpReq(true), size(0), crypto(NULL) { }
+    ~HttpReqXfer();
 };
 
 // file chunk upload
 struct MEGA_API HttpReqUL : public HttpReqXfer
 {
     // size (in bytes) of the CRC of uploaded chunks
-    static const int CRCSIZE;
+    static const int CRCSIZE = 12;
 
     void prepare(const char*, SymmCipher*, chunkmac_map*, uint64_t, m_off_t, m_off_t);
 
+    // prepare() with the encryption on a worker thread: the chunk MACs are
+    // kept in chunkmacs until preparecompleted() hands them to the transfer
+    void prepareasync(TransferCryptoPool*, const char*, SymmCipher*, uint64_t, m_off_t, m_off_t);
+    void preparecompleted(chunkmac_map*);
+    chunkmac_map chunkmacs;
+
     m_off_t transferred(MegaClient*);
 
     ~HttpReqUL() { }
+
+private:
+    void setupcrypto(ChunkCrypto*, chunkmac_map*, const char*, m_off_t, m_off_t);
+    void setposturl(ChunkCrypto*);
 };
 
 // file chunk download
@@ -345,10 +419,53 @@ struct MEGA_API HttpReqDL : public HttpReqXfer
     m_off_t dlpos;
     chunkmac_map chunkmacs;
 
+    // the downloaded data has been decrypted
+    bool decrypted;
+
     void prepare(const char*, SymmCipher*, chunkmac_map*, uint64_t, m_off_t, m_off_t);
     void finalize(Transfer *transfer);
 
-    ~HttpReqDL() { }
+    // finalize() with the decryption on a worker thread, completed by
+    // finalizecompleted() once the pool reports the crypto as finished
+    void finalizeasync(Transfer*, TransferCryptoPool*);
+    void finalizecompleted();
+
+    // buffers come from this pool if set
+    TransferBufferPool* bufferpool;
+
+    HttpReqDL() : decrypted(false), bufferpool(NULL) { }
+    ~HttpReqDL();
+
+private:
+    void setupcrypto(Transfer*, ChunkCrypto*);
+};
+
+// encryption (with the CRC of the encrypted data) or decryption of the
+// chunks of a transfer request - run on a TransferCryptoPool thread, the
+// TransferSlot polls for its completion as for an AsyncIOContext
+struct MEGA_API ChunkCrypto
+{
+    // own copy of the transfer cipher (not shared across threads)
+    SymmCipher cipher;
+    uint64_t ctriv;
+    bool encrypt;
+
+    vector<SymmCipher::CtrChunk> chunks;
+
+    // uploads: data to compute the CRC of, base URL and position
+    const byte* crcdata;
+    unsigned crcsize;
+    byte crc[HttpReqUL::CRCSIZE];
+    string tempurl;
+    m_off_t pos;
+
+    // processed (set under the lock of the TransferCryptoPool)
+    bool finished;
+
+    // encrypt or decrypt (thread-safe)
+    void run();
+
+    ChunkCrypto(SymmCipher*, uint64_t, bool);
 };
 
 // file attribute get
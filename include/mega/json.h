@@ -62,6 +62,10 @@ struct MEGA_API JSON
 
     static void unescape(string*);
 
+    // length of the complete value at the start of a partially received
+    // buffer (0 if the value continues beyond it)
+    static size_t valuelength(const char*, size_t);
+
     /**
      * @brief Extract a string value for a name in a JSON string
      * @param json JSON string to check
@@ -272,6 +272,7 @@ struct MEGA_API MegaApp
     virtual void syncupdate_local_file_change(Sync*, LocalNode*, const char*) { }
     virtual void syncupdate_local_move(Sync*, LocalNode*, const char*) { }
     virtual void syncupdate_local_lockretry(bool) { }
+    virtual void syncupdate_scan_completed(Sync*, dstime, m_off_t, m_off_t) { }
     virtual void syncupdate_get(Sync*, Node*, const char*) { }
     virtual void syncupdate_put(Sync*, LocalNode*, const char*) { }
     virtual void syncupdate_remote_file_addition(Sync*, Node*) { }
@@ -135,6 +135,22 @@ public:
      */
     dstime timeToLastByte;
 
+    /**
+     * @brief Time until the records read from the database are decrypted and unserialized
+     *
+     * From DB: records are decoded by worker threads while the database is being read
+     * From API: not used
+     */
+    dstime timeToDecoded;
+
+    /**
+     * @brief Time until cached nodes are linked to their parents
+     *
+     * From DB: time until the final linkage pass over all loaded nodes has finished
+     * From API: not used
+     */
+    dstime timeToLinked;
+
     /**
      * @brief Time until the cached filesystem is ready
      *
@@ -177,6 +193,353 @@ public:
     dstime timeToTransfersResumed;
 };
 
+// worker threads taking queued jobs in order - the owner implements
+// process() and keeps track of its jobs in taken() and processed(), both
+// called with the lock held
+class MEGA_API WorkerPool
+{
+    bool exiting;
+    SEMAPHORE_CLASS queued;
+    SEMAPHORE_CLASS completed;
+    vector<THREAD_CLASS*> threads;
+
+    // threads blocked in waitcompleted()
+    int waiting;
+
+    static void *threadEntryPoint(void *param);
+    void loop();
+
+protected:
+    // guards the queue and the owner's state of its jobs
+    MUTEX_CLASS mutex;
+    std::deque<void*> jobs;
+
+    // jobs taken from the queue and not processed yet
+    int active;
+
+    // notified whenever a job has been processed (may be NULL)
+    Waiter* waiter;
+
+    // do the work (worker thread, without the lock)
+    virtual void process(void*) = 0;
+
+    // the job has been taken from the queue / processed
+    virtual void taken(void*) { }
+    virtual void processed(void*) { }
+
+    // queue a job (processed right away if there are no worker threads)
+    void enqueue(void*);
+
+    // wait until the next job has been processed - with the lock held,
+    // which is released meanwhile
+    void waitcompleted();
+
+    // start the worker threads (from the owner's constructor) and stop them
+    // (from its destructor, jobs still queued are left in the queue)
+    void startworkers(int);
+    void stopworkers();
+
+    bool hasworkers() const;
+
+    WorkerPool(Waiter*);
+    virtual ~WorkerPool();
+};
+
+// batch of consecutive statecache records, decrypted and (for nodes)
+// unserialized by a StateCacheLoader
+struct MEGA_API StateCacheBatch
+{
+    vector<uint32_t> ids;
+    vector<string> records;
+
+    // detached nodes and their shares (NULL for other record types or
+    // unserialization errors)
+    vector<Node*> nodes;
+    vector<newshare_list> shares;
+
+    // number of records decrypted before the first failure
+    size_t decrypted;
+
+    // processing finished
+    bool done;
+
+    StateCacheBatch();
+    ~StateCacheBatch();
+};
+
+// decodes statecache records on a pool of worker threads
+class MEGA_API StateCacheLoader : public WorkerPool
+{
+    MegaClient* client;
+    byte key[SymmCipher::KEYLENGTH];
+
+    // decrypt all records and unserialize nodes (thread-safe)
+    void process(void*);
+    void processed(void*);
+
+public:
+    // queue batch for decoding (decoded right away without worker threads)
+    void push(StateCacheBatch*);
+
+    // wait until the batch has been decoded
+    void wait(StateCacheBatch*);
+
+    StateCacheLoader(MegaClient*, const byte*, int);
+    ~StateCacheLoader();
+};
+
+// contiguous range of node key decryptions handled by one NodeKeyPool job
+struct MEGA_API NodeKeyRange
+{
+    NodeKeyDecryption* decryptions;
+    size_t count;
+
+    // processing finished
+    bool done;
+
+    NodeKeyRange() : decryptions(NULL), count(0), done(false) { }
+};
+
+// unwraps node keys and decrypts node attributes for applykeys() on a pool
+// of worker threads - started with the first batch large enough to be split
+class MEGA_API NodeKeyPool : public WorkerPool
+{
+    const FileSystemAccess* fsaccess;
+
+    // unwrap the keys and decrypt the attributes of the range (thread-safe)
+    void process(void*);
+    void processed(void*);
+
+public:
+    // queue range for decryption (decrypted right away without worker threads)
+    void push(NodeKeyRange*);
+
+    // wait until the range has been decrypted
+    void wait(NodeKeyRange*);
+
+    NodeKeyPool(const FileSystemAccess*, int);
+    ~NodeKeyPool();
+};
+
+// encrypts and decrypts transfer chunks on a pool of worker threads - the
+// TransferSlots poll for finished jobs, the client's waiter is notified
+// whenever one completes
+class MEGA_API TransferCryptoPool : public WorkerPool
+{
+    void process(void*);
+    void processed(void*);
+
+public:
+    // queue a job (processed right away if there are no worker threads)
+    void push(ChunkCrypto*);
+
+    // the job has been processed
+    bool finished(ChunkCrypto*);
+
+    // dequeue or wait for a job, so that it can be deleted
+    void cancel(ChunkCrypto*);
+
+    TransferCryptoPool(Waiter*, int);
+    ~TransferCryptoPool();
+};
+
+#ifdef ENABLE_SYNC
+// lists folders and fingerprints files for the syncs on a bounded pool of
+// worker threads - finished jobs are collected by their sync on the client
+// thread, the client's waiter is notified whenever one completes
+class MEGA_API SyncScanPool : public WorkerPool
+{
+    FileSystemAccess* fsaccess;
+
+    vector<SyncScanJob*> running;
+    std::deque<SyncScanJob*> done;
+
+    void process(void*);
+    void taken(void*);
+    void processed(void*);
+
+public:
+    // queue a job (processed right away if there are no worker threads)
+    void push(SyncScanJob*);
+
+    // move the finished jobs of a sync to the vector, in completion order
+    void collect(class Sync*, vector<SyncScanJob*>*);
+
+    // drop the jobs of a sync, waiting for the ones being processed
+    void cancel(class Sync*);
+
+    SyncScanPool(FileSystemAccess*, Waiter*, int);
+    ~SyncScanPool();
+};
+#endif
+
+// writes to a local cache table on a dedicated thread - write operations,
+// including transaction boundaries, are queued as encoded records and
+// applied in order, reads wait until the queue has been written
+class MEGA_API StateCacheWriter : public DbTable, public WorkerPool
+{
+    enum { PUT, DEL, PUTNODE, DELNODE, DELNODETREES, BEGIN, COMMIT, ABORT, TRUNCATE, NODESMIGRATED };
+
+    struct Operation
+    {
+        int type;
+
+        // PUT, PUTNODE
+        dbrecord_vector records;
+
+        // PUTNODE
+        vector<NodeColumns> columns;
+
+        // DEL, DELNODE
+        vector<uint32_t> ids;
+
+        // DELNODETREES
+        handle_vector handles;
+
+        size_t size() const;
+
+        Operation(int);
+    };
+
+    DbTable* table;
+
+    // bytes of queued records, including the operation being written
+    size_t pendingbytes;
+
+    // a write failed: the current transaction is rolled back, later writes
+    // are ignored and reported as failed
+    bool failed;
+
+    // the record with index 0 (the sequence number) as queued, so that it
+    // can be read without waiting for the thread
+    bool seqknown;
+    bool seqpresent;
+    string seqrecord;
+    void queuedrecords(int, dbrecord_vector*, vector<uint32_t>*);
+
+    // apply an operation to the table (writer thread)
+    void process(void*);
+    void processed(void*);
+
+    bool push(Operation*);
+    void flush();
+
+public:
+    // queued bytes above which writes wait for the thread to catch up
+    size_t maxpendingbytes;
+    static const size_t MAXPENDINGBYTES = 64 << 20;
+
+    // number of writes that had to wait for the thread
+    unsigned stalls;
+
+    void rewind();
+    bool rewindrecords();
+    bool next(uint32_t*, string*);
+    bool get(uint32_t, string*);
+    bool put(uint32_t, char*, unsigned);
+    bool del(uint32_t);
+    bool putrecords(dbrecord_vector*);
+    bool delrecords(vector<uint32_t>*);
+    bool putnode(uint32_t, NodeColumns*, string*);
+    bool delnode(uint32_t);
+    bool putnoderecords(vector<NodeColumns>*, dbrecord_vector*);
+    bool delnoderecords(vector<uint32_t>*);
+    bool delnodetrees(handle_vector*);
+    bool getnode(handle, uint32_t*, string*);
+    bool getchildren(handle, dbrecord_vector*);
+    bool getnodesbyfingerprint(FileFingerprint*, dbrecord_vector*);
+    bool getsharednodes(dbrecord_vector*);
+    bool getsubtreecounter(handle, NodeCounter*);
+    void nodesmigrated();
+    void truncate();
+    void begin();
+    void commit();
+    void abort();
+    void remove();
+
+    // takes ownership of the table
+    StateCacheWriter(PrnGen&, DbTable*);
+    ~StateCacheWriter();
+};
+
+// time spent by the client thread on local cache updates, in microseconds
+struct MEGA_API StateCacheStats
+{
+    unsigned updates;
+    long long lastus;
+    long long maxus;
+    long long totalus;
+
+    void add(long long);
+
+    StateCacheStats();
+};
+
+// trigram index over the display names of resident nodes, for substring
+// searches that do not need the client's lock - built on first use, then
+// kept up to date as nodes are added, renamed, moved and deleted
+class MEGA_API NodeSearchIndex
+{
+    struct Entry
+    {
+        // UNDEF if the slot is free
+        handle nodehandle;
+        handle parenthandle;
+
+        // display name, ASCII-lowercased
+        string name;
+
+        // files and folders are returned by searches, other nodes are only
+        // kept as ancestors
+        nodetype_t type;
+    };
+
+    MUTEX_CLASS mutex;
+
+    vector<Entry> entries;
+    vector<uint32_t> freeslots;
+    std::unordered_map<handle, uint32_t> slots;
+
+    // entry slots by trigram of their name
+    std::unordered_map<uint32_t, vector<uint32_t> > postings;
+
+    // all postings, and those among them that refer to old names or to
+    // freed slots
+    size_t numpostings;
+    size_t stale;
+
+    bool built;
+
+    void add(uint32_t);
+    void retire(uint32_t);
+    void compact();
+    bool inscope(uint32_t, const handle_set*, bool, std::unordered_map<handle, bool>*);
+
+public:
+    // names are matched like strcasestr(), so lowercasing is ASCII-only
+    static void normalize(string*);
+
+    bool isbuilt();
+
+    // index all given nodes, replacing the current contents
+    void build(node_map*);
+
+    // (re)index a node after its name or its parent changed
+    void update(Node*);
+    void remove(handle);
+    void clear();
+
+    // handles of files and folders whose name contains the text, below one
+    // of the ancestors (directly below them if not recursive) - like the
+    // tree walk, previous versions are only returned for the ancestors
+    // themselves - false if the index is not built
+    bool search(const char*, const handle_set*, bool, handle_vector*);
+
+    size_t size();
+
+    NodeSearchIndex();
+};
+
 class MEGA_API MegaClient
 {
 public:
@@ -330,6 +693,42 @@ public:
     // fetchnodes stats
     FetchNodesStats fnstats;
 
+    // node records of the fetchnodes response processed while it arrives:
+    // results of the preceding commands, node records, end of node array
+    enum { FNSTREAM_OFF, FNSTREAM_RESULTS, FNSTREAM_NODES, FNSTREAM_END };
+    int fnstream;
+
+    // scan position in the unpurged response and index of the next result
+    size_t fnstreampos;
+    int fnstreamresult;
+
+    // response up to the node array (the records are purged once processed)
+    string fnstreamprefix;
+
+    // processed nodes whose parent has not arrived yet
+    node_vector fnstreamdp;
+
+    // process the complete node records received so far, and restore the
+    // rest of the response for procresult() once it is complete
+    void procpartialresponse();
+    void restorepartialresponse();
+
+    // local cache update stats
+    StateCacheStats scstats;
+
+    // buffers of the download requests, shared by all transfers
+    TransferBufferPool downloadbuffers;
+
+    // write the local cache on a dedicated thread
+    bool scwriter;
+
+    // name index for searches (see NodeSearchIndex)
+    NodeSearchIndex searchindex;
+
+    // build the search index from the resident nodes, if it is not built
+    // yet - returns false if it cannot be used (nodes loaded on demand)
+    bool buildsearchindex();
+
 #ifdef ENABLE_CHAT
     // load cryptographic keys: RSA, Ed25519, Cu25519 and their signatures
     void fetchkeys();    
@@ -643,6 +1042,9 @@ public:
     // get max upload speed
     m_off_t getmaxuploadspeed();
 
+    // use HTTP/2 (with multiplexing) if the network layer supports it
+    bool sethttp2(bool);
+
     // get the handle of the older version for a NewNode
     handle getovhandle(Node *parent, string *name);
 
@@ -664,6 +1066,14 @@ public:
     // finish downloaded chunks in order
     bool orderdownloadedchunks;
 
+    // adapt the connections and request size of new transfers to the
+    // measured throughput (see ThroughputController)
+    bool adaptivetransfers;
+
+    // maximum number of storage hosts a download fetches from in parallel
+    // (see DownloadSources)
+    int downloadsources;
+
     // disable public key pinning (for testing purposes)
     static bool disablepkp;
 
@@ -775,8 +1185,6 @@ private:
     // a TransferSlot chunk failed
     bool chunkfailed;
     
-    // fetch state serialize from local cache
-    bool fetchsc(DbTable*);
 
     // close the local transfer cache
     void closetc(bool remove = false);
@@ -1093,6 +1501,12 @@ public:
 
     bool syncuprequired;
 
+    // the next syncdown() / syncup() pass visits all synced folders rather
+    // than only those flagged as dirty (for changes that can't be attributed
+    // to a LocalNode)
+    bool syncdownfull;
+    bool syncupfull;
+
     // block local fs updates processing while locked ops are in progress
     bool syncfsopsfailed;
 
@@ -1207,8 +1621,10 @@ public:
     bool requestLock;
     dstime disconnecttimestamp;
 
-    // process object arrays by the API server
-    int readnodes(JSON*, int, putsource_t = PUTNODES_APP, NewNode* = NULL, int = 0, int = 0);
+    // process object arrays by the API server (optionally continuing an
+    // array whose first records were processed by readnode())
+    int readnodes(JSON*, int, putsource_t = PUTNODES_APP, NewNode* = NULL, int = 0, int = 0, node_vector* = NULL);
+    bool readnode(JSON*, int, putsource_t, NewNode*, int, int, node_vector*);
 
     void readok(JSON*);
     void readokelement(JSON*);
@@ -1243,9 +1659,95 @@ public:
     Node* childnodebyname(Node*, const char*, bool = false);
     vector<Node*> childnodesbyname(Node*, const char*, bool = false);
 
+    // folders with at least this many children get a name index on their
+    // first lookup by name (0 disables indexing)
+    size_t childnameindexmin;
+    static const size_t CHILDNAMEINDEXMIN = 128;
+
+    // folders with sorted children (see Node::sortedchildren), least
+    // recently listed first - the sort orders of the least recently listed
+    // folders are dropped beyond maxsortedfolders
+    node_list sortedfolders;
+    size_t maxsortedfolders;
+    static const size_t MAXSORTEDFOLDERS = 16;
+
+    // worker threads decoding the local cache in fetchsc() (0 to decode on
+    // the client thread) and size of the record batches passed to them
+    int fetchscthreads;
+    static const int FETCHSCTHREADS = 4;
+    static const int FETCHSCBATCH = 1024;
+
+    // worker threads unwrapping node keys and decrypting attributes in
+    // applykeys() (0 to do it on the client thread), used with at least
+    // APPLYKEYSBATCH nodes per thread
+    int applykeysthreads;
+    static const int APPLYKEYSTHREADS = 4;
+    static const int APPLYKEYSBATCH = 2048;
+    NodeKeyPool* keypool;
+    NodeKeyPool* nodekeypool();
+
+    // worker threads for the encryption and decryption of transfer chunks
+    // (0 to process them on the client thread), started with the first
+    // transfer
+    int cryptothreads;
+    static const int CRYPTOTHREADS = 4;
+    TransferCryptoPool* cryptopool;
+    TransferCryptoPool* transfercryptopool();
+
+#ifdef ENABLE_SYNC
+    // worker threads listing folders and fingerprinting new files for the
+    // syncs (0 to scan on the client thread), started with the first scan
+    int syncscanthreads;
+    static const int SYNCSCANTHREADS = 4;
+    SyncScanPool* scanpool;
+    SyncScanPool* syncscanpool();
+#endif
+
+    // fetch state serialize from local cache
+    bool fetchsc(DbTable*);
+
+    // keep at most this many nodes in memory once the state has been
+    // fetched from the local cache, loading the rest on demand (0 loads
+    // all nodes upfront)
+    size_t maxresidentnodes;
+
+    // nodes are loaded from the local cache on demand
+    bool lazynodes;
+
+    // resident nodes, least recently used first (only while lazynodes)
+    node_list lrunodes;
+
+    // load a node from the local cache (NULL if not cached)
+    Node* loadnode(handle);
+
+    // load all children of a node from the local cache
+    void loadchildren(Node*);
+
+    // counters of a node's subtree, including the nodes that are not in
+    // memory (summed up in the local cache while lazynodes)
+    NodeCounter subtreecounter(Node*);
+
+    // evict least recently used nodes down to maxresidentnodes
+    void unloadnodes();
+
+    // deleted nodes whose descendants may not be in memory - their cached
+    // records are deleted with the next successful cache update (only while
+    // lazynodes)
+    handle_vector deletedtrees;
+
+    // apply an owner/attribute/ctime update to the cached record of a node
+    // that is not in memory (false if the node has to be loaded instead)
+    bool updatecachednode(handle, handle, const char*, m_time_t);
+
     // purge account state and abort server-client connection
     void purgenodesusersabortsc();
 
+    // decrypt and attach a node record of the local cache
+    Node* loadnode(uint32_t, string*);
+
+    // load the cached nodes matching a fingerprint
+    void loadnodesbyfingerprint(FileFingerprint*);
+
     static const int USERHANDLE = 8;
     static const int PCRHANDLE = 8;
     static const int NODEHANDLE = 6;
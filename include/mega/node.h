@@ -95,6 +95,87 @@ struct MEGA_API PublicLink
     bool isExpired();
 };
 
+// node key unwrapping and attribute decryption done apart from the node, on
+// a worker thread (see MegaClient::applykeys())
+struct MEGA_API NodeKeyDecryption
+{
+    Node* node;
+
+    // wrapped key (base64) and the key that wraps it - or the unwrapped key
+    // if it was RSA-encrypted (unwrapped on the client thread)
+    const char* wrapped;
+    byte wrapkey[SymmCipher::KEYLENGTH];
+    byte key[FILENODEKEYLENGTH];
+    int keylength;
+    bool unwrapped;
+
+    // results: attributes are only valid if attrsdecrypted
+    bool attrsdecrypted;
+    attr_map attrs;
+
+    // unwrap the key and decrypt the attributes (thread-safe)
+    void decrypt(const FileSystemAccess*);
+};
+
+// aggregated statistics of a node subtree
+struct MEGA_API NodeCounter
+{
+    // bytes in current files and in previous versions
+    m_off_t storage;
+    m_off_t versionstorage;
+
+    long long files;
+    long long folders;
+    long long versions;
+
+    void operator+=(const NodeCounter&);
+    void operator-=(const NodeCounter&);
+    bool operator==(const NodeCounter&) const;
+
+    NodeCounter();
+};
+
+// a folder's children, sorted by one comparator
+struct MEGA_API ChildOrder
+{
+    // strict ordering on top of the comparator (which may compare a node
+    // as smaller than itself, and breaks ties between equal sort keys by
+    // node address)
+    struct Less
+    {
+        nodecomparator comparator;
+
+        bool operator()(Node* a, Node* b) const
+        {
+            return a != b && comparator(a, b);
+        }
+    };
+
+    typedef std::set<Node*, Less> node_sorted_set;
+
+    node_sorted_set nodes;
+
+    // position of each node in nodes - a node whose sort key has already
+    // changed can no longer be looked up by key
+    std::unordered_map<Node*, node_sorted_set::iterator> positions;
+
+    nodecomparator comparator() const
+    {
+        return nodes.key_comp().comparator;
+    }
+
+    void insert(Node*);
+    void erase(Node*);
+
+    // refile a node after a change of its sort key
+    void update(Node*);
+
+    // position of a node in the sort order (-1 if not included)
+    int index(Node*) const;
+
+    ChildOrder(nodecomparator);
+};
+
 // filesystem node
 struct MEGA_API Node : public NodeCore, FileFingerprint
 {
@@ -109,12 +190,24 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // try to resolve node key string
     bool applykey();
 
+    // applykey() in steps: locate the key that wraps nodekey (false if
+    // there is nothing to unwrap yet), then unwrap it and decrypt the
+    // attributes
+    bool findkey(const char**, SymmCipher**);
+    void unwrapkey(const char*, SymmCipher*);
+
     // set up nodekey in a static SymmCipher
     SymmCipher* nodecipher();
 
     // decrypt attribute string and set fileattrs
     void setattr();
 
+    // decrypt and parse an attribute string (thread-safe)
+    static bool decryptattrs(SymmCipher*, const string*, const FileSystemAccess*, attr_map*);
+
+    // update the node after its attributes were decrypted
+    void setattrcompleted();
+
     // display name (UTF-8)
     const char* displayname() const;
 
@@ -187,9 +280,65 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
     // own position in parent's children
     node_list::iterator child_it;
 
+    // number of file and folder children (for folders)
+    int numchildfiles;
+    int numchildfolders;
+
+    // counters of the subtree below and including this node
+    NodeCounter subtreecounter;
+
+    // change file size, updating the counters of all ancestors
+    void setsize(m_off_t);
+
+    // change the creation time, refiling the node among its sorted siblings
+    void setctime(m_time_t);
+
+    // recompute the subtree counters from scratch and compare (for tests)
+    bool checkcounters(NodeCounter* = NULL) const;
+
+    // children by name (only built for large folders, see MegaClient::childnameindexmin)
+    nodename_map* childnames;
+
+    // own key in parent's childnames (NULL if the parent is not indexed)
+    const string* childname;
+
+    // build childnames from the current children
+    void indexchildnames();
+
+    // refile this node in its parent's childnames after a name change
+    void updatechildname();
+
+    // children sorted by a comparator (only built for the orders requested
+    // through sortedchildren(), then kept up to date incrementally until
+    // the folder drops out of MegaClient::sortedfolders)
+    list<ChildOrder>* childorders;
+
+    // own position in MegaClient::sortedfolders (only valid with childorders)
+    node_list::iterator sortedfolders_it;
+
+    // children sorted by the comparator - sorts only on first use
+    const ChildOrder* sortedchildren(nodecomparator);
+
+    // drop the sorted children
+    void unsortchildren();
+
+    // position of a child in sortedchildren() (-1 if not a child)
+    int childindex(Node*, nodecomparator);
+
+    // refile this node in its parent's childorders after a change of name,
+    // size or modification time
+    void updatechildorders();
+
     // own position in fingerprint set (only valid for file nodes)
     fingerprint_set::iterator fingerprint_it;
 
+    // own position in the client's LRU list of resident nodes (only valid
+    // while nodes are loaded on demand, see MegaClient::maxresidentnodes)
+    node_list::iterator lru_it;
+
+    // all children have been loaded from the local cache
+    bool childrenloaded;
+
 #ifdef ENABLE_SYNC
     // related synced item or NULL
     LocalNode* localnode;
@@ -219,11 +368,59 @@ struct MEGA_API Node : public NodeCore, FileFingerprint
 
     void setpubliclink(handle, m_time_t, bool);
 
+    // the compact layout has a first byte with the node type and the
+    // sections present, and the format version as last byte (the legacy
+    // layout always ends with 0 or 1)
+    static const char COMPACTFORMAT = 2;
+    enum { COMPACT_TYPE = 7, COMPACT_PARENT = 8, COMPACT_FINGERPRINT = 16,
+           COMPACT_SHARES = 32, COMPACT_INSHARE = 64, COMPACT_PLINK = 128 };
+
     bool serialize(string*);
     static Node* unserialize(MegaClient*, string*, node_vector*);
 
+    // serialize with the given parent handle (UNDEF for none), for nodes
+    // that are not attached
+    bool serialize(string*, handle);
+
+    // previous layout, still accepted by unserialize()
+    bool serializelegacy(string*);
+
+    // read handle, parent handle and type of a serialized node in place
+    static bool peek(const string*, handle*, handle*, nodetype_t*);
+
+    // unserialize without touching the client's state (thread-safe) - the
+    // node has to be attached and shares have to be queued by the caller
+    static Node* unserialize(MegaClient*, const string*, newshare_list*);
+
+    // add to the client's nodes and set parent linkage (queued in the
+    // vector if the parent is unknown, left to the caller without vector)
+    void attach(node_vector*);
+
+    // free shares of a node that was not attached
+    static void discardshares(newshare_list*);
+
     Node(MegaClient*, vector<Node*>*, handle, handle, nodetype_t, m_off_t, handle, const char*, m_time_t);
     ~Node();
+
+private:
+    bool serializable();
+    static Node* unserializecompact(MegaClient*, const string*, newshare_list*);
+    static Node* unserializelegacy(MegaClient*, const string*, newshare_list*);
+
+    // name under which the node is filed in its parent's childnames
+    const char* childnamekey() const;
+
+    // contribution of the node itself to the counters of its ancestors
+    NodeCounter owncounter() const;
+
+    // add (or remove) the subtree counters to all ancestors
+    void addcounters(bool);
+
+    void addchildname(Node*);
+    void removechildname(Node*);
+
+    void addchildorders(Node*);
+    void removechildorders(Node*);
 };
 
 #ifdef ENABLE_SYNC
@@ -257,6 +454,11 @@ struct MEGA_API LocalNode : public File
     // FILENODE or FOLDERNODE
     nodetype_t type;
 
+    // inode change time of the file when the fingerprint was computed (0 if
+    // unknown) - with fsid, size and mtime, it vouches for the fingerprint
+    // without reading the file again
+    m_time_t ctime;
+
     // detection of deleted filesystem records
     int scanseqno;
 
@@ -279,8 +481,17 @@ struct MEGA_API LocalNode : public File
 
         // checked for missing attributes
         bool checked : 1;
+
+        // folder has changes that the next syncdown() / syncup() pass has to
+        // process (only set together with the parent's, see setdirty())
+        bool syncdowndirty : 1;
+        bool syncupdirty : 1;
     };
 
+    // flag the folder (or the parent of the file) and its ancestors for the
+    // next syncdown() and syncup() passes
+    void setdirty();
+
     // current subtree sync state: current and displayed
     treestate_t ts, dts;
 
@@ -28,6 +28,8 @@ namespace mega {
 struct PosixConsoleWaiter : public PosixWaiter
 {
     int wait();
+
+    PosixConsoleWaiter();
 };
 } // namespace
 
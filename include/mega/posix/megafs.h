@@ -38,6 +38,25 @@
 #include <aio.h>
 #endif
 
+#ifdef USE_FANOTIFY
+#ifdef USE_INOTIFY
+#include <sys/fanotify.h>
+#else
+// inotify watches are the fallback where fanotify is not permitted
+#undef USE_FANOTIFY
+#endif
+#endif
+
+#ifdef USE_IO_URING
+#ifdef HAVE_AIO_RT
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#else
+// io_uring completes PosixAsyncIOContext operations
+#undef USE_IO_URING
+#endif
+#endif
+
 #include "mega.h"
 
 #define DEBRISFOLDER ".debris"
@@ -53,15 +72,81 @@ struct MEGA_API PosixDirAccess : public DirAccess
     bool dopen(string*, FileAccess*, bool);
     bool dnext(string*, string*, bool, nodetype_t*);
 
+    // one fstatat() relative to the directory per item
+    void dlist(string*, vector<DirEntry>*, bool);
+
     PosixDirAccess();
     virtual ~PosixDirAccess();
 };
 
+#ifdef USE_IO_URING
+struct PosixAsyncIOContext;
+
+// io_uring rings shared by the async reads/writes of a PosixFileSystemAccess
+// (set up on first use - POSIX AIO is used if the kernel refuses them)
+class MEGA_API PosixIOUring
+{
+public:
+    static const unsigned ENTRIES = 64;
+
+    // ring descriptor, readable while completions are pending
+    int fd;
+
+    // add a read or write to the submission queue
+    bool queue(PosixAsyncIOContext*, int);
+
+    // start all queued operations with a single system call
+    void submit();
+
+    // complete the finished operations, returns how many there were
+    int reap();
+
+    // block until an operation has finished
+    void waitfor(PosixAsyncIOContext*);
+
+    PosixIOUring();
+    ~PosixIOUring();
+
+private:
+    bool init();
+    int enter(unsigned, unsigned, unsigned);
+
+    bool failed;
+
+    // operations in the submission queue / owned by the kernel
+    unsigned queued;
+    unsigned inflight;
+
+    void* sqring;
+    size_t sqringsize;
+    void* cqring;
+    size_t cqringsize;
+    struct io_uring_sqe* sqes;
+    size_t sqessize;
+
+    unsigned* sqhead;
+    unsigned* sqtail;
+    unsigned* sqmask;
+    unsigned* sqarray;
+    unsigned sqentries;
+
+    unsigned* cqhead;
+    unsigned* cqtail;
+    unsigned* cqmask;
+    struct io_uring_cqe* cqes;
+    unsigned cqentries;
+};
+#endif
+
 class MEGA_API PosixFileSystemAccess : public FileSystemAccess
 {
 public:
     int notifyfd;
 
+    // waiter the event descriptors are registered with (once - they are
+    // unwatched before they are closed)
+    Waiter* eventswaiter;
+
 #ifdef USE_INOTIFY
     typedef map<int, LocalNode*> wdlocalnode_map;
     wdlocalnode_map wdnodes;
@@ -72,10 +157,50 @@ public:
     string lastname;
 #endif
 
+#ifdef USE_FANOTIFY
+    // fanotify group reporting directory entry changes on whole filesystems
+    // by parent directory handle and name (-1 if not permitted - the syncs
+    // use per-folder inotify watches then)
+    int fanotifyfd;
+
+    // marked filesystems by id: descriptor to resolve directory handles
+    // against and number of syncs watching through the mark
+    struct FanotifyMount
+    {
+        int fd;
+        int syncs;
+    };
+    typedef map<fsfp_t, FanotifyMount> fsidmount_map;
+    fsidmount_map fanotifymounts;
+
+    // paths of resolved directory handles (those below a moved or deleted
+    // directory are dropped)
+    static const unsigned FANOTIFYDIRS = 4096;
+    map<string, string> fanotifydirs;
+
+    // watch the filesystem of a sync root, get the root's absolute path and
+    // the filesystem id
+    bool fanotifymark(string*, string*, fsfp_t*);
+
+    // a sync no longer watches the filesystem - the mark is removed with
+    // the last one
+    void fanotifyunmark(fsfp_t);
+
+    // forget the resolved paths at or below a path
+    void fanotifyforget(const string&);
+#endif
+
 #ifdef USE_IOS
     static char *appbasepath;
 #endif
 
+#ifdef USE_IO_URING
+    PosixIOUring uring;
+
+    // ring descriptor registered with eventswaiter (set up on first use)
+    int watchedringfd;
+#endif
+
     bool notifyerr;
     int defaultfilepermissions;
     int defaultfolderpermissions;
@@ -105,6 +230,7 @@ public:
 
     void addevents(Waiter*, int);
     int checkevents(Waiter*);
+    void processasync();
 
     void osversion(string*) const;
     void statsid(string*) const;
@@ -118,6 +244,12 @@ public:
 
     PosixFileSystemAccess(int = -1);
     ~PosixFileSystemAccess();
+
+#ifdef USE_FANOTIFY
+private:
+    int checkfanotify();
+    bool fanotifypath(const void*, struct file_handle*, string*);
+#endif
 };
 
 #ifdef HAVE_AIO_RT
@@ -128,6 +260,12 @@ struct MEGA_API PosixAsyncIOContext : public AsyncIOContext
     virtual void finish();
 
     struct aiocb *aiocb;
+
+#ifdef USE_IO_URING
+    // ring the operation was queued to
+    PosixIOUring *uring;
+    struct iovec iov;
+#endif
 };
 #endif
 
@@ -137,6 +275,11 @@ public:
     int fd;
     int defaultfilepermissions;
 
+#ifdef USE_IO_URING
+    // async reads/writes go through the io_uring of the PosixFileSystemAccess
+    PosixIOUring* uring;
+#endif
+
 #ifndef HAVE_FDOPENDIR
     DIR* dp;
 #endif
@@ -174,12 +317,20 @@ class MEGA_API PosixDirNotify : public DirNotify
 public:
     PosixFileSystemAccess* fsaccess;
 
+#ifdef USE_FANOTIFY
+    // absolute path of the sync root if its filesystem is watched through
+    // fanotify (no per-folder watches are added then)
+    string fanotifyroot;
+    fsfp_t fanotifyfsid;
+#endif
+
     void addnotify(LocalNode*, string*);
     void delnotify(LocalNode*);
 
     fsfp_t fsfingerprint();
 
     PosixDirNotify(string*, string*);
+    ~PosixDirNotify();
 };
 } // namespace
 
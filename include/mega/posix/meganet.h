@@ -60,7 +60,10 @@ protected:
     string useragent;
     CURLM* curlm[3];
 
+    // DNS cache, TLS sessions and (cURL 7.57+) connections shared by the
+    // API, GET and PUT multi handles
     CURLSH* curlsh;
+    void initcurlshare();
     ares_channel ares;
     string proxyurl;
     string proxyscheme;
@@ -78,6 +81,11 @@ protected:
     std::map<string, CurlDNSEntry> dnscache;
     int pkpErrors;
 
+    // HTTP/2 requested, and supported by cURL
+    bool http2;
+    bool curlhttp2;
+    void setmultiplexing();
+
     void send_pending_requests();
     void drop_pending_requests();
 
@@ -143,6 +151,17 @@ protected:
     void processaresevents();
     void processcurlevents(direction_t d);
     std::vector<SockInfo> aressockets;
+    void initares();
+
+#ifndef _WIN32
+    // sockets are registered with the waiter as they are opened, changed
+    // and closed (those of a direction are unregistered while its requests
+    // are paused)
+    std::map<int, SockInfo> aressocketmap;
+    bool curlsocketswatched[3];
+    void watchcurlsockets(direction_t d, bool);
+    static void ares_sockstate_callback(void*, ares_socket_t, int, int);
+#endif
     std::map<int, SockInfo> curlsockets[3];
     m_time_t curltimeoutreset[3];
     bool arerequestspaused[3];
@@ -181,6 +200,9 @@ public:
     // get max upload speed
     virtual m_off_t getmaxuploadspeed();
 
+    // use HTTP/2 with multiplexing for HTTPS requests
+    virtual bool sethttp2(bool);
+
     CurlHttpIO();
     ~CurlHttpIO();
 };
@@ -110,6 +110,10 @@
     #include <sys/inotify.h>
 #endif
 
+#ifdef USE_EPOLL
+    #include <sys/epoll.h>
+#endif
+
 #include <sys/select.h>
 
 #include <curl/curl.h>
@@ -42,8 +42,35 @@ struct PosixWaiter : public Waiter
 
     void notify();
 
+    // descriptors watched across wait() calls - registered once and updated
+    // as they change instead of being added to the fd_sets on every
+    // iteration (kept in an epoll set where available, ignored descriptors
+    // do not request exec() by themselves) - unwatch them before closing
+    enum { WATCH_READ = 1, WATCH_WRITE = 2 };
+    void watchfd(int fd, int events, bool ignore = false);
+    void unwatchfd(int fd);
+
+    // watched descriptors triggered by the last wait(), with their events
+    // (entries stay until the next wait(), even if unwatched meanwhile)
+    std::map<int, int> triggered;
+    int triggeredevents(int fd) const;
+
 protected:
     int m_pipe[2];
+
+    // watched descriptors with their events (plus WATCH_IGNORE)
+    enum { WATCH_IGNORE = 4 };
+    std::map<int, int> watched;
+
+#ifdef USE_EPOLL
+    int epollfd;
+
+    // descriptors reported by one epoll_wait() (level-triggered, so any
+    // others are reported by the next one)
+    static const int MAXEVENTS = 256;
+
+    bool epollwait(int timeoutms);
+#endif
 };
 } // namespace
 
@@ -30,6 +30,9 @@ class MEGA_API Request
 {
     vector<Command*> cmds;
 
+    // leading results already processed while the response was being received
+    int processed;
+
 public:
     void add(Command*);
 
@@ -39,7 +42,16 @@ public:
 
     void procresult(MegaClient*);
 
+    // process the results that precede a given command while the response
+    // is still being received (false if the request was cleared meanwhile)
+    bool procresults(MegaClient*, int);
+
+    // position of the first command with an incremental result (-1 if none)
+    int incrementalcmd() const;
+
     void clear();
+
+    Request();
 };
 
 class MEGA_API RequestDispatcher
@@ -68,6 +80,10 @@ public:
 
     void procresult(MegaClient*);
 
+    // in-flight request: see Request::procresults() and incrementalcmd()
+    bool procresults(MegaClient*, int);
+    int incrementalcmd() const;
+
     void clear();
 };
 
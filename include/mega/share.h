@@ -39,7 +39,7 @@ struct MEGA_API Share
     void update(accesslevel_t, m_time_t, PendingContactRequest* = NULL);
 
     void serialize(string*);
-    static bool unserialize(MegaClient *, int, handle, const byte *, const char**, const char*);
+    static bool unserialize(newshare_list*, int, handle, const byte *, const char**, const char*);
 
     Share(User*, accesslevel_t, m_time_t, PendingContactRequest* = NULL);
 };
@@ -26,6 +26,45 @@
 #include "megaclient.h"
 
 namespace mega {
+// filesystem work of a sync scan, done on a SyncScanPool thread: a folder
+// listing, or the fingerprint of a new file
+struct MEGA_API SyncScanJob
+{
+    enum { LIST, FINGERPRINT };
+
+    class Sync* sync;
+    int type;
+
+    // absolute local path of the folder or file
+    string localpath;
+
+    bool followsymlinks;
+
+    // the listing could be read / the file could be fingerprinted
+    bool success;
+
+    // LIST: the folder's items
+    vector<DirEntry> entries;
+
+    // FINGERPRINT: fingerprint (including size and mtime), fsid and the
+    // ctime that vouches for the fingerprint (see LocalNode::ctime)
+    FileFingerprint fingerprint;
+    handle fsid;
+    bool fsidvalid;
+    m_time_t ctime;
+
+    // FINGERPRINT: time the job was queued, the ctime has to be older
+    m_time_t queued;
+
+    // processed (set under the lock of the SyncScanPool)
+    bool finished;
+
+    // do the filesystem work (thread-safe)
+    void run(FileSystemAccess*);
+
+    SyncScanJob(class Sync*, int, const string&);
+};
+
 class MEGA_API Sync
 {
 public:
@@ -49,6 +88,23 @@ public:
     // are we conducting a full tree scan? (during initialization and if event notification failed)
     bool fullscan;
 
+    // start time of the last full scan, and bytes read to fingerprint files
+    // and not read thanks to the fingerprints of the state cache since then
+    dstime fullscanstart;
+    m_off_t scanbytesread, scanbytesskipped;
+
+    // reset the statistics / report them to the app
+    void startfullscan();
+    void fullscancompleted();
+
+    // the ctime of a file as far as it vouches for its current contents at
+    // the given time (0 if it is too recent to tell a later change within
+    // the same second)
+    static m_time_t settledctime(const FileAccess*, m_time_t);
+
+    // current time for settledctime() (m_time(), tests move it ahead)
+    m_time_t (*settledclock)(m_time_t*);
+
     // syncing to an inbound share?
     bool inshare;
     
@@ -79,8 +135,10 @@ public:
     // recursively look for vanished child nodes and delete them
     void deletemissing(LocalNode*);
 
-    // scan specific path
-    LocalNode* checkpath(LocalNode*, string*, string* = NULL, dstime* = NULL, bool wejustcreatedthisfolder = false);
+    // scan specific path (with its attributes from the folder listing, if
+    // available)
+    LocalNode* checkpath(LocalNode*, string*, string* = NULL, dstime* = NULL, bool wejustcreatedthisfolder = false,
+                         const DirEntry* = NULL);
 
     m_off_t localbytes;
     unsigned localnodes[2];
@@ -89,9 +147,28 @@ public:
     LocalNode* localnodebypath(LocalNode*, string*, LocalNode** = NULL, string* = NULL);
 
     // scan items in specified path and add as children of the specified
-    // LocalNode
+    // LocalNode (listed on the client's SyncScanPool once the sync has
+    // been initialized)
     bool scan(string*, FileAccess*);
 
+    // scan jobs queued to the SyncScanPool and not merged yet
+    int scanpending;
+
+    // merge finished scan jobs: queue the listed items for checkpath() and
+    // keep the fingerprints of new files for it
+    void procscanresults();
+
+    // fingerprints of new files computed on the SyncScanPool, by local path
+    map<string, SyncScanJob*> scanned;
+
+    // fingerprint a file in checkpath() - the file is not read if the
+    // LocalNode's fingerprint is still vouched for by fsid, size, mtime and
+    // ctime, or if it was fingerprinted on the SyncScanPool in the meantime
+    bool genfingerprint(LocalNode*, FileAccess*, string*);
+
+    // checkpath() had to fingerprint a file on the client thread
+    bool fingerprinted;
+
     // own position in session sync list
     sync_list::iterator sync_it;
 
@@ -140,9 +217,16 @@ public:
     static const int FILE_UPDATE_MAX_DELAY_SECS;
     static const dstime RECENT_VERSION_INTERVAL_SECS;
 
+    // notifications processed in one go while no file has to be
+    // fingerprinted on the client thread
+    static const int SCANNING_BATCH;
+
 protected :
     bool readstatecache();
 
+    // the path is the sync's debris folder or inside it
+    bool isdebris(string*);
+
 };
 } // namespace
 
@@ -27,6 +27,125 @@
 #include "backofftimer.h"
 
 namespace mega {
+// adapts the number of parallel connections and the request size of a
+// transfer to the measured throughput: every round, one of them is increased
+// and the increase is kept only if the throughput grows; errors halve both
+struct MEGA_API ThroughputController
+{
+    // minimum length of a measurement round (ds)
+    static const dstime ROUNDDS;
+
+    // requests expected to take less than this are dominated by latency,
+    // so the request size is increased before the connections (ds)
+    static const dstime TARGETREQDS;
+
+    // minimum throughput gain (in percent) to keep an increase
+    static const int MINGAIN;
+
+    // rounds without increases after a reverted increase or an error
+    static const int HOLDROUNDS;
+
+    // adaptation enabled (otherwise the configuration stays fixed)
+    bool enabled;
+
+    // current configuration
+    int connections;
+    m_off_t reqsize;
+
+    // limits
+    int maxconnections;
+    m_off_t minreqsize, maxreqsize;
+
+    // throughput of the last complete round (bytes per second)
+    m_off_t roundspeed;
+
+    // start with the given configuration
+    void init(int, int, m_off_t, m_off_t, m_off_t);
+
+    // account transferred bytes, returns true if the configuration changed
+    bool sample(m_off_t);
+
+    // a request failed or timed out, returns true if the configuration changed
+    bool failed();
+
+    ThroughputController();
+
+private:
+    enum { PROBE_NONE, PROBE_CONNECTIONS, PROBE_REQSIZE };
+
+    dstime roundstart;
+    m_off_t roundbytes;
+
+    // configuration and throughput before the increase under evaluation
+    int baseconnections;
+    m_off_t basereqsize;
+    m_off_t basespeed;
+    int probe;
+    int hold;
+
+    dstime lastfailure;
+};
+
+// storage hosts a download fetches from in parallel (see
+// MegaClient::downloadsources): new requests go to the source expected to
+// complete them first, and a request lagging on a slow source is raced on a
+// faster one once there is nothing left to request
+struct MEGA_API DownloadSources
+{
+    // failures in a row after which a source is only used if no other is left
+    static const int MAXFAILURES;
+
+    // race a request if another source is expected to complete it this many
+    // times sooner
+    static const int RACEFACTOR;
+
+    // minimum time a request runs before it is considered for racing (ds)
+    static const dstime MINRACEDS;
+
+    struct Source
+    {
+        // temp URL
+        string url;
+
+        // measured throughput of a request (bytes per second, 0 if unknown)
+        m_off_t speed;
+
+        // requests in flight
+        int requests;
+
+        // failures in a row
+        int failures;
+    };
+
+    vector<Source> sources;
+
+    // add a temp URL - false if its host is a source already
+    bool add(const string&);
+
+    // source for a new request (-1 if there is none)
+    int select() const;
+
+    // source for a copy of a request on another source, given its size,
+    // the bytes received and the elapsed time (-1 if not worth racing)
+    int race(int, m_off_t, m_off_t, dstime) const;
+
+    // expected throughput of a request to a source - sources not measured
+    // yet are assumed to be as fast as the fastest one (0 if none is known)
+    m_off_t expectedspeed(int) const;
+
+    // a request was posted, completed (after the given time), failed (for
+    // good, if the URL was rejected) or was withdrawn
+    void started(int);
+    void completed(int, m_off_t, dstime);
+    void failed(int, bool = false);
+    void withdrawn(int);
+
+    bool usable(int) const;
+
+    // host part of a URL
+    static string host(const string&);
+};
+
 // active transfer
 struct MEGA_API TransferSlot
 {
@@ -83,9 +202,36 @@ struct MEGA_API TransferSlot
     int connections;
     HttpReqXfer** reqs;
 
+    // connections in use and request size (see MegaClient::adaptivetransfers)
+    ThroughputController controller;
+
     // async IO operations
     AsyncIOContext** asyncIO;
 
+    // storage hosts of a download (empty unless several are used)
+    DownloadSources sources;
+
+    // source, start time and racing copy (connection index, -1 if none) of
+    // the request of each connection
+    struct RequestSource
+    {
+        int source;
+        int twin;
+        dstime start;
+    };
+    RequestSource* reqsources;
+
+    // command in flight to obtain the temp URL of another source, and no
+    // more sources are requested once one of them yielded a known host
+    Command* pendingsourcecmd;
+    bool sourcesexhausted;
+
+    // downloads smaller than this are not split across sources
+    static const m_off_t MIN_SOURCES_SIZE;
+
+    // add the temp URL of another source (NULL if it could not be obtained)
+    void sourceresult(const string*);
+
     // handle I/O for this slot
     void doio(MegaClient*);
 
@@ -117,6 +263,22 @@ struct MEGA_API TransferSlot
 protected:
     void toggleport(HttpReqXfer* req);
 
+    // request the temp URL of another source
+    void requestsource(MegaClient*);
+
+    // temp URL of a source with the alternative port applied if in use
+    string sourceurl(MegaClient*, int);
+
+    // start a copy of the slowest request on another source on connection i
+    bool racerequest(MegaClient*, int i);
+
+    // resolve a completed download request and its racing copy - returns
+    // false if the copy won and the request has to be dropped
+    bool resolverace(int i);
+
+    // encrypt the upload chunk of request i (asynchronously, see REQ_CRYPTO)
+    void prepareupload(int i, string* url, m_off_t pos, m_off_t npos);
+
 };
 } // namespace
 
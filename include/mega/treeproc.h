@@ -34,6 +34,9 @@ class MEGA_API TreeProc
 public:
     virtual void proc(MegaClient*, Node*) = 0;
 
+    // skip nodes that are not in memory (see MegaClient::maxresidentnodes)
+    virtual bool residentonly() { return false; }
+
     virtual ~TreeProc() { }
 };
 
@@ -41,6 +44,10 @@ class MEGA_API TreeProcDel : public TreeProc
 {
 public:
     void proc(MegaClient*, Node*);
+
+    // the cached records of the rest of the tree are deleted directly (see
+    // MegaClient::deletedtrees)
+    bool residentonly() { return true; }
 };
 
 class MEGA_API TreeProcApplyKey : public TreeProc
@@ -96,6 +103,9 @@ class MEGA_API TreeProcDelSyncGet : public TreeProc
 {
 public:
     void proc(MegaClient*, Node*);
+
+    // sync gets are only attached to resident nodes
+    bool residentonly() { return true; }
 };
 
 class MEGA_API LocalTreeProc
@@ -73,6 +73,7 @@ typedef unsigned char byte;
 #include "mega/crypto/sodium.h"
 
 #include <string>
+#include <unordered_map>
 
 namespace mega {
 
@@ -112,6 +113,7 @@ class MegaClient;
 struct NewNode;
 struct Node;
 struct NodeCore;
+struct NodeCounter;
 class PubKeyAction;
 class Request;
 struct Transfer;
@@ -122,6 +124,10 @@ struct Waiter;
 struct Proxy;
 struct PendingContactRequest;
 class TransferList;
+struct ChunkCrypto;
+class TransferCryptoPool;
+struct SyncScanJob;
+class SyncScanPool;
 struct Achievement;
 namespace UserAlert
 {
@@ -144,7 +150,7 @@ typedef uint32_t dstime;
 #define TOSTRING(x) STRINGIFY(x)
 
 // HttpReq states
-typedef enum { REQ_READY, REQ_PREPARED, REQ_INFLIGHT, REQ_SUCCESS, REQ_FAILURE, REQ_DONE, REQ_ASYNCIO } reqstatus_t;
+typedef enum { REQ_READY, REQ_PREPARED, REQ_INFLIGHT, REQ_SUCCESS, REQ_FAILURE, REQ_DONE, REQ_ASYNCIO, REQ_CRYPTO } reqstatus_t;
 
 typedef enum { USER_HANDLE, NODE_HANDLE } targettype_t;
 
@@ -298,6 +304,12 @@ typedef set<Node*> node_set;
 // FIXME: switch to forward_list once C++11 becomes more widely available
 typedef list<Node*> node_list;
 
+// maps normalized names to a folder's children (name clashes are allowed)
+typedef std::unordered_multimap<string, Node*> nodename_map;
+
+// orders a folder's children (provided by the application layer)
+typedef bool (*nodecomparator)(struct Node*, struct Node*);
+
 // undefined node handle
 const handle UNDEF = ~(handle)0;
 
@@ -316,6 +328,9 @@ typedef deque<Transfer*> transfer_list;
 // map a request tag with pending dbids of transfers and files
 typedef map<int, vector<uint32_t> > pendingdbid_map;
 
+// database records (id and content)
+typedef vector<pair<uint32_t, string> > dbrecord_vector;
+
 // map a request tag with a pending dns request
 typedef map<int, GenericHttpReq*> pendinghttp_map;
 
@@ -3921,7 +3921,8 @@ public:
         TYPE_REMOTE_FOLDER_ADDITION, TYPE_REMOTE_FOLDER_DELETION,
         TYPE_REMOTE_FILE_ADDITION, TYPE_REMOTE_FILE_DELETION,
         TYPE_REMOTE_MOVE, TYPE_REMOTE_RENAME,
-        TYPE_FILE_GET, TYPE_FILE_PUT
+        TYPE_FILE_GET, TYPE_FILE_PUT,
+        TYPE_SCAN_COMPLETED
     };
 
     virtual ~MegaSyncEvent();
@@ -3992,6 +3993,39 @@ public:
      * @return Handle of the previous parent of the remote node
      */
     virtual MegaHandle getPrevParent() const;
+
+    /**
+     * @brief Returns the duration of a full scan of the local folder, in milliseconds
+     *
+     * Full scans take place when a synchronization starts and when filesystem
+     * notifications were lost.
+     *
+     * This data is only valid when the event type is TYPE_SCAN_COMPLETED
+     *
+     * @return Duration of the scan in milliseconds
+     */
+    virtual long long getScanTime() const;
+
+    /**
+     * @brief Returns the number of bytes read to fingerprint files during a full scan
+     *
+     * This data is only valid when the event type is TYPE_SCAN_COMPLETED
+     *
+     * @return Bytes read to fingerprint files
+     */
+    virtual long long getBytesRead() const;
+
+    /**
+     * @brief Returns the number of bytes that did not have to be read during a full scan
+     *
+     * Files whose inode, size, modification time and change time match the ones
+     * stored with their fingerprint are not read again.
+     *
+     * This data is only valid when the event type is TYPE_SCAN_COMPLETED
+     *
+     * @return Bytes not read thanks to stored fingerprints
+     */
+    virtual long long getBytesSkipped() const;
 };
 
 class MegaRegExpPrivate;
@@ -8329,6 +8363,26 @@ class MegaApi
          */
         void fetchNodes(MegaRequestListener *listener = NULL);
 
+        /**
+         * @brief Limit the number of nodes kept in memory
+         *
+         * When the filesystem is loaded from the local cache with a limit set, only the root
+         * nodes and the shared or exported nodes are loaded upfront. The other nodes are read
+         * from the local cache when they are needed (lookups by handle, children listings,
+         * searches by fingerprint) and the least recently used ones are released when there
+         * are more than the limit. Updates of nodes that are not in memory are applied to the
+         * local cache directly and are not reported to MegaGlobalListener::onNodesUpdate.
+         *
+         * The limit is not strict: nodes that are being used by the SDK (transfers, syncs,
+         * shares) are kept in memory. It is disabled by default (all nodes are kept in memory).
+         *
+         * The setting applies to the next load of the filesystem from the local cache (see
+         * MegaApi::fetchNodes), so it should be set before it.
+         *
+         * @param maxNodes Maximum number of nodes to keep in memory, 0 to keep all of them
+         */
+        void setMaxResidentNodes(unsigned maxNodes);
+
         /**
          * @brief Get details about the MEGA account
          *
@@ -9739,6 +9793,60 @@ class MegaApi
          */
         int getMaxUploadSpeed();
 
+        /**
+         * @brief Enable or disable HTTP/2 for the connections of the SDK
+         *
+         * When enabled, HTTPS requests negotiate HTTP/2 with the server and parallel
+         * requests of the same kind to the same host (download chunks, upload chunks,
+         * or API commands) are sent as streams over a single connection instead of
+         * opening one connection each. Idle connections are reused by requests of any
+         * kind, with or without HTTP/2. Requests over plain HTTP and servers without
+         * HTTP/2 support keep using HTTP/1.1. It is disabled by default.
+         *
+         * Currently, this method is only available using the cURL-based network layer,
+         * and only if cURL was built with HTTP/2 support. You can check if the function
+         * will have effect by checking the return value.
+         *
+         * The setting applies to new requests. See also MegaApi::useHttpsOnly, since
+         * transfers use plain HTTP by default.
+         *
+         * @param enable true to use HTTP/2 when possible, false to always use HTTP/1.1
+         * @return true if the network layer supports the setting, otherwise false
+         */
+        bool useHttp2(bool enable);
+
+        /**
+         * @brief Enable or disable the adaptation of transfers to the network conditions
+         *
+         * When enabled, each transfer measures its throughput and adjusts the number of
+         * parallel connections (up to 6) and, for downloads, the size of the requests.
+         * Increases are kept only if they improve the throughput, and both are halved
+         * when requests fail or time out. The values set by MegaApi::setMaxConnections
+         * are used as starting point. It is disabled by default.
+         *
+         * The setting applies to transfers started after the call.
+         *
+         * @param enable true to adapt transfers to the measured throughput, false to use
+         * a fixed number of connections and request size
+         */
+        void useAdaptiveTransfers(bool enable);
+
+        /**
+         * @brief Set the maximum number of storage servers a download fetches from in parallel
+         *
+         * With more than one source, downloads of at least 8 MB request additional temporary
+         * URLs while they progress and keep the ones on a different storage server. Each
+         * chunk is requested from the server expected to deliver it first, according to the
+         * measured throughput, and when there is nothing left to request, chunks lagging on
+         * a slow server are requested again from a faster one. Servers that fail repeatedly
+         * are left aside. The default value is 1 (a single storage server per download).
+         *
+         * The setting applies to transfers started after the call.
+         *
+         * @param sources Maximum number of storage servers per download (between 1 and 6)
+         */
+        void setMaxDownloadSources(int sources);
+
         /**
          * @brief Return the current download speed
          * @return Download speed in bytes per second
@@ -10732,6 +10840,48 @@ class MegaApi
 		 */
         MegaNodeList* getChildren(MegaNode *parent, int order = 1);
 
+        /**
+         * @brief Get a page of the children of a MegaNode
+         *
+         * Returns the children at positions [offset, offset + limit) of the list that
+         * MegaApi::getChildren would return for the same order. The sorted order is
+         * maintained by the SDK for each folder, so large folders can be listed page
+         * by page without sorting all the children on every call.
+         *
+         * If the parent node doesn't exist or it isn't a folder, or the offset is past
+         * the last child, this function returns an empty list
+         *
+         * You take the ownership of the returned value
+         *
+         * @param parent Parent node
+         * @param order Order for the returned list (see MegaApi::getChildren)
+         * @param offset Position of the first child to return
+         * @param limit Maximum number of children to return (-1 to return all of them)
+         * @return List with the requested child MegaNode objects
+         */
+        MegaNodeList* getChildren(MegaNode *parent, int order, int offset, int limit);
+
+        /**
+         * @brief Get the children of a MegaNode that follow another child
+         *
+         * Cursor-based variant of MegaApi::getChildren with offset and limit: it returns
+         * up to limit children that come after the node passed in the second parameter
+         * (usually the last node of the previous page) in the requested order. Unlike
+         * offsets, the cursor is not shifted by children added or removed before it.
+         *
+         * If after is NULL, the first page is returned. If after isn't a child of the
+         * parent node, this function returns an empty list
+         *
+         * You take the ownership of the returned value
+         *
+         * @param parent Parent node
+         * @param after Child after which the page starts
+         * @param order Order for the returned list (see MegaApi::getChildren)
+         * @param limit Maximum number of children to return (-1 to return all of them)
+         * @return List with the requested child MegaNode objects
+         */
+        MegaNodeList* getChildrenAfter(MegaNode *parent, MegaNode *after, int order, int limit);
+
         /**
          * @brief Get all versions of a file
          * @param node Node to check
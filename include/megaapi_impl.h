@@ -872,12 +872,16 @@ public:
     virtual const char *getNewPath() const;
     virtual const char* getPrevName() const;
     virtual MegaHandle getPrevParent() const;
+    virtual long long getScanTime() const;
+    virtual long long getBytesRead() const;
+    virtual long long getBytesSkipped() const;
 
     void setPath(const char* path);
     void setNodeHandle(MegaHandle nodeHandle);
     void setNewPath(const char* newPath);
     void setPrevName(const char* prevName);
     void setPrevParent(MegaHandle prevParent);
+    void setScanStats(long long scanTime, long long bytesRead, long long bytesSkipped);
 
 protected:
     int type;
@@ -886,6 +890,9 @@ protected:
     const char* prevName;
     MegaHandle nodeHandle;
     MegaHandle prevParent;
+    long long scanTime;
+    long long bytesRead;
+    long long bytesSkipped;
 };
 
 class MegaRegExpPrivate
@@ -1657,33 +1664,6 @@ class PublicLinkProcessor : public TreeProcessor
         vector<Node *> nodes;
 };
 
-class SizeProcessor : public TreeProcessor
-{
-    protected:
-        long long totalBytes;
-
-    public:
-        SizeProcessor();
-        virtual bool processNode(Node* node);
-        long long getTotalBytes();
-};
-
-class TreeProcFolderInfo : public TreeProc
-{
-    public:
-        TreeProcFolderInfo();
-        virtual void proc(MegaClient*, Node*);
-        virtual ~TreeProcFolderInfo() {}
-        MegaFolderInfo *getResult();
-
-    protected:
-        int numFiles;
-        int numFolders;
-        int numVersions;
-        long long currentSize;
-        long long versionsSize;
-};
-
 //Thread safe request queue
 class RequestQueue
 {
@@ -1883,6 +1863,7 @@ class MegaApiImpl : public MegaApp
         void exportNode(MegaNode *node, int64_t expireTime, MegaRequestListener *listener = NULL);
         void disableExport(MegaNode *node, MegaRequestListener *listener = NULL);
         void fetchNodes(MegaRequestListener *listener = NULL);
+        void setMaxResidentNodes(unsigned maxNodes);
         void getPricing(MegaRequestListener *listener = NULL);
         void getPaymentId(handle productHandle, handle lastPublicHandle, MegaRequestListener *listener = NULL);
         void upgradeAccount(MegaHandle productHandle, int paymentMethod, MegaRequestListener *listener = NULL);
@@ -1956,6 +1937,9 @@ class MegaApiImpl : public MegaApp
         bool setMaxUploadSpeed(m_off_t bpslimit);
         int getMaxDownloadSpeed();
         int getMaxUploadSpeed();
+        bool useHttp2(bool enable);
+        void useAdaptiveTransfers(bool enable);
+        void setMaxDownloadSources(int sources);
         int getCurrentDownloadSpeed();
         int getCurrentUploadSpeed();
         int getCurrentSpeed(int type);
@@ -2030,6 +2014,8 @@ class MegaApiImpl : public MegaApp
 		int getNumChildFiles(MegaNode* parent);
 		int getNumChildFolders(MegaNode* parent);
         MegaNodeList* getChildren(MegaNode *parent, int order=1);
+        MegaNodeList* getChildren(MegaNode *parent, int order, int offset, int limit);
+        MegaNodeList* getChildrenAfter(MegaNode *parent, MegaNode *after, int order, int limit);
         MegaNodeList* getVersions(MegaNode *node);
         int getNumVersions(MegaNode *node);
         bool hasVersions(MegaNode *node);
@@ -2152,6 +2138,8 @@ class MegaApiImpl : public MegaApp
         void pauseActionPackets();
         void resumeActionPackets();
 
+        // NULL for ORDER_NONE and unknown orders (DefaultASC for negative ones)
+        static nodecomparator getNodeComparator(int order);
         static bool nodeComparatorDefaultASC  (Node *i, Node *j);
         static bool nodeComparatorDefaultDESC (Node *i, Node *j);
         static bool nodeComparatorSizeASC  (Node *i, Node *j);
@@ -2312,6 +2300,8 @@ protected:
 
         MegaTransferPrivate* getMegaTransferPrivate(int tag);
 
+        MegaNodeListPrivate* getChildrenWindow(Node *parent, Node *after, int order, int offset, int limit);
+
         void fireOnRequestStart(MegaRequestPrivate *request);
         void fireOnRequestFinish(MegaRequestPrivate *request, MegaError e);
         void fireOnRequestUpdate(MegaRequestPrivate *request);
@@ -2631,6 +2621,7 @@ protected:
         virtual bool sync_syncable(Sync *, const char*, string *, Node *);
         virtual bool sync_syncable(Sync *, const char*, string *);
         virtual void syncupdate_local_lockretry(bool);
+        virtual void syncupdate_scan_completed(Sync*, dstime, m_off_t, m_off_t);
 #endif
 
 protected:
@@ -25,29 +25,9 @@ namespace mega {
 // modified base64 conversion (no trailing '=' and '-_' instead of '+/')
 unsigned char Base64::to64(byte c)
 {
-    c &= 63;
- 
-    if (c < 26)
-    {
-        return c + 'A';
-    }
- 
-    if (c < 52)
-    {
-        return c - 26 + 'a';
-    }
-
-    if (c < 62)
-    {
-        return c - 52 + '0';
-    }
-
-    if (c == 62)
-    {
-        return '-';
-    }
+    static const char alphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789-_";
 
-    return '_';
+    return alphabet[c & 63];
 }
 
 unsigned char Base64::from64(byte c)
@@ -27,6 +27,7 @@ namespace mega {
 Command::Command()
 {
     persistent = false;
+    incremental = false;
     level = -1;
     canceled = false;
     result = API_OK;
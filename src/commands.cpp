@@ -309,6 +309,85 @@ void CommandAttachFA::procresult()
     client->app->putfa_result(h, type, e);
 }
 
+CommandGetFileSource::CommandGetFileSource(MegaClient* client, TransferSlot* ctslot, handle h, bool p, const char* privateauth, const char* publicauth, const char* chatauth)
+{
+    cmd("g");
+    arg(p ? "n" : "p", (byte*)&h, MegaClient::NODEHANDLE);
+    arg("g", 1);
+
+    if (client->usehttps)
+    {
+        arg("ssl", 2);
+    }
+
+    if (privateauth)
+    {
+        arg("esid", privateauth);
+    }
+
+    if (publicauth)
+    {
+        arg("en", publicauth);
+    }
+
+    if (chatauth)
+    {
+        arg("cauth", chatauth);
+    }
+
+    tslot = ctslot;
+}
+
+void CommandGetFileSource::cancel()
+{
+    Command::cancel();
+    tslot = NULL;
+}
+
+// only the temp URL is of interest, the file itself is known already
+void CommandGetFileSource::procresult()
+{
+    if (client->json.isnumeric())
+    {
+        client->json.getint();
+
+        if (tslot)
+        {
+            tslot->sourceresult(NULL);
+        }
+        return;
+    }
+
+    string url;
+
+    for (;;)
+    {
+        switch (client->json.getnameid())
+        {
+            case 'g':
+                client->json.storeobject(&url);
+                break;
+
+            case EOO:
+                if (tslot)
+                {
+                    tslot->sourceresult(!memcmp(url.c_str(), "http", 4) ? &url : NULL);
+                }
+                return;
+
+            default:
+                if (!client->json.storeobject())
+                {
+                    if (tslot)
+                    {
+                        tslot->sourceresult(NULL);
+                    }
+                    return;
+                }
+        }
+    }
+}
+
 // request upload target URL
 CommandPutFile::CommandPutFile(MegaClient* client, TransferSlot* ctslot, int ms)
 {
@@ -719,7 +798,7 @@ void CommandGetFile::procresult()
                                                 Node *n = client->nodebyhandle(ph);
                                                 if (n)
                                                 {
-                                                    n->size = s;
+                                                    n->setsize(s);
                                                     client->notifynode(n);
                                                 }
                                             }
@@ -4263,6 +4342,7 @@ CommandFetchNodes::CommandFetchNodes(MegaClient* client, bool nocache)
         arg("ca", 1);
     }
 
+    incremental = true;
     tag = client->reqtag;
 }
 
@@ -4272,7 +4352,11 @@ void CommandFetchNodes::procresult()
     WAIT_CLASS::bumpds();
     client->fnstats.timeToLastByte = Waiter::ds - client->fnstats.startTime;
 
-    client->purgenodesusersabortsc();
+    // already purged if the node records were processed while arriving
+    if (client->fnstream != MegaClient::FNSTREAM_NODES && client->fnstream != MegaClient::FNSTREAM_END)
+    {
+        client->purgenodesusersabortsc();
+    }
 
     if (client->json.isnumeric())
     {
@@ -4285,8 +4369,8 @@ void CommandFetchNodes::procresult()
         switch (client->json.getnameid())
         {
             case 'f':
-                // nodes
-                if (!client->readnodes(&client->json, 0))
+                // nodes (remainder of the records if they were streamed)
+                if (!client->readnodes(&client->json, 0, PUTNODES_APP, NULL, 0, 0, &client->fnstreamdp))
                 {
                     client->fetchingnodes = false;
                     return client->app->fetchnodes_result(API_EINTERNAL);
@@ -21,6 +21,17 @@
 
 #include "mega.h"
 
+// AES-NI kernels for ctr_crypt(), selected at runtime
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define MEGA_AESNI_TARGET __attribute__((target("aes,sse2")))
+#include <cpuid.h>
+#include <wmmintrin.h>
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#define MEGA_AESNI_TARGET
+#include <intrin.h>
+#include <wmmintrin.h>
+#endif
+
 namespace mega {
 #ifndef htobe64
 #define htobe64(x) (((uint64_t)htonl((uint32_t)((x) >> 32))) | (((uint64_t)htonl((uint32_t)x)) << 32))
@@ -28,6 +39,245 @@ namespace mega {
 
 using namespace CryptoPP;
 
+#ifdef MEGA_AESNI_TARGET
+static bool aesnisupported()
+{
+    static const bool supported = []
+    {
+#ifdef _MSC_VER
+        int info[4];
+        __cpuid(info, 1);
+        return ((info[2] >> 25) & 1) && ((info[3] >> 26) & 1);
+#else
+        unsigned a, b, c, d;
+        return __get_cpuid(1, &a, &b, &c, &d) && (c & bit_AES) && (d & bit_SSE2);
+#endif
+    }();
+
+    return supported;
+}
+
+#define AESNI_EXPAND(k, rcon) aesniexpandstep(k, _mm_aeskeygenassist_si128(k, rcon))
+
+MEGA_AESNI_TARGET static inline __m128i aesniexpandstep(__m128i k, __m128i gen)
+{
+    gen = _mm_shuffle_epi32(gen, 0xff);
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    k = _mm_xor_si128(k, _mm_slli_si128(k, 4));
+    return _mm_xor_si128(k, gen);
+}
+
+// AES-128 key schedule
+MEGA_AESNI_TARGET static void aesniexpandkey(const byte* key, byte* roundkeys)
+{
+    __m128i rk[11];
+
+    rk[0] = _mm_loadu_si128((const __m128i*)key);
+    rk[1] = AESNI_EXPAND(rk[0], 0x01);
+    rk[2] = AESNI_EXPAND(rk[1], 0x02);
+    rk[3] = AESNI_EXPAND(rk[2], 0x04);
+    rk[4] = AESNI_EXPAND(rk[3], 0x08);
+    rk[5] = AESNI_EXPAND(rk[4], 0x10);
+    rk[6] = AESNI_EXPAND(rk[5], 0x20);
+    rk[7] = AESNI_EXPAND(rk[6], 0x40);
+    rk[8] = AESNI_EXPAND(rk[7], 0x80);
+    rk[9] = AESNI_EXPAND(rk[8], 0x1b);
+    rk[10] = AESNI_EXPAND(rk[9], 0x36);
+
+    for (int i = 0; i < 11; i++)
+    {
+        _mm_storeu_si128((__m128i*)(roundkeys + i * 16), rk[i]);
+    }
+}
+
+// XOR the keystream into the data, eight counter blocks per round so that
+// the pipelined AES units stay busy
+MEGA_AESNI_TARGET static void aesnictr(const byte* roundkeys, byte* data, unsigned blocks, uint64_t nonce, uint64_t ctr)
+{
+    __m128i rk[11];
+
+    for (int i = 0; i < 11; i++)
+    {
+        rk[i] = _mm_loadu_si128((const __m128i*)(roundkeys + i * 16));
+    }
+
+    for (; blocks >= 8; blocks -= 8, data += 8 * 16, ctr += 8)
+    {
+        __m128i b[8];
+
+        for (int i = 0; i < 8; i++)
+        {
+            b[i] = _mm_xor_si128(_mm_set_epi64x((int64_t)htobe64(ctr + i), (int64_t)nonce), rk[0]);
+        }
+
+        for (int r = 1; r < 10; r++)
+        {
+            for (int i = 0; i < 8; i++)
+            {
+                b[i] = _mm_aesenc_si128(b[i], rk[r]);
+            }
+        }
+
+        for (int i = 0; i < 8; i++)
+        {
+            __m128i* p = (__m128i*)(data + i * 16);
+            _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), _mm_aesenclast_si128(b[i], rk[10])));
+        }
+    }
+
+    for (; blocks; blocks--, data += 16, ctr++)
+    {
+        __m128i b = _mm_xor_si128(_mm_set_epi64x((int64_t)htobe64(ctr), (int64_t)nonce), rk[0]);
+
+        for (int r = 1; r < 10; r++)
+        {
+            b = _mm_aesenc_si128(b, rk[r]);
+        }
+
+        __m128i* p = (__m128i*)data;
+        _mm_storeu_si128(p, _mm_xor_si128(_mm_loadu_si128(p), _mm_aesenclast_si128(b, rk[10])));
+    }
+}
+
+// N MAC chains advanced together (the lane count is a template parameter so
+// that the chains are kept in registers)
+template<int N>
+MEGA_AESNI_TARGET static inline void aesnimacsteps(const __m128i* rk, __m128i* mac, const byte* const* data, unsigned steps)
+{
+    __m128i m[N];
+
+    for (int i = 0; i < N; i++)
+    {
+        m[i] = mac[i];
+    }
+
+    for (unsigned s = 0; s < steps; s++)
+    {
+        for (int i = 0; i < N; i++)
+        {
+            m[i] = _mm_xor_si128(_mm_xor_si128(m[i], _mm_loadu_si128((const __m128i*)(data[i] + s * 16))), rk[0]);
+        }
+
+        for (int r = 1; r < 10; r++)
+        {
+            for (int i = 0; i < N; i++)
+            {
+                m[i] = _mm_aesenc_si128(m[i], rk[r]);
+            }
+        }
+
+        for (int i = 0; i < N; i++)
+        {
+            m[i] = _mm_aesenclast_si128(m[i], rk[10]);
+        }
+    }
+
+    for (int i = 0; i < N; i++)
+    {
+        mac[i] = m[i];
+    }
+}
+
+// CBC-MAC of up to eight chunks in lockstep: each chunk's MAC is a serial
+// chain, but the chains of different chunks are independent
+MEGA_AESNI_TARGET static void aesnicbcmac(const byte* roundkeys, SymmCipher::CtrChunk* chunks, unsigned n, bool encrypt)
+{
+    __m128i rk[11];
+    __m128i mac[8];
+    const byte* data[8];
+    unsigned blocks[8];
+
+    for (int i = 0; i < 11; i++)
+    {
+        rk[i] = _mm_loadu_si128((const __m128i*)(roundkeys + i * 16));
+    }
+
+    // plaintext to encrypt is NUL-padded, decrypted plaintext is not
+    for (unsigned i = 0; i < n; i++)
+    {
+        mac[i] = _mm_loadu_si128((const __m128i*)chunks[i].mac);
+        data[i] = chunks[i].data;
+        blocks[i] = encrypt ? (chunks[i].len + 15) / 16 : chunks[i].len / 16;
+    }
+
+    for (;;)
+    {
+        unsigned lanes[8];
+        unsigned active = 0;
+        unsigned steps = 0;
+
+        for (unsigned i = 0; i < n; i++)
+        {
+            if (blocks[i])
+            {
+                steps = (!active || blocks[i] < steps) ? blocks[i] : steps;
+                lanes[active++] = i;
+            }
+        }
+
+        if (!active)
+        {
+            break;
+        }
+
+        __m128i m[8];
+        const byte* d[8];
+
+        for (unsigned i = 0; i < active; i++)
+        {
+            m[i] = mac[lanes[i]];
+            d[i] = data[lanes[i]];
+        }
+
+        switch (active)
+        {
+            case 1: aesnimacsteps<1>(rk, m, d, steps); break;
+            case 2: aesnimacsteps<2>(rk, m, d, steps); break;
+            case 3: aesnimacsteps<3>(rk, m, d, steps); break;
+            case 4: aesnimacsteps<4>(rk, m, d, steps); break;
+            case 5: aesnimacsteps<5>(rk, m, d, steps); break;
+            case 6: aesnimacsteps<6>(rk, m, d, steps); break;
+            case 7: aesnimacsteps<7>(rk, m, d, steps); break;
+            default: aesnimacsteps<8>(rk, m, d, steps); break;
+        }
+
+        for (unsigned i = 0; i < active; i++)
+        {
+            mac[lanes[i]] = m[i];
+            data[lanes[i]] += steps * 16;
+            blocks[lanes[i]] -= steps;
+        }
+    }
+
+    for (unsigned i = 0; i < n; i++)
+    {
+        unsigned tail = encrypt ? 0 : chunks[i].len % 16;
+
+        if (tail)
+        {
+            byte last[16] = { 0 };
+            memcpy(last, data[i], tail);
+
+            mac[i] = _mm_xor_si128(_mm_xor_si128(mac[i], _mm_loadu_si128((const __m128i*)last)), rk[0]);
+
+            for (int r = 1; r < 10; r++)
+            {
+                mac[i] = _mm_aesenc_si128(mac[i], rk[r]);
+            }
+
+            mac[i] = _mm_aesenclast_si128(mac[i], rk[10]);
+        }
+
+        _mm_storeu_si128((__m128i*)chunks[i].mac, mac[i]);
+    }
+}
+
+bool SymmCipher::aesni = aesnisupported();
+#else
+bool SymmCipher::aesni = false;
+#endif
+
 // cryptographically strong random byte sequence
 void PrnGen::genblock(byte* buf, int len)
 {
@@ -74,6 +324,13 @@ void SymmCipher::setkey(const byte* newkey, int type)
 
     aesgcm_e.SetKeyWithIV(key, KEYLENGTH, zeroiv);
     aesgcm_d.SetKeyWithIV(key, KEYLENGTH, zeroiv);
+
+#ifdef MEGA_AESNI_TARGET
+    if (aesnisupported())
+    {
+        aesniexpandkey(key, roundkeys);
+    }
+#endif
 }
 
 bool SymmCipher::setkey(const string* key)
@@ -264,56 +521,152 @@ SymmCipher& SymmCipher::operator=(const SymmCipher& ref)
 // len must be < 2^31
 void SymmCipher::ctr_crypt(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv, byte* mac, bool encrypt, bool initmac)
 {
-    assert(!(pos & (KEYLENGTH - 1)));
+    CtrChunk chunk = { data, len, pos, mac, initmac };
 
-    byte ctr[BLOCKSIZE], tmp[BLOCKSIZE];
+    ctr_crypt(&chunk, 1, ctriv, encrypt);
+}
 
-    MemAccess::set<int64_t>(ctr,ctriv);
-    setint64(pos / BLOCKSIZE, ctr + sizeof ctriv);
+// the MACs are computed on the plaintext: before encrypting, after decrypting
+void SymmCipher::ctr_crypt(CtrChunk* chunks, unsigned numchunks, ctr_iv ctriv, bool encrypt)
+{
+    bool macs = false;
 
-    if (mac && initmac)
+    for (unsigned i = 0; i < numchunks; i++)
     {
-        memcpy(mac, ctr, sizeof ctriv);
-        memcpy(mac + sizeof ctriv, ctr, sizeof ctriv);
-    }
+        assert(!(chunks[i].pos & (KEYLENGTH - 1)));
 
-    while ((int)len > 0)
-    {
-        if (encrypt)
+        if (chunks[i].mac)
         {
-            if(mac)
+            if (chunks[i].initmac)
             {
-                xorblock(data, mac);
-                ecb_encrypt(mac);
+                MemAccess::set<int64_t>(chunks[i].mac, ctriv);
+                MemAccess::set<int64_t>(chunks[i].mac + sizeof ctriv, ctriv);
             }
 
-            ecb_encrypt(ctr, tmp);
-            xorblock(tmp, data);
+            macs = true;
         }
-        else
+    }
+
+    if (!encrypt)
+    {
+        for (unsigned i = 0; i < numchunks; i++)
         {
-            ecb_encrypt(ctr, tmp);
-            xorblock(tmp, data);
+            ctr_keystream(chunks[i].data, chunks[i].len, chunks[i].pos, ctriv);
+        }
+    }
+
+    if (macs)
+    {
+        cbc_mac(chunks, numchunks, encrypt);
+    }
 
-            if (mac)
+    if (encrypt)
+    {
+        for (unsigned i = 0; i < numchunks; i++)
+        {
+            ctr_keystream(chunks[i].data, chunks[i].len, chunks[i].pos, ctriv);
+        }
+    }
+}
+
+// XOR the keystream into all blocks of the data
+void SymmCipher::ctr_keystream(byte* data, unsigned len, m_off_t pos, ctr_iv ctriv)
+{
+    unsigned blocks = (len + BLOCKSIZE - 1) / BLOCKSIZE;
+
+#ifdef MEGA_AESNI_TARGET
+    if (aesni && aesnisupported())
+    {
+        aesnictr(roundkeys, data, blocks, ctriv, pos / BLOCKSIZE);
+        return;
+    }
+#endif
+
+    // portable: encrypt batches of counter blocks in a single call
+    const unsigned BATCH = 64;
+    byte ctrs[BATCH * BLOCKSIZE];
+    uint64_t ctr = pos / BLOCKSIZE;
+
+    while (blocks)
+    {
+        unsigned n = blocks < BATCH ? blocks : BATCH;
+
+        for (unsigned i = 0; i < n; i++)
+        {
+            MemAccess::set<int64_t>(ctrs + i * BLOCKSIZE, ctriv);
+            setint64(ctr++, ctrs + i * BLOCKSIZE + sizeof ctriv);
+        }
+
+        ecb_encrypt(ctrs, NULL, n * BLOCKSIZE);
+
+        for (unsigned i = 0; i < n; i++)
+        {
+            xorblock(ctrs + i * BLOCKSIZE, data);
+            data += BLOCKSIZE;
+        }
+
+        blocks -= n;
+    }
+}
+
+void SymmCipher::cbc_mac(CtrChunk* chunks, unsigned numchunks, bool encrypt)
+{
+#ifdef MEGA_AESNI_TARGET
+    if (aesni && aesnisupported())
+    {
+        CtrChunk lanes[8];
+        unsigned n = 0;
+
+        for (unsigned i = 0; i < numchunks; i++)
+        {
+            if (chunks[i].mac)
             {
-                if (len >= (unsigned)BLOCKSIZE)
-                {
-                    xorblock(data, mac);
-                }
-                else
+                lanes[n++] = chunks[i];
+
+                if (n == 8)
                 {
-                    xorblock(data, mac, len);
+                    aesnicbcmac(roundkeys, lanes, n, encrypt);
+                    n = 0;
                 }
-
-                ecb_encrypt(mac);
             }
         }
 
-        len -= BLOCKSIZE;
-        data += BLOCKSIZE;
+        if (n)
+        {
+            aesnicbcmac(roundkeys, lanes, n, encrypt);
+        }
+
+        return;
+    }
+#endif
+
+    for (unsigned i = 0; i < numchunks; i++)
+    {
+        byte* data = chunks[i].data;
+        byte* mac = chunks[i].mac;
+        unsigned len = chunks[i].len;
+
+        if (!mac)
+        {
+            continue;
+        }
+
+        while ((int)len > 0)
+        {
+            if (encrypt || len >= (unsigned)BLOCKSIZE)
+            {
+                xorblock(data, mac);
+            }
+            else
+            {
+                xorblock(data, mac, len);
+            }
 
-        incblock(ctr);
+            ecb_encrypt(mac);
+
+            len -= BLOCKSIZE;
+            data += BLOCKSIZE;
+        }
     }
 }
 
@@ -22,12 +22,25 @@
 #include "mega/db.h"
 #include "mega/utils.h"
 #include "mega/logging.h"
+#include "mega/node.h"
 
 namespace mega {
+NodeColumns::NodeColumns(const Node* node)
+{
+    nodehandle = node->nodehandle;
+    parenthandle = node->parent ? node->parent->nodehandle : UNDEF;
+    type = node->type;
+    size = node->size;
+    mtime = node->mtime;
+    memcpy(crc, node->crc, sizeof crc);
+    shared = node->inshare || node->outshares || node->pendingshares || node->plink;
+}
+
 DbTable::DbTable(PrnGen &rng)
     : rng(rng)
 {
     nextid = 0;
+    legacynodes = false;
 }
 
 // add or update record from string
@@ -36,27 +49,155 @@ bool DbTable::put(uint32_t index, string* data)
     return put(index, (char*)data->data(), unsigned(data->size()));
 }
 
+// serialize record with padding and encryption
+bool DbTable::encode(uint32_t type, Cachable* record, SymmCipher* key, string* data)
+{
+    if (!record->serialize(data))
+    {
+        LOG_warn << "Serialization failed: " << type;
+        return false;
+    }
+
+    PaddedCBC::encrypt(rng, data, key);
+
+    if (!record->dbid)
+    {
+        record->dbid = (nextid += IDSPACING) | type;
+    }
+
+    return true;
+}
+
 // add or update record with padding and encryption
 bool DbTable::put(uint32_t type, Cachable* record, SymmCipher* key)
 {
     string data;
 
-    if (!record->serialize(&data))
+    if (!encode(type, record, key, &data))
     {
         //Don't return false if there are errors in the serialization
         //to let the SDK continue and save the rest of records
-        LOG_warn << "Serialization failed: " << type;
         return true;
     }
 
-    PaddedCBC::encrypt(rng, &data, key);
+    return put(record->dbid, &data);
+}
 
-    if (!record->dbid)
+// add or update node record with padding and encryption
+bool DbTable::putnode(uint32_t type, Node* node, SymmCipher* key)
+{
+    string data;
+
+    if (!encode(type, node, key, &data))
     {
-        record->dbid = (nextid += IDSPACING) | type;
+        return true;
     }
 
-    return put(record->dbid, &data);
+    NodeColumns columns(node);
+    return putnode(node->dbid, &columns, &data);
+}
+
+bool DbTable::putrecords(dbrecord_vector* records)
+{
+    for (dbrecord_vector::iterator it = records->begin(); it != records->end(); it++)
+    {
+        if (!put(it->first, &it->second))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool DbTable::delrecords(vector<uint32_t>* indexes)
+{
+    for (vector<uint32_t>::iterator it = indexes->begin(); it != indexes->end(); it++)
+    {
+        if (!del(*it))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool DbTable::putnoderecords(vector<NodeColumns>* columns, dbrecord_vector* records)
+{
+    for (size_t i = 0; i < records->size(); i++)
+    {
+        if (!putnode((*records)[i].first, &(*columns)[i], &(*records)[i].second))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool DbTable::delnoderecords(vector<uint32_t>* indexes)
+{
+    for (vector<uint32_t>::iterator it = indexes->begin(); it != indexes->end(); it++)
+    {
+        if (!delnode(*it))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// without node table, nodes are regular records
+bool DbTable::putnode(uint32_t index, NodeColumns*, string* data)
+{
+    return put(index, data);
+}
+
+bool DbTable::delnode(uint32_t index)
+{
+    return del(index);
+}
+
+bool DbTable::rewindrecords()
+{
+    return false;
+}
+
+bool DbTable::delnodetrees(handle_vector*)
+{
+    return false;
+}
+
+bool DbTable::getsubtreecounter(handle, NodeCounter*)
+{
+    return false;
+}
+
+bool DbTable::getnode(handle, uint32_t*, string*)
+{
+    return false;
+}
+
+bool DbTable::getchildren(handle, dbrecord_vector*)
+{
+    return false;
+}
+
+bool DbTable::getnodesbyfingerprint(FileFingerprint*, dbrecord_vector*)
+{
+    return false;
+}
+
+bool DbTable::getsharednodes(dbrecord_vector*)
+{
+    return false;
+}
+
+void DbTable::nodesmigrated()
+{
+    legacynodes = false;
 }
 
 // get next record, decrypt and unpad
@@ -69,17 +210,28 @@ bool DbTable::next(uint32_t* type, string* data, SymmCipher* key)
             return true;
         }
 
-        if (*type > nextid)
-        {
-            nextid = *type & - IDSPACING;
-        }
+        reserveid(*type);
 
-        return PaddedCBC::decrypt(data, key);
+        return !key || PaddedCBC::decrypt(data, key);
     }
 
     return false;
 }
 
+void DbTable::reserveid(uint32_t index)
+{
+    if (index > nextid)
+    {
+        nextid = index & - IDSPACING;
+    }
+}
+
+// decrypt and unpad a record obtained from next() without key
+bool DbTable::decrypt(uint32_t type, string* data, SymmCipher* key)
+{
+    return !type || PaddedCBC::decrypt(data, key);
+}
+
 DbAccess::DbAccess()
 {
     currentDbVersion = LEGACY_DB_VERSION;
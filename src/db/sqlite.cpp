@@ -54,6 +54,13 @@ DbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess* fsaccess, string* n
     newoss << "_" << *name << ".db";
     string currentdbpath = newoss.str();
 
+    ostringstream previousoss;
+    previousoss << dbpath;
+    previousoss << "megaclient_statecache";
+    previousoss << PREVIOUS_DB_VERSION;
+    previousoss << "_" << *name << ".db";
+    string previousdbpath = previousoss.str();
+
     string locallegacydbpath;
     FileAccess *fa = fsaccess->newfileaccess();
     fsaccess->path2local(&legacydbpath, &locallegacydbpath);
@@ -77,23 +84,8 @@ DbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess* fsaccess, string* n
             else
             {
                 LOG_debug << "Trying to recycle a legacy DB";
-                string localcurrentdbpath;
-                fsaccess->path2local(&currentdbpath, &localcurrentdbpath);
-                if (fsaccess->renamelocal(&locallegacydbpath, &localcurrentdbpath, false))
+                if (renamedb(fsaccess, &legacydbpath, &currentdbpath))
                 {
-                    string suffix = "-shm";
-                    string localsuffix;
-                    fsaccess->path2local(&suffix, &localsuffix);
-
-                    string oldfile = locallegacydbpath + localsuffix;
-                    string newfile = localcurrentdbpath + localsuffix;
-                    fsaccess->renamelocal(&oldfile, &newfile, true);
-
-                    suffix = "-wal";
-                    fsaccess->path2local(&suffix, &localsuffix);
-                    oldfile = locallegacydbpath + localsuffix;
-                    newfile = localcurrentdbpath + localsuffix;
-                    fsaccess->renamelocal(&oldfile, &newfile, true);
                     LOG_debug << "Legacy DB recycled";
                 }
                 else
@@ -107,6 +99,18 @@ DbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess* fsaccess, string* n
 
     if (!dbfile.size())
     {
+        // the previous version only lacks the node table: upgrade in place
+        string localcurrentdbpath;
+        fsaccess->path2local(&currentdbpath, &localcurrentdbpath);
+        fa = fsaccess->newfileaccess();
+        bool currentdbavailable = fa->fopen(&localcurrentdbpath);
+        delete fa;
+
+        if (!currentdbavailable && renamedb(fsaccess, &previousdbpath, &currentdbpath))
+        {
+            LOG_debug << "Previous DB version upgraded";
+        }
+
         LOG_debug << "Using an upgraded DB";
         dbfile = currentdbpath;
         currentDbVersion = DB_VERSION;
@@ -134,16 +138,108 @@ DbTable* SqliteDbAccess::open(PrnGen &rng, FileSystemAccess* fsaccess, string* n
         return NULL;
     }
 
-    return new SqliteDbTable(rng, db, fsaccess, &dbfile);
+    // legacy databases keep all records in statecache
+    bool nodetable = currentDbVersion == DB_VERSION;
+    bool legacynodes = false;
+
+    if (nodetable)
+    {
+        // node records, with plain handles, size and fingerprint for
+        // lookups from disk
+        sql = "CREATE TABLE IF NOT EXISTS nodes (id INTEGER PRIMARY KEY ASC NOT NULL, nodehandle INTEGER NOT NULL, "
+              "parenthandle INTEGER, type INTEGER NOT NULL, size INTEGER, mtime INTEGER, fingerprint BLOB, shared INTEGER NOT NULL, "
+              "content BLOB NOT NULL);"
+              "CREATE INDEX IF NOT EXISTS nodes_nodehandle ON nodes (nodehandle);"
+              "CREATE INDEX IF NOT EXISTS nodes_parenthandle ON nodes (parenthandle);"
+              "CREATE INDEX IF NOT EXISTS nodes_fingerprint ON nodes (size, mtime, fingerprint);"
+              "CREATE INDEX IF NOT EXISTS nodes_shared ON nodes (shared) WHERE shared";
+
+        rc = sqlite3_exec(db, sql, NULL, NULL, NULL);
+
+        if (rc)
+        {
+            sqlite3_close(db);
+            return NULL;
+        }
+
+        // databases of the previous version have user_version 0 and their
+        // nodes in statecache until the client moves them
+        sqlite3_stmt *stmt;
+        int userversion = 0;
+        if (sqlite3_prepare(db, "PRAGMA user_version", -1, &stmt, NULL) == SQLITE_OK)
+        {
+            if (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                userversion = sqlite3_column_int(stmt, 0);
+            }
+        }
+        sqlite3_finalize(stmt);
+
+        if (userversion < DB_VERSION)
+        {
+            bool empty = true;
+            if (sqlite3_prepare(db, "SELECT id FROM statecache LIMIT 1", -1, &stmt, NULL) == SQLITE_OK)
+            {
+                empty = sqlite3_step(stmt) != SQLITE_ROW;
+            }
+            sqlite3_finalize(stmt);
+
+            if (empty)
+            {
+                ostringstream oss;
+                oss << "PRAGMA user_version = " << DB_VERSION;
+                sqlite3_exec(db, oss.str().c_str(), NULL, NULL, NULL);
+            }
+            else
+            {
+                LOG_debug << "DB with nodes in the previous layout";
+                legacynodes = true;
+            }
+        }
+    }
+
+    SqliteDbTable* table = new SqliteDbTable(rng, db, fsaccess, &dbfile, nodetable);
+    table->legacynodes = legacynodes;
+    return table;
 }
 
-SqliteDbTable::SqliteDbTable(PrnGen &rng, sqlite3* cdb, FileSystemAccess *fs, string *filepath)
+bool SqliteDbAccess::renamedb(FileSystemAccess* fsaccess, string* from, string* to)
+{
+    string localfrom, localto;
+    fsaccess->path2local(from, &localfrom);
+    fsaccess->path2local(to, &localto);
+
+    if (!fsaccess->renamelocal(&localfrom, &localto, false))
+    {
+        return false;
+    }
+
+    string suffix = "-shm";
+    string localsuffix;
+    fsaccess->path2local(&suffix, &localsuffix);
+
+    string oldfile = localfrom + localsuffix;
+    string newfile = localto + localsuffix;
+    fsaccess->renamelocal(&oldfile, &newfile, true);
+
+    suffix = "-wal";
+    fsaccess->path2local(&suffix, &localsuffix);
+    oldfile = localfrom + localsuffix;
+    newfile = localto + localsuffix;
+    fsaccess->renamelocal(&oldfile, &newfile, true);
+
+    return true;
+}
+
+SqliteDbTable::SqliteDbTable(PrnGen &rng, sqlite3* cdb, FileSystemAccess *fs, string *filepath, bool cnodetable)
     : DbTable(rng)
 {
     db = cdb;
     pStmt = NULL;
+    memset(stmts, 0, sizeof stmts);
     fsaccess = fs;
     dbfile = *filepath;
+    nodetable = cnodetable;
 }
 
 SqliteDbTable::~SqliteDbTable()
@@ -157,6 +253,7 @@ SqliteDbTable::~SqliteDbTable()
     {
         sqlite3_finalize(pStmt);
     }
+    finalizestatements();
     abort();
     sqlite3_close(db);
     LOG_debug << "Database closed " << dbfile;
@@ -174,12 +271,48 @@ void SqliteDbTable::rewind()
     {
         sqlite3_reset(pStmt);
     }
+    else if (nodetable)
+    {
+        sqlite3_prepare(db, "SELECT id, content FROM statecache UNION ALL SELECT id, content FROM nodes", -1, &pStmt, NULL);
+    }
     else
     {
         sqlite3_prepare(db, "SELECT id, content FROM statecache", -1, &pStmt, NULL);
     }
 }
 
+// set cursor to first record, skipping the nodes table
+bool SqliteDbTable::rewindrecords()
+{
+    if (!db || !nodetable || legacynodes)
+    {
+        return false;
+    }
+
+    if (pStmt)
+    {
+        sqlite3_finalize(pStmt);
+        pStmt = NULL;
+    }
+
+    // the skipped node records must not be overwritten by new records
+    sqlite3_stmt *stmt;
+    bool result = false;
+
+    if (sqlite3_prepare(db, "SELECT MAX(id) FROM nodes", -1, &stmt, NULL) == SQLITE_OK)
+    {
+        if (sqlite3_step(stmt) == SQLITE_ROW)
+        {
+            reserveid(sqlite3_column_int(stmt, 0));
+            result = true;
+        }
+    }
+
+    sqlite3_finalize(stmt);
+
+    return result && sqlite3_prepare(db, "SELECT id, content FROM statecache", -1, &pStmt, NULL) == SQLITE_OK;
+}
+
 // retrieve next record through cursor
 bool SqliteDbTable::next(uint32_t* index, string* data)
 {
@@ -209,6 +342,56 @@ bool SqliteDbTable::next(uint32_t* index, string* data)
     return true;
 }
 
+// cached prepared statement, with the bindings of its last use cleared
+sqlite3_stmt* SqliteDbTable::statement(int id, const char* sql)
+{
+    if (stmts[id])
+    {
+        sqlite3_clear_bindings(stmts[id]);
+    }
+    else if (sqlite3_prepare(db, sql, -1, &stmts[id], NULL) != SQLITE_OK)
+    {
+        sqlite3_finalize(stmts[id]);
+        stmts[id] = NULL;
+    }
+
+    return stmts[id];
+}
+
+// cached statement with a list of rows or values, e.g. multi-row inserts
+sqlite3_stmt* SqliteDbTable::statement(int id, const char* head, const char* row, int rows, const char* tail)
+{
+    if (stmts[id])
+    {
+        return statement(id, NULL);
+    }
+
+    string sql = head;
+
+    for (int i = 0; i < rows; i++)
+    {
+        if (i)
+        {
+            sql.append(", ");
+        }
+
+        sql.append(row);
+    }
+
+    sql.append(tail);
+
+    return statement(id, sql.c_str());
+}
+
+void SqliteDbTable::finalizestatements()
+{
+    for (int i = 0; i < NUMSTATEMENTS; i++)
+    {
+        sqlite3_finalize(stmts[i]);
+        stmts[i] = NULL;
+    }
+}
+
 // retrieve record by index
 bool SqliteDbTable::get(uint32_t index, string* data)
 {
@@ -217,10 +400,10 @@ bool SqliteDbTable::get(uint32_t index, string* data)
         return false;
     }
 
-    sqlite3_stmt *stmt;
+    sqlite3_stmt *stmt = statement(STMT_GET, "SELECT content FROM statecache WHERE id = ?");
     bool result = false;
 
-    if (sqlite3_prepare(db, "SELECT content FROM statecache WHERE id = ?", -1, &stmt, NULL) == SQLITE_OK)
+    if (stmt)
     {
         if (sqlite3_bind_int(stmt, 1, index) == SQLITE_OK)
         {
@@ -231,9 +414,10 @@ bool SqliteDbTable::get(uint32_t index, string* data)
                 result = true;
             }
         }
+
+        sqlite3_reset(stmt);
     }
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
@@ -245,10 +429,10 @@ bool SqliteDbTable::put(uint32_t index, char* data, unsigned len)
         return false;
     }
 
-    sqlite3_stmt *stmt;
+    sqlite3_stmt *stmt = statement(STMT_PUT, "INSERT OR REPLACE INTO statecache (id, content) VALUES (?, ?)");
     bool result = false;
 
-    if (sqlite3_prepare(db, "INSERT OR REPLACE INTO statecache (id, content) VALUES (?, ?)", -1, &stmt, NULL) == SQLITE_OK)
+    if (stmt)
     {
         if (sqlite3_bind_int(stmt, 1, index) == SQLITE_OK)
         {
@@ -260,25 +444,430 @@ bool SqliteDbTable::put(uint32_t index, char* data, unsigned len)
                 }
             }
         }
+
+        sqlite3_reset(stmt);
     }
 
-    sqlite3_finalize(stmt);
     return result;
 }
 
 // delete record by index
 bool SqliteDbTable::del(uint32_t index)
+{
+    vector<uint32_t> indexes(1, index);
+
+    return delrecords(&indexes);
+}
+
+// add/update records, BATCHROWS per statement
+bool SqliteDbTable::putrecords(dbrecord_vector* records)
+{
+    if (!db)
+    {
+        return false;
+    }
+
+    size_t i = 0;
+
+    while (records->size() - i >= size_t(BATCHROWS))
+    {
+        sqlite3_stmt *stmt = statement(STMT_PUTBATCH, "INSERT OR REPLACE INTO statecache (id, content) VALUES ", "(?, ?)", BATCHROWS);
+        int rc = stmt ? SQLITE_OK : SQLITE_ERROR;
+
+        for (int j = 0; rc == SQLITE_OK && j < BATCHROWS; j++, i++)
+        {
+            string* data = &(*records)[i].second;
+
+            rc = sqlite3_bind_int(stmt, 2 * j + 1, (*records)[i].first);
+            rc = rc ? rc : sqlite3_bind_blob(stmt, 2 * j + 2, data->data(), int(data->size()), SQLITE_STATIC);
+        }
+
+        rc = rc ? rc : sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+
+        if (rc != SQLITE_DONE)
+        {
+            return false;
+        }
+    }
+
+    for (; i < records->size(); i++)
+    {
+        if (!DbTable::put((*records)[i].first, &(*records)[i].second))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// delete records, BATCHROWS per statement
+bool SqliteDbTable::delrecords(vector<uint32_t>* indexes)
+{
+    return db && delfrom("statecache", STMT_DEL, STMT_DELBATCH, indexes);
+}
+
+bool SqliteDbTable::delfrom(const char* table, int single, int batch, vector<uint32_t>* indexes)
+{
+    string head = string("DELETE FROM ") + table + " WHERE id IN (";
+
+    for (size_t i = 0; i < indexes->size(); )
+    {
+        int rows = indexes->size() - i >= size_t(BATCHROWS) ? BATCHROWS : 1;
+        sqlite3_stmt *stmt = statement(rows > 1 ? batch : single, head.c_str(), "?", rows, ")");
+        int rc = stmt ? SQLITE_OK : SQLITE_ERROR;
+
+        for (int j = 0; rc == SQLITE_OK && j < rows; j++, i++)
+        {
+            rc = sqlite3_bind_int(stmt, j + 1, (*indexes)[i]);
+        }
+
+        rc = rc ? rc : sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+
+        if (rc != SQLITE_DONE)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// bind the columns of a node record, starting at the given parameter
+int SqliteDbTable::bindnode(sqlite3_stmt* stmt, int param, uint32_t index, NodeColumns* node, string* data)
+{
+    int rc = sqlite3_bind_int(stmt, param, index);
+    rc = rc ? rc : sqlite3_bind_int64(stmt, param + 1, node->nodehandle);
+    rc = rc ? rc : (!ISUNDEF(node->parenthandle) ? sqlite3_bind_int64(stmt, param + 2, node->parenthandle) : sqlite3_bind_null(stmt, param + 2));
+    rc = rc ? rc : sqlite3_bind_int(stmt, param + 3, node->type);
+
+    if (node->type == FILENODE)
+    {
+        rc = rc ? rc : sqlite3_bind_int64(stmt, param + 4, node->size);
+        rc = rc ? rc : sqlite3_bind_int64(stmt, param + 5, node->mtime);
+        rc = rc ? rc : sqlite3_bind_blob(stmt, param + 6, node->crc, sizeof node->crc, SQLITE_STATIC);
+    }
+
+    rc = rc ? rc : sqlite3_bind_int(stmt, param + 7, node->shared);
+    rc = rc ? rc : sqlite3_bind_blob(stmt, param + 8, data->data(), int(data->size()), SQLITE_STATIC);
+
+    return rc;
+}
+
+static const char* const PUTNODESQL = "INSERT OR REPLACE INTO nodes (id, nodehandle, parenthandle, type, size, mtime, fingerprint, shared, content) VALUES ";
+static const char* const PUTNODEROW = "(?, ?, ?, ?, ?, ?, ?, ?, ?)";
+static const int PUTNODECOLUMNS = 9;
+
+// add/update node record by index
+bool SqliteDbTable::putnode(uint32_t index, NodeColumns* node, string* data)
+{
+    if (!db)
+    {
+        return false;
+    }
+
+    if (!nodetable)
+    {
+        return DbTable::putnode(index, node, data);
+    }
+
+    sqlite3_stmt *stmt = statement(STMT_PUTNODE, PUTNODESQL, PUTNODEROW, 1);
+    bool result = false;
+
+    if (stmt)
+    {
+        if (bindnode(stmt, 1, index, node, data) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_DONE)
+        {
+            result = true;
+        }
+
+        sqlite3_reset(stmt);
+    }
+
+    return result;
+}
+
+// add/update node records, BATCHROWS per statement
+bool SqliteDbTable::putnoderecords(vector<NodeColumns>* nodes, dbrecord_vector* records)
+{
+    if (!db)
+    {
+        return false;
+    }
+
+    if (!nodetable)
+    {
+        return putrecords(records);
+    }
+
+    size_t i = 0;
+
+    while (records->size() - i >= size_t(BATCHROWS))
+    {
+        sqlite3_stmt *stmt = statement(STMT_PUTNODEBATCH, PUTNODESQL, PUTNODEROW, BATCHROWS);
+        int rc = stmt ? SQLITE_OK : SQLITE_ERROR;
+
+        for (int j = 0; rc == SQLITE_OK && j < BATCHROWS; j++, i++)
+        {
+            rc = bindnode(stmt, PUTNODECOLUMNS * j + 1, (*records)[i].first, &(*nodes)[i], &(*records)[i].second);
+        }
+
+        rc = rc ? rc : sqlite3_step(stmt);
+        sqlite3_reset(stmt);
+
+        if (rc != SQLITE_DONE)
+        {
+            return false;
+        }
+    }
+
+    for (; i < records->size(); i++)
+    {
+        if (!putnode((*records)[i].first, &(*nodes)[i], &(*records)[i].second))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// delete node record by index
+bool SqliteDbTable::delnode(uint32_t index)
+{
+    vector<uint32_t> indexes(1, index);
+
+    return delnoderecords(&indexes);
+}
+
+// delete node records, BATCHROWS per statement
+bool SqliteDbTable::delnoderecords(vector<uint32_t>* indexes)
 {
     if (!db)
     {
         return false;
     }
 
-    char buf[64];
+    if (!nodetable)
+    {
+        return delrecords(indexes);
+    }
+
+    return delfrom("nodes", STMT_DELNODE, STMT_DELNODEBATCH, indexes);
+}
+
+// delete the node records of and below the given nodes
+bool SqliteDbTable::delnodetrees(handle_vector* handles)
+{
+    if (!db || !nodetable)
+    {
+        return false;
+    }
+
+    for (handle_vector::iterator it = handles->begin(); it != handles->end(); it++)
+    {
+        sqlite3_stmt *stmt = statement(STMT_DELNODETREE,
+                                       "WITH RECURSIVE tree(nodehandle) AS (SELECT ?1 "
+                                       "UNION ALL SELECT nodes.nodehandle FROM nodes JOIN tree ON nodes.parenthandle = tree.nodehandle "
+                                       "WHERE NOT nodes.shared) "
+                                       "DELETE FROM nodes WHERE nodehandle IN tree");
+        int rc = stmt ? sqlite3_bind_int64(stmt, 1, *it) : SQLITE_ERROR;
+
+        rc = rc ? rc : sqlite3_step(stmt);
+
+        if (stmt)
+        {
+            sqlite3_reset(stmt);
+        }
+
+        if (rc != SQLITE_DONE)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// collect the records returned by a prepared node query
+bool SqliteDbTable::getnodes(sqlite3_stmt* stmt, dbrecord_vector* records)
+{
+    int rc;
+
+    while ((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+    {
+        records->push_back(pair<uint32_t, string>(sqlite3_column_int(stmt, 0), string()));
+        records->back().second.assign((char*)sqlite3_column_blob(stmt, 1), sqlite3_column_bytes(stmt, 1));
+    }
+
+    return rc == SQLITE_DONE;
+}
+
+// retrieve node record by node handle
+bool SqliteDbTable::getnode(handle h, uint32_t* index, string* data)
+{
+    if (!db || !nodetable)
+    {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = statement(STMT_GETNODE, "SELECT id, content FROM nodes WHERE nodehandle = ?");
+    bool result = false;
+
+    if (stmt)
+    {
+        if (sqlite3_bind_int64(stmt, 1, h) == SQLITE_OK)
+        {
+            if (sqlite3_step(stmt) == SQLITE_ROW)
+            {
+                *index = sqlite3_column_int(stmt, 0);
+                data->assign((char*)sqlite3_column_blob(stmt, 1), sqlite3_column_bytes(stmt, 1));
+
+                result = true;
+            }
+        }
+
+        sqlite3_reset(stmt);
+    }
+
+    return result;
+}
+
+// retrieve node records by parent handle
+bool SqliteDbTable::getchildren(handle h, dbrecord_vector* records)
+{
+    if (!db || !nodetable)
+    {
+        return false;
+    }
+
+    sqlite3_stmt *stmt;
+    bool result = false;
+
+    // nodes without parent (root nodes, inbound shares) for UNDEF
+    if (ISUNDEF(h))
+    {
+        if (sqlite3_prepare(db, "SELECT id, content FROM nodes WHERE parenthandle IS NULL", -1, &stmt, NULL) == SQLITE_OK)
+        {
+            result = getnodes(stmt, records);
+        }
+
+        sqlite3_finalize(stmt);
+    }
+    else if ((stmt = statement(STMT_GETCHILDREN, "SELECT id, content FROM nodes WHERE parenthandle = ?")))
+    {
+        if (sqlite3_bind_int64(stmt, 1, h) == SQLITE_OK)
+        {
+            result = getnodes(stmt, records);
+        }
+
+        sqlite3_reset(stmt);
+    }
+
+    return result;
+}
+
+// retrieve file node records by fingerprint
+bool SqliteDbTable::getnodesbyfingerprint(FileFingerprint* fp, dbrecord_vector* records)
+{
+    if (!db || !nodetable)
+    {
+        return false;
+    }
+
+    sqlite3_stmt *stmt;
+    bool result = false;
+
+    if (sqlite3_prepare(db, "SELECT id, content FROM nodes WHERE size = ? AND mtime = ? AND fingerprint = ?", -1, &stmt, NULL) == SQLITE_OK)
+    {
+        if (sqlite3_bind_int64(stmt, 1, fp->size) == SQLITE_OK
+         && sqlite3_bind_int64(stmt, 2, fp->mtime) == SQLITE_OK
+         && sqlite3_bind_blob(stmt, 3, fp->crc, sizeof fp->crc, SQLITE_STATIC) == SQLITE_OK)
+        {
+            result = getnodes(stmt, records);
+        }
+    }
+
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+// retrieve records of nodes with shares or public links
+bool SqliteDbTable::getsharednodes(dbrecord_vector* records)
+{
+    if (!db || !nodetable)
+    {
+        return false;
+    }
+
+    sqlite3_stmt *stmt;
+    bool result = false;
+
+    if (sqlite3_prepare(db, "SELECT id, content FROM nodes WHERE shared", -1, &stmt, NULL) == SQLITE_OK)
+    {
+        result = getnodes(stmt, records);
+    }
+
+    sqlite3_finalize(stmt);
+    return result;
+}
+
+// sum up a subtree following the parent handles, without reading the
+// records - files below files are previous versions
+bool SqliteDbTable::getsubtreecounter(handle h, NodeCounter* counter)
+{
+    if (!db || !nodetable)
+    {
+        return false;
+    }
+
+    sqlite3_stmt *stmt = statement(STMT_GETSUBTREECOUNTER,
+                                   "WITH RECURSIVE tree(nodehandle, type, size, parenttype) AS ("
+                                   "SELECT nodehandle, type, size, -1 FROM nodes WHERE nodehandle = ?1 "
+                                   "UNION ALL SELECT nodes.nodehandle, nodes.type, nodes.size, tree.type FROM nodes "
+                                   "JOIN tree ON nodes.parenthandle = tree.nodehandle) "
+                                   "SELECT COUNT(*), "
+                                   "SUM(CASE WHEN type = 0 AND parenttype <> 0 THEN size ELSE 0 END), "
+                                   "SUM(CASE WHEN type = 0 AND parenttype = 0 THEN size ELSE 0 END), "
+                                   "SUM(type = 0 AND parenttype <> 0), SUM(type <> 0), SUM(type = 0 AND parenttype = 0) "
+                                   "FROM tree");
+    bool result = false;
 
-    sprintf(buf, "DELETE FROM statecache WHERE id = %" PRIu32, index);
+    if (stmt)
+    {
+        if (sqlite3_bind_int64(stmt, 1, h) == SQLITE_OK
+         && sqlite3_step(stmt) == SQLITE_ROW
+         && sqlite3_column_int64(stmt, 0))
+        {
+            counter->storage = sqlite3_column_int64(stmt, 1);
+            counter->versionstorage = sqlite3_column_int64(stmt, 2);
+            counter->files = sqlite3_column_int64(stmt, 3);
+            counter->folders = sqlite3_column_int64(stmt, 4);
+            counter->versions = sqlite3_column_int64(stmt, 5);
+            result = true;
+        }
 
-    return !sqlite3_exec(db, buf, 0, 0, NULL);
+        sqlite3_reset(stmt);
+    }
+
+    return result;
+}
+
+// node records have been moved to the nodes table
+void SqliteDbTable::nodesmigrated()
+{
+    DbTable::nodesmigrated();
+
+    if (!db)
+    {
+        return;
+    }
+
+    ostringstream oss;
+    oss << "PRAGMA user_version = " << SqliteDbAccess::DB_VERSION;
+    sqlite3_exec(db, oss.str().c_str(), NULL, NULL, NULL);
 }
 
 // truncate table
@@ -290,6 +879,11 @@ void SqliteDbTable::truncate()
     }
 
     sqlite3_exec(db, "DELETE FROM statecache", 0, 0, NULL);
+
+    if (nodetable)
+    {
+        sqlite3_exec(db, "DELETE FROM nodes", 0, 0, NULL);
+    }
 }
 
 // begin transaction
@@ -339,6 +933,7 @@ void SqliteDbTable::remove()
     {
         sqlite3_finalize(pStmt);
     }
+    finalizestatements();
     abort();
     sqlite3_close(db);
 
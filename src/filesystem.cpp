@@ -237,9 +237,25 @@ DirNotify* FileSystemAccess::newdirnotify(string* localpath, string* ignore)
     return new DirNotify(localpath, ignore);
 }
 
+void DirAccess::dlist(string* path, vector<DirEntry>* entries, bool followsymlinks)
+{
+    DirEntry entry;
+    entry.size = -1;
+    entry.mtime = 0;
+    entry.ctime = 0;
+    entry.fsid = UNDEF;
+    entry.fsidvalid = false;
+
+    while (dnext(path, &entry.localname, followsymlinks, &entry.type))
+    {
+        entries->push_back(entry);
+    }
+}
+
 FileAccess::FileAccess(Waiter *waiter)
 {
     this->waiter = waiter;
+    this->ctime = 0;
     this->isAsyncOpened = false;
     this->numAsyncReads = 0;
 }
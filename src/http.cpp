@@ -54,7 +54,7 @@ const int HttpIO::SCREQUESTTIMEOUT = 400;
 const int HttpIO::CONNECTTIMEOUT = 120;
 
 // size (in bytes) of the CRC of uploaded chunks
-const int HttpReqUL::CRCSIZE = 12;
+const int HttpReqUL::CRCSIZE;
 
 #ifdef _WIN32
 const char* mega_inet_ntop(int af, const void* src, char* dst, int cnt)
@@ -338,6 +338,11 @@ m_off_t HttpIO::getmaxuploadspeed()
     return 0;
 }
 
+bool HttpIO::sethttp2(bool)
+{
+    return false;
+}
+
 void HttpReq::post(MegaClient* client, const char* data, unsigned len)
 {
     if (httpio)
@@ -352,6 +357,7 @@ void HttpReq::post(MegaClient* client, const char* data, unsigned len)
     outpos = 0;
     notifiedbufpos = 0;
     inpurge = 0;
+    inpurged = 0;
     method = METHOD_POST;
     contentlength = -1;
     lastdata = Waiter::ds;
@@ -373,6 +379,7 @@ void HttpReq::get(MegaClient *client)
     outpos = 0;
     notifiedbufpos = 0;
     inpurge = 0;
+    inpurged = 0;
     method = METHOD_GET;
     contentlength = -1;
     lastdata = Waiter::ds;
@@ -394,6 +401,7 @@ void HttpReq::dns(MegaClient *client)
     outpos = 0;
     notifiedbufpos = 0;
     inpurge = 0;
+    inpurged = 0;
     method = METHOD_NONE;
     contentlength = -1;
     lastdata = Waiter::ds;
@@ -425,6 +433,7 @@ HttpReq::HttpReq(bool b)
     buflen = 0;
     protect = false;
     minspeed = false;
+    incremental = false;
 
     init();
 }
@@ -443,6 +452,7 @@ void HttpReq::init()
 {
     httpstatus = 0;
     inpurge = 0;
+    inpurged = 0;
     sslcheckfailed = false;
     bufpos = 0;
     notifiedbufpos = 0;
@@ -481,6 +491,7 @@ void HttpReq::put(void* data, unsigned len, bool purge)
         if (inpurge && purge)
         {
             in.erase(0, inpurge);
+            inpurged += inpurge;
             inpurge = 0;
         }
 
@@ -509,7 +520,7 @@ void HttpReq::purge(size_t numbytes)
 // set total response size
 void HttpReq::setcontentlength(m_off_t len)
 {
-    if (!buf && type != REQ_BINARY)
+    if (!buf && type != REQ_BINARY && !incremental)
     {
         in.reserve(len);
     }
@@ -536,6 +547,7 @@ byte* HttpReq::reserveput(unsigned* len)
             // FIXME: optimize erase()/resize() -> single copy/resize()
             in.erase(0, inpurge);
             bufpos -= inpurge;
+            inpurged += inpurge;
             inpurge = 0;
         }
 
@@ -575,26 +587,81 @@ void HttpReqDL::prepare(const char* tempurl, SymmCipher* /*key*/,
 
     dlpos = pos;
     size = (unsigned)(npos - pos);
+    decrypted = false;
 
     if (!buf || buflen != size)
     {
         // (re)allocate buffer
-        if (buf)
+        if (bufferpool)
         {
-            delete[] buf;
-            buf = NULL;
+            if (size)
+            {
+                buf = bufferpool->get(buf, (size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE);
+            }
+            else if (buf)
+            {
+                bufferpool->release(buf);
+                buf = NULL;
+            }
         }
-
-        if (size)
+        else
         {
-            buf = new byte[(size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE];
+            if (buf)
+            {
+                delete[] buf;
+                buf = NULL;
+            }
+
+            if (size)
+            {
+                buf = new byte[(size + SymmCipher::BLOCKSIZE - 1) & - SymmCipher::BLOCKSIZE];
+            }
         }
         buflen = size;
     }
 }
 
+HttpReqDL::~HttpReqDL()
+{
+    if (bufferpool && buf)
+    {
+        bufferpool->release(buf);
+        buf = NULL;
+    }
+}
+
 // decrypt, mac and write downloaded chunk
 void HttpReqDL::finalize(Transfer *transfer)
+{
+    if (decrypted)
+    {
+        return;
+    }
+
+    ChunkCrypto job(transfer->transfercipher(), transfer->ctriv, false);
+    setupcrypto(transfer, &job);
+    job.run();
+    decrypted = true;
+}
+
+void HttpReqDL::finalizeasync(Transfer *transfer, TransferCryptoPool *pool)
+{
+    assert(!crypto && !decrypted);
+
+    crypto = new ChunkCrypto(transfer->transfercipher(), transfer->ctriv, false);
+    setupcrypto(transfer, crypto);
+    pool->push(crypto);
+}
+
+void HttpReqDL::finalizecompleted()
+{
+    delete crypto;
+    crypto = NULL;
+    decrypted = true;
+}
+
+// update the chunk MACs of the request and collect the chunks to decrypt
+void HttpReqDL::setupcrypto(Transfer *transfer, ChunkCrypto *job)
 {
     byte *chunkstart = buf;
     m_off_t startpos = dlpos;
@@ -606,9 +673,13 @@ void HttpReqDL::finalize(Transfer *transfer)
         bufpos &= -SymmCipher::BLOCKSIZE;
     }
 
+    if (bufferpool)
+    {
+        bufferpool->stats.transferred += bufpos;
+    }
+
     m_off_t endpos = ChunkedHash::chunkceil(startpos, finalpos);
     m_off_t chunksize = endpos - startpos;
-    SymmCipher *cipher = transfer->transfercipher();
     while (chunksize)
     {
         m_off_t chunkid = ChunkedHash::chunkfloor(startpos);
@@ -616,8 +687,9 @@ void HttpReqDL::finalize(Transfer *transfer)
         if (!chunkmac.finished)
         {
             chunkmac = transfer->chunkmacs[chunkid];
-            cipher->ctr_crypt(chunkstart, chunksize, startpos, transfer->ctriv,
-                                    chunkmac.mac, false, !chunkmac.finished && !chunkmac.offset);
+            SymmCipher::CtrChunk chunk = { chunkstart, unsigned(chunksize), startpos, chunkmac.mac,
+                                           !chunkmac.finished && !chunkmac.offset };
+            job->chunks.push_back(chunk);
             if (endpos == ChunkedHash::chunkceil(chunkid, transfer->size))
             {
                 LOG_debug << "Finished chunk: " << startpos << " - " << endpos << "   Size: " << chunksize;
@@ -642,6 +714,40 @@ void HttpReqDL::finalize(Transfer *transfer)
 void HttpReqUL::prepare(const char* tempurl, SymmCipher* key,
                         chunkmac_map* macs, uint64_t ctriv, m_off_t pos,
                         m_off_t npos)
+{
+    ChunkCrypto job(key, ctriv, true);
+    setupcrypto(&job, macs, tempurl, pos, npos);
+    job.run();
+    setposturl(&job);
+}
+
+void HttpReqUL::prepareasync(TransferCryptoPool* pool, const char* tempurl, SymmCipher* key,
+                             uint64_t ctriv, m_off_t pos, m_off_t npos)
+{
+    assert(!crypto);
+
+    chunkmacs.clear();
+    crypto = new ChunkCrypto(key, ctriv, true);
+    setupcrypto(crypto, &chunkmacs, tempurl, pos, npos);
+    pool->push(crypto);
+}
+
+void HttpReqUL::preparecompleted(chunkmac_map* macs)
+{
+    for (chunkmac_map::iterator it = chunkmacs.begin(); it != chunkmacs.end(); it++)
+    {
+        (*macs)[it->first] = it->second;
+    }
+    chunkmacs.clear();
+
+    setposturl(crypto);
+    delete crypto;
+    crypto = NULL;
+}
+
+// collect the chunks to encrypt, their MACs go to macs
+void HttpReqUL::setupcrypto(ChunkCrypto* job, chunkmac_map* macs, const char* tempurl,
+                            m_off_t pos, m_off_t npos)
 {
     size = (unsigned)(npos - pos);
 
@@ -652,11 +758,11 @@ void HttpReqUL::prepare(const char* tempurl, SymmCipher* key,
     m_off_t chunksize = endpos - startpos;
     while (chunksize)
     {
-        byte mac[SymmCipher::BLOCKSIZE] = { 0 };
-        key->ctr_crypt(chunkstart, chunksize, startpos, ctriv, mac, 1);
-        memcpy((*macs)[startpos].mac, mac, sizeof mac);
-        (*macs)[startpos].finished = false;
-        LOG_debug << "Encrypted chunk: " << startpos << " - " << endpos << "   Size: " << chunksize;
+        ChunkMAC &chunkmac = (*macs)[startpos];
+        SymmCipher::CtrChunk chunk = { chunkstart, unsigned(chunksize), startpos, chunkmac.mac, true };
+        job->chunks.push_back(chunk);
+        chunkmac.finished = false;
+        LOG_debug << "Encrypting chunk: " << startpos << " - " << endpos << "   Size: " << chunksize;
 
         chunkstart += chunksize;
         startpos = endpos;
@@ -665,17 +771,152 @@ void HttpReqUL::prepare(const char* tempurl, SymmCipher* key,
     }
     assert(endpos == finalpos);
 
+    job->crcdata = (const byte*)out->data();
+    job->crcsize = size;
+    job->tempurl = tempurl;
+    job->pos = pos;
+}
+
+void HttpReqUL::setposturl(ChunkCrypto* job)
+{
     // unpad for POSTing
     out->resize(size);
 
-    const char *data = out->data();
-    byte c[CRCSIZE];
-    memset(c, 0, CRCSIZE);
+    char crc[32];
+    char buf[512];
+    Base64::btoa(job->crc, CRCSIZE, crc);
+    snprintf(buf, sizeof buf, "%s/%" PRIu64 "?c=%s", job->tempurl.c_str(), job->pos, crc);
+    setreq(buf, REQ_BINARY);
+}
 
+HttpReqXfer::~HttpReqXfer()
+{
+    delete crypto;
+}
+
+TransferBufferPool::TransferBufferPool()
+{
+    idlebytes = 0;
+    maxidlebytes = MAXIDLEBYTES;
+}
+
+TransferBufferPool::~TransferBufferPool()
+{
+    for (std::map<byte*, pair<byte*, unsigned> >::iterator it = buffers.begin(); it != buffers.end(); it++)
+    {
+        delete[] it->second.first;
+    }
+}
+
+byte* TransferBufferPool::get(byte* previous, unsigned size)
+{
+    if (previous)
+    {
+        unsigned capacity = buffers[previous].second;
+
+        if (capacity >= size && capacity / 2 <= size)
+        {
+            return previous;
+        }
+
+        release(previous);
+    }
+
+    // smallest idle buffer that fits, unless it is more than twice as large
+    std::multimap<unsigned, byte*>::iterator it = idle.lower_bound(size);
+
+    if (it != idle.end() && it->first / 2 <= size)
+    {
+        byte* buf = it->second;
+        idlebytes -= it->first;
+        idle.erase(it);
+        return buf;
+    }
+
+    // round up to the alignment, so that similar sizes share buffers
+    unsigned capacity = (size + ALIGNMENT - 1) & - ALIGNMENT;
+    byte* start = new byte[capacity + ALIGNMENT];
+    byte* buf = start + (ALIGNMENT - (uintptr_t)start % ALIGNMENT) % ALIGNMENT;
+
+    buffers[buf] = pair<byte*, unsigned>(start, capacity);
+    stats.allocations++;
+
+    return buf;
+}
+
+void TransferBufferPool::release(byte* buf)
+{
+    std::map<byte*, pair<byte*, unsigned> >::iterator it = buffers.find(buf);
+
+    assert(it != buffers.end());
+    if (it == buffers.end())
+    {
+        return;
+    }
+
+    idle.insert(pair<unsigned, byte*>(it->second.second, buf));
+    idlebytes += it->second.second;
+
+    // free the largest idle buffers beyond the limit
+    while (idlebytes > maxidlebytes)
+    {
+        std::multimap<unsigned, byte*>::iterator largest = --idle.end();
+        std::map<byte*, pair<byte*, unsigned> >::iterator b = buffers.find(largest->second);
+
+        idlebytes -= largest->first;
+        delete[] b->second.first;
+        buffers.erase(b);
+        idle.erase(largest);
+    }
+}
+
+TransferBufferPool::Stats TransferBufferPool::resetstats()
+{
+    Stats result = stats;
+    stats = Stats();
+    return result;
+}
+
+TransferBufferPool::Stats::Stats()
+{
+    allocations = 0;
+    transferred = 0;
+}
+
+double TransferBufferPool::Stats::allocationspermb() const
+{
+    return transferred ? allocations * 1048576.0 / transferred : 0;
+}
+
+ChunkCrypto::ChunkCrypto(SymmCipher* key, uint64_t civ, bool cencrypt) : cipher(*key)
+{
+    ctriv = civ;
+    encrypt = cencrypt;
+    crcdata = NULL;
+    crcsize = 0;
+    memset(crc, 0, sizeof crc);
+    pos = 0;
+    finished = false;
+}
+
+// all chunks at once, so that their MACs are computed in parallel
+void ChunkCrypto::run()
+{
+    if (chunks.size())
+    {
+        cipher.ctr_crypt(chunks.data(), unsigned(chunks.size()), ctriv, encrypt);
+    }
+
+    if (!crcdata)
+    {
+        return;
+    }
+
+    const byte *data = crcdata;
     uint32_t *intdata = (uint32_t *)data;
-    uint32_t *intc = (uint32_t *)c;
-    int ll = size % CRCSIZE;
-    int l = size / CRCSIZE;
+    uint32_t *intc = (uint32_t *)crc;
+    int ll = crcsize % HttpReqUL::CRCSIZE;
+    int l = crcsize / HttpReqUL::CRCSIZE;
     if (l)
     {
         l *= 3;
@@ -689,18 +930,12 @@ void HttpReqUL::prepare(const char* tempurl, SymmCipher* key,
     }
     if (ll)
     {
-        data += (size - ll);
+        data += (crcsize - ll);
         while (ll--)
         {
-            c[ll] ^= data[ll];
+            crc[ll] ^= data[ll];
         }
     }
-
-    char crc[32];
-    char buf[512];
-    Base64::btoa(c, CRCSIZE, crc);
-    snprintf(buf, sizeof buf, "%s/%" PRIu64 "?c=%s", tempurl, pos, crc);
-    setreq(buf, REQ_BINARY);
 }
 
 // number of bytes sent in this request
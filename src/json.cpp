@@ -119,6 +119,61 @@ bool JSON::storeobject(string* s)
     }
 }
 
+// number of bytes taken by the array, object, string or literal at ptr
+// - incomplete values (including literals that may still continue) yield 0
+size_t JSON::valuelength(const char* ptr, size_t len)
+{
+    int depth = 0;
+    size_t i = 0;
+
+    while (i < len)
+    {
+        char c = ptr[i++];
+
+        if (c == '[' || c == '{')
+        {
+            depth++;
+        }
+        else if (c == ']' || c == '}')
+        {
+            if (!depth--)
+            {
+                // end of the enclosing array or object
+                return 0;
+            }
+        }
+        else if (c == '"')
+        {
+            while (i < len && ptr[i] != '"')
+            {
+                i += (ptr[i] == '\\') ? 2 : 1;
+            }
+
+            if (i++ >= len)
+            {
+                return 0;
+            }
+        }
+        else if (!depth)
+        {
+            // literal: complete once followed by a delimiter
+            while (i < len && ptr[i] != ',' && ptr[i] != ']' && ptr[i] != '}')
+            {
+                i++;
+            }
+
+            return i < len ? i : 0;
+        }
+
+        if (!depth)
+        {
+            return i;
+        }
+    }
+
+    return 0;
+}
+
 bool JSON::isnumeric()
 {
     if (*pos == ',')
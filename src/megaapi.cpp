@@ -2133,6 +2133,11 @@ void MegaApi::fetchNodes(MegaRequestListener *listener)
     pImpl->fetchNodes(listener);
 }
 
+void MegaApi::setMaxResidentNodes(unsigned maxNodes)
+{
+    pImpl->setMaxResidentNodes(maxNodes);
+}
+
 void MegaApi::getAccountDetails(MegaRequestListener *listener)
 {
     pImpl->getAccountDetails(true, true, true, false, false, false, listener);
@@ -2426,6 +2431,21 @@ int MegaApi::getMaxUploadSpeed()
     return pImpl->getMaxUploadSpeed();
 }
 
+bool MegaApi::useHttp2(bool enable)
+{
+    return pImpl->useHttp2(enable);
+}
+
+void MegaApi::useAdaptiveTransfers(bool enable)
+{
+    pImpl->useAdaptiveTransfers(enable);
+}
+
+void MegaApi::setMaxDownloadSources(int sources)
+{
+    pImpl->setMaxDownloadSources(sources);
+}
+
 bool MegaApi::setMaxDownloadSpeed(long long bpslimit)
 {
     return pImpl->setMaxDownloadSpeed(bpslimit);
@@ -3413,6 +3433,16 @@ MegaNodeList *MegaApi::getChildren(MegaNode* p, int order)
     return pImpl->getChildren(p, order);
 }
 
+MegaNodeList *MegaApi::getChildren(MegaNode *p, int order, int offset, int limit)
+{
+    return pImpl->getChildren(p, order, offset, limit);
+}
+
+MegaNodeList *MegaApi::getChildrenAfter(MegaNode *p, MegaNode *after, int order, int limit)
+{
+    return pImpl->getChildrenAfter(p, after, order, limit);
+}
+
 MegaNodeList *MegaApi::getVersions(MegaNode *node)
 {
     return pImpl->getVersions(node);
@@ -4926,6 +4956,21 @@ MegaHandle MegaSyncEvent::getPrevParent() const
     return INVALID_HANDLE;
 }
 
+long long MegaSyncEvent::getScanTime() const
+{
+    return 0;
+}
+
+long long MegaSyncEvent::getBytesRead() const
+{
+    return 0;
+}
+
+long long MegaSyncEvent::getBytesSkipped() const
+{
+    return 0;
+}
+
 MegaRegExp::MegaRegExp()
 {
     pImpl = new MegaRegExpPrivate();
@@ -5867,6 +5867,13 @@ void MegaApiImpl::fetchNodes(MegaRequestListener *listener)
     waiter->notify();
 }
 
+void MegaApiImpl::setMaxResidentNodes(unsigned maxNodes)
+{
+    sdkMutex.lock();
+    client->maxresidentnodes = maxNodes;
+    sdkMutex.unlock();
+}
+
 void MegaApiImpl::getPricing(MegaRequestListener *listener)
 {
     MegaRequestPrivate *request = new MegaRequestPrivate(MegaRequest::TYPE_GET_PRICING, listener);
@@ -6601,6 +6608,37 @@ int MegaApiImpl::getMaxUploadSpeed()
     return int(client->getmaxuploadspeed());
 }
 
+bool MegaApiImpl::useHttp2(bool enable)
+{
+    sdkMutex.lock();
+    bool result = client->sethttp2(enable);
+    sdkMutex.unlock();
+    return result;
+}
+
+void MegaApiImpl::useAdaptiveTransfers(bool enable)
+{
+    sdkMutex.lock();
+    client->adaptivetransfers = enable;
+    sdkMutex.unlock();
+}
+
+void MegaApiImpl::setMaxDownloadSources(int sources)
+{
+    if (sources < 1)
+    {
+        sources = 1;
+    }
+    else if (sources > int(MegaClient::MAX_NUM_CONNECTIONS))
+    {
+        sources = int(MegaClient::MAX_NUM_CONNECTIONS);
+    }
+
+    sdkMutex.lock();
+    client->downloadsources = sources;
+    sdkMutex.unlock();
+}
+
 int MegaApiImpl::getCurrentDownloadSpeed()
 {
     return int(httpio->downloadSpeed);
@@ -9370,6 +9408,7 @@ bool MegaApiImpl::processMegaTree(MegaNode* n, MegaTreeProcessor* processor, boo
 
     if (node->type != FILENODE)
     {
+        client->loadchildren(node);
         for (node_list::iterator it = node->children.begin(); it != node->children.end(); )
         {
             MegaNode *megaNode = MegaNodePrivate::fromNode(*it++);
@@ -9411,31 +9450,81 @@ MegaNodeList *MegaApiImpl::search(const char *searchString, int order)
     node_vector result;
     Node *node;
 
-    // rootnodes
-    for (unsigned int i = 0; i < (sizeof client->rootnodes / sizeof *client->rootnodes); i++)
+    if (client->buildsearchindex())
     {
-        node = client->nodebyhandle(client->rootnodes[i]);
+        handle_set ancestors;
 
-        SearchTreeProcessor searchProcessor(searchString);
-        processTree(node, &searchProcessor);
-        node_vector& vNodes = searchProcessor.getResults();
+        for (unsigned int i = 0; i < (sizeof client->rootnodes / sizeof *client->rootnodes); i++)
+        {
+            if (!ISUNDEF(client->rootnodes[i]))
+            {
+                ancestors.insert(client->rootnodes[i]);
+            }
+        }
 
-        result.insert(result.end(), vNodes.begin(), vNodes.end());
-    }
+        // inshares: the shared folders themselves can match too
+        MegaShareList *shares = getInSharesList();
+        for (int i = 0; i < shares->size(); i++)
+        {
+            node = client->nodebyhandle(shares->get(i)->getNodeHandle());
+            if (node)
+            {
+                ancestors.insert(node->nodehandle);
+
+                SearchTreeProcessor searchProcessor(searchString);
+                searchProcessor.processNode(node);
+                vector<Node *>& vNodes = searchProcessor.getResults();
+
+                result.insert(result.end(), vNodes.begin(), vNodes.end());
+            }
+        }
+        delete shares;
 
-    // inshares
-    MegaShareList *shares = getInSharesList();
-    for (int i = 0; i < shares->size(); i++)
+        // the lookup does not need the SDK lock
+        sdkMutex.unlock();
+
+        handle_vector handles;
+        client->searchindex.search(searchString, &ancestors, true, &handles);
+
+        sdkMutex.lock();
+
+        result.reserve(result.size() + handles.size());
+        for (handle_vector::iterator it = handles.begin(); it != handles.end(); it++)
+        {
+            if ((node = client->nodebyhandle(*it)))
+            {
+                result.push_back(node);
+            }
+        }
+    }
+    else
     {
-        node = client->nodebyhandle(shares->get(i)->getNodeHandle());
+        // rootnodes
+        for (unsigned int i = 0; i < (sizeof client->rootnodes / sizeof *client->rootnodes); i++)
+        {
+            node = client->nodebyhandle(client->rootnodes[i]);
 
-        SearchTreeProcessor searchProcessor(searchString);
-        processTree(node, &searchProcessor);
-        vector<Node *>& vNodes  = searchProcessor.getResults();
+            SearchTreeProcessor searchProcessor(searchString);
+            processTree(node, &searchProcessor);
+            node_vector& vNodes = searchProcessor.getResults();
 
-        result.insert(result.end(), vNodes.begin(), vNodes.end());
+            result.insert(result.end(), vNodes.begin(), vNodes.end());
+        }
+
+        // inshares
+        MegaShareList *shares = getInSharesList();
+        for (int i = 0; i < shares->size(); i++)
+        {
+            node = client->nodebyhandle(shares->get(i)->getNodeHandle());
+
+            SearchTreeProcessor searchProcessor(searchString);
+            processTree(node, &searchProcessor);
+            vector<Node *>& vNodes  = searchProcessor.getResults();
+
+            result.insert(result.end(), vNodes.begin(), vNodes.end());
+        }
+        delete shares;
     }
-    delete shares;
 
     if (order && order <= MegaApi::ORDER_ALPHABETICAL_DESC)
     {
@@ -9928,6 +10017,7 @@ bool MegaApiImpl::processTree(Node* node, TreeProcessor* processor, bool recursi
 
     if (recursive && node->type != FILENODE)
     {
+        client->loadchildren(node);
         for (node_list::iterator it = node->children.begin(); it != node->children.end(); )
         {
             if (!processTree(*it++,processor))
@@ -9959,12 +10049,38 @@ MegaNodeList* MegaApiImpl::search(MegaNode* n, const char* searchString, bool re
     }
 
     SearchTreeProcessor searchProcessor(searchString);
-    for (node_list::iterator it = node->children.begin(); it != node->children.end(); )
+    vector<Node *>& vNodes = searchProcessor.getResults();
+
+    if (client->buildsearchindex())
     {
-        processTree(*it++, &searchProcessor, recursive);
-    }
+        handle_set ancestors;
+        ancestors.insert(node->nodehandle);
 
-    vector<Node *>& vNodes = searchProcessor.getResults();
+        // the lookup does not need the SDK lock
+        sdkMutex.unlock();
+
+        handle_vector handles;
+        client->searchindex.search(searchString, &ancestors, recursive, &handles);
+
+        sdkMutex.lock();
+
+        vNodes.reserve(handles.size());
+        for (handle_vector::iterator it = handles.begin(); it != handles.end(); it++)
+        {
+            if ((node = client->nodebyhandle(*it)))
+            {
+                vNodes.push_back(node);
+            }
+        }
+    }
+    else
+    {
+        client->loadchildren(node);
+        for (node_list::iterator it = node->children.begin(); it != node->children.end(); )
+        {
+            processTree(*it++, &searchProcessor, recursive);
+        }
+    }
     if (order && order <= MegaApi::ORDER_ALPHABETICAL_DESC)
     {
         bool (*comp)(Node*, Node*);
@@ -10013,9 +10129,7 @@ long long MegaApiImpl::getSize(MegaNode *n)
         sdkMutex.unlock();
         return 0;
     }
-    SizeProcessor sizeProcessor;
-    processTree(node, &sizeProcessor);
-    long long result = sizeProcessor.getTotalBytes();
+    long long result = client->subtreecounter(node).storage;
     sdkMutex.unlock();
 
     return result;
@@ -10277,6 +10391,7 @@ MegaNode *MegaApiImpl::getNodeByCRC(const char *crc, MegaNode *parent)
     byte binarycrc[sizeof(node->crc)];
     Base64::atob(crc, binarycrc, sizeof(binarycrc));
 
+    client->loadchildren(node);
     for (node_list::iterator it = node->children.begin(); it != node->children.end(); it++)
     {
         Node *child = (*it);
@@ -10345,23 +10460,6 @@ vector<Node *> &SearchTreeProcessor::getResults()
 	return results;
 }
 
-SizeProcessor::SizeProcessor()
-{
-    totalBytes=0;
-}
-
-bool SizeProcessor::processNode(Node *node)
-{
-    if(node->type == FILENODE)
-        totalBytes += node->size;
-    return true;
-}
-
-long long SizeProcessor::getTotalBytes()
-{
-    return totalBytes;
-}
-
 void MegaApiImpl::file_added(File *f)
 {
     Transfer *t = f->transfer;
@@ -11538,6 +11636,19 @@ void MegaApiImpl::syncupdate_local_lockretry(bool waiting)
 
     this->fireOnGlobalSyncStateChanged();
 }
+
+void MegaApiImpl::syncupdate_scan_completed(Sync *sync, dstime elapsed, m_off_t bytesread, m_off_t bytesskipped)
+{
+    LOG_debug << "Sync - full scan completed in " << elapsed * 100 << " ms. Fingerprint bytes read: " << bytesread
+              << " skipped: " << bytesskipped;
+
+    if(syncMap.find(sync->tag) == syncMap.end()) return;
+    MegaSyncPrivate* megaSync = syncMap.at(sync->tag);
+
+    MegaSyncEventPrivate *event = new MegaSyncEventPrivate(MegaSyncEvent::TYPE_SCAN_COMPLETED);
+    event->setScanStats(elapsed * 100, bytesread, bytesskipped);
+    fireOnSyncEvent(megaSync, event);
+}
 #endif
 
 
@@ -14940,6 +15051,24 @@ int naturalsorting_compare (const char *i, const char *j)
     return 0;
 }
 
+nodecomparator MegaApiImpl::getNodeComparator(int order)
+{
+    switch(order)
+    {
+        case MegaApi::ORDER_DEFAULT_ASC: return MegaApiImpl::nodeComparatorDefaultASC;
+        case MegaApi::ORDER_DEFAULT_DESC: return MegaApiImpl::nodeComparatorDefaultDESC;
+        case MegaApi::ORDER_SIZE_ASC: return MegaApiImpl::nodeComparatorSizeASC;
+        case MegaApi::ORDER_SIZE_DESC: return MegaApiImpl::nodeComparatorSizeDESC;
+        case MegaApi::ORDER_CREATION_ASC: return MegaApiImpl::nodeComparatorCreationASC;
+        case MegaApi::ORDER_CREATION_DESC: return MegaApiImpl::nodeComparatorCreationDESC;
+        case MegaApi::ORDER_MODIFICATION_ASC: return MegaApiImpl::nodeComparatorModificationASC;
+        case MegaApi::ORDER_MODIFICATION_DESC: return MegaApiImpl::nodeComparatorModificationDESC;
+        case MegaApi::ORDER_ALPHABETICAL_ASC: return MegaApiImpl::nodeComparatorAlphabeticalASC;
+        case MegaApi::ORDER_ALPHABETICAL_DESC: return MegaApiImpl::nodeComparatorAlphabeticalDESC;
+        default: return order < 0 ? MegaApiImpl::nodeComparatorDefaultASC : NULL;
+    }
+}
+
 bool MegaApiImpl::nodeComparatorDefaultASC(Node *i, Node *j)
 {
     if (i->type < j->type)
@@ -14952,7 +15081,7 @@ bool MegaApiImpl::nodeComparatorDefaultASC(Node *i, Node *j)
     }
 
     int r = naturalsorting_compare(i->displayname(), j->displayname());
-    if (r < 0 || (!r && i < j))
+    if (r < 0 || (!r && i->nodehandle < j->nodehandle))
     {
         return 1;
     }
@@ -14971,7 +15100,7 @@ bool MegaApiImpl::nodeComparatorDefaultDESC(Node *i, Node *j)
     }
 
     int r = naturalsorting_compare(i->displayname(), j->displayname());
-    if (r < 0 || (!r && i < j))
+    if (r < 0 || (!r && i->nodehandle < j->nodehandle))
     {
         return 0;
     }
@@ -14986,7 +15115,7 @@ bool MegaApiImpl::nodeComparatorSizeASC(Node *i, Node *j)
     }
 
     m_off_t r = i->size - j->size;
-    if (r < 0 || (!r && i < j))
+    if (r < 0 || (!r && i->nodehandle < j->nodehandle))
     {
         return 1;
     }
@@ -15001,7 +15130,7 @@ bool MegaApiImpl::nodeComparatorSizeDESC(Node *i, Node *j)
     }
 
     m_off_t r = i->size - j->size;
-    if (r < 0 || (!r && i < j))
+    if (r < 0 || (!r && i->nodehandle < j->nodehandle))
     {
         return 0;
     }
@@ -15058,7 +15187,7 @@ bool MegaApiImpl::nodeComparatorModificationASC(Node *i, Node *j)
     }
 
     m_time_t r = i->mtime - j->mtime;
-    if (r < 0 || (!r && i < j))
+    if (r < 0 || (!r && i->nodehandle < j->nodehandle))
     {
         return 1;
     }
@@ -15073,7 +15202,7 @@ bool MegaApiImpl::nodeComparatorModificationDESC(Node *i, Node *j)
     }
 
     m_time_t r = i->mtime - j->mtime;
-    if (r < 0 || (!r && i < j))
+    if (r < 0 || (!r && i->nodehandle < j->nodehandle))
     {
         return 0;
     }
@@ -15092,7 +15221,7 @@ bool MegaApiImpl::nodeComparatorAlphabeticalASC(Node *i, Node *j)
     }
 
     int r = strcasecmp(i->displayname(), j->displayname());
-    if (r < 0 || (!r && i < j))
+    if (r < 0 || (!r && i->nodehandle < j->nodehandle))
     {
         return 1;
     }
@@ -15111,7 +15240,7 @@ bool MegaApiImpl::nodeComparatorAlphabeticalDESC(Node *i, Node *j)
     }
 
     int r = strcasecmp(i->displayname(), j->displayname());
-    if (r < 0 || (!r && i < j))
+    if (r < 0 || (!r && i->nodehandle < j->nodehandle))
     {
         return 0;
     }
@@ -15133,6 +15262,7 @@ int MegaApiImpl::getNumChildren(MegaNode* p)
 		return 0;
 	}
 
+	client->loadchildren(parent);
 	int numChildren = int(parent->children.size());
 	sdkMutex.unlock();
 
@@ -15154,12 +15284,8 @@ int MegaApiImpl::getNumChildFiles(MegaNode* p)
 		return 0;
 	}
 
-	int numFiles = 0;
-	for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); it++)
-	{
-		if ((*it)->type == FILENODE)
-			numFiles++;
-	}
+	client->loadchildren(parent);
+	int numFiles = parent->numchildfiles;
 	sdkMutex.unlock();
 
 	return numFiles;
@@ -15180,12 +15306,8 @@ int MegaApiImpl::getNumChildFolders(MegaNode* p)
 		return 0;
 	}
 
-	int numFolders = 0;
-	for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); it++)
-	{
-		if ((*it)->type != FILENODE)
-			numFolders++;
-	}
+	client->loadchildren(parent);
+	int numFolders = parent->numchildfolders;
 	sdkMutex.unlock();
 
 	return numFolders;
@@ -15194,7 +15316,12 @@ int MegaApiImpl::getNumChildFolders(MegaNode* p)
 
 MegaNodeList *MegaApiImpl::getChildren(MegaNode* p, int order)
 {
-    if (!p || p->getType() == MegaNode::TYPE_FILE)
+    return getChildren(p, order, 0, -1);
+}
+
+MegaNodeList *MegaApiImpl::getChildren(MegaNode* p, int order, int offset, int limit)
+{
+    if (!p || p->getType() == MegaNode::TYPE_FILE || offset < 0)
     {
         return new MegaNodeListPrivate();
     }
@@ -15207,51 +15334,94 @@ MegaNodeList *MegaApiImpl::getChildren(MegaNode* p, int order)
         return new MegaNodeListPrivate();
 	}
 
+    client->loadchildren(parent);
+
+    MegaNodeListPrivate *result = getChildrenWindow(parent, NULL, order, offset, limit);
+    sdkMutex.unlock();
+    return result;
+}
+
+MegaNodeList *MegaApiImpl::getChildrenAfter(MegaNode* p, MegaNode *after, int order, int limit)
+{
+    if (!p || p->getType() == MegaNode::TYPE_FILE)
+    {
+        return new MegaNodeListPrivate();
+    }
+
+    if (!after)
+    {
+        return getChildren(p, order, 0, limit);
+    }
+
+    sdkMutex.lock();
+    Node *parent = client->nodebyhandle(p->getHandle());
+    Node *node = client->nodebyhandle(after->getHandle());
+    if (!parent || parent->type == FILENODE || !node || node->parent != parent)
+	{
+        sdkMutex.unlock();
+        return new MegaNodeListPrivate();
+	}
+
+    client->loadchildren(parent);
+
+    MegaNodeListPrivate *result = getChildrenWindow(parent, node, order, 0, limit);
+    sdkMutex.unlock();
+    return result;
+}
+
+// children [offset, offset + limit) in the requested order (limit < 0: all),
+// counting from the child after "after" if it is not NULL
+MegaNodeListPrivate *MegaApiImpl::getChildrenWindow(Node *parent, Node *after, int order, int offset, int limit)
+{
     vector<Node *> childrenNodes;
+    size_t count = limit < 0 ? parent->children.size() : size_t(limit);
+    nodecomparator comp = getNodeComparator(order);
 
-    if(!order || order> MegaApi::ORDER_ALPHABETICAL_DESC)
+    if (!comp)
 	{
-		for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); )
+        node_list::iterator it = parent->children.begin();
+        if (after)
+        {
+            it = std::next(after->child_it);
+        }
+
+        for (int i = 0; i < offset && it != parent->children.end(); i++)
+        {
+            it++;
+        }
+
+        while (it != parent->children.end() && childrenNodes.size() < count)
+        {
             childrenNodes.push_back(*it++);
+        }
 	}
 	else
 	{
-        bool (*comp)(Node*, Node*);
-		switch(order)
-		{
-        case MegaApi::ORDER_DEFAULT_ASC: comp = MegaApiImpl::nodeComparatorDefaultASC; break;
-        case MegaApi::ORDER_DEFAULT_DESC: comp = MegaApiImpl::nodeComparatorDefaultDESC; break;
-        case MegaApi::ORDER_SIZE_ASC: comp = MegaApiImpl::nodeComparatorSizeASC; break;
-        case MegaApi::ORDER_SIZE_DESC: comp = MegaApiImpl::nodeComparatorSizeDESC; break;
-        case MegaApi::ORDER_CREATION_ASC: comp = MegaApiImpl::nodeComparatorCreationASC; break;
-        case MegaApi::ORDER_CREATION_DESC: comp = MegaApiImpl::nodeComparatorCreationDESC; break;
-        case MegaApi::ORDER_MODIFICATION_ASC: comp = MegaApiImpl::nodeComparatorModificationASC; break;
-        case MegaApi::ORDER_MODIFICATION_DESC: comp = MegaApiImpl::nodeComparatorModificationDESC; break;
-        case MegaApi::ORDER_ALPHABETICAL_ASC: comp = MegaApiImpl::nodeComparatorAlphabeticalASC; break;
-        case MegaApi::ORDER_ALPHABETICAL_DESC: comp = MegaApiImpl::nodeComparatorAlphabeticalDESC; break;
-        default: comp = MegaApiImpl::nodeComparatorDefaultASC; break;
-		}
+        // kept sorted by the parent node, no need to sort again
+        const ChildOrder *sorted = parent->sortedchildren(comp);
+        ChildOrder::node_sorted_set::const_iterator it = sorted->nodes.begin();
+        if (after)
+        {
+            it = std::next(ChildOrder::node_sorted_set::const_iterator(sorted->positions.at(after)));
+        }
 
-		for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); )
-		{
-            Node *n = *it++;
-            vector<Node *>::iterator i = std::lower_bound(childrenNodes.begin(),
-					childrenNodes.end(), n, comp);
-            childrenNodes.insert(i, n);
-		}
+        for (int i = 0; i < offset && it != sorted->nodes.end(); i++)
+        {
+            it++;
+        }
+
+        while (it != sorted->nodes.end() && childrenNodes.size() < count)
+        {
+            childrenNodes.push_back(*it++);
+        }
 	}
 
-    MegaNodeListPrivate *result = NULL;
     if (childrenNodes.size())
     {
-        result = new MegaNodeListPrivate(childrenNodes.data(), int(childrenNodes.size()));
-    }
-    else
-    {
-        result = new MegaNodeListPrivate();
+        return new MegaNodeListPrivate(childrenNodes.data(), int(childrenNodes.size()));
     }
-    sdkMutex.unlock();
-    return result;
+
+    return new MegaNodeListPrivate();
 }
 
 MegaNodeList *MegaApiImpl::getVersions(MegaNode *node)
@@ -15271,11 +15441,13 @@ MegaNodeList *MegaApiImpl::getVersions(MegaNode *node)
 
     vector<Node*> versions;
     versions.push_back(current);
+    client->loadchildren(current);
     while (current->children.size())
     {
         assert(current->children.back()->parent == current);
         current = current->children.back();
         assert(current->type == FILENODE);
+        client->loadchildren(current);
         versions.push_back(current);
     }
 
@@ -15300,11 +15472,13 @@ int MegaApiImpl::getNumVersions(MegaNode *node)
     }
 
     int numVersions = 1;
+    client->loadchildren(current);
     while (current->children.size())
     {
         assert(current->children.back()->parent == current);
         current = current->children.back();
         assert(current->type == FILENODE);
+        client->loadchildren(current);
         numVersions++;
     }
     sdkMutex.unlock();
@@ -15326,6 +15500,7 @@ bool MegaApiImpl::hasVersions(MegaNode *node)
         return false;
     }
 
+    client->loadchildren(current);
     assert(!current->children.size()
            || (current->children.back()->parent == current
                && current->children.back()->type == FILENODE));
@@ -15363,6 +15538,7 @@ MegaChildrenLists *MegaApiImpl::getFileFolderChildren(MegaNode *p, int order)
 
     vector<Node *> files;
     vector<Node *> folders;
+    client->loadchildren(parent);
 
     if(!order || order> MegaApi::ORDER_ALPHABETICAL_DESC)
     {
@@ -15452,6 +15628,7 @@ bool MegaApiImpl::hasChildren(MegaNode *parent)
         return false;
     }
 
+    client->loadchildren(p);
     bool ret = p->children.size();
     sdkMutex.unlock();
 
@@ -15480,43 +15657,18 @@ int MegaApiImpl::getIndex(MegaNode *n, int order)
         return -1;
     }
 
-
-    if(!order || order> MegaApi::ORDER_ALPHABETICAL_DESC)
+    nodecomparator comp = getNodeComparator(order);
+    if (!comp)
     {
         sdkMutex.unlock();
         return 0;
     }
 
-    bool (*comp)(Node*, Node*);
-    switch(order)
-    {
-        case MegaApi::ORDER_DEFAULT_ASC: comp = MegaApiImpl::nodeComparatorDefaultASC; break;
-        case MegaApi::ORDER_DEFAULT_DESC: comp = MegaApiImpl::nodeComparatorDefaultDESC; break;
-        case MegaApi::ORDER_SIZE_ASC: comp = MegaApiImpl::nodeComparatorSizeASC; break;
-        case MegaApi::ORDER_SIZE_DESC: comp = MegaApiImpl::nodeComparatorSizeDESC; break;
-        case MegaApi::ORDER_CREATION_ASC: comp = MegaApiImpl::nodeComparatorCreationASC; break;
-        case MegaApi::ORDER_CREATION_DESC: comp = MegaApiImpl::nodeComparatorCreationDESC; break;
-        case MegaApi::ORDER_MODIFICATION_ASC: comp = MegaApiImpl::nodeComparatorModificationASC; break;
-        case MegaApi::ORDER_MODIFICATION_DESC: comp = MegaApiImpl::nodeComparatorModificationDESC; break;
-        case MegaApi::ORDER_ALPHABETICAL_ASC: comp = MegaApiImpl::nodeComparatorAlphabeticalASC; break;
-        case MegaApi::ORDER_ALPHABETICAL_DESC: comp = MegaApiImpl::nodeComparatorAlphabeticalDESC; break;
-        default: comp = MegaApiImpl::nodeComparatorDefaultASC; break;
-    }
-
-    vector<Node *> childrenNodes;
-    for (node_list::iterator it = parent->children.begin(); it != parent->children.end(); )
-    {
-        Node *temp = *it++;
-        vector<Node *>::iterator i = std::lower_bound(childrenNodes.begin(),
-                childrenNodes.end(), temp, comp);
-        childrenNodes.insert(i, temp);
-    }
-
-    vector<Node *>::iterator i = std::lower_bound(childrenNodes.begin(),
-            childrenNodes.end(), node, comp);
+    client->loadchildren(parent);
+    int index = parent->childindex(node, comp);
 
     sdkMutex.unlock();
-    return int(i - childrenNodes.begin());
+    return index;
 }
 
 MegaNode *MegaApiImpl::getChildNode(MegaNode *parent, const char* name)
@@ -19610,9 +19762,9 @@ void MegaApiImpl::sendPendingRequests()
                 break;
             }
 
-            TreeProcFolderInfo folderProcessor;
-            client->proctree(node, &folderProcessor, false, false);
-            MegaFolderInfo *folderInfo = folderProcessor.getResult();
+            // the folder itself is not included in the number of folders
+            NodeCounter nc = client->subtreecounter(node);
+            MegaFolderInfo *folderInfo = new MegaFolderInfoPrivate(int(nc.files), int(nc.folders - 1), int(nc.versions), nc.storage, nc.versionstorage);
             request->setMegaFolderInfo(folderInfo);
             delete folderInfo;
 
@@ -20853,6 +21005,9 @@ MegaSyncEventPrivate::MegaSyncEventPrivate(int type)
     prevName = NULL;
     nodeHandle = INVALID_HANDLE;
     prevParent = INVALID_HANDLE;
+    scanTime = 0;
+    bytesRead = 0;
+    bytesSkipped = 0;
 }
 
 MegaSyncEventPrivate::~MegaSyncEventPrivate()
@@ -20868,6 +21023,7 @@ MegaSyncEvent *MegaSyncEventPrivate::copy()
     event->setNewPath(this->newPath);
     event->setPrevName(this->prevName);
     event->setPrevParent(this->prevParent);
+    event->setScanStats(this->scanTime, this->bytesRead, this->bytesSkipped);
     return event;
 }
 
@@ -20901,6 +21057,21 @@ MegaHandle MegaSyncEventPrivate::getPrevParent() const
     return prevParent;
 }
 
+long long MegaSyncEventPrivate::getScanTime() const
+{
+    return scanTime;
+}
+
+long long MegaSyncEventPrivate::getBytesRead() const
+{
+    return bytesRead;
+}
+
+long long MegaSyncEventPrivate::getBytesSkipped() const
+{
+    return bytesSkipped;
+}
+
 void MegaSyncEventPrivate::setPath(const char *path)
 {
     if(this->path)
@@ -20938,6 +21109,13 @@ void MegaSyncEventPrivate::setPrevParent(MegaHandle prevParent)
     this->prevParent = prevParent;
 }
 
+void MegaSyncEventPrivate::setScanStats(long long scanTime, long long bytesRead, long long bytesSkipped)
+{
+    this->scanTime = scanTime;
+    this->bytesRead = bytesRead;
+    this->bytesSkipped = bytesSkipped;
+}
+
 #endif
 
 
@@ -21320,57 +21498,56 @@ void MegaFolderUploadController::onFolderAvailable(MegaHandle handle)
 
     MegaNode *parent = megaApi->getNodeByHandle(handle);
 
-    string localname;
+    // list the folder in one pass (without opening its items) and close it
+    // before recursing into subfolders
+    vector<DirEntry> entries;
     DirAccess* da;
     da = client->fsaccess->newdiraccess();
     if (da->dopen(&localPath, NULL, false))
     {
-        size_t t = localPath.size();
+        da->dlist(&localPath, &entries, client->followsymlinks);
+    }
+    delete da;
 
-        while (da->dnext(&localPath, &localname, client->followsymlinks))
+    size_t t = localPath.size();
+
+    for (size_t i = 0; i < entries.size(); i++)
+    {
+        if (t)
         {
-            if (t)
-            {
-                localPath.append(client->fsaccess->localseparator);
-            }
+            localPath.append(client->fsaccess->localseparator);
+        }
 
-            localPath.append(localname);
+        localPath.append(entries[i].localname);
 
-            FileAccess *fa = client->fsaccess->newfileaccess();
-            if (fa->fopen(&localPath, true, false))
+        string name = entries[i].localname;
+        client->fsaccess->local2name(&name);
+        if (entries[i].type == FILENODE)
+        {
+            pendingTransfers++;
+            string utf8path;
+            client->fsaccess->local2path(&localPath, &utf8path);
+            megaApi->startUpload(false, utf8path.c_str(), parent, (const char *)NULL, -1, tag, false, NULL, false, this);
+        }
+        else
+        {
+            MegaNode *child = megaApi->getChildNode(parent, name.c_str());
+            if(!child || !child->isFolder())
             {
-                string name = localname;
-                client->fsaccess->local2name(&name);
-                if (fa->type == FILENODE)
-                {
-                    pendingTransfers++;
-                    string utf8path;
-                    client->fsaccess->local2path(&localPath, &utf8path);
-                    megaApi->startUpload(false, utf8path.c_str(), parent, (const char *)NULL, -1, tag, false, NULL, false, this);
-                }
-                else
-                {
-                    MegaNode *child = megaApi->getChildNode(parent, name.c_str());
-                    if(!child || !child->isFolder())
-                    {
-                        pendingFolders.push_back(localPath);
-                        megaApi->createFolder(name.c_str(), parent, this);
-                    }
-                    else
-                    {
-                        pendingFolders.push_front(localPath);
-                        onFolderAvailable(child->getHandle());
-                    }
-                    delete child;
-                }
+                pendingFolders.push_back(localPath);
+                megaApi->createFolder(name.c_str(), parent, this);
             }
-
-            localPath.resize(t);
-            delete fa;
+            else
+            {
+                pendingFolders.push_front(localPath);
+                onFolderAvailable(child->getHandle());
+            }
+            delete child;
         }
+
+        localPath.resize(t);
     }
 
-    delete da;
     delete parent;
     recursive--;
 
@@ -22097,61 +22274,59 @@ void MegaBackupController::onFolderAvailable(MegaHandle handle)
 
     if (state == BACKUP_ONGOING)
     {
-        string localname;
+        // list the folder in one pass (without opening its items) and close
+        // it before recursing into subfolders
+        vector<DirEntry> entries;
         DirAccess* da;
         da = client->fsaccess->newdiraccess();
         if (da->dopen(&localPath, NULL, false))
         {
-            size_t t = localPath.size();
+            da->dlist(&localPath, &entries, client->followsymlinks);
+        }
+        delete da;
 
-            while (da->dnext(&localPath, &localname, client->followsymlinks))
+        size_t t = localPath.size();
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            if (t)
             {
-                if (t)
-                {
-                    localPath.append(client->fsaccess->localseparator);
-                }
+                localPath.append(client->fsaccess->localseparator);
+            }
 
-                localPath.append(localname);
+            localPath.append(entries[i].localname);
 
-                //TODO: add exclude filters here
+            //TODO: add exclude filters here
 
-                FileAccess *fa = client->fsaccess->newfileaccess();
-                if(fa->fopen(&localPath, true, false))
-                {
-                    string name = localname;
-                    client->fsaccess->local2name(&name);
-                    if(fa->type == FILENODE)
-                    {
-                        pendingTransfers++;
-                        string utf8path;
-                        client->fsaccess->local2path(&localPath, &utf8path);
+            string name = entries[i].localname;
+            client->fsaccess->local2name(&name);
+            if(entries[i].type == FILENODE)
+            {
+                pendingTransfers++;
+                string utf8path;
+                client->fsaccess->local2path(&localPath, &utf8path);
 
-                        totalFiles++;
-                        megaApi->startUpload(false, utf8path.c_str(), parent, (const char *)NULL, -1, folderTransferTag, true, NULL, false, this);
-                    }
-                    else
-                    {
-                        MegaNode *child = megaApi->getChildNode(parent, name.c_str());
-                        if(!child || !child->isFolder())
-                        {
-                            pendingFolders.push_back(localPath);
-                            megaApi->createFolder(name.c_str(), parent, this);
-                        }
-                        else
-                        {
-                            pendingFolders.push_front(localPath);
-                            onFolderAvailable(child->getHandle());
-                        }
-                        delete child;
-                    }
+                totalFiles++;
+                megaApi->startUpload(false, utf8path.c_str(), parent, (const char *)NULL, -1, folderTransferTag, true, NULL, false, this);
+            }
+            else
+            {
+                MegaNode *child = megaApi->getChildNode(parent, name.c_str());
+                if(!child || !child->isFolder())
+                {
+                    pendingFolders.push_back(localPath);
+                    megaApi->createFolder(name.c_str(), parent, this);
                 }
-
-                localPath.resize(t);
-                delete fa;
+                else
+                {
+                    pendingFolders.push_front(localPath);
+                    onFolderAvailable(child->getHandle());
+                }
+                delete child;
             }
-        }
 
-        delete da;
+            localPath.resize(t);
+        }
     }
     else if (state == BACKUP_SKIPPING)
     {
@@ -29256,41 +29431,6 @@ long long MegaFolderInfoPrivate::getVersionsSize() const
     return versionsSize;
 }
 
-TreeProcFolderInfo::TreeProcFolderInfo()
-{
-    numFiles = 0;
-    numFolders = 0;
-    numVersions = 0;
-    currentSize = 0;
-    versionsSize = 0;
-}
-
-void TreeProcFolderInfo::proc(MegaClient *, Node *node)
-{
-    if (node->parent && node->parent->type == FILENODE)
-    {
-        numVersions++;
-        versionsSize += node->size;
-    }
-    else
-    {
-        if (node->type == FILENODE)
-        {
-            numFiles++;
-            currentSize += node->size;
-        }
-        else
-        {
-            numFolders++;
-        }
-    }
-}
-
-MegaFolderInfo *TreeProcFolderInfo::getResult()
-{
-    return new MegaFolderInfoPrivate(numFiles, numFolders - 1, numVersions, currentSize, versionsSize);
-}
-
 MegaTimeZoneDetailsPrivate::MegaTimeZoneDetailsPrivate(vector<std::string> *timeZones, vector<int> *timeZoneOffsets, int defaultTimeZone)
 {
     this->timeZones = *timeZones;
@@ -22,6 +22,7 @@
 #include "mega.h"
 #include "mega/mediafileattribute.h"
 #include <cctype>
+#include <chrono>
 
 namespace mega {
 
@@ -927,8 +928,32 @@ bool MegaClient::warnlevel()
     return warned ? (warned = false) | true : false;
 }
 
-// returns a matching child node by UTF-8 name (does not resolve name clashes)
-// folder nodes take precedence over file nodes
+// name clashes are resolved the same way with and without the name index:
+// folder nodes take precedence over file nodes (unless skipfolders is set),
+// then the lowest handle wins
+static bool childnamepreferred(Node* n, Node* found, bool skipfolders)
+{
+    if (!found)
+    {
+        return true;
+    }
+
+    if (!skipfolders && (n->type == FILENODE) != (found->type == FILENODE))
+    {
+        return n->type != FILENODE;
+    }
+
+    return n->nodehandle < found->nodehandle;
+}
+
+static bool childhandleless(const Node* a, const Node* b)
+{
+    return a->nodehandle < b->nodehandle;
+}
+
+// returns a matching child node by UTF-8 name (see childnamepreferred() for
+// name clashes)
+// large folders are looked up through a hash of their children's names
 Node* MegaClient::childnodebyname(Node* p, const char* name, bool skipfolders)
 {
     string nname = name;
@@ -941,27 +966,40 @@ Node* MegaClient::childnodebyname(Node* p, const char* name, bool skipfolders)
 
     fsaccess->normalize(&nname);
 
-    for (node_list::iterator it = p->children.begin(); it != p->children.end(); it++)
+    loadchildren(p);
+
+    if (!p->childnames && childnameindexmin && p->children.size() >= childnameindexmin)
+    {
+        p->indexchildnames();
+    }
+
+    if (p->childnames)
     {
-        if (!strcmp(nname.c_str(), (*it)->displayname()))
+        pair<nodename_map::iterator, nodename_map::iterator> range = p->childnames->equal_range(nname);
+
+        for (nodename_map::iterator it = range.first; it != range.second; it++)
         {
-            if ((*it)->type != FILENODE && !skipfolders)
+            if (childnamepreferred(it->second, found, skipfolders))
             {
-                return *it;
+                found = it->second;
             }
+        }
 
+        return found;
+    }
+
+    for (node_list::iterator it = p->children.begin(); it != p->children.end(); it++)
+    {
+        if (!strcmp(nname.c_str(), (*it)->displayname()) && childnamepreferred(*it, found, skipfolders))
+        {
             found = *it;
-            if (skipfolders)
-            {
-                return found;
-            }
         }
     }
 
     return found;
 }
 
-// returns all the matching child nodes by UTF-8 name
+// returns all the matching child nodes by UTF-8 name, by handle
 vector<Node*> MegaClient::childnodesbyname(Node* p, const char* name, bool skipfolders)
 {
     string nname = name;
@@ -974,17 +1012,41 @@ vector<Node*> MegaClient::childnodesbyname(Node* p, const char* name, bool skipf
 
     fsaccess->normalize(&nname);
 
-    for (node_list::iterator it = p->children.begin(); it != p->children.end(); it++)
+    loadchildren(p);
+
+    if (!p->childnames && childnameindexmin && p->children.size() >= childnameindexmin)
+    {
+        p->indexchildnames();
+    }
+
+    if (p->childnames)
+    {
+        pair<nodename_map::iterator, nodename_map::iterator> range = p->childnames->equal_range(nname);
+
+        for (nodename_map::iterator it = range.first; it != range.second; it++)
+        {
+            if (it->second->type == FILENODE || !skipfolders)
+            {
+                found.push_back(it->second);
+            }
+        }
+    }
+    else
     {
-        if (nname == (*it)->displayname())
+        for (node_list::iterator it = p->children.begin(); it != p->children.end(); it++)
         {
-            if ((*it)->type == FILENODE || !skipfolders)
+            if (nname == (*it)->displayname())
             {
-                found.push_back(*it);
+                if ((*it)->type == FILENODE || !skipfolders)
+                {
+                    found.push_back(*it);
+                }
             }
         }
     }
 
+    std::sort(found.begin(), found.end(), childhandleless);
+
     return found;
 }
 
@@ -1011,6 +1073,8 @@ void MegaClient::init()
     syncsup = true;
     syncdownrequired = false;
     syncuprequired = false;
+    syncdownfull = false;
+    syncupfull = false;
 
     if (syncscanstate)
     {
@@ -1083,9 +1147,15 @@ MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, Db
     usehttps = true;
     orderdownloadedchunks = true;
 #endif
+
+    adaptivetransfers = false;
+    downloadsources = 1;
     
     fetchingnodes = false;
     fetchnodestag = 0;
+    fnstream = FNSTREAM_OFF;
+    fnstreampos = 0;
+    fnstreamresult = 0;
 
 #ifdef ENABLE_SYNC
     syncscanstate = false;
@@ -1138,6 +1208,21 @@ MegaClient::MegaClient(MegaApp* a, Waiter* w, HttpIO* h, FileSystemAccess* f, Db
     connections[PUT] = 3;
     connections[GET] = 4;
 
+    childnameindexmin = CHILDNAMEINDEXMIN;
+    maxsortedfolders = MAXSORTEDFOLDERS;
+    fetchscthreads = FETCHSCTHREADS;
+    applykeysthreads = APPLYKEYSTHREADS;
+    keypool = NULL;
+    cryptothreads = CRYPTOTHREADS;
+    cryptopool = NULL;
+#ifdef ENABLE_SYNC
+    syncscanthreads = SYNCSCANTHREADS;
+    scanpool = NULL;
+#endif
+    maxresidentnodes = 0;
+    lazynodes = false;
+    scwriter = true;
+
     int i;
 
     // initialize random client application instance ID (for detecting own
@@ -1192,7 +1277,44 @@ MegaClient::~MegaClient()
     delete sctable;
     delete tctable;
     delete dbaccess;
+    delete cryptopool;
+    delete keypool;
+#ifdef ENABLE_SYNC
+    delete scanpool;
+#endif
+}
+
+NodeKeyPool* MegaClient::nodekeypool()
+{
+    if (!keypool)
+    {
+        keypool = new NodeKeyPool(fsaccess, applykeysthreads);
+    }
+
+    return keypool;
+}
+
+TransferCryptoPool* MegaClient::transfercryptopool()
+{
+    if (!cryptopool)
+    {
+        cryptopool = new TransferCryptoPool(waiter, cryptothreads);
+    }
+
+    return cryptopool;
+}
+
+#ifdef ENABLE_SYNC
+SyncScanPool* MegaClient::syncscanpool()
+{
+    if (!scanpool)
+    {
+        scanpool = new SyncScanPool(fsaccess, waiter, syncscanthreads);
+    }
+
+    return scanpool;
 }
+#endif
 
 // nonblocking state machine executing all operations currently in progress
 void MegaClient::exec()
@@ -1600,12 +1722,19 @@ void MegaClient::exec()
                                 pendingcs->notifiedbufpos = pendingcs->bufpos;
                             }
                         }
+
+                        if (fnstream == FNSTREAM_RESULTS || fnstream == FNSTREAM_NODES)
+                        {
+                            procpartialresponse();
+                        }
                         break;
 
                     case REQ_SUCCESS:
                         abortlockrequest();
                         app->request_response_progress(pendingcs->bufpos, -1);
 
+                        restorepartialresponse();
+
                         if (pendingcs->in != "-3" && pendingcs->in != "-4")
                         {
                             if (*pendingcs->in.c_str() == '[')
@@ -1786,6 +1915,13 @@ void MegaClient::exec()
                     pendingcs->post(this);
 
                     reqs.nextRequest();
+
+                    // the node records of a fetchnodes response are processed
+                    // while they arrive
+                    fnstream = (fetchingnodes && reqs.incrementalcmd() >= 0) ? FNSTREAM_RESULTS : FNSTREAM_OFF;
+                    fnstreampos = 0;
+                    fnstreamresult = 0;
+                    pendingcs->incremental = fnstream != FNSTREAM_OFF;
                     continue;
                 }
                 else
@@ -2067,6 +2203,9 @@ void MegaClient::exec()
             }
         }
 
+        // submit the disk reads/writes queued by the transfer slots
+        fsaccess->processasync();
+
 
 #ifdef ENABLE_SYNC
         // verify filesystem fingerprints, disable deviating syncs
@@ -2105,6 +2244,8 @@ void MegaClient::exec()
                 syncsup = true;
                 syncactivity = true;
                 syncdownrequired = true;
+                syncdownfull = true;
+                syncupfull = true;
             }
         }
 
@@ -2143,6 +2284,15 @@ void MegaClient::exec()
             // process active syncs, stop doing so while transient local fs ops are pending
             if (syncs.size() || syncactivity)
             {
+                // queue the items listed and fingerprinted on the scan pool
+                for (it = syncs.begin(); it != syncs.end(); it++)
+                {
+                    if ((*it)->scanpending && ((*it)->state == SYNC_ACTIVE || (*it)->state == SYNC_INITIALSCAN))
+                    {
+                        (*it)->procscanresults();
+                    }
+                }
+
                 bool prevpending = false;
                 for (int q = syncfslockretry ? DirNotify::RETRY : DirNotify::DIREVENTS; q >= DirNotify::DIREVENTS; q--)
                 {
@@ -2269,7 +2419,8 @@ void MegaClient::exec()
                                     }
                                 }
 
-                                if (sync->state == SYNC_INITIALSCAN && q == DirNotify::DIREVENTS && !sync->dirnotify->notifyq[q].size())
+                                if (sync->state == SYNC_INITIALSCAN && q == DirNotify::DIREVENTS
+                                        && !sync->dirnotify->notifyq[q].size() && !sync->scanpending)
                                 {
                                     sync->changestate(SYNC_ACTIVE);
 
@@ -2277,6 +2428,7 @@ void MegaClient::exec()
                                     // FIXME: defer this until RETRY queue is processed
                                     sync->scanseqno++;
                                     sync->deletemissing(&sync->localroot);
+                                    sync->fullscancompleted();
                                 }
                             }
                         }
@@ -2300,7 +2452,8 @@ void MegaClient::exec()
                         totalpending += sync->dirnotify->notifyq[q].size();
                         if (q == DirNotify::DIREVENTS)
                         {
-                            scanningpending += sync->dirnotify->notifyq[q].size();
+                            totalpending += sync->scanpending;
+                            scanningpending += sync->dirnotify->notifyq[q].size() + sync->scanpending;
                         }
                         else if (!syncfslockretry && sync->dirnotify->notifyq[DirNotify::RETRY].size())
                         {
@@ -2386,6 +2539,12 @@ void MegaClient::exec()
 
                             break;
                         }
+
+                        // the scan pool wakes us up when its jobs complete
+                        if ((*it)->scanpending)
+                        {
+                            break;
+                        }
                     }
 
                     if (it == syncs.end())
@@ -2416,8 +2575,7 @@ void MegaClient::exec()
                                         << syncfslockretry << synccreate.size();
                             syncops = false;
 
-                            // FIXME: only syncup for subtrees that were actually
-                            // updated to reduce CPU load
+                            // (syncup() only descends into the subtrees flagged as dirty)
                             bool repeatsyncup = false;
                             bool syncupdone = false;
                             for (it = syncs.begin(); it != syncs.end(); it++)
@@ -2433,6 +2591,11 @@ void MegaClient::exec()
                             }
                             syncuprequired = !syncupdone || repeatsyncup;
 
+                            if (syncupdone && !repeatsyncup)
+                            {
+                                syncupfull = false;
+                            }
+
                             if (EVER(nds))
                             {
                                 if (!syncnagleretry || (nds - Waiter::ds) < syncnaglebt.backoffdelta())
@@ -2467,7 +2630,8 @@ void MegaClient::exec()
                                 if (sync->state == SYNC_ACTIVE || sync->state == SYNC_INITIALSCAN)
                                 {
                                     if (sync->dirnotify->notifyq[DirNotify::DIREVENTS].size()
-                                     || sync->dirnotify->notifyq[DirNotify::RETRY].size())
+                                     || sync->dirnotify->notifyq[DirNotify::RETRY].size()
+                                     || sync->scanpending)
                                     {
                                         break;
                                     }
@@ -2478,6 +2642,7 @@ void MegaClient::exec()
                                             // recursively delete all LocalNodes that were deleted (not moved or renamed!)
                                             sync->deletemissing(&sync->localroot);
                                             sync->cachenodes();
+                                            sync->fullscancompleted();
                                         }
 
                                         // if the directory events notification subsystem is permanently unavailable or
@@ -2500,6 +2665,7 @@ void MegaClient::exec()
                                                 }
                                                 scanfailed = true;
 
+                                                sync->startfullscan();
                                                 sync->scan(&sync->localroot.localname, NULL);
                                                 sync->dirnotify->error = 0;
                                                 sync->fullscan = true;
@@ -2582,6 +2748,7 @@ void MegaClient::exec()
                     // notify the app if a lock is being retried
                     if (success)
                     {
+                        syncdownfull = false;
                         syncuprequired = true;
                         syncdownretry = false;
                         syncactivity = true;
@@ -4218,7 +4385,7 @@ void MegaClient::initsc()
             // 3. write new or modified nodes, purge deleted nodes
             for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
             {
-                if (!(complete = sctable->put(CACHEDNODE, it->second, &key)))
+                if (!(complete = sctable->putnode(CACHEDNODE, it->second, &key)))
                 {
                     break;
                 }
@@ -4263,6 +4430,7 @@ void MegaClient::updatesc()
 {
     if (sctable)
     {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
         string t;
 
         sctable->get(CACHEDSCSN, &t);
@@ -4313,7 +4481,12 @@ void MegaClient::updatesc()
 
         if (complete)
         {
-            // 3. write new or modified nodes, purge deleted nodes
+            // 3. write new or modified nodes, purge deleted nodes (in
+            // batches, as a single action can touch many nodes)
+            vector<NodeColumns> putnodes;
+            dbrecord_vector putrecords;
+            vector<uint32_t> delrecords;
+
             for (node_vector::iterator it = nodenotify.begin(); it != nodenotify.end(); it++)
             {
                 char base64[12];
@@ -4322,21 +4495,36 @@ void MegaClient::updatesc()
                     if ((*it)->dbid)
                     {
                         LOG_verbose << "Removing node from database: " << (Base64::btoa((byte*)&((*it)->nodehandle),MegaClient::NODEHANDLE,base64) ? base64 : "");
-                        if (!(complete = sctable->del((*it)->dbid)))
-                        {
-                            break;
-                        }
+                        delrecords.push_back((*it)->dbid);
                     }
                 }
                 else
                 {
                     LOG_verbose << "Adding node to database: " << (Base64::btoa((byte*)&((*it)->nodehandle),MegaClient::NODEHANDLE,base64) ? base64 : "");
-                    if (!(complete = sctable->put(CACHEDNODE, *it, &key)))
+                    putrecords.push_back(pair<uint32_t, string>(0, string()));
+
+                    if (sctable->encode(CACHEDNODE, *it, &key, &putrecords.back().second))
                     {
-                        break;
+                        putrecords.back().first = (*it)->dbid;
+                        putnodes.push_back(NodeColumns(*it));
+                    }
+                    else
+                    {
+                        putrecords.pop_back();
                     }
                 }
             }
+
+            // the records below deleted trees go last, so that nodes moved
+            // out of them don't still point into them
+            complete = sctable->delnoderecords(&delrecords) && sctable->putnoderecords(&putnodes, &putrecords)
+                    && (deletedtrees.empty() || sctable->delnodetrees(&deletedtrees));
+
+            // until then, loadnode() keeps skipping the records below them
+            if (complete)
+            {
+                deletedtrees.clear();
+            }
         }
 
         if (complete)
@@ -4386,6 +4574,9 @@ void MegaClient::updatesc()
         LOG_debug << "Saving SCSN " << scsn << " with " << nodenotify.size() << " modified nodes, " << usernotify.size() << " users and " << pcrnotify.size() << " pcrs to local cache (" << complete << ")";
 #endif
         finalizesc(complete);
+
+        scstats.add(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        LOG_debug << "Local cache update blocked for " << scstats.lastus << " us (max: " << scstats.maxus << " us, updates: " << scstats.updates << ")";
     }
 }
 
@@ -4405,6 +4596,15 @@ void MegaClient::finalizesc(bool complete)
         delete sctable;
         sctable = NULL;
         pendingsccommit = false;
+
+        // nodes that are not resident can't be loaded anymore
+        deletedtrees.clear();
+
+        if (lazynodes)
+        {
+            lazynodes = false;
+            app->reload("Local cache lost");
+        }
     }
 }
 
@@ -4667,6 +4867,12 @@ void MegaClient::sc_updatenode()
                     Node* n;
                     bool notify = false;
 
+                    // nodes that are not in memory are updated in the cache
+                    if (lazynodes && nodes.find(h) == nodes.end() && updatecachednode(h, u, a, ts))
+                    {
+                        return;
+                    }
+
                     if ((n = nodebyhandle(h)))
                     {
                         if (u && n->owner != u)
@@ -4689,7 +4895,7 @@ void MegaClient::sc_updatenode()
 
                         if (ts != -1 && n->ctime != ts)
                         {
-                            n->ctime = ts;
+                            n->setctime(ts);
                             n->changed.ctime = true;
                             notify = true;
                         }
@@ -6312,6 +6518,8 @@ void MegaClient::notifypurge(void)
     }
 #endif
 
+    unloadnodes();
+
     totalNodes = nodes.size();
 }
 
@@ -6322,10 +6530,236 @@ Node* MegaClient::nodebyhandle(handle h)
 
     if ((it = nodes.find(h)) != nodes.end())
     {
+        if (lazynodes && it->second->lru_it != lrunodes.end())
+        {
+            lrunodes.splice(lrunodes.end(), lrunodes, it->second->lru_it);
+        }
+
         return it->second;
     }
 
-    return NULL;
+    return lazynodes ? loadnode(h) : NULL;
+}
+
+// load a node from the local cache - its ancestors are loaded as well, so
+// that paths, shares and the subtree counters of resident nodes resolve
+Node* MegaClient::loadnode(handle h)
+{
+    uint32_t id;
+    string data;
+
+    if (!sctable || ISUNDEF(h) || !sctable->getnode(h, &id, &data))
+    {
+        return NULL;
+    }
+
+    return loadnode(id, &data);
+}
+
+Node* MegaClient::loadnode(uint32_t id, string* data)
+{
+    newshare_list shares;
+    node_vector orphans;
+    node_map::iterator it;
+    Node* n;
+
+    handle h, ph;
+    nodetype_t t;
+
+    if (!DbTable::decrypt(id, data, &key) || !Node::peek(data, &h, &ph, &t))
+    {
+        LOG_err << "Failed - node record read error";
+        return NULL;
+    }
+
+    // the record of a node that moved or was removed since the last cache
+    // update: the resident node prevails
+    if ((it = nodes.find(h)) != nodes.end())
+    {
+        return it->second;
+    }
+
+    // records of and below a tree deleted since the last cache update go
+    // with it
+    if (deletedtrees.size())
+    {
+        if (std::find(deletedtrees.begin(), deletedtrees.end(), h) != deletedtrees.end())
+        {
+            return NULL;
+        }
+
+        if (!ISUNDEF(ph))
+        {
+            Node* p = nodebyhandle(ph);
+
+            if (!p || p->changed.removed)
+            {
+                return NULL;
+            }
+        }
+    }
+
+    if (!(n = Node::unserialize(this, (const string*)data, &shares)))
+    {
+        LOG_err << "Failed - node record read error";
+        return NULL;
+    }
+
+    n->dbid = id;
+    n->attach(&orphans);
+    n->setfingerprint();
+
+    if (shares.size())
+    {
+        newshares.splice(newshares.end(), shares);
+        mergenewshares(0);
+    }
+
+    return n;
+}
+
+// the update is applied to a detached copy of the node, which is written
+// back and discarded - the app is not notified, as it only learns about
+// nodes in memory
+bool MegaClient::updatecachednode(handle h, handle u, const char* a, m_time_t ts)
+{
+    uint32_t id;
+    string data;
+    newshare_list shares;
+    Node* n;
+
+    if (!sctable || !sctable->getnode(h, &id, &data) || !DbTable::decrypt(id, &data, &key)
+     || !(n = Node::unserialize(this, (const string*)&data, &shares)))
+    {
+        return false;
+    }
+
+    if (u)
+    {
+        n->owner = u;
+    }
+
+    if (a)
+    {
+        if (!n->attrstring)
+        {
+            n->attrstring = new string;
+        }
+        Node::copystring(n->attrstring, a);
+    }
+
+    if (ts != -1)
+    {
+        n->setctime(ts);
+    }
+
+    n->applykey();
+    n->setattr();
+
+    // the record keeps its parent, which is not attached
+    NodeColumns columns(n);
+    columns.parenthandle = n->parenthandle;
+
+    bool updated = false;
+    data.clear();
+
+    if (n->serialize(&data, n->parenthandle))
+    {
+        PaddedCBC::encrypt(rng, &data, &key);
+        updated = sctable->putnode(id, &columns, &data);
+    }
+
+    Node::discardshares(&shares);
+    delete n;
+
+    return updated;
+}
+
+// counters of a subtree, from the node table while nodes are loaded on
+// demand
+NodeCounter MegaClient::subtreecounter(Node* n)
+{
+    NodeCounter counter;
+
+    if (lazynodes && n->type != FILENODE && sctable && sctable->getsubtreecounter(n->nodehandle, &counter))
+    {
+        return counter;
+    }
+
+    return n->subtreecounter;
+}
+
+// load all children of a node from the local cache
+void MegaClient::loadchildren(Node* n)
+{
+    dbrecord_vector records;
+    set<uint32_t> resident;
+
+    if (!lazynodes || !n || n->childrenloaded || !sctable
+     || !sctable->getchildren(n->nodehandle, &records))
+    {
+        return;
+    }
+
+    for (node_list::iterator it = n->children.begin(); it != n->children.end(); it++)
+    {
+        resident.insert((*it)->dbid);
+    }
+
+    for (dbrecord_vector::iterator it = records.begin(); it != records.end(); it++)
+    {
+        if (!resident.count(it->first))
+        {
+            loadnode(it->first, &it->second);
+        }
+    }
+
+    n->childrenloaded = true;
+}
+
+// evict least recently used nodes that are cached and not referenced from
+// elsewhere in the client - leaves go first, their parents become leaves
+// in later passes
+void MegaClient::unloadnodes()
+{
+    if (!lazynodes || nodes.size() <= maxresidentnodes)
+    {
+        return;
+    }
+
+    for (node_list::iterator it = lrunodes.begin(); it != lrunodes.end() && nodes.size() > maxresidentnodes; )
+    {
+        Node* n = *it++;
+
+        if (!n->dbid || n->notified || n->children.size() || n->type > FOLDERNODE
+         || n->inshare || n->outshares || n->pendingshares || n->sharekey || n->plink || n->appdata)
+        {
+            continue;
+        }
+
+#ifdef ENABLE_SYNC
+        if (n->localnode || n->syncget || n->todebris_it != todebris.end() || n->tounlink_it != tounlink.end())
+        {
+            continue;
+        }
+#endif
+
+        handle h = n->nodehandle;
+        encodehandletype(&h, true);
+
+        if (hdrns.find(h) != hdrns.end())
+        {
+            continue;
+        }
+
+        if (n->parent)
+        {
+            n->parent->childrenloaded = false;
+        }
+
+        nodes.erase(n->nodehandle);
+        delete n;
+    }
 }
 
 // server-client deletion
@@ -6404,6 +6838,11 @@ void MegaClient::makeattr(SymmCipher* key, string* attrstring, const char* json,
 // (with speculative instant completion)
 error MegaClient::setattr(Node* n, const char *prevattr)
 {
+    // the name may have been changed in place by the caller
+    n->updatechildname();
+    n->updatechildorders();
+    searchindex.update(n);
+
     if (!checkaccess(n, FULL))
     {
         return API_EACCESS;
@@ -6821,7 +7260,7 @@ uint64_t MegaClient::stringhash64(string* s, SymmCipher* c)
 }
 
 // read and add/verify node array
-int MegaClient::readnodes(JSON* j, int notify, putsource_t source, NewNode* nn, int nnsize, int tag)
+int MegaClient::readnodes(JSON* j, int notify, putsource_t source, NewNode* nn, int nnsize, int tag, node_vector* pending)
 {
     if (!j->enterarray())
     {
@@ -6831,303 +7270,462 @@ int MegaClient::readnodes(JSON* j, int notify, putsource_t source, NewNode* nn,
     node_vector dp;
     Node* n;
 
-    while (j->enterobject())
+    if (pending)
     {
-        handle h = UNDEF, ph = UNDEF;
-        handle u = 0, su = UNDEF;
-        nodetype_t t = TYPE_UNKNOWN;
-        const char* a = NULL;
-        const char* k = NULL;
-        const char* fa = NULL;
-        const char *sk = NULL;
-        accesslevel_t rl = ACCESS_UNKNOWN;
-        m_off_t s = NEVER;
-        m_time_t ts = -1, sts = -1;
-        nameid name;
-        int nni = -1;
+        dp.swap(*pending);
+    }
 
-        while ((name = j->getnameid()) != EOO)
+    while (j->enterobject())
+    {
+        if (!readnode(j, notify, source, nn, nnsize, tag, &dp))
         {
-            switch (name)
-            {
-                case 'h':   // new node: handle
-                    h = j->gethandle();
-                    break;
+            return 0;
+        }
+    }
 
-                case 'p':   // parent node
-                    ph = j->gethandle();
-                    break;
+    // any child nodes that arrived before their parents?
+    for (size_t i = dp.size(); i--; )
+    {
+        if ((n = nodebyhandle(dp[i]->parenthandle)))
+        {
+            dp[i]->setparent(n);
+        }
+    }
 
-                case 'u':   // owner user
-                    u = j->gethandle(USERHANDLE);
-                    break;
+    return j->leavearray();
+}
 
-                case 't':   // type
-                    t = (nodetype_t)j->getint();
-                    break;
+// read a single node object (after enterobject()) - nodes whose parent is
+// not known yet are queued in dp
+bool MegaClient::readnode(JSON* j, int notify, putsource_t source, NewNode* nn, int nnsize, int tag, node_vector* dp)
+{
+    Node* n;
+    handle h = UNDEF, ph = UNDEF;
+    handle u = 0, su = UNDEF;
+    nodetype_t t = TYPE_UNKNOWN;
+    const char* a = NULL;
+    const char* k = NULL;
+    const char* fa = NULL;
+    const char *sk = NULL;
+    accesslevel_t rl = ACCESS_UNKNOWN;
+    m_off_t s = NEVER;
+    m_time_t ts = -1, sts = -1;
+    nameid name;
+    int nni = -1;
 
-                case 'a':   // attributes
-                    a = j->getvalue();
-                    break;
+    while ((name = j->getnameid()) != EOO)
+    {
+        switch (name)
+        {
+            case 'h':   // new node: handle
+                h = j->gethandle();
+                break;
 
-                case 'k':   // key(s)
-                    k = j->getvalue();
-                    break;
+            case 'p':   // parent node
+                ph = j->gethandle();
+                break;
 
-                case 's':   // file size
-                    s = j->getint();
-                    break;
+            case 'u':   // owner user
+                u = j->gethandle(USERHANDLE);
+                break;
 
-                case 'i':   // related source NewNode index
-                    nni = int(j->getint());
-                    break;
+            case 't':   // type
+                t = (nodetype_t)j->getint();
+                break;
 
-                case MAKENAMEID2('t', 's'):  // actual creation timestamp
-                    ts = j->getint();
-                    break;
+            case 'a':   // attributes
+                a = j->getvalue();
+                break;
 
-                case MAKENAMEID2('f', 'a'):  // file attributes
-                    fa = j->getvalue();
-                    break;
+            case 'k':   // key(s)
+                k = j->getvalue();
+                break;
 
-                    // inbound share attributes
-                case 'r':   // share access level
-                    rl = (accesslevel_t)j->getint();
-                    break;
+            case 's':   // file size
+                s = j->getint();
+                break;
 
-                case MAKENAMEID2('s', 'k'):  // share key
-                    sk = j->getvalue();
-                    break;
+            case 'i':   // related source NewNode index
+                nni = int(j->getint());
+                break;
 
-                case MAKENAMEID2('s', 'u'):  // sharing user
-                    su = j->gethandle(USERHANDLE);
-                    break;
+            case MAKENAMEID2('t', 's'):  // actual creation timestamp
+                ts = j->getint();
+                break;
 
-                case MAKENAMEID3('s', 't', 's'):  // share timestamp
-                    sts = j->getint();
-                    break;
+            case MAKENAMEID2('f', 'a'):  // file attributes
+                fa = j->getvalue();
+                break;
 
-                default:
-                    if (!j->storeobject())
-                    {
-                        return 0;
-                    }
-            }
+                // inbound share attributes
+            case 'r':   // share access level
+                rl = (accesslevel_t)j->getint();
+                break;
+
+            case MAKENAMEID2('s', 'k'):  // share key
+                sk = j->getvalue();
+                break;
+
+            case MAKENAMEID2('s', 'u'):  // sharing user
+                su = j->gethandle(USERHANDLE);
+                break;
+
+            case MAKENAMEID3('s', 't', 's'):  // share timestamp
+                sts = j->getint();
+                break;
+
+            default:
+                if (!j->storeobject())
+                {
+                    return 0;
+                }
         }
+    }
 
-        if (ISUNDEF(h))
+    if (ISUNDEF(h))
+    {
+        warn("Missing node handle");
+    }
+    else
+    {
+        if (t == TYPE_UNKNOWN)
         {
-            warn("Missing node handle");
+            warn("Unknown node type");
         }
-        else
+        else if (t == FILENODE || t == FOLDERNODE)
+        {
+            if (ISUNDEF(ph))
+            {
+                warn("Missing parent");
+            }
+            else if (!a)
+            {
+                warn("Missing node attributes");
+            }
+            else if (!k)
+            {
+                warn("Missing node key");
+            }
+
+            if (t == FILENODE && ISUNDEF(s))
+            {
+                warn("File node without file size");
+            }
+        }
+    }
+
+    if (fa && t != FILENODE)
+    {
+        warn("Spurious file attributes");
+    }
+
+    if (!warnlevel())
+    {
+        if ((n = nodebyhandle(h)))
         {
-            if (t == TYPE_UNKNOWN)
+            Node* p = NULL;
+            if (!ISUNDEF(ph))
+            {
+                p = nodebyhandle(ph);
+            }
+
+            if (n->changed.removed)
             {
-                warn("Unknown node type");
+                // node marked for deletion is being resurrected, possibly
+                // with a new parent (server-client move operation)
+                n->changed.removed = false;
             }
-            else if (t == FILENODE || t == FOLDERNODE)
+            else
             {
-                if (ISUNDEF(ph))
+                // node already present - check for race condition
+                if ((n->parent && ph != n->parent->nodehandle && p &&  p->type != FILENODE) || n->type != t)
                 {
-                    warn("Missing parent");
+                    app->reload("Node inconsistency");
+
+                    static bool reloadnotified = false;
+                    if (!reloadnotified)
+                    {
+                        sendevent(99437, "Node inconsistency", 0);
+                        reloadnotified = true;
+                    }
                 }
-                else if (!a)
+            }
+
+            if (!ISUNDEF(ph))
+            {
+                if (p)
                 {
-                    warn("Missing node attributes");
+                    n->setparent(p);
+                    n->changed.parent = true;
                 }
-                else if (!k)
+                else
                 {
-                    warn("Missing node key");
+                    n->setparent(NULL);
+                    n->parenthandle = ph;
+                    dp->push_back(n);
                 }
+            }
 
-                if (t == FILENODE && ISUNDEF(s))
-                {
-                    warn("File node without file size");
-                }
+            if (a && k && n->attrstring)
+            {
+                LOG_warn << "Updating the key of a NO_KEY node";
+                Node::copystring(n->attrstring, a);
+                Node::copystring(&n->nodekey, k);
             }
         }
-
-        if (fa && t != FILENODE)
+        else
         {
-            warn("Spurious file attributes");
-        }
+            byte buf[SymmCipher::KEYLENGTH];
 
-        if (!warnlevel())
-        {
-            if ((n = nodebyhandle(h)))
+            if (!ISUNDEF(su))
             {
-                Node* p = NULL;
-                if (!ISUNDEF(ph))
+                if (t != FOLDERNODE)
                 {
-                    p = nodebyhandle(ph);
+                    warn("Invalid share node type");
                 }
 
-                if (n->changed.removed)
+                if (rl == ACCESS_UNKNOWN)
                 {
-                    // node marked for deletion is being resurrected, possibly
-                    // with a new parent (server-client move operation)
-                    n->changed.removed = false;
+                    warn("Missing access level");
                 }
-                else
-                {
-                    // node already present - check for race condition
-                    if ((n->parent && ph != n->parent->nodehandle && p &&  p->type != FILENODE) || n->type != t)
-                    {
-                        app->reload("Node inconsistency");
 
-                        static bool reloadnotified = false;
-                        if (!reloadnotified)
-                        {
-                            sendevent(99437, "Node inconsistency", 0);
-                            reloadnotified = true;
-                        }
-                    }
+                if (!sk)
+                {
+                    LOG_warn << "Missing share key for inbound share";
                 }
 
-                if (!ISUNDEF(ph))
+                if (warnlevel())
                 {
-                    if (p)
-                    {
-                        n->setparent(p);
-                        n->changed.parent = true;
-                    }
-                    else
+                    su = UNDEF;
+                }
+                else
+                {
+                    if (sk)
                     {
-                        n->setparent(NULL);
-                        n->parenthandle = ph;
-                        dp.push_back(n);
+                        decryptkey(sk, buf, sizeof buf, &key, 1, h);
                     }
                 }
+            }
 
-                if (a && k && n->attrstring)
-                {
-                    LOG_warn << "Updating the key of a NO_KEY node";
-                    Node::copystring(n->attrstring, a);
-                    Node::copystring(&n->nodekey, k);
-                }
+            string fas;
+
+            Node::copystring(&fas, fa);
+
+            // fallback timestamps
+            if (!(ts + 1))
+            {
+                ts = m_time();
             }
-            else
+
+            if (!(sts + 1))
+            {
+                sts = ts;
+            }
+
+            n = new Node(this, dp, h, ph, t, s, u, fas.c_str(), ts);
+
+            n->tag = tag;
+
+            n->attrstring = new string;
+            Node::copystring(n->attrstring, a);
+            Node::copystring(&n->nodekey, k);
+
+            if (!ISUNDEF(su))
+            {
+                newshares.push_back(new NewShare(h, 0, su, rl, sts, sk ? buf : NULL));
+            }
+
+            if (u != me && !ISUNDEF(u) && !fetchingnodes)
+            {
+                useralerts.noteSharedNode(u, t, ts, n);
+            }
+
+            if (nn && nni >= 0 && nni < nnsize)
             {
-                byte buf[SymmCipher::KEYLENGTH];
+                nn[nni].added = true;
 
-                if (!ISUNDEF(su))
+#ifdef ENABLE_SYNC
+                if (source == PUTNODES_SYNC)
                 {
-                    if (t != FOLDERNODE)
+                    if (nn[nni].localnode)
                     {
-                        warn("Invalid share node type");
-                    }
+                        // overwrites/updates: associate LocalNode with newly created Node
+                        nn[nni].localnode->setnode(n);
+                        nn[nni].localnode->newnode = NULL;
+                        nn[nni].localnode->treestate(TREESTATE_SYNCED);
 
-                    if (rl == ACCESS_UNKNOWN)
-                    {
-                        warn("Missing access level");
+                        // updates cache with the new node associated
+                        nn[nni].localnode->sync->statecacheadd(nn[nni].localnode);
                     }
+                }
+#endif
 
-                    if (!sk)
-                    {
-                        LOG_warn << "Missing share key for inbound share";
-                    }
+                if (nn[nni].source == NEW_UPLOAD)
+                {
+                    handle uh = nn[nni].uploadhandle;
 
-                    if (warnlevel())
+                    // do we have pending file attributes for this upload? set them.
+                    for (fa_map::iterator it = pendingfa.lower_bound(pair<handle, fatype>(uh, 0));
+                         it != pendingfa.end() && it->first.first == uh; )
                     {
-                        su = UNDEF;
-                    }
-                    else
-                    {
-                        if (sk)
-                        {
-                            decryptkey(sk, buf, sizeof buf, &key, 1, h);
-                        }
+                        reqs.add(new CommandAttachFA(this, h, it->first.second, it->second.first, it->second.second));
+                        pendingfa.erase(it++);
                     }
-                }
 
-                string fas;
+                    // FIXME: only do this for in-flight FA writes
+                    uhnh.insert(pair<handle, handle>(uh, h));
+                }
+            }
+        }
 
-                Node::copystring(&fas, fa);
+        if (notify)
+        {
+            notifynode(n);
+        }
+    }
 
-                // fallback timestamps
-                if (!(ts + 1))
-                {
-                    ts = m_time();
-                }
+    return true;
+}
 
-                if (!(sts + 1))
-                {
-                    sts = ts;
-                }
+// process the fetchnodes response while it is being received: once its
+// result starts, the results of the preceding commands are processed and
+// the node tree is purged as procresult() would do, then complete node
+// records are read and purged from the buffer, so that the response is never
+// held in full. The remainder is processed by procresult() as usual, after
+// prepending the part of the response that precedes the node records.
+void MegaClient::procpartialresponse()
+{
+    static const char nodes[] = "{\"f\":[";
+    HttpReq* req = pendingcs;
 
-                n = new Node(this, &dp, h, ph, t, s, u, fas.c_str(), ts);
+    for (;;)
+    {
+        const char* ptr = req->data();
+        size_t len = req->size();
 
-                n->tag = tag;
+        if (fnstreampos < len && ptr[fnstreampos] == ',')
+        {
+            fnstreampos++;
+        }
 
-                n->attrstring = new string;
-                Node::copystring(n->attrstring, a);
-                Node::copystring(&n->nodekey, k);
+        if (fnstreampos >= len)
+        {
+            break;
+        }
 
-                if (!ISUNDEF(su))
+        if (fnstream == FNSTREAM_RESULTS)
+        {
+            if (!fnstreampos)
+            {
+                if (*ptr != '[')
                 {
-                    newshares.push_back(new NewShare(h, 0, su, rl, sts, sk ? buf : NULL));
+                    fnstream = FNSTREAM_OFF;
+                    return;
                 }
 
-                if (u != me && !ISUNDEF(u) && !fetchingnodes)
+                fnstreampos++;
+                continue;
+            }
+
+            int cmd = reqs.incrementalcmd();
+
+            if (fnstreamresult < cmd)
+            {
+                // result of a preceding command
+                size_t l = JSON::valuelength(ptr + fnstreampos, len - fnstreampos);
+
+                if (!l)
                 {
-                    useralerts.noteSharedNode(u, t, ts, n);
+                    return;
                 }
 
-                if (nn && nni >= 0 && nni < nnsize)
-                {
-                    nn[nni].added = true;
+                fnstreampos += l;
+                fnstreamresult++;
+                continue;
+            }
 
-#ifdef ENABLE_SYNC
-                    if (source == PUTNODES_SYNC)
-                    {
-                        if (nn[nni].localnode)
-                        {
-                            // overwrites/updates: associate LocalNode with newly created Node
-                            nn[nni].localnode->setnode(n);
-                            nn[nni].localnode->newnode = NULL;
-                            nn[nni].localnode->treestate(TREESTATE_SYNCED);
+            if (len - fnstreampos < sizeof nodes - 1)
+            {
+                return;
+            }
 
-                            // updates cache with the new node associated
-                            nn[nni].localnode->sync->statecacheadd(nn[nni].localnode);
-                        }
-                    }
-#endif
+            if (cmd < 0 || memcmp(ptr + fnstreampos, nodes, sizeof nodes - 1))
+            {
+                // error or unexpected layout: process the full response
+                fnstream = FNSTREAM_OFF;
+                return;
+            }
 
-                    if (nn[nni].source == NEW_UPLOAD)
-                    {
-                        handle uh = nn[nni].uploadhandle;
+            fnstreampos += sizeof nodes - 1;
+            fnstreamprefix.assign(ptr, fnstreampos);
 
-                        // do we have pending file attributes for this upload? set them.
-                        for (fa_map::iterator it = pendingfa.lower_bound(pair<handle, fatype>(uh, 0));
-                             it != pendingfa.end() && it->first.first == uh; )
-                        {
-                            reqs.add(new CommandAttachFA(this, h, it->first.second, it->second.first, it->second.second));
-                            pendingfa.erase(it++);
-                        }
+            if (cmd)
+            {
+                json.begin(fnstreamprefix.c_str() + 1);
 
-                        // FIXME: only do this for in-flight FA writes
-                        uhnh.insert(pair<handle, handle>(uh, h));
-                    }
+                if (!reqs.procresults(this, cmd) || pendingcs != req)
+                {
+                    fnstream = FNSTREAM_OFF;
+                    return;
                 }
             }
 
-            if (notify)
+            purgenodesusersabortsc();
+
+            req->purge(fnstreampos);
+            fnstreampos = 0;
+            fnstream = FNSTREAM_NODES;
+        }
+        else if (fnstream == FNSTREAM_NODES)
+        {
+            if (ptr[fnstreampos] == ']')
             {
-                notifynode(n);
+                fnstream = FNSTREAM_END;
+                break;
+            }
+
+            size_t l = JSON::valuelength(ptr + fnstreampos, len - fnstreampos);
+
+            if (!l)
+            {
+                break;
+            }
+
+            JSON j;
+            j.begin(ptr + fnstreampos);
+
+            if (!j.enterobject() || !readnode(&j, 0, PUTNODES_APP, NULL, 0, 0, &fnstreamdp))
+            {
+                // leave the record to procresult() for error handling
+                fnstream = FNSTREAM_END;
+                break;
             }
+
+            fnstreampos += l;
+        }
+        else
+        {
+            return;
         }
     }
 
-    // any child nodes that arrived before their parents?
-    for (size_t i = dp.size(); i--; )
+    if (fnstream != FNSTREAM_RESULTS && fnstreampos)
     {
-        if ((n = nodebyhandle(dp[i]->parenthandle)))
-        {
-            dp[i]->setparent(n);
-        }
+        req->purge(fnstreampos);
+        fnstreampos = 0;
     }
+}
 
-    return j->leavearray();
+// prepend the part of the response that precedes the node records that
+// were processed and purged by procpartialresponse()
+void MegaClient::restorepartialresponse()
+{
+    if (fnstream == FNSTREAM_NODES || fnstream == FNSTREAM_END)
+    {
+        pendingcs->in.replace(0, pendingcs->inpurge, fnstreamprefix);
+        pendingcs->inpurge = 0;
+        fnstreamprefix.clear();
+    }
 }
 
 // decrypt and set encrypted sharekey
@@ -7528,27 +8126,108 @@ void MegaClient::procph(JSON *j)
 int MegaClient::applykeys()
 {
     int t = 0;
+    vector<NodeKeyDecryption> decryptions;
+    vector<SymmCipher*> ciphers;
+    const char* k;
+    SymmCipher* sc;
 
     // FIXME: rather than iterating through the whole node set, maintain subset
     // with missing keys
     for (node_map::iterator it = nodes.begin(); it != nodes.end(); it++)
     {
-        if (it->second->applykey())
+        if (it->second->findkey(&k, &sc))
         {
-            t++;
+            decryptions.push_back(NodeKeyDecryption());
+            decryptions.back().node = it->second;
+            decryptions.back().wrapped = k;
+            ciphers.push_back(sc);
         }
     }
 
-    if (sharekeyrewrite.size())
-    {
-        reqs.add(new CommandShareKeyUpdate(this, &sharekeyrewrite));
-        sharekeyrewrite.clear();
-    }
+    t = int(decryptions.size());
 
-    if (nodekeyrewrite.size())
+    size_t numthreads = std::min(decryptions.size() / APPLYKEYSBATCH, size_t(applykeysthreads));
+
+    if (numthreads < 2)
     {
-        reqs.add(new CommandNodeKeyUpdate(this, &nodekeyrewrite));
-        nodekeyrewrite.clear();
+        for (size_t i = 0; i < decryptions.size(); i++)
+        {
+            decryptions[i].node->unwrapkey(decryptions[i].wrapped, ciphers[i]);
+        }
+    }
+    else
+    {
+        // RSA-encrypted keys are unwrapped here (see decryptkey()), the
+        // remaining work is split into contiguous ranges for the key pool
+        for (size_t i = 0; i < decryptions.size(); i++)
+        {
+            NodeKeyDecryption* d = &decryptions[i];
+            Node* n = d->node;
+
+            d->keylength = (n->type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
+            d->unwrapped = strcspn(d->wrapped, "\"/") > 4 * FILENODEKEYLENGTH / 3 + 1;
+            memcpy(d->wrapkey, ciphers[i]->key, sizeof d->wrapkey);
+
+            if (d->unwrapped && !decryptkey(d->wrapped, d->key, d->keylength, ciphers[i], 0, n->nodehandle))
+            {
+                d->node = NULL;
+            }
+        }
+
+        vector<NodeKeyRange> ranges(numthreads);
+        NodeKeyPool* pool = nodekeypool();
+
+        for (size_t i = 0; i < numthreads; i++)
+        {
+            size_t first = decryptions.size() * i / numthreads;
+
+            ranges[i].decryptions = &decryptions[first];
+            ranges[i].count = decryptions.size() * (i + 1) / numthreads - first;
+            pool->push(&ranges[i]);
+        }
+
+        for (size_t i = 0; i < numthreads; i++)
+        {
+            pool->wait(&ranges[i]);
+        }
+
+        // merged in node order, as applykey() would have done it
+        for (size_t i = 0; i < decryptions.size(); i++)
+        {
+            NodeKeyDecryption* d = &decryptions[i];
+            Node* n = d->node;
+
+            if (!n)
+            {
+                continue;
+            }
+
+            if (!d->unwrapped)
+            {
+                LOG_warn << "Corrupt or invalid symmetric node key";
+                continue;
+            }
+
+            n->nodekey.assign((const char*)d->key, d->keylength);
+
+            if (d->attrsdecrypted)
+            {
+                n->attrs.map.swap(d->attrs);
+                n->setattrcompleted();
+            }
+        }
+    }
+
+    if (sharekeyrewrite.size())
+    {
+        reqs.add(new CommandShareKeyUpdate(this, &sharekeyrewrite));
+        sharekeyrewrite.clear();
+    }
+
+    if (nodekeyrewrite.size())
+    {
+        reqs.add(new CommandNodeKeyUpdate(this, &nodekeyrewrite));
+        nodekeyrewrite.clear();
     }
 
     return t;
@@ -7943,6 +8622,11 @@ void MegaClient::opensctable()
         {
             sctable = dbaccess->open(rng, fsaccess, &dbname);
             pendingsccommit = false;
+
+            if (sctable && scwriter)
+            {
+                sctable = new StateCacheWriter(rng, sctable);
+            }
         }
     }
 }
@@ -8277,6 +8961,11 @@ void MegaClient::proctree(Node* n, TreeProc* tp, bool skipinshares, bool skipver
 {
     if (!skipversions || n->type != FILENODE)
     {
+        if (!tp->residentonly())
+        {
+            loadchildren(n);
+        }
+
         for (node_list::iterator it = n->children.begin(); it != n->children.end(); )
         {
             Node *child = *it++;
@@ -8760,6 +9449,25 @@ void MegaClient::notifynode(Node* n)
         }
 
 #ifdef ENABLE_SYNC
+        if (syncs.size())
+        {
+            // flag the synced folders holding the previous and the current
+            // location of the node for the next syncdown() / syncup() passes
+            if (n->localnode)
+            {
+                n->localnode->setdirty();
+            }
+
+            for (Node* p = n->parent; p; p = p->parent)
+            {
+                if (p->localnode)
+                {
+                    p->localnode->setdirty();
+                    break;
+                }
+            }
+        }
+
         // is this a synced node that was moved to a non-synced location? queue for
         // deletion from LocalNodes.
         if (n->localnode && n->localnode->parent && n->parent && !n->parent->localnode)
@@ -10141,97 +10849,225 @@ bool MegaClient::fetchsc(DbTable* sctable)
     Node* n;
     User* u;
     PendingContactRequest* pcr;
-    node_vector dp;
+    node_vector loaded;
+    std::deque<StateCacheBatch*> pending;
+    StateCacheLoader loader(this, key.key, fetchscthreads);
+    size_t maxpending = 2 * fetchscthreads + 2;
+    bool hasNext, ok = true;
 
-    LOG_info << "Loading session from local cache";
+    // with a cache bound, only the root nodes and the shared nodes are
+    // loaded upfront
+    bool lazy = maxresidentnodes && sctable->rewindrecords();
 
-    sctable->rewind();
+    LOG_info << "Loading session from local cache" << (lazy ? " (nodes on demand)" : "");
+
+    if (!lazy)
+    {
+        sctable->rewind();
+    }
 
-    bool hasNext = sctable->next(&id, &data, &key);
+    // records are read here and decoded in batches by the loader - decoded
+    // batches are processed strictly in database order
+    hasNext = sctable->next(&id, &data, NULL);
     WAIT_CLASS::bumpds();
     fnstats.timeToFirstByte = Waiter::ds - fnstats.startTime;
 
-    while (hasNext)
+    while (ok && (hasNext || pending.size()))
     {
-        switch (id & 15)
+        if (hasNext && pending.size() < maxpending)
         {
-            case CACHEDSCSN:
-                if (data.size() != sizeof cachedscsn)
-                {
-                    return false;
-                }
-                break;
+            StateCacheBatch* batch = new StateCacheBatch();
 
-            case CACHEDNODE:
-                if ((n = Node::unserialize(this, &data, &dp)))
-                {
-                    n->dbid = id;
-                }
-                else
-                {
-                    LOG_err << "Failed - node record read error";
-                    return false;
-                }
-                break;
+            do
+            {
+                batch->ids.push_back(id);
+                batch->records.push_back(string());
+                batch->records.back().swap(data);
+            } while ((hasNext = sctable->next(&id, &data, NULL)) && batch->ids.size() < size_t(FETCHSCBATCH));
 
-            case CACHEDPCR:
-                if ((pcr = PendingContactRequest::unserialize(this, &data)))
-                {
-                    pcr->dbid = id;
-                }
-                else
-                {
-                    LOG_err << "Failed - pcr record read error";
-                    return false;
-                }
-                break;
+            if (!hasNext)
+            {
+                WAIT_CLASS::bumpds();
+                fnstats.timeToLastByte = Waiter::ds - fnstats.startTime;
+            }
 
-            case CACHEDUSER:
-                if ((u = User::unserialize(this, &data)))
-                {
-                    u->dbid = id;
-                }
-                else
-                {
-                    LOG_err << "Failed - user record read error";
-                    return false;
-                }
-                break;
+            loader.push(batch);
+            pending.push_back(batch);
+            continue;
+        }
 
-            case CACHEDCHAT:
-#ifdef ENABLE_CHAT
-                {
-                    TextChat *chat;
-                    if ((chat = TextChat::unserialize(this, &data)))
+        StateCacheBatch* batch = pending.front();
+        loader.wait(batch);
+
+        for (size_t i = 0; ok && i < batch->decrypted; i++)
+        {
+            id = batch->ids[i];
+
+            switch (id & 15)
+            {
+                case CACHEDSCSN:
+                    if (batch->records[i].size() != sizeof cachedscsn)
+                    {
+                        ok = false;
+                    }
+                    break;
+
+                case CACHEDNODE:
+                    if ((n = batch->nodes[i]))
                     {
-                        chat->dbid = id;
+                        batch->nodes[i] = NULL;
+                        n->dbid = id;
+                        n->attach(NULL);
+                        n->setfingerprint();
+                        newshares.splice(newshares.end(), batch->shares[i]);
+                        loaded.push_back(n);
                     }
                     else
                     {
-                        LOG_err << "Failed - chat record read error";
-                        return false;
+                        LOG_err << "Failed - node record read error";
+                        ok = false;
+                    }
+                    break;
+
+                case CACHEDPCR:
+                    if ((pcr = PendingContactRequest::unserialize(this, &batch->records[i])))
+                    {
+                        pcr->dbid = id;
+                    }
+                    else
+                    {
+                        LOG_err << "Failed - pcr record read error";
+                        ok = false;
+                    }
+                    break;
+
+                case CACHEDUSER:
+                    if ((u = User::unserialize(this, &batch->records[i])))
+                    {
+                        u->dbid = id;
+                    }
+                    else
+                    {
+                        LOG_err << "Failed - user record read error";
+                        ok = false;
+                    }
+                    break;
+
+                case CACHEDCHAT:
+#ifdef ENABLE_CHAT
+                    {
+                        TextChat *chat;
+                        if ((chat = TextChat::unserialize(this, &batch->records[i])))
+                        {
+                            chat->dbid = id;
+                        }
+                        else
+                        {
+                            LOG_err << "Failed - chat record read error";
+                            ok = false;
+                        }
                     }
-                }
 #endif
-                break;
+                    break;
+            }
+        }
+
+        // a record that can't be decrypted ends the cache
+        if (batch->decrypted < batch->ids.size())
+        {
+            hasNext = false;
+            while (pending.size() > 1)
+            {
+                loader.wait(pending.back());
+                delete pending.back();
+                pending.pop_back();
+            }
         }
-        hasNext = sctable->next(&id, &data, &key);
+
+        pending.pop_front();
+        delete batch;
+    }
+
+    // discard the batches that could not be processed
+    while (pending.size())
+    {
+        loader.wait(pending.front());
+        delete pending.front();
+        pending.pop_front();
+    }
+
+    if (fnstats.timeToLastByte == NEVER)
+    {
+        WAIT_CLASS::bumpds();
+        fnstats.timeToLastByte = Waiter::ds - fnstats.startTime;
+    }
+
+    if (!ok)
+    {
+        return false;
     }
 
     WAIT_CLASS::bumpds();
-    fnstats.timeToLastByte = Waiter::ds - fnstats.startTime;
+    fnstats.timeToDecoded = Waiter::ds - fnstats.startTime;
 
-    // any child nodes arrived before their parents?
-    for (size_t i = dp.size(); i--; )
+    // all nodes are known now: link them to their parents in a single pass
+    for (node_vector::iterator it = loaded.begin(); it != loaded.end(); it++)
     {
-        if ((n = nodebyhandle(dp[i]->parenthandle)))
+        if ((n = nodebyhandle((*it)->parenthandle)))
         {
-            dp[i]->setparent(n);
+            (*it)->setparent(n);
         }
     }
 
+    WAIT_CLASS::bumpds();
+    fnstats.timeToLinked = Waiter::ds - fnstats.startTime;
+
     mergenewshares(0);
 
+    if (lazy)
+    {
+        dbrecord_vector records;
+
+        lazynodes = true;
+
+        if (!sctable->getchildren(UNDEF, &records) || !sctable->getsharednodes(&records))
+        {
+            LOG_err << "Failed - node table read error";
+            lazynodes = false;
+            return false;
+        }
+
+        for (dbrecord_vector::iterator it = records.begin(); it != records.end(); it++)
+        {
+            if (!loadnode(it->first, &it->second))
+            {
+                lazynodes = false;
+                return false;
+            }
+        }
+    }
+
+    // caches of the previous layout: move the node records to the node table
+    if (sctable->legacynodes)
+    {
+        LOG_info << "Moving " << loaded.size() << " cached nodes to the node table";
+
+        sctable->begin();
+
+        for (node_vector::iterator it = loaded.begin(); it != loaded.end(); it++)
+        {
+            if (!sctable->del((*it)->dbid) || !sctable->putnode(CACHEDNODE, *it, &key))
+            {
+                LOG_err << "Failed to move cached nodes";
+                sctable->abort();
+                return true;
+            }
+        }
+
+        sctable->nodesmigrated();
+        sctable->commit();
+    }
+
     return true;
 }
 
@@ -10801,6 +11637,10 @@ void MegaClient::purgenodesusersabortsc()
 {
     app->clearing();
 
+    lazynodes = false;
+    deletedtrees.clear();
+    searchindex.clear();
+
     while (!hdrns.empty())
     {
         delete hdrns.begin()->second;
@@ -10849,6 +11689,7 @@ void MegaClient::purgenodesusersabortsc()
 
     newshares.clear();
 
+    fnstreamdp.clear();
     nodenotify.clear();
     usernotify.clear();
     pcrnotify.clear();
@@ -11311,6 +12152,14 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
         return true;
     }
 
+    // unchanged subtree
+    if (!l->syncdowndirty && !syncdownfull)
+    {
+        return true;
+    }
+
+    l->syncdowndirty = false;
+
     list<string> strings;
     remotenode_map nchildren;
     remotenode_map::iterator rit;
@@ -11321,6 +12170,8 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
     // remote children by name
     string localname;
 
+    loadchildren(l->node);
+
     // build child hash - nameclash resolution: use newest/largest version
     for (node_list::iterator it = l->node->children.begin(); it != l->node->children.end(); it++)
     {
@@ -11645,6 +12496,12 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
         localpath->resize(t);
     }
 
+    // come back for unfinished downloads, moves and retries
+    if (!success || nchildren.size())
+    {
+        l->setdirty();
+    }
+
     return success;
 }
 
@@ -11658,8 +12515,19 @@ bool MegaClient::syncdown(LocalNode* l, string* localpath, bool rubbish)
 // for creation
 bool MegaClient::syncup(LocalNode* l, dstime* nds)
 {
+    // unchanged subtree
+    if (!l->syncupdirty && !syncupfull)
+    {
+        return true;
+    }
+
+    l->syncupdirty = false;
+
     bool insync = true;
 
+    // set if a child still has to be created, uploaded or replaced
+    bool pending = false;
+
     list<string> strings;
     remotenode_map nchildren;
     remotenode_map::iterator rit;
@@ -11674,6 +12542,8 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
     {
         // corresponding remote node present: build child hash - nameclash
         // resolution: use newest version
+        loadchildren(l->node);
+
         for (node_list::iterator it = l->node->children.begin(); it != l->node->children.end(); it++)
         {
             // node must be alive
@@ -11769,6 +12639,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
             if (ll->type != rit->second->type)
             {
                 insync = false;
+                pending = true;
                 LOG_warn << "Type changed: " << localname << " LNtype: " << ll->type << " Ntype: " << rit->second->type;
                 movetosyncdebris(rit->second, l->sync->inshare);
             }
@@ -11943,6 +12814,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
                     // recurse into directories of equal name
                     if (!syncup(ll, nds))
                     {
+                        l->setdirty();
                         return false;
                     }
                     continue;
@@ -11954,6 +12826,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
         {
             // do not begin transfer until the file size / mtime has stabilized
             insync = false;
+            pending = true;
 
             if (ll->transfer)
             {
@@ -12081,6 +12954,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
         else
         {
             LOG_verbose << "Unsynced LocalNode (folder): " << ll->name;
+            pending = true;
         }
 
         if (ll->created)
@@ -12147,6 +13021,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
             if (synccreate.size() >= MAX_NEWNODES)
             {
                 LOG_warn << "Stopping syncup due to MAX_NEWNODES";
+                l->setdirty();
                 return false;
             }
         }
@@ -12155,6 +13030,7 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
         {
             if (!syncup(ll, nds))
             {
+                l->setdirty();
                 return false;
             }
         }
@@ -12165,6 +13041,12 @@ bool MegaClient::syncup(LocalNode* l, dstime* nds)
         l->treestate(TREESTATE_SYNCED);
     }
 
+    // come back until all children exist on both sides
+    if (pending)
+    {
+        l->setdirty();
+    }
+
     return true;
 }
 
@@ -12942,10 +13824,26 @@ void MegaClient::setmaxconnections(direction_t d, int num)
     }
 }
 
+// nodes loaded on demand: page in all cached nodes with the fingerprint
+void MegaClient::loadnodesbyfingerprint(FileFingerprint* fingerprint)
+{
+    dbrecord_vector records;
+
+    if (lazynodes && sctable && fingerprint->isvalid && sctable->getnodesbyfingerprint(fingerprint, &records))
+    {
+        for (dbrecord_vector::iterator it = records.begin(); it != records.end(); it++)
+        {
+            loadnode(it->first, &it->second);
+        }
+    }
+}
+
 Node* MegaClient::nodebyfingerprint(FileFingerprint* fingerprint)
 {
     fingerprint_set::iterator it;
 
+    loadnodesbyfingerprint(fingerprint);
+
     if ((it = fingerprints.find(fingerprint)) != fingerprints.end())
     {
         return (Node*)*it;
@@ -12957,6 +13855,9 @@ Node* MegaClient::nodebyfingerprint(FileFingerprint* fingerprint)
 node_vector *MegaClient::nodesbyfingerprint(FileFingerprint* fingerprint)
 {
     node_vector *nodes = new node_vector();
+
+    loadnodesbyfingerprint(fingerprint);
+
     pair<fingerprint_set::iterator, fingerprint_set::iterator> p = fingerprints.equal_range(fingerprint);
     for (fingerprint_set::iterator it = p.first; it != p.second; it++)
     {
@@ -13039,6 +13940,11 @@ m_off_t MegaClient::getmaxuploadspeed()
     return httpio->getmaxuploadspeed();
 }
 
+bool MegaClient::sethttp2(bool enable)
+{
+    return httpio->sethttp2(enable);
+}
+
 handle MegaClient::getovhandle(Node *parent, string *name)
 {
     handle ovhandle = UNDEF;
@@ -13250,6 +14156,1080 @@ FetchNodesStats::FetchNodesStats()
     init();
 }
 
+StateCacheBatch::StateCacheBatch()
+{
+    decrypted = 0;
+    done = false;
+}
+
+StateCacheBatch::~StateCacheBatch()
+{
+    // nodes that were not taken over by the client
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        delete nodes[i];
+
+        for (newshare_list::iterator it = shares[i].begin(); it != shares[i].end(); it++)
+        {
+            delete *it;
+        }
+    }
+}
+
+WorkerPool::WorkerPool(Waiter* cwaiter) : mutex(false)
+{
+    waiter = cwaiter;
+    exiting = false;
+    waiting = 0;
+    active = 0;
+}
+
+WorkerPool::~WorkerPool()
+{
+    assert(threads.empty());
+}
+
+void WorkerPool::startworkers(int numthreads)
+{
+    for (int i = 0; i < numthreads; i++)
+    {
+        THREAD_CLASS* thread = new THREAD_CLASS();
+        threads.push_back(thread);
+        thread->start(threadEntryPoint, this);
+    }
+}
+
+void WorkerPool::stopworkers()
+{
+    mutex.lock();
+    exiting = true;
+    mutex.unlock();
+
+    for (size_t i = threads.size(); i--; )
+    {
+        queued.release();
+    }
+
+    for (size_t i = 0; i < threads.size(); i++)
+    {
+        threads[i]->join();
+        delete threads[i];
+    }
+
+    threads.clear();
+}
+
+bool WorkerPool::hasworkers() const
+{
+    return threads.size() > 0;
+}
+
+void *WorkerPool::threadEntryPoint(void *param)
+{
+    static_cast<WorkerPool*>(param)->loop();
+    return NULL;
+}
+
+void WorkerPool::loop()
+{
+    for (;;)
+    {
+        queued.wait();
+
+        mutex.lock();
+        if (exiting)
+        {
+            mutex.unlock();
+            break;
+        }
+
+        if (jobs.empty())
+        {
+            // removed by the owner before being picked up
+            mutex.unlock();
+            continue;
+        }
+
+        void* job = jobs.front();
+        jobs.pop_front();
+        active++;
+        taken(job);
+        mutex.unlock();
+
+        process(job);
+
+        mutex.lock();
+        active--;
+        processed(job);
+        bool release = waiting > 0;
+        mutex.unlock();
+
+        if (release)
+        {
+            completed.release();
+        }
+
+        if (waiter)
+        {
+            waiter->notify();
+        }
+    }
+}
+
+void WorkerPool::enqueue(void* job)
+{
+    if (!threads.size())
+    {
+        process(job);
+
+        mutex.lock();
+        processed(job);
+        mutex.unlock();
+        return;
+    }
+
+    mutex.lock();
+    jobs.push_back(job);
+    mutex.unlock();
+
+    queued.release();
+}
+
+void WorkerPool::waitcompleted()
+{
+    waiting++;
+    mutex.unlock();
+    completed.wait();
+    mutex.lock();
+    waiting--;
+}
+
+StateCacheLoader::StateCacheLoader(MegaClient* cclient, const byte* ckey, int numthreads) : WorkerPool(NULL)
+{
+    client = cclient;
+    memcpy(key, ckey, sizeof key);
+
+    startworkers(numthreads);
+}
+
+StateCacheLoader::~StateCacheLoader()
+{
+    stopworkers();
+}
+
+void StateCacheLoader::process(void* job)
+{
+    StateCacheBatch* batch = static_cast<StateCacheBatch*>(job);
+    size_t count = batch->ids.size();
+    SymmCipher cipher;
+
+    cipher.setkey(key);
+    batch->nodes.resize(count);
+    batch->shares.resize(count);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        if (!DbTable::decrypt(batch->ids[i], &batch->records[i], &cipher))
+        {
+            break;
+        }
+
+        if ((batch->ids[i] & 15) == MegaClient::CACHEDNODE)
+        {
+            batch->nodes[i] = Node::unserialize(client, &batch->records[i], &batch->shares[i]);
+        }
+
+        batch->decrypted = i + 1;
+    }
+}
+
+void StateCacheLoader::processed(void* job)
+{
+    static_cast<StateCacheBatch*>(job)->done = true;
+}
+
+void StateCacheLoader::push(StateCacheBatch* batch)
+{
+    enqueue(batch);
+}
+
+void StateCacheLoader::wait(StateCacheBatch* batch)
+{
+    mutex.lock();
+
+    while (!batch->done)
+    {
+        waitcompleted();
+    }
+
+    mutex.unlock();
+}
+
+NodeKeyPool::NodeKeyPool(const FileSystemAccess* cfsaccess, int numthreads) : WorkerPool(NULL)
+{
+    fsaccess = cfsaccess;
+
+    startworkers(numthreads);
+}
+
+NodeKeyPool::~NodeKeyPool()
+{
+    stopworkers();
+}
+
+void NodeKeyPool::process(void* job)
+{
+    NodeKeyRange* range = static_cast<NodeKeyRange*>(job);
+
+    for (size_t i = 0; i < range->count; i++)
+    {
+        range->decryptions[i].decrypt(fsaccess);
+    }
+}
+
+void NodeKeyPool::processed(void* job)
+{
+    static_cast<NodeKeyRange*>(job)->done = true;
+}
+
+void NodeKeyPool::push(NodeKeyRange* range)
+{
+    enqueue(range);
+}
+
+void NodeKeyPool::wait(NodeKeyRange* range)
+{
+    mutex.lock();
+
+    while (!range->done)
+    {
+        waitcompleted();
+    }
+
+    mutex.unlock();
+}
+
+TransferCryptoPool::TransferCryptoPool(Waiter* cwaiter, int numthreads) : WorkerPool(cwaiter)
+{
+    startworkers(numthreads);
+}
+
+TransferCryptoPool::~TransferCryptoPool()
+{
+    stopworkers();
+}
+
+void TransferCryptoPool::process(void* job)
+{
+    static_cast<ChunkCrypto*>(job)->run();
+}
+
+void TransferCryptoPool::processed(void* job)
+{
+    static_cast<ChunkCrypto*>(job)->finished = true;
+}
+
+void TransferCryptoPool::push(ChunkCrypto* job)
+{
+    enqueue(job);
+}
+
+bool TransferCryptoPool::finished(ChunkCrypto* job)
+{
+    mutex.lock();
+    bool done = job->finished;
+    mutex.unlock();
+
+    return done;
+}
+
+void TransferCryptoPool::cancel(ChunkCrypto* job)
+{
+    mutex.lock();
+
+    std::deque<void*>::iterator it = std::find(jobs.begin(), jobs.end(), (void*)job);
+    if (it != jobs.end())
+    {
+        jobs.erase(it);
+        mutex.unlock();
+        return;
+    }
+
+    while (!job->finished)
+    {
+        waitcompleted();
+    }
+
+    mutex.unlock();
+}
+
+StateCacheWriter::Operation::Operation(int ctype)
+{
+    type = ctype;
+}
+
+size_t StateCacheWriter::Operation::size() const
+{
+    size_t bytes = ids.size() * sizeof(uint32_t) + handles.size() * sizeof(handle)
+                 + columns.size() * sizeof(NodeColumns);
+
+    for (dbrecord_vector::const_iterator it = records.begin(); it != records.end(); it++)
+    {
+        bytes += it->second.size();
+    }
+
+    return bytes;
+}
+
+StateCacheWriter::StateCacheWriter(PrnGen& rng, DbTable* ctable)
+    : DbTable(rng), WorkerPool(NULL)
+{
+    table = ctable;
+    legacynodes = table->legacynodes;
+    nextid = table->nextid;
+    pendingbytes = 0;
+    failed = false;
+    seqknown = false;
+    seqpresent = false;
+    maxpendingbytes = MAXPENDINGBYTES;
+    stalls = 0;
+
+    startworkers(1);
+}
+
+// queued operations are written before the table is closed
+StateCacheWriter::~StateCacheWriter()
+{
+    flush();
+    stopworkers();
+
+    delete table;
+}
+
+void StateCacheWriter::processed(void* job)
+{
+    Operation* operation = static_cast<Operation*>(job);
+
+    pendingbytes -= operation->size();
+    delete operation;
+}
+
+// apply an operation to the table (writer thread)
+void StateCacheWriter::process(void* job)
+{
+    Operation* operation = static_cast<Operation*>(job);
+    bool ok = true;
+
+    mutex.lock();
+    bool skip = failed;
+    mutex.unlock();
+
+    switch (operation->type)
+    {
+        case PUT:
+            ok = skip || table->putrecords(&operation->records);
+            break;
+
+        case DEL:
+            ok = skip || table->delrecords(&operation->ids);
+            break;
+
+        case PUTNODE:
+            ok = skip || table->putnoderecords(&operation->columns, &operation->records);
+            break;
+
+        case DELNODE:
+            ok = skip || table->delnoderecords(&operation->ids);
+            break;
+
+        case DELNODETREES:
+            ok = skip || table->delnodetrees(&operation->handles);
+            break;
+
+        case BEGIN:
+            table->begin();
+            break;
+
+        case COMMIT:
+            // never commit a partially written update
+            if (skip)
+            {
+                table->abort();
+            }
+            else
+            {
+                table->commit();
+            }
+            break;
+
+        case ABORT:
+            table->abort();
+            break;
+
+        case TRUNCATE:
+            table->truncate();
+            break;
+
+        case NODESMIGRATED:
+            if (!skip)
+            {
+                table->nodesmigrated();
+            }
+            break;
+    }
+
+    if (!ok)
+    {
+        LOG_err << "Local cache write error";
+
+        mutex.lock();
+        failed = true;
+        mutex.unlock();
+    }
+}
+
+// queue an operation, waiting for the thread to catch up if too much is
+// pending - false if a previous write failed
+bool StateCacheWriter::push(Operation* operation)
+{
+    size_t bytes = operation->size();
+
+    mutex.lock();
+
+    if (pendingbytes && pendingbytes + bytes > maxpendingbytes)
+    {
+        stalls++;
+
+        while (pendingbytes && pendingbytes + bytes > maxpendingbytes)
+        {
+            waitcompleted();
+        }
+    }
+
+    pendingbytes += bytes;
+    bool ok = !failed;
+    mutex.unlock();
+
+    enqueue(operation);
+    return ok;
+}
+
+// track the sequence number record through the queued operations
+void StateCacheWriter::queuedrecords(int type, dbrecord_vector* records, vector<uint32_t>* ids)
+{
+    switch (type)
+    {
+        case PUT:
+            for (dbrecord_vector::iterator it = records->begin(); it != records->end(); it++)
+            {
+                if (!it->first)
+                {
+                    seqknown = true;
+                    seqpresent = true;
+                    seqrecord = it->second;
+                }
+            }
+            break;
+
+        case DEL:
+            for (vector<uint32_t>::iterator it = ids->begin(); it != ids->end(); it++)
+            {
+                if (!*it)
+                {
+                    seqknown = true;
+                    seqpresent = false;
+                }
+            }
+            break;
+
+        case TRUNCATE:
+            seqknown = true;
+            seqpresent = false;
+            break;
+
+        case ABORT:
+            seqknown = false;
+            break;
+    }
+}
+
+// wait until all queued operations have been written
+void StateCacheWriter::flush()
+{
+    mutex.lock();
+
+    while (jobs.size() || active)
+    {
+        waitcompleted();
+    }
+
+    mutex.unlock();
+}
+
+void StateCacheWriter::rewind()
+{
+    flush();
+    table->rewind();
+}
+
+bool StateCacheWriter::rewindrecords()
+{
+    flush();
+    bool result = table->rewindrecords();
+    reserveid(table->nextid);
+    return result;
+}
+
+bool StateCacheWriter::next(uint32_t* index, string* data)
+{
+    flush();
+    return table->next(index, data);
+}
+
+bool StateCacheWriter::get(uint32_t index, string* data)
+{
+    if (!index && seqknown)
+    {
+        if (seqpresent)
+        {
+            *data = seqrecord;
+        }
+
+        return seqpresent;
+    }
+
+    flush();
+
+    bool result = table->get(index, data);
+
+    if (!index)
+    {
+        seqknown = true;
+        seqpresent = result;
+        seqrecord = result ? *data : string();
+    }
+
+    return result;
+}
+
+bool StateCacheWriter::put(uint32_t index, char* data, unsigned len)
+{
+    Operation* operation = new Operation(PUT);
+    operation->records.push_back(pair<uint32_t, string>(index, string(data, len)));
+    queuedrecords(PUT, &operation->records, NULL);
+    return push(operation);
+}
+
+bool StateCacheWriter::del(uint32_t index)
+{
+    Operation* operation = new Operation(DEL);
+    operation->ids.push_back(index);
+    queuedrecords(DEL, NULL, &operation->ids);
+    return push(operation);
+}
+
+bool StateCacheWriter::putrecords(dbrecord_vector* records)
+{
+    Operation* operation = new Operation(PUT);
+    operation->records = *records;
+    queuedrecords(PUT, &operation->records, NULL);
+    return push(operation);
+}
+
+bool StateCacheWriter::delrecords(vector<uint32_t>* indexes)
+{
+    Operation* operation = new Operation(DEL);
+    operation->ids = *indexes;
+    queuedrecords(DEL, NULL, &operation->ids);
+    return push(operation);
+}
+
+bool StateCacheWriter::putnode(uint32_t index, NodeColumns* columns, string* data)
+{
+    Operation* operation = new Operation(PUTNODE);
+    operation->records.push_back(pair<uint32_t, string>(index, *data));
+    operation->columns.push_back(*columns);
+    return push(operation);
+}
+
+bool StateCacheWriter::delnode(uint32_t index)
+{
+    Operation* operation = new Operation(DELNODE);
+    operation->ids.push_back(index);
+    return push(operation);
+}
+
+bool StateCacheWriter::putnoderecords(vector<NodeColumns>* columns, dbrecord_vector* records)
+{
+    Operation* operation = new Operation(PUTNODE);
+    operation->records = *records;
+    operation->columns = *columns;
+    return push(operation);
+}
+
+bool StateCacheWriter::delnoderecords(vector<uint32_t>* indexes)
+{
+    Operation* operation = new Operation(DELNODE);
+    operation->ids = *indexes;
+    return push(operation);
+}
+
+bool StateCacheWriter::delnodetrees(handle_vector* handles)
+{
+    Operation* operation = new Operation(DELNODETREES);
+    operation->handles = *handles;
+    return push(operation);
+}
+
+bool StateCacheWriter::getnode(handle h, uint32_t* index, string* data)
+{
+    flush();
+    return table->getnode(h, index, data);
+}
+
+bool StateCacheWriter::getchildren(handle h, dbrecord_vector* records)
+{
+    flush();
+    return table->getchildren(h, records);
+}
+
+bool StateCacheWriter::getnodesbyfingerprint(FileFingerprint* fingerprint, dbrecord_vector* records)
+{
+    flush();
+    return table->getnodesbyfingerprint(fingerprint, records);
+}
+
+bool StateCacheWriter::getsubtreecounter(handle h, NodeCounter* counter)
+{
+    flush();
+    return table->getsubtreecounter(h, counter);
+}
+
+bool StateCacheWriter::getsharednodes(dbrecord_vector* records)
+{
+    flush();
+    return table->getsharednodes(records);
+}
+
+void StateCacheWriter::nodesmigrated()
+{
+    DbTable::nodesmigrated();
+    push(new Operation(NODESMIGRATED));
+}
+
+void StateCacheWriter::truncate()
+{
+    queuedrecords(TRUNCATE, NULL, NULL);
+    push(new Operation(TRUNCATE));
+}
+
+void StateCacheWriter::begin()
+{
+    push(new Operation(BEGIN));
+}
+
+void StateCacheWriter::commit()
+{
+    push(new Operation(COMMIT));
+}
+
+void StateCacheWriter::abort()
+{
+    queuedrecords(ABORT, NULL, NULL);
+    push(new Operation(ABORT));
+}
+
+void StateCacheWriter::remove()
+{
+    flush();
+    table->remove();
+}
+
+StateCacheStats::StateCacheStats()
+{
+    updates = 0;
+    lastus = 0;
+    maxus = 0;
+    totalus = 0;
+}
+
+void StateCacheStats::add(long long us)
+{
+    updates++;
+    lastus = us;
+    totalus += us;
+
+    if (us > maxus)
+    {
+        maxus = us;
+    }
+}
+
+NodeSearchIndex::NodeSearchIndex()
+    : mutex(false)
+{
+    numpostings = 0;
+    stale = 0;
+    built = false;
+}
+
+void NodeSearchIndex::normalize(string* name)
+{
+    for (size_t i = 0; i < name->size(); i++)
+    {
+        char c = (*name)[i];
+
+        if (c >= 'A' && c <= 'Z')
+        {
+            (*name)[i] = c + 'a' - 'A';
+        }
+    }
+}
+
+static inline uint32_t trigram(const char* p)
+{
+    return ((uint32_t)(byte)p[0] << 16) | ((uint32_t)(byte)p[1] << 8) | (byte)p[2];
+}
+
+// distinct trigrams of a normalized name
+static void nametrigrams(const string& name, vector<uint32_t>* trigrams)
+{
+    trigrams->clear();
+
+    if (name.size() < 3)
+    {
+        return;
+    }
+
+    trigrams->reserve(name.size() - 2);
+
+    for (size_t i = 0; i + 3 <= name.size(); i++)
+    {
+        trigrams->push_back(trigram(name.data() + i));
+    }
+
+    std::sort(trigrams->begin(), trigrams->end());
+    trigrams->erase(std::unique(trigrams->begin(), trigrams->end()), trigrams->end());
+}
+
+// add the postings of an entry
+void NodeSearchIndex::add(uint32_t slot)
+{
+    vector<uint32_t> trigrams;
+    nametrigrams(entries[slot].name, &trigrams);
+
+    for (size_t i = 0; i < trigrams.size(); i++)
+    {
+        postings[trigrams[i]].push_back(slot);
+    }
+
+    numpostings += trigrams.size();
+}
+
+// the postings of an entry's current name become stale
+void NodeSearchIndex::retire(uint32_t slot)
+{
+    vector<uint32_t> trigrams;
+    nametrigrams(entries[slot].name, &trigrams);
+    stale += trigrams.size();
+}
+
+// drop stale postings once they make up a quarter of the index
+void NodeSearchIndex::compact()
+{
+    if (stale < 4096 || stale * 4 < numpostings)
+    {
+        return;
+    }
+
+    postings.clear();
+    numpostings = 0;
+    stale = 0;
+
+    for (uint32_t slot = 0; slot < entries.size(); slot++)
+    {
+        if (!ISUNDEF(entries[slot].nodehandle))
+        {
+            add(slot);
+        }
+    }
+}
+
+bool NodeSearchIndex::isbuilt()
+{
+    mutex.lock();
+    bool result = built;
+    mutex.unlock();
+    return result;
+}
+
+void NodeSearchIndex::build(node_map* nodes)
+{
+    mutex.lock();
+
+    entries.clear();
+    freeslots.clear();
+    slots.clear();
+    postings.clear();
+    numpostings = 0;
+    stale = 0;
+
+    entries.resize(nodes->size());
+    slots.reserve(nodes->size());
+
+    uint32_t slot = 0;
+    for (node_map::iterator it = nodes->begin(); it != nodes->end(); it++, slot++)
+    {
+        Node* n = it->second;
+        Entry* e = &entries[slot];
+
+        e->nodehandle = n->nodehandle;
+        e->parenthandle = n->parent ? n->parent->nodehandle : UNDEF;
+        e->name = n->displayname();
+        e->type = n->type;
+        normalize(&e->name);
+
+        slots[n->nodehandle] = slot;
+        add(slot);
+    }
+
+    built = true;
+
+    mutex.unlock();
+}
+
+void NodeSearchIndex::update(Node* n)
+{
+    mutex.lock();
+
+    if (!built)
+    {
+        mutex.unlock();
+        return;
+    }
+
+    string name = n->displayname();
+    normalize(&name);
+
+    std::unordered_map<handle, uint32_t>::iterator it = slots.find(n->nodehandle);
+    uint32_t slot;
+
+    if (it != slots.end())
+    {
+        slot = it->second;
+
+        if (entries[slot].name != name)
+        {
+            retire(slot);
+            entries[slot].name.swap(name);
+            add(slot);
+        }
+    }
+    else
+    {
+        if (freeslots.size())
+        {
+            slot = freeslots.back();
+            freeslots.pop_back();
+        }
+        else
+        {
+            slot = uint32_t(entries.size());
+            entries.resize(slot + 1);
+        }
+
+        entries[slot].nodehandle = n->nodehandle;
+        entries[slot].name.swap(name);
+        entries[slot].type = n->type;
+        slots[n->nodehandle] = slot;
+        add(slot);
+    }
+
+    entries[slot].parenthandle = n->parent ? n->parent->nodehandle : UNDEF;
+
+    compact();
+
+    mutex.unlock();
+}
+
+void NodeSearchIndex::remove(handle h)
+{
+    mutex.lock();
+
+    std::unordered_map<handle, uint32_t>::iterator it;
+
+    if (built && (it = slots.find(h)) != slots.end())
+    {
+        Entry* e = &entries[it->second];
+
+        retire(it->second);
+        e->nodehandle = UNDEF;
+        string().swap(e->name);
+        freeslots.push_back(it->second);
+        slots.erase(it);
+
+        compact();
+    }
+
+    mutex.unlock();
+}
+
+void NodeSearchIndex::clear()
+{
+    mutex.lock();
+
+    entries.clear();
+    freeslots.clear();
+    slots.clear();
+    postings.clear();
+    numpostings = 0;
+    stale = 0;
+    built = false;
+
+    mutex.unlock();
+}
+
+size_t NodeSearchIndex::size()
+{
+    mutex.lock();
+    size_t result = slots.size();
+    mutex.unlock();
+    return result;
+}
+
+// check whether an entry is below one of the ancestors, without files in
+// between - the outcome is remembered for the folders walked through
+bool NodeSearchIndex::inscope(uint32_t slot, const handle_set* ancestors, bool recursive, std::unordered_map<handle, bool>* known)
+{
+    handle p = entries[slot].parenthandle;
+
+    if (!recursive)
+    {
+        return ancestors->count(p) > 0;
+    }
+
+    handle_vector path;
+    bool result = false;
+
+    while (!ISUNDEF(p) && path.size() <= entries.size())
+    {
+        if (ancestors->count(p))
+        {
+            result = true;
+            break;
+        }
+
+        std::unordered_map<handle, bool>::iterator kit = known->find(p);
+        if (kit != known->end())
+        {
+            result = kit->second;
+            break;
+        }
+
+        path.push_back(p);
+
+        std::unordered_map<handle, uint32_t>::iterator it = slots.find(p);
+        if (it == slots.end() || entries[it->second].type == FILENODE)
+        {
+            break;
+        }
+
+        p = entries[it->second].parenthandle;
+    }
+
+    for (size_t i = 0; i < path.size(); i++)
+    {
+        (*known)[path[i]] = result;
+    }
+
+    return result;
+}
+
+bool NodeSearchIndex::search(const char* text, const handle_set* ancestors, bool recursive, handle_vector* results)
+{
+    string query = text;
+    normalize(&query);
+
+    mutex.lock();
+
+    if (!built)
+    {
+        mutex.unlock();
+        return false;
+    }
+
+    // the rarest trigram of the query yields the candidates, short queries
+    // check all entries
+    const vector<uint32_t>* candidates = NULL;
+
+    for (size_t i = 0; i + 3 <= query.size(); i++)
+    {
+        std::unordered_map<uint32_t, vector<uint32_t> >::iterator it = postings.find(trigram(query.data() + i));
+
+        if (it == postings.end())
+        {
+            mutex.unlock();
+            return true;
+        }
+
+        if (!candidates || it->second.size() < candidates->size())
+        {
+            candidates = &it->second;
+        }
+    }
+
+    std::unordered_map<handle, bool> known;
+    vector<uint32_t> matches;
+    size_t count = candidates ? candidates->size() : entries.size();
+
+    for (size_t i = 0; i < count; i++)
+    {
+        uint32_t slot = candidates ? (*candidates)[i] : uint32_t(i);
+        Entry* e = &entries[slot];
+
+        if (!ISUNDEF(e->nodehandle) && (e->type == FILENODE || e->type == FOLDERNODE)
+         && e->name.find(query) != string::npos
+         && inscope(slot, ancestors, recursive, &known))
+        {
+            matches.push_back(slot);
+        }
+    }
+
+    // a reused slot can appear twice in the postings of a trigram
+    std::sort(matches.begin(), matches.end());
+    matches.erase(std::unique(matches.begin(), matches.end()), matches.end());
+
+    results->reserve(results->size() + matches.size());
+    for (size_t i = 0; i < matches.size(); i++)
+    {
+        results->push_back(entries[matches[i]].nodehandle);
+    }
+
+    mutex.unlock();
+
+    return true;
+}
+
+bool MegaClient::buildsearchindex()
+{
+    if (lazynodes)
+    {
+        return false;
+    }
+
+    if (!searchindex.isbuilt())
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+        searchindex.build(&nodes);
+
+        LOG_debug << "Search index built for " << nodes.size() << " nodes in "
+                  << std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count() << " ms";
+    }
+
+    return true;
+}
+
 void FetchNodesStats::init()
 {
     mode = MODE_NONE;
@@ -13266,6 +15246,8 @@ void FetchNodesStats::init()
     startTime = Waiter::ds;
     timeToFirstByte = NEVER;
     timeToLastByte = NEVER;
+    timeToDecoded = NEVER;
+    timeToLinked = NEVER;
     timeToCached = NEVER;
     timeToResult = NEVER;
     timeToSyncsResumed = NEVER;
@@ -13287,7 +15269,8 @@ void FetchNodesStats::toJsonArray(string *json)
         << timeToFirstByte << "," << timeToLastByte << ","
         << timeToCached << "," << timeToResult << ","
         << timeToSyncsResumed << "," << timeToCurrent << ","
-        << timeToTransfersResumed << "," << cache << "]";
+        << timeToTransfersResumed << "," << cache << ","
+        << timeToDecoded << "," << timeToLinked << "]";
     json->append(oss.str());
 }
 
@@ -44,6 +44,12 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
     parenthandle = ph;
 
     parent = NULL;
+    childnames = NULL;
+    childname = NULL;
+    childorders = NULL;
+    numchildfiles = 0;
+    numchildfolders = 0;
+    childrenloaded = false;
 
 #ifdef ENABLE_SYNC
     localnode = NULL;
@@ -59,6 +65,8 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
     size = s;
     owner = u;
 
+    subtreecounter = owncounter();
+
     copystring(&fileattrstring, fa);
 
     ctime = ts;
@@ -74,37 +82,58 @@ Node::Node(MegaClient* cclient, node_vector* dp, handle h, handle ph,
 
     if (client)
     {
-        Node* p;
-
-        client->nodes[h] = this;
-
-        // folder link access: first returned record defines root node and
-        // identity
-        if (ISUNDEF(*client->rootnodes))
+        if (type == FILENODE)
         {
-            *client->rootnodes = h;
+            fingerprint_it = client->fingerprints.end();
         }
 
-        if (t >= ROOTNODE && t <= RUBBISHNODE)
-        {
-            client->rootnodes[t - ROOTNODE] = h;
-        }
+        lru_it = client->lrunodes.end();
 
-        // set parent linkage or queue for delayed parent linkage in case of
-        // out-of-order delivery
-        if ((p = client->nodebyhandle(ph)))
+        // without mismatch vector, the node is attached later
+        if (dp)
         {
-            setparent(p);
-        }
-        else
-        {
-            dp->push_back(this);
+            attach(dp);
         }
+    }
+}
 
-        if (type == FILENODE)
-        {
-            fingerprint_it = client->fingerprints.end();
-        }
+void Node::attach(node_vector* dp)
+{
+    Node* p;
+
+    client->nodes[nodehandle] = this;
+
+    if (client->lazynodes)
+    {
+        lru_it = client->lrunodes.insert(client->lrunodes.end(), this);
+    }
+
+    // folder link access: first returned record defines root node and
+    // identity
+    if (ISUNDEF(*client->rootnodes))
+    {
+        *client->rootnodes = nodehandle;
+    }
+
+    if (type >= ROOTNODE && type <= RUBBISHNODE)
+    {
+        client->rootnodes[type - ROOTNODE] = nodehandle;
+    }
+
+    if (!dp)
+    {
+        return;
+    }
+
+    // set parent linkage or queue for delayed parent linkage in case of
+    // out-of-order delivery
+    if ((p = client->nodebyhandle(parenthandle)))
+    {
+        setparent(p);
+    }
+    else
+    {
+        dp->push_back(this);
     }
 }
 
@@ -119,6 +148,13 @@ Node::~Node()
         client->fingerprints.erase(fingerprint_it);
     }
 
+    if (lru_it != client->lrunodes.end())
+    {
+        client->lrunodes.erase(lru_it);
+    }
+
+    client->searchindex.remove(nodehandle);
+
 #ifdef ENABLE_SYNC
     // remove from todebris node_set
     if (todebris_it != client->todebris.end())
@@ -157,16 +193,28 @@ Node::~Node()
     // remove from parent's children
     if (parent)
     {
+        addcounters(false);
+        parent->removechildname(this);
+        parent->removechildorders(this);
         parent->children.erase(child_it);
+        (type == FILENODE) ? parent->numchildfiles-- : parent->numchildfolders--;
     }
 
     // delete child-parent associations (normally not used, as nodes are
     // deleted bottom-up)
     for (node_list::iterator it = children.begin(); it != children.end(); it++)
     {
-        (*it)->parent = NULL;
+        Node* child = *it;
+
+        child->subtreecounter -= child->owncounter();
+        child->parent = NULL;
+        child->subtreecounter += child->owncounter();
+        child->childname = NULL;
     }
 
+    delete childnames;
+    unsortchildren();
+
     delete plink;
     delete inshare;
     delete sharekey;
@@ -198,6 +246,407 @@ void Node::setkey(const byte* newkey)
 // parse serialized node and return Node object - updates nodes hash and parent
 // mismatch vector
 Node* Node::unserialize(MegaClient* client, string* d, node_vector* dp)
+{
+    newshare_list shares;
+    Node* n = unserialize(client, (const string*)d, &shares);
+
+    if (n)
+    {
+        n->attach(dp);
+        n->setfingerprint();
+        client->newshares.splice(client->newshares.end(), shares);
+    }
+
+    return n;
+}
+
+// parse serialized node and return a detached Node object - shares are
+// returned in the supplied list
+Node* Node::unserialize(MegaClient* client, const string* d, newshare_list* shares)
+{
+    if (d->empty())
+    {
+        return NULL;
+    }
+
+    // the legacy layout ends with an attribute terminator or a takedown flag
+    char format = (*d)[d->size() - 1];
+
+    if (format == COMPACTFORMAT)
+    {
+        return unserializecompact(client, d, shares);
+    }
+
+    if (format > 1 || format < 0)
+    {
+        LOG_err << "Unknown node record format: " << int(format);
+        return NULL;
+    }
+
+    return unserializelegacy(client, d, shares);
+}
+
+// append an integer in Serialize64 format
+static void appendnumber(string* d, uint64_t v)
+{
+    byte buf[sizeof v + 1];
+
+    d->append((char*)buf, Serialize64::serialize(buf, v));
+}
+
+// read an integer in Serialize64 format (inlined, as records are read in
+// bulk when the local cache is loaded)
+static inline bool readnumber(const char** ptr, const char* end, uint64_t* v)
+{
+    const byte* b = (const byte*)*ptr;
+
+    if (*ptr >= end || *b > sizeof *v || *b >= end - *ptr)
+    {
+        return false;
+    }
+
+    *v = 0;
+
+    for (byte p = *b; p; p--)
+    {
+        *v = (*v << 8) + b[p];
+    }
+
+    *ptr += *b + 1;
+    return true;
+}
+
+// append a share in the compact layout
+static void appendshare(string* d, Share* share)
+{
+    handle uh = share->user ? share->user->userhandle : 0;
+
+    // access level + 1, with the high bit set if a pending contact request
+    // follows
+    byte a = (byte)(share->access + 1);
+
+    if (share->pcr)
+    {
+        a |= 0x80;
+    }
+
+    d->append((char*)&uh, MegaClient::USERHANDLE);
+    appendnumber(d, share->ts);
+    d->append((char*)&a, 1);
+
+    if (share->pcr)
+    {
+        d->append((char*)&share->pcr->id, sizeof share->pcr->id);
+    }
+}
+
+// read the handles and type of a serialized node in place
+bool Node::peek(const string* d, handle* h, handle* ph, nodetype_t* t)
+{
+    const char* ptr = d->data();
+
+    if (d->size() < 1 + 2 * MegaClient::NODEHANDLE)
+    {
+        return false;
+    }
+
+    *h = 0;
+    *ph = 0;
+
+    if ((*d)[d->size() - 1] == COMPACTFORMAT)
+    {
+        byte flags = *ptr++;
+
+        *t = (nodetype_t)(flags & COMPACT_TYPE);
+        memcpy((char*)h, ptr, MegaClient::NODEHANDLE);
+        ptr += MegaClient::NODEHANDLE;
+
+        if (flags & COMPACT_PARENT)
+        {
+            memcpy((char*)ph, ptr, MegaClient::NODEHANDLE);
+        }
+        else
+        {
+            *ph = UNDEF;
+        }
+
+        return *t <= RUBBISHNODE;
+    }
+
+    if (d->size() < sizeof(m_off_t) + 2 * MegaClient::NODEHANDLE)
+    {
+        return false;
+    }
+
+    m_off_t s = MemAccess::get<m_off_t>(ptr);
+    *t = (s < 0 && s >= -RUBBISHNODE) ? (nodetype_t)-s : FILENODE;
+    ptr += sizeof s;
+
+    memcpy((char*)h, ptr, MegaClient::NODEHANDLE);
+    ptr += MegaClient::NODEHANDLE;
+
+    memcpy((char*)ph, ptr, MegaClient::NODEHANDLE);
+
+    if (!*ph)
+    {
+        *ph = UNDEF;
+    }
+
+    return true;
+}
+
+// parse the compact layout written by serialize()
+Node* Node::unserializecompact(MegaClient* client, const string* d, newshare_list* shares)
+{
+    const char* ptr = d->data();
+    const char* end = ptr + d->size() - 1;
+    handle h = 0, ph = UNDEF, u = 0;
+    nodetype_t t;
+    m_off_t s;
+    m_time_t ts;
+    uint64_t v;
+    const byte* k = NULL;
+    const char* fa = NULL;
+    const char* fp = NULL;
+    int fplen = 0;
+    AttrMap attrs;
+
+    if (ptr + 1 + MegaClient::NODEHANDLE > end)
+    {
+        return NULL;
+    }
+
+    byte flags = *ptr++;
+
+    t = (nodetype_t)(flags & COMPACT_TYPE);
+    if (t > RUBBISHNODE)
+    {
+        return NULL;
+    }
+
+    memcpy((char*)&h, ptr, MegaClient::NODEHANDLE);
+    ptr += MegaClient::NODEHANDLE;
+
+    if (flags & COMPACT_PARENT)
+    {
+        if (ptr + MegaClient::NODEHANDLE > end)
+        {
+            return NULL;
+        }
+
+        ph = 0;
+        memcpy((char*)&ph, ptr, MegaClient::NODEHANDLE);
+        ptr += MegaClient::NODEHANDLE;
+    }
+
+    if (ptr + MegaClient::USERHANDLE > end)
+    {
+        return NULL;
+    }
+
+    memcpy((char*)&u, ptr, MegaClient::USERHANDLE);
+    ptr += MegaClient::USERHANDLE;
+
+    if (!readnumber(&ptr, end, &v))
+    {
+        return NULL;
+    }
+    ts = (m_time_t)v;
+
+    if (t == FILENODE)
+    {
+        if (!readnumber(&ptr, end, &v))
+        {
+            return NULL;
+        }
+        s = (m_off_t)v;
+    }
+    else
+    {
+        s = -t;
+    }
+
+    if ((t == FILENODE) || (t == FOLDERNODE))
+    {
+        int keylen = ((t == FILENODE) ? FILENODEKEYLENGTH + 0 : FOLDERNODEKEYLENGTH + 0);
+
+        if (ptr + keylen > end)
+        {
+            return NULL;
+        }
+
+        k = (const byte*)ptr;
+        ptr += keylen;
+    }
+
+    if (t == FILENODE)
+    {
+        // NUL-terminated, so that it can be used in place
+        if (!readnumber(&ptr, end, &v) || v >= uint64_t(end - ptr) || ptr[v])
+        {
+            return NULL;
+        }
+
+        fa = ptr;
+        ptr += v + 1;
+    }
+
+    // binary form of the fingerprint attribute: sparse CRC and mtime
+    if (flags & COMPACT_FINGERPRINT)
+    {
+        fp = ptr;
+
+        if (ptr + 4 * sizeof(int32_t) > end)
+        {
+            return NULL;
+        }
+
+        ptr += 4 * sizeof(int32_t);
+
+        if (!readnumber(&ptr, end, &v))
+        {
+            return NULL;
+        }
+
+        fplen = int(ptr - fp);
+    }
+
+    if (flags & COMPACT_SHARES)
+    {
+        if (!readnumber(&ptr, end, &v) || ptr + SymmCipher::KEYLENGTH > end)
+        {
+            return NULL;
+        }
+
+        uint64_t numshares = v;
+        const byte* skey = (const byte*)ptr;
+        ptr += SymmCipher::KEYLENGTH;
+
+        while (numshares--)
+        {
+            handle uh, sph = UNDEF;
+            uint64_t sts;
+
+            if (ptr + MegaClient::USERHANDLE > end)
+            {
+                discardshares(shares);
+                return NULL;
+            }
+
+            uh = MemAccess::get<handle>(ptr);
+            ptr += MegaClient::USERHANDLE;
+
+            if (!readnumber(&ptr, end, &sts) || ptr >= end)
+            {
+                discardshares(shares);
+                return NULL;
+            }
+
+            byte a = *ptr++;
+
+            if (a & 0x80)
+            {
+                if (ptr + sizeof sph > end)
+                {
+                    discardshares(shares);
+                    return NULL;
+                }
+
+                sph = MemAccess::get<handle>(ptr);
+                ptr += sizeof sph;
+            }
+
+            shares->push_back(new NewShare(h, (flags & COMPACT_INSHARE) ? 0 : -1, uh,
+                                           (accesslevel_t)((a & 0x7f) - 1), (m_time_t)sts,
+                                           skey, NULL, sph));
+        }
+    }
+
+    // attributes by name id, terminated by a zero id
+    for (;;)
+    {
+        uint64_t id;
+
+        if (!readnumber(&ptr, end, &id))
+        {
+            discardshares(shares);
+            return NULL;
+        }
+
+        if (!id)
+        {
+            break;
+        }
+
+        if (!readnumber(&ptr, end, &v) || v > uint64_t(end - ptr))
+        {
+            discardshares(shares);
+            return NULL;
+        }
+
+        attrs.map[(nameid)id].assign(ptr, (size_t)v);
+        ptr += v;
+    }
+
+    if (fp)
+    {
+        string* c = &attrs.map['c'];
+
+        c->resize(fplen * 4 / 3 + 4);
+        c->resize(Base64::btoa((const byte*)fp, fplen, (char*)c->data()));
+    }
+
+    attr_map::iterator it = attrs.map.find('n');
+    if (it != attrs.map.end())
+    {
+        client->fsaccess->normalize(&(it->second));
+    }
+
+    PublicLink *plink = NULL;
+    if (flags & COMPACT_PLINK)
+    {
+        handle lph = 0;
+
+        if (ptr + MegaClient::NODEHANDLE > end)
+        {
+            discardshares(shares);
+            return NULL;
+        }
+
+        memcpy((char*)&lph, ptr, MegaClient::NODEHANDLE);
+        ptr += MegaClient::NODEHANDLE;
+
+        if (!readnumber(&ptr, end, &v) || ptr >= end)
+        {
+            discardshares(shares);
+            return NULL;
+        }
+
+        plink = new PublicLink(lph, (m_time_t)v, *ptr++ != 0);
+    }
+
+    if (ptr != end)
+    {
+        delete plink;
+        discardshares(shares);
+        return NULL;
+    }
+
+    Node* n = new Node(client, NULL, h, ph, t, s, u, fa, ts);
+
+    if (k)
+    {
+        n->setkey(k);
+    }
+
+    n->attrs.map.swap(attrs.map);
+    n->plink = plink;
+
+    return n;
+}
+
+// parse the layout written by serializelegacy()
+Node* Node::unserializelegacy(MegaClient* client, const string* d, newshare_list* shares)
 {
     handle h, ph;
     nodetype_t t;
@@ -213,6 +662,7 @@ Node* Node::unserialize(MegaClient* client, string* d, node_vector* dp)
     Node* n;
     int i;
     char isExported = '\0';
+    AttrMap attrs;
 
     if (ptr + sizeof s + 2 * MegaClient::NODEHANDLE + MegaClient::USERHANDLE + 2 * sizeof ts + sizeof ll > end)
     {
@@ -313,27 +763,20 @@ Node* Node::unserialize(MegaClient* client, string* d, node_vector* dp)
         skey = NULL;
     }
 
-    n = new Node(client, dp, h, ph, t, s, u, fa, ts);
-
-    if (k)
-    {
-        n->setkey(k);
-    }
-
     if (numshares)
     {
         // read inshare, outshares, or pending shares
-        while (Share::unserialize(client,
+        while (Share::unserialize(shares,
                                   (numshares > 0) ? -1 : 0,
                                   h, skey, &ptr, end)
                && numshares > 0
                && --numshares);
     }
 
-    ptr = n->attrs.unserialize(ptr, end);
+    ptr = attrs.unserialize(ptr, end);
     if (!ptr)
     {
-        delete n;
+        discardshares(shares);
         return NULL;
     }
 
@@ -341,8 +784,8 @@ Node* Node::unserialize(MegaClient* client, string* d, node_vector* dp)
     // the updated version of utf8proc doesn't provide
     // exactly the same output as the previous one that
     // we were using
-    attr_map::iterator it = n->attrs.map.find('n');
-    if (it != n->attrs.map.end())
+    attr_map::iterator it = attrs.map.find('n');
+    if (it != attrs.map.end())
     {
         client->fsaccess->normalize(&(it->second));
     }
@@ -352,11 +795,12 @@ Node* Node::unserialize(MegaClient* client, string* d, node_vector* dp)
     {
         if (ptr + MegaClient::NODEHANDLE + sizeof(m_time_t) + sizeof(bool) > end)
         {
-            delete n;
+            discardshares(shares);
             return NULL;
         }
 
-        handle ph = MemAccess::get<handle>(ptr);
+        handle ph = 0;
+        memcpy((char*)&ph, ptr, MegaClient::NODEHANDLE);
         ptr += MegaClient::NODEHANDLE;
         m_time_t ets = MemAccess::get<m_time_t>(ptr);
         ptr += sizeof(ets);
@@ -365,23 +809,40 @@ Node* Node::unserialize(MegaClient* client, string* d, node_vector* dp)
 
         plink = new PublicLink(ph, ets, takendown);
     }
-    n->plink = plink;
 
-    n->setfingerprint();
+    if (ptr != end)
+    {
+        delete plink;
+        discardshares(shares);
+        return NULL;
+    }
+
+    n = new Node(client, NULL, h, ph, t, s, u, fa, ts);
 
-    if (ptr == end)
+    if (k)
     {
-        return n;
+        n->setkey(k);
     }
-    else
+
+    n->attrs.map.swap(attrs.map);
+    n->plink = plink;
+
+    return n;
+}
+
+void Node::discardshares(newshare_list* shares)
+{
+    for (newshare_list::iterator it = shares->begin(); it != shares->end(); it++)
     {
-        delete n;
-        return NULL;
+        delete *it;
     }
+
+    shares->clear();
 }
 
-// serialize node - nodes with pending or RSA keys are unsupported
-bool Node::serialize(string* d)
+// check that the node can be serialized - nodes with pending or RSA keys
+// are unsupported
+bool Node::serializable()
 {
     // do not serialize encrypted nodes
     if (attrstring)
@@ -415,11 +876,182 @@ bool Node::serialize(string* d)
             }
             break;
 
-        default:
+        case ROOTNODE:
+        case INCOMINGNODE:
+        case RUBBISHNODE:
             if (nodekey.size())
             {
                 return false;
             }
+            break;
+
+        default:
+            return false;
+    }
+
+    return true;
+}
+
+// serialize node in the compact layout
+bool Node::serialize(string* d)
+{
+    return serialize(d, parent ? parent->nodehandle : UNDEF);
+}
+
+bool Node::serialize(string* d, handle ph)
+{
+    if (!serializable())
+    {
+        return false;
+    }
+
+    FileFingerprint fp;
+    attr_map::iterator fpattr = attrs.map.end();
+
+    // pack the fingerprint attribute, if it survives the round trip
+    if (type == FILENODE)
+    {
+        attr_map::iterator it = attrs.map.find('c');
+        string packed;
+
+        if (it != attrs.map.end() && fp.unserializefingerprint(&it->second)
+         && (fp.serializefingerprint(&packed), packed == it->second))
+        {
+            fpattr = it;
+        }
+    }
+
+    size_t numshares = 0;
+
+    if (inshare)
+    {
+        numshares = 1;
+    }
+    else
+    {
+        if (outshares)
+        {
+            numshares += outshares->size();
+        }
+        if (pendingshares)
+        {
+            numshares += pendingshares->size();
+        }
+    }
+
+    byte flags = (byte)type;
+
+    if (!ISUNDEF(ph))
+    {
+        flags |= COMPACT_PARENT;
+    }
+    if (fpattr != attrs.map.end())
+    {
+        flags |= COMPACT_FINGERPRINT;
+    }
+    if (numshares)
+    {
+        flags |= COMPACT_SHARES;
+    }
+    if (inshare)
+    {
+        flags |= COMPACT_INSHARE;
+    }
+    if (plink)
+    {
+        flags |= COMPACT_PLINK;
+    }
+
+    d->append((char*)&flags, 1);
+    d->append((char*)&nodehandle, MegaClient::NODEHANDLE);
+
+    if (!ISUNDEF(ph))
+    {
+        d->append((char*)&ph, MegaClient::NODEHANDLE);
+    }
+
+    d->append((char*)&owner, MegaClient::USERHANDLE);
+    appendnumber(d, ctime);
+
+    if (type == FILENODE)
+    {
+        appendnumber(d, size);
+    }
+
+    d->append(nodekey);
+
+    if (type == FILENODE)
+    {
+        appendnumber(d, fileattrstring.size());
+        d->append(fileattrstring.c_str(), fileattrstring.size() + 1);
+    }
+
+    if (fpattr != attrs.map.end())
+    {
+        d->append((char*)fp.crc, sizeof fp.crc);
+        appendnumber(d, fp.mtime);
+    }
+
+    if (numshares)
+    {
+        appendnumber(d, numshares);
+        d->append((char*)sharekey->key, SymmCipher::KEYLENGTH);
+
+        if (inshare)
+        {
+            appendshare(d, inshare);
+        }
+        else
+        {
+            if (outshares)
+            {
+                for (share_map::iterator it = outshares->begin(); it != outshares->end(); it++)
+                {
+                    appendshare(d, it->second);
+                }
+            }
+            if (pendingshares)
+            {
+                for (share_map::iterator it = pendingshares->begin(); it != pendingshares->end(); it++)
+                {
+                    appendshare(d, it->second);
+                }
+            }
+        }
+    }
+
+    for (attr_map::iterator it = attrs.map.begin(); it != attrs.map.end(); it++)
+    {
+        if (it != fpattr && it->first)
+        {
+            appendnumber(d, it->first);
+            appendnumber(d, it->second.size());
+            d->append(it->second);
+        }
+    }
+
+    appendnumber(d, 0);
+
+    if (plink)
+    {
+        char takendown = plink->takendown ? 1 : 0;
+
+        d->append((char*)&plink->ph, MegaClient::NODEHANDLE);
+        appendnumber(d, plink->ets);
+        d->append(&takendown, 1);
+    }
+
+    d->append(1, COMPACTFORMAT);
+
+    return true;
+}
+
+// serialize node in the legacy layout
+bool Node::serializelegacy(string* d)
+{
+    if (!serializable())
+    {
+        return false;
     }
 
     unsigned short ll;
@@ -583,35 +1215,55 @@ SymmCipher* Node::nodecipher()
 // decrypt attributes and build attribute hash
 void Node::setattr()
 {
-    byte* buf;
     SymmCipher* cipher;
 
-    if (attrstring && (cipher = nodecipher()) && (buf = decryptattr(cipher, attrstring->c_str(), attrstring->size())))
+    if (attrstring && (cipher = nodecipher()) && decryptattrs(cipher, attrstring, client->fsaccess, &attrs.map))
     {
-        JSON json;
-        nameid name;
-        string* t;
+        setattrcompleted();
+    }
+}
 
-        attrs.map.clear();
-        json.begin((char*)buf + 5);
+bool Node::decryptattrs(SymmCipher* cipher, const string* attrstring, const FileSystemAccess* fsaccess, attr_map* attrs)
+{
+    byte* buf = decryptattr(cipher, attrstring->c_str(), int(attrstring->size()));
 
-        while ((name = json.getnameid()) != EOO && json.storeobject((t = &attrs.map[name])))
-        {
-            JSON::unescape(t);
+    if (!buf)
+    {
+        return false;
+    }
 
-            if (name == 'n')
-            {
-                client->fsaccess->normalize(t);
-            }
+    JSON json;
+    nameid name;
+    string* t;
+
+    attrs->clear();
+    json.begin((char*)buf + 5);
+
+    while ((name = json.getnameid()) != EOO && json.storeobject((t = &(*attrs)[name])))
+    {
+        JSON::unescape(t);
+
+        if (name == 'n')
+        {
+            fsaccess->normalize(t);
         }
+    }
 
-        setfingerprint();
+    delete[] buf;
 
-        delete[] buf;
+    return true;
+}
 
-        delete attrstring;
-        attrstring = NULL;
-    }
+void Node::setattrcompleted()
+{
+    setfingerprint();
+
+    delete attrstring;
+    attrstring = NULL;
+
+    updatechildname();
+    updatechildorders();
+    client->searchindex.update(this);
 }
 
 // if present, configure FileFingerprint from attributes
@@ -760,6 +1412,22 @@ int Node::hasfileattribute(const string *fileattrstring, fatype t)
 
 // attempt to apply node key - sets nodekey to a raw key if successful
 bool Node::applykey()
+{
+    const char* k;
+    SymmCipher* sc;
+
+    if (!findkey(&k, &sc))
+    {
+        return false;
+    }
+
+    unwrapkey(k, sc);
+
+    return true;
+}
+
+// locate the key that wraps nodekey and the cipher to unwrap it
+bool Node::findkey(const char** key, SymmCipher** cipher)
 {
     unsigned int keylength = (type == FILENODE)
                    ? FILENODEKEYLENGTH + 0
@@ -839,6 +1507,15 @@ bool Node::applykey()
         }
     }
 
+    *key = k;
+    *cipher = sc;
+
+    return true;
+}
+
+void Node::unwrapkey(const char* k, SymmCipher* sc)
+{
+    int keylength = (type == FILENODE) ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
     byte key[FILENODEKEYLENGTH];
 
     if (client->decryptkey(k, key, keylength, sc, 0, nodehandle))
@@ -846,10 +1523,37 @@ bool Node::applykey()
         nodekey.assign((const char*)key, keylength);
         setattr();
     }
+}
 
-    return true;
+// unwrap the key as MegaClient::decryptkey() does for symmetric keys, then
+// decrypt the attributes with it
+void NodeKeyDecryption::decrypt(const FileSystemAccess* fsaccess)
+{
+    SymmCipher cipher;
+
+    attrsdecrypted = false;
+
+    if (!unwrapped)
+    {
+        if (Base64::atob(wrapped, key, keylength) != keylength)
+        {
+            return;
+        }
+
+        cipher.setkey(wrapkey);
+        cipher.ecb_decrypt(key, keylength);
+        unwrapped = true;
+    }
+
+    string k((const char*)key, keylength);
+
+    if (node->attrstring && cipher.setkey(&k))
+    {
+        attrsdecrypted = Node::decryptattrs(&cipher, node->attrstring, fsaccess, &attrs);
+    }
 }
 
+
 // returns whether node was moved
 bool Node::setparent(Node* p)
 {
@@ -860,20 +1564,38 @@ bool Node::setparent(Node* p)
 
     if (parent)
     {
+        addcounters(false);
+        parent->removechildname(this);
+        parent->removechildorders(this);
         parent->children.erase(child_it);
+        (type == FILENODE) ? parent->numchildfiles-- : parent->numchildfolders--;
     }
 
 #ifdef ENABLE_SYNC
     Node *oldparent = parent;
 #endif
 
+    // a file becomes a version when moved below another file, and vice versa
+    subtreecounter -= owncounter();
     parent = p;
+    subtreecounter += owncounter();
 
     if (parent)
     {
         child_it = parent->children.insert(parent->children.end(), this);
+        (type == FILENODE) ? parent->numchildfiles++ : parent->numchildfolders++;
+        addcounters(true);
+
+        if (parent->childnames)
+        {
+            parent->addchildname(this);
+        }
+
+        parent->addchildorders(this);
     }
 
+    client->searchindex.update(this);
+
 #ifdef ENABLE_SYNC
     // if we are moving an entire sync, don't cancel GET transfers
     if (!localnode || localnode->parent)
@@ -905,6 +1627,354 @@ bool Node::setparent(Node* p)
     return true;
 }
 
+NodeCounter Node::owncounter() const
+{
+    NodeCounter nc;
+
+    if (type == FILENODE)
+    {
+        if (parent && parent->type == FILENODE)
+        {
+            nc.versions = 1;
+            nc.versionstorage = size;
+        }
+        else
+        {
+            nc.files = 1;
+            nc.storage = size;
+        }
+    }
+    else
+    {
+        nc.folders = 1;
+    }
+
+    return nc;
+}
+
+void Node::addcounters(bool add)
+{
+    for (Node* p = parent; p; p = p->parent)
+    {
+        if (add)
+        {
+            p->subtreecounter += subtreecounter;
+        }
+        else
+        {
+            p->subtreecounter -= subtreecounter;
+        }
+    }
+}
+
+void Node::setsize(m_off_t s)
+{
+    addcounters(false);
+    subtreecounter -= owncounter();
+    size = s;
+    subtreecounter += owncounter();
+    addcounters(true);
+    updatechildorders();
+}
+
+void Node::setctime(m_time_t ts)
+{
+    ctime = ts;
+    updatechildorders();
+}
+
+// recursively verify the maintained counters - returns the recomputed
+// subtree counters in *nc
+bool Node::checkcounters(NodeCounter* nc) const
+{
+    NodeCounter counter = owncounter();
+    int files = 0, folders = 0;
+    bool ok = true;
+
+    for (node_list::const_iterator it = children.begin(); it != children.end(); it++)
+    {
+        NodeCounter childcounter;
+
+        ok = (*it)->checkcounters(&childcounter) && ok;
+        counter += childcounter;
+        ((*it)->type == FILENODE) ? files++ : folders++;
+    }
+
+    if (!(counter == subtreecounter) || files != numchildfiles || folders != numchildfolders)
+    {
+        LOG_err << "Node counters mismatch: " << Base64Str<MegaClient::NODEHANDLE>(nodehandle);
+        ok = false;
+    }
+
+    if (nc)
+    {
+        *nc = counter;
+    }
+
+    return ok;
+}
+
+NodeCounter::NodeCounter()
+{
+    storage = 0;
+    versionstorage = 0;
+    files = 0;
+    folders = 0;
+    versions = 0;
+}
+
+void NodeCounter::operator+=(const NodeCounter& o)
+{
+    storage += o.storage;
+    versionstorage += o.versionstorage;
+    files += o.files;
+    folders += o.folders;
+    versions += o.versions;
+}
+
+void NodeCounter::operator-=(const NodeCounter& o)
+{
+    storage -= o.storage;
+    versionstorage -= o.versionstorage;
+    files -= o.files;
+    folders -= o.folders;
+    versions -= o.versions;
+}
+
+bool NodeCounter::operator==(const NodeCounter& o) const
+{
+    return storage == o.storage
+        && versionstorage == o.versionstorage
+        && files == o.files
+        && folders == o.folders
+        && versions == o.versions;
+}
+
+// same as displayname(), but without logging (used for name lookups)
+const char* Node::childnamekey() const
+{
+    if (attrstring)
+    {
+        return "NO_KEY";
+    }
+
+    attr_map::const_iterator it = attrs.map.find('n');
+
+    if (it == attrs.map.end())
+    {
+        return "CRYPTO_ERROR";
+    }
+
+    return it->second.size() ? it->second.c_str() : "BLANK";
+}
+
+void Node::addchildname(Node* n)
+{
+    nodename_map::iterator it = childnames->insert(nodename_map::value_type(n->childnamekey(), n));
+    n->childname = &it->first;
+}
+
+void Node::removechildname(Node* n)
+{
+    if (!childnames || !n->childname)
+    {
+        return;
+    }
+
+    pair<nodename_map::iterator, nodename_map::iterator> range = childnames->equal_range(*n->childname);
+
+    for (nodename_map::iterator it = range.first; it != range.second; it++)
+    {
+        if (it->second == n)
+        {
+            childnames->erase(it);
+            break;
+        }
+    }
+
+    n->childname = NULL;
+}
+
+// name lookups in large folders: hash children by their display name
+void Node::indexchildnames()
+{
+    if (childnames)
+    {
+        return;
+    }
+
+    childnames = new nodename_map(children.size());
+
+    for (node_list::iterator it = children.begin(); it != children.end(); it++)
+    {
+        addchildname(*it);
+    }
+}
+
+void Node::updatechildname()
+{
+    if (parent && parent->childnames
+     && (!childname || strcmp(childname->c_str(), childnamekey())))
+    {
+        parent->removechildname(this);
+        parent->addchildname(this);
+    }
+}
+
+ChildOrder::ChildOrder(nodecomparator comparator)
+    : nodes(Less{ comparator })
+{
+}
+
+void ChildOrder::insert(Node* n)
+{
+    positions[n] = nodes.insert(n).first;
+}
+
+void ChildOrder::erase(Node* n)
+{
+    std::unordered_map<Node*, node_sorted_set::iterator>::iterator it = positions.find(n);
+
+    if (it != positions.end())
+    {
+        nodes.erase(it->second);
+        positions.erase(it);
+    }
+}
+
+void ChildOrder::update(Node* n)
+{
+    std::unordered_map<Node*, node_sorted_set::iterator>::iterator it = positions.find(n);
+
+    if (it == positions.end())
+    {
+        return;
+    }
+
+    node_sorted_set::iterator nit = it->second;
+
+    // nothing to do if the node is still in order with its neighbours
+    if ((nit == nodes.begin() || nodes.key_comp()(*std::prev(nit), n))
+     && (std::next(nit) == nodes.end() || nodes.key_comp()(n, *std::next(nit))))
+    {
+        return;
+    }
+
+    nodes.erase(nit);
+    it->second = nodes.insert(n).first;
+}
+
+int ChildOrder::index(Node* n) const
+{
+    std::unordered_map<Node*, node_sorted_set::iterator>::const_iterator it = positions.find(n);
+
+    if (it == positions.end())
+    {
+        return -1;
+    }
+
+    return int(std::distance(nodes.begin(), node_sorted_set::const_iterator(it->second)));
+}
+
+void Node::addchildorders(Node* n)
+{
+    if (!childorders)
+    {
+        return;
+    }
+
+    for (list<ChildOrder>::iterator it = childorders->begin(); it != childorders->end(); it++)
+    {
+        it->insert(n);
+    }
+}
+
+void Node::removechildorders(Node* n)
+{
+    if (!childorders)
+    {
+        return;
+    }
+
+    for (list<ChildOrder>::iterator it = childorders->begin(); it != childorders->end(); it++)
+    {
+        it->erase(n);
+    }
+}
+
+// paginated listings: each requested order is sorted once and then
+// maintained on every change to the folder's children, for as long as the
+// folder is among the most recently listed ones
+const ChildOrder* Node::sortedchildren(nodecomparator comparator)
+{
+    if (childorders)
+    {
+        client->sortedfolders.splice(client->sortedfolders.end(), client->sortedfolders, sortedfolders_it);
+    }
+    else
+    {
+        while (client->sortedfolders.size() && client->sortedfolders.size() >= client->maxsortedfolders)
+        {
+            client->sortedfolders.front()->unsortchildren();
+        }
+
+        childorders = new list<ChildOrder>;
+        sortedfolders_it = client->sortedfolders.insert(client->sortedfolders.end(), this);
+    }
+
+    for (list<ChildOrder>::iterator it = childorders->begin(); it != childorders->end(); it++)
+    {
+        if (it->comparator() == comparator)
+        {
+            return &*it;
+        }
+    }
+
+    childorders->emplace_back(comparator);
+
+    ChildOrder& order = childorders->back();
+
+    for (node_list::iterator it = children.begin(); it != children.end(); it++)
+    {
+        order.insert(*it);
+    }
+
+    return &order;
+}
+
+void Node::unsortchildren()
+{
+    if (childorders)
+    {
+        client->sortedfolders.erase(sortedfolders_it);
+        delete childorders;
+        childorders = NULL;
+    }
+}
+
+int Node::childindex(Node* n, nodecomparator comparator)
+{
+    if (n->parent != this)
+    {
+        return -1;
+    }
+
+    return sortedchildren(comparator)->index(n);
+}
+
+void Node::updatechildorders()
+{
+    if (!parent || !parent->childorders)
+    {
+        return;
+    }
+
+    for (list<ChildOrder>::iterator it = parent->childorders->begin(); it != parent->childorders->end(); it++)
+    {
+        it->update(this);
+    }
+}
+
 // returns 1 if n is under p, 0 otherwise
 bool Node::isbelow(Node* p) const
 {
@@ -982,6 +2052,9 @@ void LocalNode::setnameparent(LocalNode* newparent, string* newlocalpath)
 
     if (parent)
     {
+        // the previous parent has to be processed again
+        parent->setdirty();
+
         // remove existing child linkage
         parent->children.erase(&localname);
 
@@ -1096,6 +2169,7 @@ void LocalNode::setnameparent(LocalNode* newparent, string* newlocalpath)
 
         // (we don't construct a UTF-8 or sname for the root path)
         parent->children[&localname] = this;
+        parent->setdirty();
 
         if (!slocalname)
         {
@@ -1150,9 +2224,23 @@ void LocalNode::bumpnagleds()
     nagleds = sync->client->waiter->ds + 11;
 }
 
+// flags stop propagating at the first ancestor that already is flagged for
+// both passes - syncdown() and syncup() clear them on the way down
+void LocalNode::setdirty()
+{
+    for (LocalNode* l = (type == FILENODE) ? parent : this; l && !(l->syncdowndirty && l->syncupdirty); l = l->parent)
+    {
+        l->syncdowndirty = true;
+        l->syncupdirty = true;
+    }
+}
+
 LocalNode::LocalNode()
 {
     checked = false;
+    syncdowndirty = false;
+    syncupdirty = false;
+    ctime = 0;
 }
 
 // initialize fresh LocalNode object - must be called exactly once
@@ -1190,6 +2278,9 @@ void LocalNode::init(Sync* csync, nodetype_t ctype, LocalNode* cparent, string*
 
     scanseqno = sync->scanseqno;
 
+    // new folders are processed by the next passes
+    setdirty();
+
     // mark fsid as not valid
     fsid_it = sync->client->fsidnode.end();
 
@@ -1271,6 +2362,11 @@ void LocalNode::setnode(Node* cnode)
 
     deleted = false;
 
+    if (node != cnode)
+    {
+        setdirty();
+    }
+
     node = cnode;
 
     if (node)
@@ -1561,6 +2657,9 @@ bool LocalNode::serialize(string* d)
         byte buf[sizeof mtime+1];
 
         d->append((const char*)buf, Serialize64::serialize(buf, mtime));
+
+        // optional, absent in records of older versions
+        d->append((const char*)buf, Serialize64::serialize(buf, ctime));
     }
 
     return true;
@@ -1618,6 +2717,7 @@ LocalNode* LocalNode::unserialize(Sync* sync, string* d)
     const char* localname = ptr;
     ptr += localnamelen;
     uint64_t mtime = 0;
+    uint64_t ctime = 0;
     int32_t crc[4];
     memset(crc, 0, sizeof crc);
 
@@ -1632,11 +2732,19 @@ LocalNode* LocalNode::unserialize(Sync* sync, string* d)
         memcpy(crc, ptr, sizeof crc);
         ptr += sizeof crc;
 
-        if (Serialize64::unserialize((byte*)ptr, end - ptr, &mtime) < 0)
+        int t = Serialize64::unserialize((byte*)ptr, end - ptr, &mtime);
+        if (t < 0)
         {
             LOG_err << "LocalNode unserialization failed - malformed fingerprint mtime";
             return NULL;
         }
+        ptr += t;
+
+        if (ptr < end && Serialize64::unserialize((byte*)ptr, end - ptr, &ctime) < 0)
+        {
+            LOG_err << "LocalNode unserialization failed - malformed ctime";
+            return NULL;
+        }
     }
 
     LocalNode* l = new LocalNode();
@@ -1655,6 +2763,7 @@ LocalNode* LocalNode::unserialize(Sync* sync, string* d)
 
     memcpy(l->crc, crc, sizeof crc);
     l->mtime = mtime;
+    l->ctime = ctime;
     l->isvalid = 1;
 
     l->node = sync->client->nodebyhandle(h);
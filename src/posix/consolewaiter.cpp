@@ -22,20 +22,20 @@
 #include "megaconsolewaiter.h"
 
 namespace mega {
+PosixConsoleWaiter::PosixConsoleWaiter()
+{
+    // application's own wakeup criteria: wake up upon user input
+    watchfd(STDIN_FILENO, WATCH_READ, true);
+}
+
 int PosixConsoleWaiter::wait()
 {
     int r;
 
-    // application's own wakeup criteria: wake up upon user input
-    FD_SET(STDIN_FILENO, &rfds);
-    FD_SET(STDIN_FILENO, &ignorefds);
-    
-    bumpmaxfd(STDIN_FILENO);
-
     r = PosixWaiter::wait();
 
     // application's own event processing: user interaction from stdin?
-    if (FD_ISSET(STDIN_FILENO, &rfds))
+    if (triggeredevents(STDIN_FILENO) & WATCH_READ)
     {
         r |= HAVESTDIN;
     }
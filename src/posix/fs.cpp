@@ -39,6 +39,11 @@ extern JavaVM *MEGAjvm;
 #include <uuid/uuid.h>
 #endif
 
+#ifdef USE_IO_URING
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#endif
+
 namespace mega {
 using namespace std;
 
@@ -50,6 +55,9 @@ using namespace std;
 PosixAsyncIOContext::PosixAsyncIOContext() : AsyncIOContext()
 {
     aiocb = NULL;
+#ifdef USE_IO_URING
+    uring = NULL;
+#endif
 }
 
 PosixAsyncIOContext::~PosixAsyncIOContext()
@@ -60,6 +68,18 @@ PosixAsyncIOContext::~PosixAsyncIOContext()
 
 void PosixAsyncIOContext::finish()
 {
+#ifdef USE_IO_URING
+    if (uring)
+    {
+        if (!finished)
+        {
+            LOG_debug << "Synchronously waiting for async operation";
+            uring->waitfor(this);
+        }
+        uring = NULL;
+    }
+#endif
+
     if (aiocb)
     {
         if (!finished)
@@ -74,11 +94,275 @@ void PosixAsyncIOContext::finish()
 }
 #endif
 
+#ifdef USE_IO_URING
+PosixIOUring::PosixIOUring()
+{
+    fd = -1;
+    failed = false;
+    queued = 0;
+    inflight = 0;
+    sqring = cqring = MAP_FAILED;
+    sqes = (struct io_uring_sqe*)MAP_FAILED;
+    sqringsize = cqringsize = sqessize = 0;
+}
+
+PosixIOUring::~PosixIOUring()
+{
+    // all contexts wait for their operation before being deleted
+    assert(!queued && !inflight);
+
+    if (sqes != MAP_FAILED)
+    {
+        munmap(sqes, sqessize);
+    }
+
+    if (cqring != MAP_FAILED && cqring != sqring)
+    {
+        munmap(cqring, cqringsize);
+    }
+
+    if (sqring != MAP_FAILED)
+    {
+        munmap(sqring, sqringsize);
+    }
+
+    if (fd >= 0)
+    {
+        close(fd);
+    }
+}
+
+bool PosixIOUring::init()
+{
+    struct io_uring_params p;
+    memset(&p, 0, sizeof p);
+
+    if ((fd = int(syscall(__NR_io_uring_setup, ENTRIES, &p))) < 0)
+    {
+        LOG_warn << "io_uring not available (" << errno << "), using POSIX AIO";
+        failed = true;
+        return false;
+    }
+
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+    sqringsize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    cqringsize = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    // since Linux 5.4 both rings share a single mapping
+    if (p.features & IORING_FEAT_SINGLE_MMAP && cqringsize > sqringsize)
+    {
+        sqringsize = cqringsize;
+    }
+
+    sqring = mmap(NULL, sqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+
+    if (sqring != MAP_FAILED)
+    {
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            cqring = sqring;
+        }
+        else
+        {
+            cqring = mmap(NULL, cqringsize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        }
+    }
+
+    if (cqring != MAP_FAILED)
+    {
+        sqessize = p.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = (struct io_uring_sqe*)mmap(NULL, sqessize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    }
+
+    if (sqes == MAP_FAILED)
+    {
+        LOG_err << "Unable to map the io_uring rings: " << errno;
+        failed = true;
+        return false;
+    }
+
+    sqhead = (unsigned*)((char*)sqring + p.sq_off.head);
+    sqtail = (unsigned*)((char*)sqring + p.sq_off.tail);
+    sqmask = (unsigned*)((char*)sqring + p.sq_off.ring_mask);
+    sqarray = (unsigned*)((char*)sqring + p.sq_off.array);
+    sqentries = p.sq_entries;
+
+    cqhead = (unsigned*)((char*)cqring + p.cq_off.head);
+    cqtail = (unsigned*)((char*)cqring + p.cq_off.tail);
+    cqmask = (unsigned*)((char*)cqring + p.cq_off.ring_mask);
+    cqes = (struct io_uring_cqe*)((char*)cqring + p.cq_off.cqes);
+    cqentries = p.cq_entries;
+
+    LOG_debug << "io_uring enabled with " << sqentries << " entries";
+    return true;
+}
+
+int PosixIOUring::enter(unsigned tosubmit, unsigned mincomplete, unsigned flags)
+{
+    return int(syscall(__NR_io_uring_enter, fd, tosubmit, mincomplete, flags, NULL, 0));
+}
+
+bool PosixIOUring::queue(PosixAsyncIOContext* context, int filedes)
+{
+    if (failed || (fd < 0 && !init()))
+    {
+        return false;
+    }
+
+    // never have more operations outstanding than the completion queue holds
+    if (queued + inflight >= cqentries)
+    {
+        reap();
+
+        if (queued + inflight >= cqentries)
+        {
+            return false;
+        }
+    }
+
+    unsigned tail = *sqtail;
+
+    if (tail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) >= sqentries)
+    {
+        submit();
+
+        if (tail - __atomic_load_n(sqhead, __ATOMIC_ACQUIRE) >= sqentries)
+        {
+            return false;
+        }
+    }
+
+    context->iov.iov_base = context->buffer;
+    context->iov.iov_len = context->len;
+
+    unsigned index = tail & *sqmask;
+    struct io_uring_sqe* sqe = &sqes[index];
+
+    memset(sqe, 0, sizeof *sqe);
+    sqe->opcode = (context->op == AsyncIOContext::READ) ? IORING_OP_READV : IORING_OP_WRITEV;
+    sqe->fd = filedes;
+    sqe->addr = (uint64_t)(uintptr_t)&context->iov;
+    sqe->len = 1;
+    sqe->off = context->pos;
+    sqe->user_data = (uint64_t)(uintptr_t)context;
+
+    sqarray[index] = index;
+    __atomic_store_n(sqtail, tail + 1, __ATOMIC_RELEASE);
+
+    context->uring = this;
+    queued++;
+    return true;
+}
+
+void PosixIOUring::submit()
+{
+    while (queued)
+    {
+        int r = enter(queued, 0, 0);
+
+        if (r < 0)
+        {
+            if (errno != EINTR)
+            {
+                // retried on the next submit()
+                LOG_warn << "io_uring submission failed: " << errno;
+                return;
+            }
+        }
+        else
+        {
+            queued -= r;
+            inflight += r;
+        }
+    }
+}
+
+int PosixIOUring::reap()
+{
+    int n = 0;
+
+    if (fd < 0 || failed)
+    {
+        return n;
+    }
+
+    unsigned head = *cqhead;
+
+    while (head != __atomic_load_n(cqtail, __ATOMIC_ACQUIRE))
+    {
+        struct io_uring_cqe* cqe = &cqes[head & *cqmask];
+        PosixAsyncIOContext* context = (PosixAsyncIOContext*)(uintptr_t)cqe->user_data;
+        int res = cqe->res;
+
+        __atomic_store_n(cqhead, ++head, __ATOMIC_RELEASE);
+        inflight--;
+        n++;
+
+        context->retry = (res == -EAGAIN);
+        context->failed = (res < 0 || unsigned(res) != context->len);
+        if (!context->failed)
+        {
+            if (context->op == AsyncIOContext::READ && context->pad)
+            {
+                memset(context->buffer + context->len, 0, context->pad);
+                LOG_verbose << "Async read finished OK";
+            }
+            else
+            {
+                LOG_verbose << "Async write finished OK";
+            }
+        }
+        else
+        {
+            LOG_warn << "Async operation finished with error: " << res;
+        }
+
+        context->finished = true;
+        if (context->userCallback)
+        {
+            context->userCallback(context->userData);
+        }
+    }
+
+    return n;
+}
+
+void PosixIOUring::waitfor(PosixAsyncIOContext* context)
+{
+    while (!context->finished)
+    {
+        submit();
+
+        if (reap())
+        {
+            continue;
+        }
+
+        if (!inflight)
+        {
+            LOG_err << "Unable to start io_uring operations";
+            return;
+        }
+
+        if (enter(0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR)
+        {
+            LOG_err << "Error waiting for io_uring completions: " << errno;
+            return;
+        }
+    }
+}
+#endif
+
 PosixFileAccess::PosixFileAccess(Waiter *w, int defaultfilepermissions) : FileAccess(w)
 {
     fd = -1;
     this->defaultfilepermissions = defaultfilepermissions;
 
+#ifdef USE_IO_URING
+    uring = NULL;
+#endif
+
 #ifndef HAVE_FDOPENDIR
     dp = NULL;
 #endif
@@ -195,7 +479,8 @@ void PosixFileAccess::asyncopfinished(sigval sigev_value)
     int e = aio_error(aiocbp);
     assert (e != EINPROGRESS);
     context->retry = (e == EAGAIN);
-    context->failed = (aio_return(aiocbp) < 0);
+    ssize_t r = aio_return(aiocbp);
+    context->failed = (r < 0 || size_t(r) != aiocbp->aio_nbytes);
     if (!context->failed)
     {
         if (context->op == AsyncIOContext::READ && context->pad)
@@ -260,6 +545,13 @@ void PosixFileAccess::asyncsysread(AsyncIOContext *context)
         return;
     }
 
+#ifdef USE_IO_URING
+    if (uring && uring->queue(posixContext, fd))
+    {
+        return;
+    }
+#endif
+
     struct aiocb *aiocbp = new struct aiocb;
     memset(aiocbp, 0, sizeof (struct aiocb));
 
@@ -309,6 +601,13 @@ void PosixFileAccess::asyncsyswrite(AsyncIOContext *context)
         return;
     }
 
+#ifdef USE_IO_URING
+    if (uring && uring->queue(posixContext, fd))
+    {
+        return;
+    }
+#endif
+
     struct aiocb *aiocbp = new struct aiocb;
     memset(aiocbp, 0, sizeof (struct aiocb));
 
@@ -445,6 +744,7 @@ bool PosixFileAccess::fopen(string* f, bool read, bool write)
 
             size = 0;
             mtime = statbuf.st_mtime;
+            ctime = statbuf.st_ctime;
             type = FOLDERNODE;
             fsid = (handle)statbuf.st_ino;
             fsidvalid = true;
@@ -485,6 +785,7 @@ bool PosixFileAccess::fopen(string* f, bool read, bool write)
 
             size = statbuf.st_size;
             mtime = statbuf.st_mtime;
+            ctime = statbuf.st_ctime;
             type = S_ISDIR(statbuf.st_mode) ? FOLDERNODE : FILENODE;
             fsid = (handle)statbuf.st_ino;
             fsidvalid = true;
@@ -511,6 +812,10 @@ PosixFileSystemAccess::PosixFileSystemAccess(int fseventsfd)
     notifyerr = false;
     notifyfailed = true;
     notifyfd = -1;
+    eventswaiter = NULL;
+#ifdef USE_IO_URING
+    watchedringfd = -1;
+#endif
 
     defaultfilepermissions = 0600;
     defaultfolderpermissions = 0700;
@@ -539,6 +844,19 @@ PosixFileSystemAccess::PosixFileSystemAccess(int fseventsfd)
     }
 #endif
 
+#ifdef USE_FANOTIFY
+    // requires CAP_SYS_ADMIN and Linux 5.9 - per-folder inotify watches
+    // are used otherwise (the queue is bounded: an overflow triggers a
+    // full rescan, like an inotify overflow)
+    fanotifyfd = fanotify_init(FAN_CLASS_NOTIF | FAN_REPORT_DFID_NAME
+                               | FAN_NONBLOCK | FAN_CLOEXEC, O_RDONLY);
+
+    if (fanotifyfd < 0)
+    {
+        LOG_debug << "fanotify not available: " << errno;
+    }
+#endif
+
 #ifdef __MACH__
 #if __LP64__
     typedef struct fsevent_clone_args {
@@ -611,30 +929,102 @@ PosixFileSystemAccess::PosixFileSystemAccess(int fseventsfd)
 
 PosixFileSystemAccess::~PosixFileSystemAccess()
 {
+    if (eventswaiter)
+    {
+        PosixWaiter* w = (PosixWaiter*)eventswaiter;
+
+        w->unwatchfd(notifyfd);
+#ifdef USE_FANOTIFY
+        w->unwatchfd(fanotifyfd);
+#endif
+#ifdef USE_IO_URING
+        w->unwatchfd(watchedringfd);
+#endif
+    }
+
     if (notifyfd >= 0)
     {
         close(notifyfd);
     }
+
+#ifdef USE_FANOTIFY
+    if (fanotifyfd >= 0)
+    {
+        close(fanotifyfd);
+    }
+
+    for (fsidmount_map::iterator it = fanotifymounts.begin(); it != fanotifymounts.end(); it++)
+    {
+        close(it->second.fd);
+    }
+#endif
 }
 
 // wake up from filesystem updates
 void PosixFileSystemAccess::addevents(Waiter* w, int flags)
 {
-    if (notifyfd >= 0)
+    // the descriptors are registered once per waiter
+    if (eventswaiter != w)
     {
-        PosixWaiter* pw = (PosixWaiter*)w;
+        eventswaiter = w;
 
-        FD_SET(notifyfd, &pw->rfds);
-        FD_SET(notifyfd, &pw->ignorefds);
+        if (notifyfd >= 0)
+        {
+            ((PosixWaiter*)w)->watchfd(notifyfd, PosixWaiter::WATCH_READ, true);
+        }
+
+#ifdef USE_FANOTIFY
+        if (fanotifyfd >= 0)
+        {
+            ((PosixWaiter*)w)->watchfd(fanotifyfd, PosixWaiter::WATCH_READ, true);
+        }
+#endif
 
-        pw->bumpmaxfd(notifyfd);
+#ifdef USE_IO_URING
+        watchedringfd = -1;
+#endif
+    }
+
+#ifdef USE_IO_URING
+    uring.submit();
+
+    // completions wake up the waiter through the ring descriptor
+    if (uring.fd >= 0 && uring.fd != watchedringfd)
+    {
+        ((PosixWaiter*)w)->watchfd(uring.fd, PosixWaiter::WATCH_READ);
+        watchedringfd = uring.fd;
     }
+#endif
+}
+
+void PosixFileSystemAccess::processasync()
+{
+#ifdef USE_IO_URING
+    uring.submit();
+    uring.reap();
+#endif
 }
 
 // read all pending inotify events and queue them for processing
 int PosixFileSystemAccess::checkevents(Waiter* w)
 {
     int r = 0;
+
+#ifdef USE_IO_URING
+    if (uring.reap())
+    {
+        r |= Waiter::NEEDEXEC;
+    }
+#endif
+
+#if defined(ENABLE_SYNC) && defined(USE_FANOTIFY)
+    if (fanotifyfd >= 0
+     && (((PosixWaiter*)w)->triggeredevents(fanotifyfd) & PosixWaiter::WATCH_READ))
+    {
+        r |= checkfanotify();
+    }
+#endif
+
     if (notifyfd < 0)
     {
         return r;
@@ -644,7 +1034,7 @@ int PosixFileSystemAccess::checkevents(Waiter* w)
     PosixWaiter* pw = (PosixWaiter*)w;
     string *ignore;
 
-    if (FD_ISSET(notifyfd, &pw->rfds))
+    if (pw->triggeredevents(notifyfd) & PosixWaiter::WATCH_READ)
     {
         char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
         int p, l;
@@ -919,6 +1309,275 @@ int PosixFileSystemAccess::checkevents(Waiter* w)
     return r;
 }
 
+#if defined(ENABLE_SYNC) && defined(USE_FANOTIFY)
+// fanotify reports the changes of whole filesystems by parent directory
+// handle and entry name - resolve them to absolute paths and queue those
+// inside a sync root relative to it
+int PosixFileSystemAccess::checkfanotify()
+{
+    int r = 0;
+    alignas(fanotify_event_metadata) char buf[16384];
+    ssize_t l;
+    fanotify_event_metadata* fe;
+    fanotify_event_info_fid* fid;
+    struct file_handle* fh;
+    const char* name;
+    string path;
+
+    while ((l = read(fanotifyfd, buf, sizeof buf)) > 0)
+    {
+        for (fe = (fanotify_event_metadata*)buf; FAN_EVENT_OK(fe, l); fe = FAN_EVENT_NEXT(fe, l))
+        {
+            if (fe->mask & FAN_Q_OVERFLOW)
+            {
+                notifyerr = true;
+                continue;
+            }
+
+            fid = (fanotify_event_info_fid*)(fe + 1);
+
+            if (fe->event_len < sizeof *fe + sizeof *fid
+             || fid->hdr.info_type != FAN_EVENT_INFO_TYPE_DFID_NAME)
+            {
+                continue;
+            }
+
+            fh = (struct file_handle*)fid->handle;
+            name = (const char*)fh->f_handle + fh->handle_bytes;
+
+            // changes of the watched directory itself are reported by its parent
+            if (!strcmp(name, "."))
+            {
+                continue;
+            }
+
+            bool dirgone = (fe->mask & FAN_ONDIR) && (fe->mask & (FAN_MOVED_FROM | FAN_DELETE));
+
+            if (!fanotifypath(&fid->fsid, fh, &path))
+            {
+                // the parent is gone as well - the moved or deleted folder
+                // can't be located among the resolved paths
+                if (dirgone)
+                {
+                    fanotifydirs.clear();
+                }
+
+                continue;
+            }
+
+            path.append(localseparator);
+            path.append(name);
+
+            // moved or deleted folders invalidate the resolved paths below them
+            if (dirgone)
+            {
+                fanotifyforget(path);
+            }
+
+            for (sync_list::iterator it = client->syncs.begin(); it != client->syncs.end(); it++)
+            {
+                PosixDirNotify* dirnotify = (PosixDirNotify*)(*it)->dirnotify.get();
+                const string* root = &dirnotify->fanotifyroot;
+                const string* ignore = &dirnotify->ignore;
+
+                if (!root->size()
+                 || path.size() <= root->size() + 1
+                 || memcmp(path.data(), root->data(), root->size())
+                 || path[root->size()] != '/')
+                {
+                    continue;
+                }
+
+                const char* relpath = path.c_str() + root->size() + 1;
+                size_t relsize = path.size() - root->size() - 1;
+
+                if (relsize < ignore->size()
+                 || memcmp(relpath, ignore->data(), ignore->size())
+                 || (relsize > ignore->size() && relpath[ignore->size()] != '/'))
+                {
+                    LOG_debug << "Filesystem notification. Root: " << (*it)->localroot.name << "   Path: " << relpath;
+                    dirnotify->notify(DirNotify::DIREVENTS, &(*it)->localroot, relpath, relsize);
+
+                    r |= Waiter::NEEDEXEC;
+                }
+
+                break;
+            }
+        }
+    }
+
+    return r;
+}
+
+// resolve a directory handle to its current absolute path
+bool PosixFileSystemAccess::fanotifypath(const void* fsid, struct file_handle* fh, string* path)
+{
+    fsfp_t fsfp;
+    memcpy(&fsfp, fsid, sizeof fsfp);
+
+    string key((const char*)&fsfp, sizeof fsfp);
+    key.append((const char*)&fh->handle_type, sizeof fh->handle_type);
+    key.append((const char*)fh->f_handle, fh->handle_bytes);
+
+    map<string, string>::iterator it = fanotifydirs.find(key);
+
+    if (it != fanotifydirs.end())
+    {
+        *path = it->second;
+        return true;
+    }
+
+    fsidmount_map::iterator mit = fanotifymounts.find(fsfp);
+
+    if (mit == fanotifymounts.end())
+    {
+        return false;
+    }
+
+    // fails if the directory is gone by now - its parent reports that
+    int fd = open_by_handle_at(mit->second.fd, fh, O_PATH | O_CLOEXEC);
+
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    char link[32];
+    char target[PATH_MAX];
+    ssize_t len;
+
+    snprintf(link, sizeof link, "/proc/self/fd/%d", fd);
+    len = readlink(link, target, sizeof target);
+    close(fd);
+
+    if (len <= 0 || len >= (ssize_t)sizeof target)
+    {
+        return false;
+    }
+
+    if (fanotifydirs.size() >= FANOTIFYDIRS)
+    {
+        fanotifydirs.clear();
+    }
+
+    path->assign(target, len);
+    fanotifydirs[key] = *path;
+
+    return true;
+}
+
+void PosixFileSystemAccess::fanotifyforget(const string& path)
+{
+    map<string, string>::iterator it = fanotifydirs.begin();
+
+    while (it != fanotifydirs.end())
+    {
+        if (!it->second.compare(0, path.size(), path)
+         && (it->second.size() == path.size() || it->second[path.size()] == '/'))
+        {
+            fanotifydirs.erase(it++);
+        }
+        else
+        {
+            it++;
+        }
+    }
+}
+
+// events reported on the marked filesystems
+#define FANOTIFY_MASK (FAN_CREATE | FAN_DELETE | FAN_MOVED_FROM | FAN_MOVED_TO | FAN_CLOSE_WRITE | FAN_ONDIR)
+
+// watch the filesystem containing a sync root (once per filesystem, while
+// syncs on it exist - events outside the syncs are filtered)
+bool PosixFileSystemAccess::fanotifymark(string* localpath, string* rootpath, fsfp_t* fsid)
+{
+    char resolved[PATH_MAX];
+    struct statfs statfsbuf;
+    fsfp_t fsfp;
+
+    if (fanotifyfd < 0
+     || !realpath(localpath->c_str(), resolved)
+     || statfs(resolved, &statfsbuf))
+    {
+        return false;
+    }
+
+    memcpy(&fsfp, &statfsbuf.f_fsid, sizeof fsfp);
+
+    fsidmount_map::iterator it = fanotifymounts.find(fsfp);
+
+    if (it == fanotifymounts.end())
+    {
+        int fd = open(resolved, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        // the directory handles have to be resolvable on this filesystem
+        alignas(struct file_handle) char buf[sizeof(struct file_handle) + MAX_HANDLE_SZ];
+        struct file_handle* fh = (struct file_handle*)buf;
+        int mountid;
+        int hfd = -1;
+
+        fh->handle_bytes = MAX_HANDLE_SZ;
+
+        if (name_to_handle_at(fd, "", fh, &mountid, AT_EMPTY_PATH)
+         || (hfd = open_by_handle_at(fd, fh, O_PATH | O_CLOEXEC)) < 0
+         || fanotify_mark(fanotifyfd, FAN_MARK_ADD | FAN_MARK_FILESYSTEM, FANOTIFY_MASK, fd, NULL))
+        {
+            LOG_warn << "Unable to watch filesystem of " << resolved << " through fanotify: " << errno;
+
+            if (hfd >= 0)
+            {
+                close(hfd);
+            }
+
+            close(fd);
+            return false;
+        }
+
+        close(hfd);
+        it = fanotifymounts.insert(fsidmount_map::value_type(fsfp, FanotifyMount())).first;
+        it->second.fd = fd;
+        it->second.syncs = 0;
+    }
+
+    it->second.syncs++;
+    *rootpath = resolved;
+    *fsid = fsfp;
+    return true;
+}
+
+void PosixFileSystemAccess::fanotifyunmark(fsfp_t fsid)
+{
+    fsidmount_map::iterator it = fanotifymounts.find(fsid);
+
+    if (it == fanotifymounts.end() || --it->second.syncs)
+    {
+        return;
+    }
+
+    if (fanotify_mark(fanotifyfd, FAN_MARK_REMOVE | FAN_MARK_FILESYSTEM, FANOTIFY_MASK, it->second.fd, NULL))
+    {
+        LOG_warn << "Unable to remove fanotify mark: " << errno;
+    }
+
+    close(it->second.fd);
+    fanotifymounts.erase(it);
+
+    // the handles of this filesystem can't be resolved anymore
+    string key((const char*)&fsid, sizeof fsid);
+    map<string, string>::iterator dit = fanotifydirs.lower_bound(key);
+
+    while (dit != fanotifydirs.end() && !dit->first.compare(0, key.size(), key))
+    {
+        fanotifydirs.erase(dit++);
+    }
+}
+#endif
+
 // generate unique local filename in the same fs as relatedpath
 void PosixFileSystemAccess::tmpnamelocal(string* localname) const
 {
@@ -1704,12 +2363,33 @@ PosixDirNotify::PosixDirNotify(string* localbasepath, string* ignore) : DirNotif
     failed = 0;
 #endif
 
+#ifdef USE_FANOTIFY
+    fanotifyfsid = 0;
+#endif
+
     fsaccess = NULL;
 }
 
+PosixDirNotify::~PosixDirNotify()
+{
+#if defined(ENABLE_SYNC) && defined(USE_FANOTIFY)
+    if (fanotifyroot.size())
+    {
+        fsaccess->fanotifyunmark(fanotifyfsid);
+    }
+#endif
+}
+
 void PosixDirNotify::addnotify(LocalNode* l, string* path)
 {
 #ifdef ENABLE_SYNC
+#ifdef USE_FANOTIFY
+    if (fanotifyroot.size())
+    {
+        return;
+    }
+#endif
+
 #ifdef USE_INOTIFY
     int wd;
 
@@ -1733,6 +2413,13 @@ void PosixDirNotify::addnotify(LocalNode* l, string* path)
 void PosixDirNotify::delnotify(LocalNode* l)
 {
 #ifdef ENABLE_SYNC
+#ifdef USE_FANOTIFY
+    if (fanotifyroot.size())
+    {
+        return;
+    }
+#endif
+
 #ifdef USE_INOTIFY
     if (fsaccess->wdnodes.erase((int)(long)l->dirnotifytag))
     {
@@ -1754,7 +2441,11 @@ fsfp_t PosixDirNotify::fsfingerprint()
 
 FileAccess* PosixFileSystemAccess::newfileaccess()
 {
-    return new PosixFileAccess(waiter, defaultfilepermissions);
+    PosixFileAccess* fa = new PosixFileAccess(waiter, defaultfilepermissions);
+#ifdef USE_IO_URING
+    fa->uring = &uring;
+#endif
+    return fa;
 }
 
 DirAccess* PosixFileSystemAccess::newdiraccess()
@@ -1768,6 +2459,13 @@ DirNotify* PosixFileSystemAccess::newdirnotify(string* localpath, string* ignore
 
     dirnotify->fsaccess = this;
 
+#if defined(ENABLE_SYNC) && defined(USE_FANOTIFY)
+    if (fanotifyfd >= 0 && !fanotifymark(localpath, &dirnotify->fanotifyroot, &dirnotify->fanotifyfsid))
+    {
+        LOG_debug << "Using inotify watches for " << *localpath;
+    }
+#endif
+
     return dirnotify;
 }
 
@@ -1890,6 +2588,65 @@ bool PosixDirAccess::dnext(string* path, string* name, bool followsymlinks, node
     return false;
 }
 
+void PosixDirAccess::dlist(string* path, vector<DirEntry>* entries, bool followsymlinks)
+{
+    if (globbing)
+    {
+        DirAccess::dlist(path, entries, followsymlinks);
+        return;
+    }
+
+    // readdir() fetches the records in batches (getdents64() on Linux), and
+    // the attributes are read relative to the directory, without building
+    // paths or opening the items
+    int fd = dirfd(dp);
+    dirent* d;
+    struct stat statbuf;
+    DirEntry entry;
+
+    while ((d = readdir(dp)))
+    {
+        if (*d->d_name == '.' && (!d->d_name[1] || (d->d_name[1] == '.' && !d->d_name[2])))
+        {
+            continue;
+        }
+
+#ifdef _DIRENT_HAVE_D_TYPE
+        // sockets, pipes and devices are never synced
+        if (d->d_type != DT_UNKNOWN && d->d_type != DT_REG && d->d_type != DT_DIR
+                && (d->d_type != DT_LNK || !followsymlinks))
+        {
+            continue;
+        }
+#endif
+
+        if (fstatat(fd, d->d_name, &statbuf, followsymlinks ? 0 : AT_SYMLINK_NOFOLLOW)
+                || !(S_ISREG(statbuf.st_mode) || S_ISDIR(statbuf.st_mode)))
+        {
+            continue;
+        }
+
+        // items that could not be opened for reading are left out, as
+        // with dnext() and a subsequent fopen()
+        if (faccessat(fd, d->d_name, R_OK, AT_EACCESS))
+        {
+            continue;
+        }
+
+        entry.localname = d->d_name;
+        entry.type = S_ISREG(statbuf.st_mode) ? FILENODE : FOLDERNODE;
+        entry.size = statbuf.st_size;
+        entry.mtime = statbuf.st_mtime;
+        entry.ctime = statbuf.st_ctime;
+        entry.fsid = (handle)statbuf.st_ino;
+        entry.fsidvalid = true;
+
+        FileSystemAccess::captimestamp(&entry.mtime);
+
+        entries->push_back(entry);
+    }
+}
+
 PosixDirAccess::PosixDirAccess()
 {
     dp = NULL;
@@ -134,6 +134,14 @@ CurlHttpIO::CurlHttpIO()
     curlipv6 = data->features & CURL_VERSION_IPV6;
     LOG_debug << "IPv6 enabled: " << curlipv6;
 
+#if LIBCURL_VERSION_NUM >= 0x072f00 // At least cURL 7.47.0
+    curlhttp2 = data->features & CURL_VERSION_HTTP2;
+#else
+    curlhttp2 = false;
+#endif
+    LOG_debug << "HTTP/2 available: " << curlhttp2;
+    http2 = false;
+
     dnsok = false;
     reset = false;
     statechange = false;
@@ -187,10 +195,14 @@ CurlHttpIO::CurlHttpIO()
     numconnections[GET] = 0;
     numconnections[PUT] = 0;
     curlsocketsprocessed = true;
+    waiter = NULL;
+#ifndef _WIN32
+    curlsocketswatched[API] = false;
+    curlsocketswatched[GET] = false;
+    curlsocketswatched[PUT] = false;
+#endif
 
-    struct ares_options options;
-    options.tries = 2;
-    ares_init_options(&ares, &options, ARES_OPT_TRIES);
+    initares();
     arestimeout = -1;
     filterDNSservers();
 
@@ -221,10 +233,9 @@ CurlHttpIO::CurlHttpIO()
 
     curltimeoutreset[PUT] = -1;
     arerequestspaused[PUT] = false;
+    setmultiplexing();
 
-    curlsh = curl_share_init();
-    curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
-    curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+    initcurlshare();
 
     contenttypejson = curl_slist_append(NULL, "Content-Type: application/json");
     contenttypejson = curl_slist_append(contenttypejson, "Expect:");
@@ -236,7 +247,6 @@ CurlHttpIO::CurlHttpIO()
     ipv6requestsenabled = false;
     ipv6proxyenabled = ipv6requestsenabled;
     ipv6deactivationtime = Waiter::ds;
-    waiter = NULL;
     proxyport = 0;
 }
 
@@ -364,6 +374,7 @@ void CurlHttpIO::filterDNSservers()
 
 void CurlHttpIO::addaresevents(Waiter *waiter)
 {
+#if defined(_WIN32)
     closearesevents();
 
     ares_socket_t socks[ARES_GETSOCK_MAXNUM];
@@ -371,26 +382,20 @@ void CurlHttpIO::addaresevents(Waiter *waiter)
     for (int i = 0; i < ARES_GETSOCK_MAXNUM; i++)
     {
         SockInfo info;
-
-#if defined(_WIN32)
         long events = 0;
-#endif
+
         if(ARES_GETSOCK_READABLE(bitmask, i))
         {
             info.fd = socks[i];
             info.mode |= SockInfo::READ;
-#if defined(_WIN32)
             events |= FD_READ;
-#endif
         }
 
         if(ARES_GETSOCK_WRITABLE(bitmask, i))
         {
             info.fd = socks[i];
             info.mode |= SockInfo::WRITE;
-#if defined(_WIN32)
             events |= FD_WRITE;
-#endif
         }
 
         if (!info.mode)
@@ -398,7 +403,6 @@ void CurlHttpIO::addaresevents(Waiter *waiter)
             continue;
         }
 
-#if defined(_WIN32)
         info.handle = WSACreateEvent();
         if (info.handle == WSA_INVALID_EVENT)
         {
@@ -414,24 +418,16 @@ void CurlHttpIO::addaresevents(Waiter *waiter)
         {
             ((WinWaiter *)waiter)->addhandle(info.handle, Waiter::NEEDEXEC);
         }
-#else
-        if (info.mode & SockInfo::READ)
-        {
-            FD_SET(info.fd, &((PosixWaiter *)waiter)->rfds);
-            ((PosixWaiter *)waiter)->bumpmaxfd(info.fd);
-        }
-        if (info.mode & SockInfo::WRITE)
-        {
-            FD_SET(info.fd, &((PosixWaiter *)waiter)->wfds);
-            ((PosixWaiter *)waiter)->bumpmaxfd(info.fd);
-        }
-#endif
+
         aressockets.push_back(info);
     }
+#endif
+    // otherwise registered by ares_sockstate_callback()
 }
 
 void CurlHttpIO::addcurlevents(Waiter *waiter, direction_t d)
 {
+#if defined(_WIN32)
     std::map<int, SockInfo> &socketmap = curlsockets[d];
     for (std::map<int, SockInfo>::iterator it = socketmap.begin(); it != socketmap.end(); it++)
     {
@@ -441,7 +437,6 @@ void CurlHttpIO::addcurlevents(Waiter *waiter, direction_t d)
             continue;
         }
 
-#if defined(_WIN32)
         long events = 0;
         if (info.handle == WSA_INVALID_EVENT)
         {
@@ -452,29 +447,17 @@ void CurlHttpIO::addcurlevents(Waiter *waiter, direction_t d)
                 continue;
             }
         }
-#endif
 
         if (info.mode & SockInfo::READ)
         {
-#if defined(_WIN32)
             events |= FD_READ;
-#else
-            FD_SET(info.fd, &((PosixWaiter *)waiter)->rfds);
-            ((PosixWaiter *)waiter)->bumpmaxfd(info.fd);
-#endif
         }
 
         if (info.mode & SockInfo::WRITE)
         {
-#if defined(_WIN32)
             events |= FD_WRITE;
-#else
-            FD_SET(info.fd, &((PosixWaiter *)waiter)->wfds);
-            ((PosixWaiter *)waiter)->bumpmaxfd(info.fd);
-#endif
         }
 
-#if defined(_WIN32)
         if (WSAEventSelect(info.fd, info.handle, events))
         {
             LOG_err << "Error associating curl handle " << info.fd << ": " << GetLastError();
@@ -484,9 +467,85 @@ void CurlHttpIO::addcurlevents(Waiter *waiter, direction_t d)
         }
 
         ((WinWaiter *)waiter)->addhandle(info.handle, Waiter::NEEDEXEC);
+    }
+#else
+    // kept up to date by socket_callback() from then on
+    if (!curlsocketswatched[d])
+    {
+        watchcurlsockets(d, true);
+    }
 #endif
+}
+
+#ifndef _WIN32
+void CurlHttpIO::watchcurlsockets(direction_t d, bool watch)
+{
+    std::map<int, SockInfo> &socketmap = curlsockets[d];
+    for (std::map<int, SockInfo>::iterator it = socketmap.begin(); it != socketmap.end(); it++)
+    {
+        if (it->second.mode)
+        {
+            if (watch)
+            {
+                waiter->watchfd(it->second.fd, it->second.mode);
+            }
+            else
+            {
+                waiter->unwatchfd(it->second.fd);
+            }
+        }
+    }
+
+    curlsocketswatched[d] = watch;
+}
+
+void CurlHttpIO::ares_sockstate_callback(void* data, ares_socket_t s, int readable, int writable)
+{
+    CurlHttpIO *httpio = (CurlHttpIO *)data;
+    int mode = (readable ? SockInfo::READ : 0) | (writable ? SockInfo::WRITE : 0);
+
+    if (mode)
+    {
+        SockInfo &info = httpio->aressocketmap[s];
+        info.fd = s;
+        info.mode = mode;
+    }
+    else
+    {
+        httpio->aressocketmap.erase(s);
+    }
+
+    if (httpio->waiter)
+    {
+        httpio->waiter->watchfd(s, mode);
     }
 }
+#endif
+
+void CurlHttpIO::initcurlshare()
+{
+    curlsh = curl_share_init();
+    curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900 // At least cURL 7.57.0
+    // an idle connection opened for one multi handle can be reused by the
+    // others - HTTP/2 streams are still only multiplexed within each one
+    curl_share_setopt(curlsh, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+void CurlHttpIO::initares()
+{
+    struct ares_options options;
+    int optmask = ARES_OPT_TRIES;
+    options.tries = 2;
+#ifndef _WIN32
+    options.sock_state_cb = ares_sockstate_callback;
+    options.sock_state_cb_data = this;
+    optmask |= ARES_OPT_SOCK_STATE_CB;
+#endif
+    ares_init_options(&ares, &options, optmask);
+}
 
 void CurlHttpIO::closearesevents()
 {
@@ -514,27 +573,23 @@ void CurlHttpIO::closecurlevents(direction_t d)
             WSACloseEvent(info.handle);
         }
     }
+#else
+    // already closed by cURL, but not unregistered
+    for (std::map<int, SockInfo>::iterator it = socketmap.begin(); waiter && curlsocketswatched[d] && it != socketmap.end(); it++)
+    {
+        waiter->unwatchfd(it->first);
+    }
 #endif
     socketmap.clear();
 }
 
 void CurlHttpIO::processaresevents()
 {
-#ifndef _WIN32
-    fd_set *rfds = &((PosixWaiter *)waiter)->rfds;
-    fd_set *wfds = &((PosixWaiter *)waiter)->wfds;
-#endif
-
+#if defined(_WIN32)
     for (unsigned int i = 0; i < aressockets.size(); i++)
     {
         SockInfo &info = aressockets[i];
-        if (!info.mode)
-        {
-            continue;
-        }
-
-#if defined(_WIN32)
-        if (info.handle == WSA_INVALID_EVENT)
+        if (!info.mode || info.handle == WSA_INVALID_EVENT)
         {
             continue;
         }
@@ -546,15 +601,22 @@ void CurlHttpIO::processaresevents()
                             (info.mode & SockInfo::READ) ? info.fd : ARES_SOCKET_BAD,
                             (info.mode & SockInfo::WRITE) ? info.fd : ARES_SOCKET_BAD);
         }
+    }
 #else
-        if (((info.mode & SockInfo::READ) && FD_ISSET(info.fd, rfds)) || ((info.mode & SockInfo::WRITE) && FD_ISSET(info.fd, wfds)))
+    // only the sockets that were triggered
+    std::map<int, int> &triggered = ((PosixWaiter *)waiter)->triggered;
+    for (std::map<int, int>::iterator it = triggered.begin(); it != triggered.end(); it++)
+    {
+        std::map<int, SockInfo>::iterator info = aressocketmap.find(it->first);
+        int events = info != aressocketmap.end() ? info->second.mode & it->second : 0;
+        if (events)
         {
             ares_process_fd(ares,
-                            ((info.mode & SockInfo::READ) && FD_ISSET(info.fd, rfds)) ? info.fd : ARES_SOCKET_BAD,
-                            ((info.mode & SockInfo::WRITE) && FD_ISSET(info.fd, wfds)) ? info.fd : ARES_SOCKET_BAD);
+                            (events & SockInfo::READ) ? it->first : ARES_SOCKET_BAD,
+                            (events & SockInfo::WRITE) ? it->first : ARES_SOCKET_BAD);
         }
-#endif
     }
+#endif
 
     if (arestimeout >= 0 && arestimeout <= Waiter::ds)
     {
@@ -565,16 +627,12 @@ void CurlHttpIO::processaresevents()
 
 void CurlHttpIO::processcurlevents(direction_t d)
 {
-#ifndef _WIN32
-    fd_set *rfds = &((PosixWaiter *)waiter)->rfds;
-    fd_set *wfds = &((PosixWaiter *)waiter)->wfds;
-#endif
-
     int dummy = 0;
     std::map<int, SockInfo> *socketmap = &curlsockets[d];
     m_time_t *timeout = &curltimeoutreset[d];
     bool *paused = &arerequestspaused[d];
 
+#if defined(_WIN32)
     for (std::map<int, SockInfo>::iterator it = socketmap->begin(); !(*paused) && it != socketmap->end();)
     {
         SockInfo &info = (it++)->second;
@@ -583,7 +641,6 @@ void CurlHttpIO::processcurlevents(direction_t d)
             continue;
         }
 
-#if defined(_WIN32)
         if (info.handle == WSA_INVALID_EVENT)
         {
             continue;
@@ -597,16 +654,24 @@ void CurlHttpIO::processcurlevents(direction_t d)
                                      | ((info.mode & SockInfo::WRITE) ? CURL_CSELECT_OUT : 0),
                                      &dummy);
         }
+    }
 #else
-        if (((info.mode & SockInfo::READ) && FD_ISSET(info.fd, rfds)) || ((info.mode & SockInfo::WRITE) && FD_ISSET(info.fd, wfds)))
-        {
-            curl_multi_socket_action(curlm[d], info.fd,
-                                     (((info.mode & SockInfo::READ) && FD_ISSET(info.fd, rfds)) ? CURL_CSELECT_IN : 0)
-                                     | (((info.mode & SockInfo::WRITE) && FD_ISSET(info.fd, wfds)) ? CURL_CSELECT_OUT : 0),
+    // only the sockets that were triggered (socket_callback() may change the
+    // socket map meanwhile, but not the triggered ones)
+    std::map<int, int> &triggered = ((PosixWaiter *)waiter)->triggered;
+    for (std::map<int, int>::iterator it = triggered.begin(); !(*paused) && it != triggered.end(); it++)
+    {
+        std::map<int, SockInfo>::iterator info = socketmap->find(it->first);
+        int events = info != socketmap->end() ? info->second.mode & it->second : 0;
+        if (events)
+        {
+            curl_multi_socket_action(curlm[d], it->first,
+                                     ((events & SockInfo::READ) ? CURL_CSELECT_IN : 0)
+                                     | ((events & SockInfo::WRITE) ? CURL_CSELECT_OUT : 0),
                                      &dummy);
         }
-#endif
     }
+#endif
 
     m_time_t value = *timeout;
     if (value >= 0 && value <= Waiter::ds)
@@ -632,6 +697,8 @@ void CurlHttpIO::processcurlevents(direction_t d)
 
 CurlHttpIO::~CurlHttpIO()
 {
+    // the waiter may already be gone
+    waiter = NULL;
     disconnecting = true;
     ares_destroy(ares);
     curl_multi_cleanup(curlm[API]);
@@ -686,6 +753,10 @@ void CurlHttpIO::disconnect()
     curl_multi_cleanup(curlm[GET]);
     curl_multi_cleanup(curlm[PUT]);
 
+    // drop the shared connections as well
+    curl_share_cleanup(curlsh);
+    initcurlshare();
+
     if (numconnections[API] || numconnections[GET] || numconnections[PUT])
     {
         LOG_err << "Disconnecting without cancelling all requests first";
@@ -708,9 +779,7 @@ void CurlHttpIO::disconnect()
     curlm[API] = curl_multi_init();
     curlm[GET] = curl_multi_init();
     curlm[PUT] = curl_multi_init();
-    struct ares_options options;
-    options.tries = 2;
-    ares_init_options(&ares, &options, ARES_OPT_TRIES);
+    initares();
     arestimeout = -1;
 
     curl_multi_setopt(curlm[API], CURLMOPT_SOCKETFUNCTION, api_socket_callback);
@@ -740,6 +809,7 @@ void CurlHttpIO::disconnect()
 #endif
     curltimeoutreset[PUT] = -1;
     arerequestspaused[PUT] = false;
+    setmultiplexing();
 
     disconnecting = false;
     if (dnsservers.size())
@@ -759,6 +829,34 @@ void CurlHttpIO::disconnect()
     }
 }
 
+bool CurlHttpIO::sethttp2(bool enable)
+{
+    if (enable && !curlhttp2)
+    {
+        LOG_warn << "cURL built without HTTP/2 support";
+        return false;
+    }
+
+    LOG_debug << "HTTP/2 " << (enable ? "enabled" : "disabled");
+    http2 = enable;
+    setmultiplexing();
+    return true;
+}
+
+// with HTTP/2, requests of the same multi handle share connections to the
+// same host as parallel streams - otherwise connections are only reused
+// once idle, by any of the multi handles (see initcurlshare()) - cURL 7.62+
+// would multiplex by default
+void CurlHttpIO::setmultiplexing()
+{
+#if LIBCURL_VERSION_NUM >= 0x072b00 // At least cURL 7.43.0
+    for (int d = 0; d < 3; d++)
+    {
+        curl_multi_setopt(curlm[d], CURLMOPT_PIPELINING, http2 ? CURLPIPE_MULTIPLEX : CURLPIPE_NOTHING);
+    }
+#endif
+}
+
 bool CurlHttpIO::setmaxdownloadspeed(m_off_t bpslimit)
 {
     maxspeed[GET] = bpslimit;
@@ -784,6 +882,21 @@ m_off_t CurlHttpIO::getmaxuploadspeed()
 // wake up from cURL I/O
 void CurlHttpIO::addevents(Waiter* w, int)
 {
+#ifndef _WIN32
+    if (waiter != w)
+    {
+        // sockets are registered as they change, the current ones have to
+        // be registered with a new waiter
+        waiter = (WAIT_CLASS*)w;
+        for (std::map<int, SockInfo>::iterator it = aressocketmap.begin(); it != aressocketmap.end(); it++)
+        {
+            waiter->watchfd(it->first, it->second.mode);
+        }
+        curlsocketswatched[API] = false;
+        curlsocketswatched[GET] = false;
+        curlsocketswatched[PUT] = false;
+    }
+#endif
     waiter = (WAIT_CLASS*)w;
     long curltimeoutms = -1;
 
@@ -809,6 +922,13 @@ void CurlHttpIO::addevents(Waiter* w, int)
     {
         if (arerequestspaused[d])
         {
+#ifndef _WIN32
+            // readable sockets would wake the waiter up right away
+            if (curlsocketswatched[d])
+            {
+                watchcurlsockets((direction_t)d, false);
+            }
+#endif
             if (curltimeoutms < 0 || curltimeoutms > 100)
             {
                 curltimeoutms = 100;
@@ -1305,6 +1425,20 @@ void CurlHttpIO::send_request(CurlHttpContext* httpctx)
         }
 
         curl_easy_setopt(curl, CURLOPT_URL, httpctx->posturl.c_str());
+#if LIBCURL_VERSION_NUM >= 0x072f00 // At least cURL 7.47.0
+        if (httpio->http2)
+        {
+            // HTTP/2 is negotiated through ALPN (HTTP/1.1 for plain HTTP and
+            // servers without it), wait for a stream on an existing
+            // connection to the host rather than opening a new one
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_2TLS);
+            curl_easy_setopt(curl, CURLOPT_PIPEWAIT, 1L);
+        }
+        else
+#endif
+        {
+            curl_easy_setopt(curl, CURLOPT_HTTP_VERSION, CURL_HTTP_VERSION_1_1);
+        }
         curl_easy_setopt(curl, CURLOPT_READFUNCTION, read_data);
         curl_easy_setopt(curl, CURLOPT_READDATA, (void*)req);
         curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, seek_data);
@@ -1660,9 +1794,7 @@ void CurlHttpIO::post(HttpReq* req, const char* data, unsigned len)
         LOG_debug << "Error in c-ares. Reinitializing...";
         reset = false;
         ares_destroy(ares);
-        struct ares_options options;
-        options.tries = 2;
-        ares_init_options(&ares, &options, ARES_OPT_TRIES);
+        initares();
 
         if (dnsservers.size())
         {
@@ -2051,7 +2183,7 @@ bool CurlHttpIO::multidoio(CURLM *curlmhandle)
                 // check httpstatus and response length
                 req->status = (req->httpstatus == 200
                                && (req->contentlength < 0
-                                   || req->contentlength == (req->buf ? req->bufpos : (int)req->in.size())))
+                                   || req->contentlength == (req->buf ? req->bufpos : (m_off_t)req->in.size() + req->inpurged)))
                         ? REQ_SUCCESS : REQ_FAILURE;
 
                 if (req->status == REQ_SUCCESS)
@@ -2429,6 +2561,12 @@ int CurlHttpIO::socket_callback(CURL *, curl_socket_t s, int what, void *userp,
             WSACloseEvent(handle);
             socketmap[s].handle = WSA_INVALID_EVENT;
         }
+#endif
+#ifndef _WIN32
+        if (httpio->waiter && httpio->curlsocketswatched[d])
+        {
+            httpio->waiter->unwatchfd(s);
+        }
 #endif
         socketmap[s].mode = 0;
     }
@@ -2445,6 +2583,11 @@ int CurlHttpIO::socket_callback(CURL *, curl_socket_t s, int what, void *userp,
             WSACloseEvent (it->second.handle);
         }
         info.handle = WSA_INVALID_EVENT;
+#else
+        if (httpio->waiter && httpio->curlsocketswatched[d])
+        {
+            httpio->waiter->watchfd(s, what);
+        }
 #endif
         socketmap[s] = info;
     }
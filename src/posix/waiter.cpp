@@ -54,15 +54,128 @@ PosixWaiter::PosixWaiter()
         LOG_err << "fcntl error";
     }
 
+#ifdef USE_EPOLL
+    epollfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epollfd < 0)
+    {
+        LOG_fatal << "Error creating epoll instance";
+        throw std::runtime_error("Error creating epoll instance");
+    }
+#endif
+
     maxfd = -1;
+    watchfd(m_pipe[0], WATCH_READ, true);
 }
 
 PosixWaiter::~PosixWaiter()
 {
+#ifdef USE_EPOLL
+    close(epollfd);
+#endif
     close(m_pipe[0]);
     close(m_pipe[1]);
 }
 
+void PosixWaiter::watchfd(int fd, int events, bool ignore)
+{
+    if (!events)
+    {
+        return unwatchfd(fd);
+    }
+
+    int flags = events | (ignore ? WATCH_IGNORE : 0);
+
+#ifdef USE_EPOLL
+    // registered once - descriptors are unwatched before they are closed,
+    // so an unchanged registration is still in the epoll set
+    std::map<int, int>::iterator it = watched.find(fd);
+    if (it != watched.end() && it->second == flags)
+    {
+        return;
+    }
+
+    epoll_event event;
+    memset(&event, 0, sizeof event);
+    event.events = ((events & WATCH_READ) ? EPOLLIN : 0) | ((events & WATCH_WRITE) ? EPOLLOUT : 0);
+    event.data.u64 = uint64_t(unsigned(fd)) | (uint64_t(flags) << 32);
+
+    int op = it == watched.end() ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+    if (epoll_ctl(epollfd, op, fd, &event) < 0)
+    {
+        // closed without unwatchfd() and reused meanwhile
+        op = errno == ENOENT ? EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+        if (epoll_ctl(epollfd, op, fd, &event) < 0)
+        {
+            LOG_err << "Unable to watch descriptor " << fd << ": " << errno;
+            return;
+        }
+    }
+#endif
+
+    watched[fd] = flags;
+}
+
+void PosixWaiter::unwatchfd(int fd)
+{
+    std::map<int, int>::iterator it = watched.find(fd);
+    if (it == watched.end())
+    {
+        return;
+    }
+
+#ifdef USE_EPOLL
+    // fails harmlessly if the descriptor has already been closed
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, NULL);
+#endif
+
+    watched.erase(it);
+}
+
+int PosixWaiter::triggeredevents(int fd) const
+{
+    std::map<int, int>::const_iterator it = triggered.find(fd);
+    return it == triggered.end() ? 0 : it->second;
+}
+
+#ifdef USE_EPOLL
+// collect the triggered watched descriptors, returns true if one of them
+// requests exec()
+bool PosixWaiter::epollwait(int timeoutms)
+{
+    epoll_event events[MAXEVENTS];
+    bool exec = false;
+
+    int n = epoll_wait(epollfd, events, MAXEVENTS, timeoutms);
+    for (int i = 0; i < n; i++)
+    {
+        int fd = int(events[i].data.u64 & 0xffffffff);
+        int flags = int(events[i].data.u64 >> 32);
+
+        // errors and hangups are reported as readable/writable, as select() does
+        int r = 0;
+        if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+        {
+            r |= flags & WATCH_READ;
+        }
+        if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+        {
+            r |= flags & WATCH_WRITE;
+        }
+
+        if (r)
+        {
+            triggered[fd] = r;
+            if (!(flags & WATCH_IGNORE))
+            {
+                exec = true;
+            }
+        }
+    }
+
+    return exec;
+}
+#endif
+
 void PosixWaiter::init(dstime ds)
 {
     Waiter::init(ds);
@@ -113,20 +226,78 @@ int PosixWaiter::wait()
 {
     int numfd;
     timeval tv;
+    bool exec = false;
 
-    //Pipe added to rfds to be able to leave select() when needed
-    FD_SET(m_pipe[0], &rfds);
-    bumpmaxfd(m_pipe[0]);
+    triggered.clear();
 
-    if (maxds + 1)
+#ifdef USE_EPOLL
+    if (maxfd < 0)
     {
-        dstime us = 1000000 / 10 * maxds;
+        // only watched descriptors (the pipe to be able to leave the wait
+        // among them): no fd_sets to scan
+        int timeoutms = -1;
+        if (maxds + 1)
+        {
+            timeoutms = maxds < dstime(INT_MAX / 100) ? int(maxds * 100) : INT_MAX;
+        }
 
-        tv.tv_sec = us / 1000000;
-        tv.tv_usec = us - tv.tv_sec * 1000000;
+        exec = epollwait(timeoutms);
+        numfd = int(triggered.size());
     }
+    else
+    {
+        // descriptors added to the fd_sets by the host app: select() on
+        // them and on the epoll set
+        FD_SET(epollfd, &rfds);
+        bumpmaxfd(epollfd);
+#else
+    {
+        // watched descriptors go to the fd_sets
+        for (std::map<int, int>::iterator it = watched.begin(); it != watched.end(); it++)
+        {
+            if (it->second & WATCH_READ)
+            {
+                FD_SET(it->first, &rfds);
+            }
+            if (it->second & WATCH_WRITE)
+            {
+                FD_SET(it->first, &wfds);
+            }
+            if (it->second & WATCH_IGNORE)
+            {
+                FD_SET(it->first, &ignorefds);
+            }
+            bumpmaxfd(it->first);
+        }
+#endif
+
+        if (maxds + 1)
+        {
+            dstime us = 1000000 / 10 * maxds;
+
+            tv.tv_sec = us / 1000000;
+            tv.tv_usec = us - tv.tv_sec * 1000000;
+        }
 
-    numfd = select(maxfd + 1, &rfds, &wfds, &efds, maxds + 1 ? &tv : NULL);
+        numfd = select(maxfd + 1, &rfds, &wfds, &efds, maxds + 1 ? &tv : NULL);
+
+#ifdef USE_EPOLL
+        if (numfd > 0 && FD_ISSET(epollfd, &rfds))
+        {
+            FD_CLR(epollfd, &rfds);
+            exec = epollwait(0);
+        }
+#else
+        for (std::map<int, int>::iterator it = watched.begin(); numfd > 0 && it != watched.end(); it++)
+        {
+            int r = ((FD_ISSET(it->first, &rfds) ? WATCH_READ : 0) | (FD_ISSET(it->first, &wfds) ? WATCH_WRITE : 0)) & it->second;
+            if (r)
+            {
+                triggered[it->first] = r;
+            }
+        }
+#endif
+    }
 
     // empty pipe
     uint8_t buf;
@@ -143,7 +314,8 @@ int PosixWaiter::wait()
     }
 
     // request exec() to be run only if a non-ignored fd was triggered
-    return (fd_filter(maxfd + 1, &rfds, &ignorefds)
+    return (exec
+         || fd_filter(maxfd + 1, &rfds, &ignorefds)
          || fd_filter(maxfd + 1, &wfds, &ignorefds)
          || fd_filter(maxfd + 1, &efds, &ignorefds)) ? NEEDEXEC : 0;
 }
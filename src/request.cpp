@@ -50,6 +50,11 @@ void Request::get(string* req) const
     req->append("]");
 }
 
+Request::Request()
+{
+    processed = 0;
+}
+
 void Request::procresult(MegaClient* client)
 {
     if (!client->json.enterarray())
@@ -57,15 +62,33 @@ void Request::procresult(MegaClient* client)
         LOG_err << "Invalid response from server";
     }
 
-    for (int i = 0; i < (int)cmds.size(); i++)
+    // skip the results that were processed ahead
+    for (int i = processed; i--; )
+    {
+        client->json.storeobject();
+    }
+
+    if (procresults(client, (int)cmds.size()))
     {
-        client->restag = cmds[i]->tag;
+        clear();
+    }
+}
 
-        cmds[i]->client = client;
+// process the results of the commands up to (excluding) position n, with
+// the JSON scanner positioned at the first result not yet processed
+bool Request::procresults(MegaClient* client, int n)
+{
+    while (processed < n)
+    {
+        Command* cmd = cmds[processed++];
+
+        client->restag = cmd->tag;
+
+        cmd->client = client;
 
         if (client->json.enterobject())
         {
-            cmds[i]->procresult();
+            cmd->procresult();
 
             if (!client->json.leaveobject())
             {
@@ -74,7 +97,7 @@ void Request::procresult(MegaClient* client)
         }
         else if (client->json.enterarray())
         {
-            cmds[i]->procresult();
+            cmd->procresult();
 
             if (!client->json.leavearray())
             {
@@ -83,16 +106,29 @@ void Request::procresult(MegaClient* client)
         }
         else
         {
-            cmds[i]->procresult();
+            cmd->procresult();
         }
 
         if(!cmds.size())
         {
-            return;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+int Request::incrementalcmd() const
+{
+    for (int i = 0; i < (int)cmds.size(); i++)
+    {
+        if (cmds[i]->incremental)
+        {
+            return i;
         }
     }
 
-    clear();
+    return -1;
 }
 
 void Request::clear()
@@ -105,6 +141,7 @@ void Request::clear()
         }
     }
     cmds.clear();
+    processed = 0;
 }
 
 RequestDispatcher::RequestDispatcher()
@@ -156,6 +193,16 @@ void RequestDispatcher::procresult(MegaClient *client)
     reqs[r ^ 1].procresult(client);
 }
 
+bool RequestDispatcher::procresults(MegaClient *client, int n)
+{
+    return reqs[r ^ 1].procresults(client, n);
+}
+
+int RequestDispatcher::incrementalcmd() const
+{
+    return reqs[r ^ 1].incrementalcmd();
+}
+
 void RequestDispatcher::clear()
 {
     for (int i = sizeof(reqs)/sizeof(*reqs); i--; )
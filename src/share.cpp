@@ -44,7 +44,7 @@ void Share::serialize(string* d)
     d->append((char*)&ph, sizeof ph);
 }
 
-bool Share::unserialize(MegaClient* client, int direction, handle h,
+bool Share::unserialize(newshare_list* newshares, int direction, handle h,
                         const byte* key, const char** ptr, const char* end)
 {
     if (*ptr + sizeof(handle) + sizeof(m_time_t) + 2 > end)
@@ -59,7 +59,7 @@ bool Share::unserialize(MegaClient* client, int direction, handle h,
         // Pending flag exists
         ph = MemAccess::get<handle>(*ptr + sizeof(handle) + sizeof(m_time_t) + 2);       
     }
-    client->newshares.push_back(new NewShare(h, direction, MemAccess::get<handle>(*ptr),
+    newshares->push_back(new NewShare(h, direction, MemAccess::get<handle>(*ptr),
                                              (accesslevel_t)(*ptr)[sizeof(handle) + sizeof(m_time_t)],
                                              MemAccess::get<m_time_t>(*ptr + sizeof(handle)), key, NULL, ph));
 
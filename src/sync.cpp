@@ -35,6 +35,7 @@ const int Sync::EXTRA_SCANNING_DELAY_DS = 150;
 const int Sync::FILE_UPDATE_DELAY_DS = 30;
 const int Sync::FILE_UPDATE_MAX_DELAY_SECS = 60;
 const dstime Sync::RECENT_VERSION_INTERVAL_SECS = 10800;
+const int Sync::SCANNING_BATCH = 256;
 
 // new Syncs are automatically inserted into the session's syncs list
 // and a full read of the subtree is initiated
@@ -52,6 +53,8 @@ Sync::Sync(MegaClient* cclient, string* crootpath, const char* cdebris,
     updatedfilesize = ~0;
     updatedfilets = 0;
     updatedfileinitialts = 0;
+    scanpending = 0;
+    fingerprinted = false;
 
     localbytes = 0;
     localnodes[FILENODE] = 0;
@@ -62,6 +65,8 @@ Sync::Sync(MegaClient* cclient, string* crootpath, const char* cdebris,
 
     fullscan = true;
     scanseqno = 0;
+    startfullscan();
+    settledclock = m_time;
 
     if (cdebris)
     {
@@ -131,6 +136,17 @@ Sync::~Sync()
     // unlock tmp lock
     delete tmpfa;
 
+    // drop pending scan jobs and fingerprints
+    if (client->scanpool)
+    {
+        client->scanpool->cancel(this);
+    }
+
+    for (map<string, SyncScanJob*>::iterator it = scanned.begin(); it != scanned.end(); it++)
+    {
+        delete it->second;
+    }
+
     // stop all active and pending downloads
     if (localroot.node)
     {
@@ -259,14 +275,14 @@ void Sync::cachenodes()
         statecachetable->begin();
 
         // deletions
-        for (set<int32_t>::iterator it = deleteq.begin(); it != deleteq.end(); it++)
-        {
-            statecachetable->del(*it);
-        }
+        vector<uint32_t> deleted(deleteq.begin(), deleteq.end());
+        statecachetable->delrecords(&deleted);
 
         deleteq.clear();
 
         // additions - we iterate until completion or until we get stuck
+        // (parents get their dbid when encoded, before their children)
+        dbrecord_vector records;
         bool added;
 
         do {
@@ -276,7 +292,17 @@ void Sync::cachenodes()
             {
                 if ((*it)->parent->dbid || (*it)->parent == &localroot)
                 {
-                    statecachetable->put(MegaClient::CACHEDLOCALNODE, *it, &client->key);
+                    records.push_back(pair<uint32_t, string>(0, string()));
+
+                    if (statecachetable->encode(MegaClient::CACHEDLOCALNODE, *it, &client->key, &records.back().second))
+                    {
+                        records.back().first = (*it)->dbid;
+                    }
+                    else
+                    {
+                        records.pop_back();
+                    }
+
                     insertq.erase(it++);
                     added = true;
                 }
@@ -284,6 +310,8 @@ void Sync::cachenodes()
             }
         } while (added);
 
+        statecachetable->putrecords(&records);
+
         statecachetable->commit();
 
         if (insertq.size())
@@ -415,15 +443,20 @@ LocalNode* Sync::localnodebypath(LocalNode* l, string* localpath, LocalNode** pa
 // localpath must be prefixed with Sync
 bool Sync::scan(string* localpath, FileAccess* fa)
 {
-    if (localpath->size() < localdebris.size()
-     || memcmp(localpath->data(), localdebris.data(), localdebris.size())
-     || (localpath->size() != localdebris.size()
-      && memcmp(localpath->data() + localdebris.size(),
-                client->fsaccess->localseparator.data(),
-                client->fsaccess->localseparator.size())))
+    if (!isdebris(localpath))
     {
+        if (!initializing && client->syncscanthreads > 0)
+        {
+            // the listed items are queued by procscanresults()
+            SyncScanJob* job = new SyncScanJob(this, SyncScanJob::LIST, *localpath);
+            job->followsymlinks = client->followsymlinks;
+            scanpending++;
+            client->syncscanpool()->push(job);
+            return true;
+        }
+
         DirAccess* da;
-        string localname, name;
+        string name;
         bool success;
 
         string utf8path;
@@ -439,10 +472,13 @@ bool Sync::scan(string* localpath, FileAccess* fa)
         if ((success = da->dopen(localpath, fa, false)))
         {
             size_t t = localpath->size();
+            vector<DirEntry> entries;
 
-            while (da->dnext(localpath, &localname, client->followsymlinks))
+            da->dlist(localpath, &entries, client->followsymlinks);
+
+            for (size_t i = 0; i < entries.size(); i++)
             {
-                name = localname;
+                name = entries[i].localname;
                 client->fsaccess->local2name(&name);
 
                 if (t)
@@ -450,24 +486,19 @@ bool Sync::scan(string* localpath, FileAccess* fa)
                     localpath->append(client->fsaccess->localseparator);
                 }
 
-                localpath->append(localname);
+                localpath->append(entries[i].localname);
 
                 // check if this record is to be ignored
                 if (client->app->sync_syncable(this, name.c_str(), localpath))
                 {
                     // skip the sync's debris folder
-                    if (localpath->size() < localdebris.size()
-                     || memcmp(localpath->data(), localdebris.data(), localdebris.size())
-                     || (localpath->size() != localdebris.size()
-                      && memcmp(localpath->data() + localdebris.size(),
-                                client->fsaccess->localseparator.data(),
-                                client->fsaccess->localseparator.size())))
+                    if (!isdebris(localpath))
                     {
                         LocalNode *l = NULL;
                         if (initializing)
                         {
                             // preload all cached LocalNodes
-                            l = checkpath(NULL, localpath);
+                            l = checkpath(NULL, localpath, NULL, NULL, false, &entries[i]);
                         }
 
                         if (!l || l == (LocalNode*)~0)
@@ -493,13 +524,184 @@ bool Sync::scan(string* localpath, FileAccess* fa)
     else return false;
 }
 
+// bytes FileFingerprint::genfingerprint() reads from a file of the given size
+static m_off_t fingerprintbytes(m_off_t size)
+{
+    return size > 0 ? std::min(size, (m_off_t)FileFingerprint::MAXFULL) : 0;
+}
+
+bool Sync::isdebris(string* localpath)
+{
+    return localpath->size() >= localdebris.size()
+        && !memcmp(localpath->data(), localdebris.data(), localdebris.size())
+        && (localpath->size() == localdebris.size()
+         || !memcmp(localpath->data() + localdebris.size(),
+                    client->fsaccess->localseparator.data(),
+                    client->fsaccess->localseparator.size()));
+}
+
+void Sync::procscanresults()
+{
+    vector<SyncScanJob*> jobs;
+    client->syncscanpool()->collect(this, &jobs);
+
+    for (size_t i = 0; i < jobs.size(); i++)
+    {
+        SyncScanJob* job = jobs[i];
+        scanpending--;
+
+        if (job->type == SyncScanJob::FINGERPRINT)
+        {
+            // kept for checkpath(), which also handles failures
+            if (job->success)
+            {
+                scanbytesread += fingerprintbytes(job->fingerprint.size);
+
+                map<string, SyncScanJob*>::iterator it = scanned.find(job->localpath);
+                if (it != scanned.end())
+                {
+                    delete it->second;
+                    it->second = job;
+                }
+                else
+                {
+                    scanned[job->localpath] = job;
+                }
+            }
+
+            dirnotify->notify(DirNotify::DIREVENTS, NULL, job->localpath.data(), job->localpath.size(), true);
+
+            if (!job->success)
+            {
+                delete job;
+            }
+            continue;
+        }
+
+        string localpath = job->localpath;
+        string name;
+
+        if (!job->success)
+        {
+            client->fsaccess->local2path(&localpath, &name);
+            LOG_warn << "Error listing folder: " << name;
+            delete job;
+            continue;
+        }
+
+        // new files are fingerprinted on the pool before they are queued
+        LocalNode* folder = localnodebypath(NULL, &localpath);
+        size_t t = localpath.size();
+
+        for (size_t j = 0; j < job->entries.size(); j++)
+        {
+            DirEntry& entry = job->entries[j];
+
+            name = entry.localname;
+            client->fsaccess->local2name(&name);
+
+            if (t)
+            {
+                localpath.append(client->fsaccess->localseparator);
+            }
+
+            localpath.append(entry.localname);
+
+            if (!client->app->sync_syncable(this, name.c_str(), &localpath))
+            {
+                LOG_debug << "Excluded: " << name;
+            }
+            else if (!isdebris(&localpath))
+            {
+                if (entry.type == FILENODE && (!folder || !folder->childbyname(&entry.localname)))
+                {
+                    SyncScanJob* fingerprintjob = new SyncScanJob(this, SyncScanJob::FINGERPRINT, localpath);
+                    fingerprintjob->queued = settledclock(NULL);
+                    scanpending++;
+                    client->syncscanpool()->push(fingerprintjob);
+                }
+                else
+                {
+                    dirnotify->notify(DirNotify::DIREVENTS, NULL, localpath.data(), localpath.size(), true);
+                }
+            }
+
+            localpath.resize(t);
+        }
+
+        delete job;
+    }
+}
+
+bool Sync::genfingerprint(LocalNode* l, FileAccess* fa, string* localpath)
+{
+    map<string, SyncScanJob*>::iterator it = scanned.find(*localpath);
+
+    if (it != scanned.end())
+    {
+        SyncScanJob* job = it->second;
+        scanned.erase(it);
+
+        if (job->fingerprint.size == fa->size && job->fingerprint.mtime == fa->mtime
+                && (!job->fsidvalid || !fa->fsidvalid || job->fsid == fa->fsid)
+                && (!job->ctime || job->ctime == fa->ctime))
+        {
+            bool changed = !l->isvalid || l->size != job->fingerprint.size
+                    || l->mtime != job->fingerprint.mtime
+                    || memcmp(l->crc, job->fingerprint.crc, sizeof l->crc);
+
+            static_cast<FileFingerprint&>(*l) = job->fingerprint;
+            l->ctime = job->ctime;
+            delete job;
+            return changed;
+        }
+
+        LOG_debug << "File changed since it was fingerprinted";
+        delete job;
+    }
+
+    // the file was not touched since it was fingerprinted
+    if (l->isvalid && l->ctime && l->ctime == fa->ctime
+            && l->size == fa->size && l->mtime == fa->mtime
+            && (!fa->fsidvalid || l->fsid == fa->fsid))
+    {
+        scanbytesskipped += fingerprintbytes(l->size);
+        return false;
+    }
+
+    fingerprinted = true;
+    scanbytesread += fingerprintbytes(fa->size);
+
+    bool changed = l->genfingerprint(fa);
+    l->ctime = l->size >= 0 ? settledctime(fa, settledclock(NULL)) : 0;
+    return changed;
+}
+
+m_time_t Sync::settledctime(const FileAccess* fa, m_time_t now)
+{
+    return fa->ctime && now - fa->ctime > 1 ? fa->ctime : 0;
+}
+
+void Sync::startfullscan()
+{
+    fullscanstart = Waiter::ds;
+    scanbytesread = 0;
+    scanbytesskipped = 0;
+}
+
+void Sync::fullscancompleted()
+{
+    client->app->syncupdate_scan_completed(this, Waiter::ds - fullscanstart, scanbytesread, scanbytesskipped);
+}
+
 // check local path - if !localname, localpath is relative to l, with l == NULL
 // being the root of the sync
 // if localname is set, localpath is absolute and localname its last component
 // path references a new FOLDERNODE: returns created node
 // path references a existing FILENODE: returns node
 // otherwise, returns NULL
-LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, dstime *backoffds, bool wejustcreatedthisfolder)
+LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, dstime *backoffds, bool wejustcreatedthisfolder,
+                           const DirEntry* entry)
 {
     LocalNode* ll = l;
     FileAccess* fa;
@@ -617,9 +819,21 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
             l->scanseqno = scanseqno;
         }
 
+        // the attributes from the folder listing spare opening the item
+        bool listed = entry && entry->fsidvalid;
+        if (listed)
+        {
+            fa->type = entry->type;
+            fa->size = entry->size;
+            fa->mtime = entry->mtime;
+            fa->ctime = entry->ctime;
+            fa->fsid = entry->fsid;
+            fa->fsidvalid = true;
+        }
+
         // match cached LocalNode state during initial/rescan to prevent costly re-fingerprinting
         // (just compare the fsids, sizes and mtimes to detect changes)
-        if (fa->fopen(localname ? localpath : &tmppath, false, false))
+        if (listed || fa->fopen(localname ? localpath : &tmppath, false, false))
         {
             if (cl && fa->fsidvalid && fa->fsid == cl->fsid)
             {
@@ -628,19 +842,22 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
                 l->deleted = false;
                 l->setnotseen(0);
 
-                // if it's a file, size and mtime must match to qualify
-                if (l->type != FILENODE || (l->size == fa->size && l->mtime == fa->mtime))
+                // if it's a file, size and mtime (and ctime, if it was
+                // recorded with the fingerprint) must match to qualify
+                if (l->type != FILENODE || (l->size == fa->size && l->mtime == fa->mtime
+                                            && (!l->ctime || l->ctime == fa->ctime)))
                 {
                     LOG_verbose << "Cached localnode is still valid. Type: " << l->type << "  Size: " << l->size << "  Mtime: " << l->mtime;
                     l->scanseqno = scanseqno;
 
                     if (l->type == FOLDERNODE)
                     {
-                        scan(localname ? localpath : &tmppath, fa);
+                        scan(localname ? localpath : &tmppath, listed ? NULL : fa);
                     }
                     else
                     {
                         localbytes += l->size;
+                        scanbytesskipped += fingerprintbytes(l->size);
                     }
 
                     delete fa;
@@ -766,7 +983,7 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
 
                             m_off_t dsize = l->size > 0 ? l->size : 0;
 
-                            if (l->genfingerprint(fa) && l->size >= 0)
+                            if (genfingerprint(l, fa, localname ? localpath : &tmppath) && l->size >= 0)
                             {
                                 localbytes -= dsize - l->size;
                             }
@@ -778,6 +995,7 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
                             l->deleted = false;
 
                             client->syncactivity = true;
+                            l->setdirty();
 
                             statecacheadd(l);
 
@@ -1032,7 +1250,9 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
                         localbytes -= l->size;
                     }
 
-                    if (l->genfingerprint(fa))
+                    m_time_t ctime = l->ctime;
+
+                    if (genfingerprint(l, fa, localname ? localpath : &tmppath))
                     {
                         changed = true;
                         l->bumpnagleds();
@@ -1054,7 +1274,7 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
                         client->stopxfer(l);
                     }
 
-                    if (newnode || changed)
+                    if (newnode || changed || l->ctime != ctime)
                     {
                         statecacheadd(l);
                     }
@@ -1064,6 +1284,8 @@ LocalNode* Sync::checkpath(LocalNode* l, string* localpath, string* localname, d
 
         if (changed || newnode)
         {
+            l->setdirty();
+
             if (isnetwork && l->type == FILENODE)
             {
                 LOG_debug << "Queueing extra fs notification for new file";
@@ -1122,6 +1344,7 @@ dstime Sync::procscanq(int q)
     size_t t = dirnotify->notifyq[q].size();
     dstime dsmin = Waiter::ds - SCANNING_DELAY_DS;
     LocalNode* l;
+    int processed = 0;
 
     while (t--)
     {
@@ -1136,6 +1359,11 @@ dstime Sync::procscanq(int q)
         if ((l = dirnotify->notifyq[q].front().localnode) != (LocalNode*)~0)
         {
             dstime backoffds = 0;
+            fingerprinted = false;
+
+            // the notified folder has to be compared again by syncdown() / syncup()
+            (l ? l : &localroot)->setdirty();
+
             l = checkpath(l, &dirnotify->notifyq[q].front().path, NULL, &backoffds);
             if (backoffds)
             {
@@ -1153,6 +1381,17 @@ dstime Sync::procscanq(int q)
                 LOG_verbose << "Scanning deferred";
                 return 0;
             }
+
+            // a fingerprint checkpath() did not use (e.g. for a move) is stale
+            if (scanned.size() && !dirnotify->notifyq[q].front().localnode)
+            {
+                map<string, SyncScanJob*>::iterator it = scanned.find(dirnotify->notifyq[q].front().path);
+                if (it != scanned.end())
+                {
+                    delete it->second;
+                    scanned.erase(it);
+                }
+            }
         }
         else
         {
@@ -1163,11 +1402,14 @@ dstime Sync::procscanq(int q)
 
         dirnotify->notifyq[q].pop_front();
 
-        // we return control to the application in case a filenode was added
-        // (in order to avoid lengthy blocking episodes due to multiple
-        // consecutive fingerprint calculations)
-        // or if new nodes are being added due to a copy/delete operation
-        if ((l && l != (LocalNode*)~0 && l->type == FILENODE) || client->syncadding)
+        // we return control to the application in case a filenode was
+        // fingerprinted here (in order to avoid lengthy blocking episodes due
+        // to multiple consecutive fingerprint calculations - files listed on
+        // the scan pool come with their fingerprint), after a batch of
+        // notifications or if new nodes are being added due to a copy/delete
+        // operation
+        if ((l && l != (LocalNode*)~0 && l->type == FILENODE && fingerprinted)
+                || ++processed >= SCANNING_BATCH || client->syncadding)
         {
             break;
         }
@@ -1276,5 +1518,176 @@ bool Sync::movetolocaldebris(string* localpath)
 
     return false;
 }
+
+SyncScanJob::SyncScanJob(Sync* csync, int ctype, const string& clocalpath)
+{
+    sync = csync;
+    type = ctype;
+    localpath = clocalpath;
+    followsymlinks = false;
+    success = false;
+    fsid = UNDEF;
+    fsidvalid = false;
+    ctime = 0;
+    queued = m_time();
+    finished = false;
+}
+
+void SyncScanJob::run(FileSystemAccess* fsaccess)
+{
+    if (type == LIST)
+    {
+        DirAccess* da = fsaccess->newdiraccess();
+        string path = localpath;
+
+        if ((success = da->dopen(&path, NULL, false)))
+        {
+            da->dlist(&path, &entries, followsymlinks);
+        }
+
+        delete da;
+        return;
+    }
+
+    FileAccess* fa = fsaccess->newfileaccess();
+    string path = localpath;
+
+    if (fa->fopen(&path, true, false) && fa->type == FILENODE)
+    {
+        fingerprint.genfingerprint(fa);
+        success = fingerprint.size >= 0;
+        fsid = fa->fsid;
+        fsidvalid = fa->fsidvalid;
+        ctime = Sync::settledctime(fa, queued);
+    }
+
+    delete fa;
+}
+
+SyncScanPool::SyncScanPool(FileSystemAccess* cfsaccess, Waiter* cwaiter, int numthreads) : WorkerPool(cwaiter)
+{
+    fsaccess = cfsaccess;
+
+    startworkers(numthreads);
+}
+
+SyncScanPool::~SyncScanPool()
+{
+    stopworkers();
+
+    for (std::deque<void*>::iterator it = jobs.begin(); it != jobs.end(); it++)
+    {
+        delete static_cast<SyncScanJob*>(*it);
+    }
+
+    for (std::deque<SyncScanJob*>::iterator it = done.begin(); it != done.end(); it++)
+    {
+        delete *it;
+    }
+}
+
+void SyncScanPool::process(void* job)
+{
+    static_cast<SyncScanJob*>(job)->run(fsaccess);
+}
+
+void SyncScanPool::taken(void* job)
+{
+    running.push_back(static_cast<SyncScanJob*>(job));
+}
+
+void SyncScanPool::processed(void* job)
+{
+    SyncScanJob* scanjob = static_cast<SyncScanJob*>(job);
+    vector<SyncScanJob*>::iterator it = std::find(running.begin(), running.end(), scanjob);
+
+    if (it != running.end())
+    {
+        running.erase(it);
+    }
+
+    scanjob->finished = true;
+    done.push_back(scanjob);
+}
+
+void SyncScanPool::push(SyncScanJob* job)
+{
+    enqueue(job);
+}
+
+void SyncScanPool::collect(Sync* sync, vector<SyncScanJob*>* results)
+{
+    mutex.lock();
+
+    for (std::deque<SyncScanJob*>::iterator it = done.begin(); it != done.end(); )
+    {
+        if ((*it)->sync == sync)
+        {
+            results->push_back(*it);
+            it = done.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    mutex.unlock();
+}
+
+void SyncScanPool::cancel(Sync* sync)
+{
+    mutex.lock();
+
+    for (std::deque<void*>::iterator it = jobs.begin(); it != jobs.end(); )
+    {
+        SyncScanJob* job = static_cast<SyncScanJob*>(*it);
+
+        if (job->sync == sync)
+        {
+            delete job;
+            it = jobs.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    for (;;)
+    {
+        bool busy = false;
+        for (size_t i = 0; i < running.size(); i++)
+        {
+            if (running[i]->sync == sync)
+            {
+                busy = true;
+                break;
+            }
+        }
+
+        if (!busy)
+        {
+            break;
+        }
+
+        waitcompleted();
+    }
+
+    for (std::deque<SyncScanJob*>::iterator it = done.begin(); it != done.end(); )
+    {
+        if ((*it)->sync == sync)
+        {
+            delete *it;
+            it = done.erase(it);
+        }
+        else
+        {
+            it++;
+        }
+    }
+
+    mutex.unlock();
+}
 } // namespace
 #endif
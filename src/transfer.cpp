@@ -418,6 +418,8 @@ void Transfer::failed(error e, dstime timeleft)
             if((*it)->syncxfer)
             {
                 client->syncdownrequired = true;
+                client->syncdownfull = true;
+                client->syncupfull = true;
             }
 #endif
             client->app->file_removed(*it, e);
@@ -600,6 +602,7 @@ void Transfer::complete()
                                 && fingerprint.size == this->size)
                         {
                             LOG_debug << "Fixing fingerprint";
+                            n->setsize(fingerprint.size);
                             *(FileFingerprint*)n = fingerprint;
 
                             n->serializefingerprint(&n->attrs.map['c']);
@@ -826,6 +829,8 @@ void Transfer::complete()
                             if (f->syncxfer)
                             {
                                 client->syncdownrequired = true;
+                                client->syncdownfull = true;
+                                client->syncupfull = true;
                             }
 #endif
                             client->app->file_removed(f, API_EWRITE);
@@ -945,6 +950,8 @@ void Transfer::complete()
                 if (f->syncxfer)
                 {
                     client->syncdownrequired = true;
+                    client->syncdownfull = true;
+                    client->syncupfull = true;
                 }
 #endif
                 client->filecachedel(f);
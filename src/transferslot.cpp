@@ -49,6 +49,322 @@ const dstime TransferSlot::PROGRESSTIMEOUT = 10;
 
 const m_off_t TransferSlot::MAX_UPLOAD_GAP = 62914560; // 60 MB (up to 63 chunks)
 
+// measurement rounds of at least 3 seconds
+const dstime ThroughputController::ROUNDDS = 30;
+
+// aim for requests of at least 3 seconds
+const dstime ThroughputController::TARGETREQDS = 30;
+
+// keep increases that add at least 10% of throughput
+const int ThroughputController::MINGAIN = 10;
+
+const int ThroughputController::HOLDROUNDS = 3;
+
+// sources failing 3 times in a row are left aside
+const int DownloadSources::MAXFAILURES = 3;
+
+// race requests another source would complete at least twice as fast
+const int DownloadSources::RACEFACTOR = 2;
+
+// give requests 2 seconds before racing them
+const dstime DownloadSources::MINRACEDS = 20;
+
+const m_off_t TransferSlot::MIN_SOURCES_SIZE = 8388608; // 8 MB
+
+ThroughputController::ThroughputController()
+{
+    enabled = false;
+    init(1, 1, 0, 0, 0);
+}
+
+void ThroughputController::init(int cconnections, int cmaxconnections, m_off_t creqsize, m_off_t cminreqsize, m_off_t cmaxreqsize)
+{
+    connections = cconnections;
+    maxconnections = cmaxconnections;
+    reqsize = creqsize;
+    minreqsize = cminreqsize;
+    maxreqsize = cmaxreqsize;
+
+    roundstart = Waiter::ds;
+    roundbytes = 0;
+    roundspeed = 0;
+    basespeed = 0;
+    baseconnections = connections;
+    basereqsize = reqsize;
+    probe = PROBE_NONE;
+    hold = 0;
+    lastfailure = NEVER;
+}
+
+bool ThroughputController::sample(m_off_t bytes)
+{
+    if (!enabled)
+    {
+        return false;
+    }
+
+    if (bytes > 0)
+    {
+        roundbytes += bytes;
+    }
+
+    dstime elapsed = Waiter::ds - roundstart;
+    if (elapsed < ROUNDDS)
+    {
+        return false;
+    }
+
+    roundspeed = roundbytes * 10 / elapsed;
+    roundstart = Waiter::ds;
+    roundbytes = 0;
+
+    if (hold)
+    {
+        hold--;
+        return false;
+    }
+
+    if (probe != PROBE_NONE)
+    {
+        if (roundspeed * 100 < basespeed * (100 + MINGAIN))
+        {
+            // no gain: revert and measure again later
+            connections = baseconnections;
+            reqsize = basereqsize;
+
+            LOG_debug << "Throughput " << roundspeed << " (was " << basespeed << "). Back to "
+                      << connections << " connections and requests of " << reqsize << " bytes";
+
+            probe = PROBE_NONE;
+            hold = HOLDROUNDS;
+            return true;
+        }
+
+        probe = PROBE_NONE;
+    }
+
+    if (!roundspeed)
+    {
+        return false;
+    }
+
+    // time needed to complete a request at the current rate
+    dstime reqds = dstime(reqsize * connections * 10 / roundspeed);
+
+    basespeed = roundspeed;
+    baseconnections = connections;
+    basereqsize = reqsize;
+
+    if (reqsize < maxreqsize && (reqds < TARGETREQDS || connections >= maxconnections))
+    {
+        reqsize = std::min(reqsize * 2, maxreqsize);
+        probe = PROBE_REQSIZE;
+    }
+    else if (connections < maxconnections)
+    {
+        connections++;
+        probe = PROBE_CONNECTIONS;
+    }
+    else
+    {
+        return false;
+    }
+
+    LOG_debug << "Throughput " << roundspeed << ". Trying " << connections << " connections and requests of " << reqsize << " bytes";
+    return true;
+}
+
+bool ThroughputController::failed()
+{
+    if (!enabled)
+    {
+        return false;
+    }
+
+    // failures of parallel requests usually have the same cause
+    if (lastfailure != NEVER && Waiter::ds - lastfailure < ROUNDDS)
+    {
+        return false;
+    }
+    lastfailure = Waiter::ds;
+
+    int cconnections = (connections + 1) / 2;
+    m_off_t creqsize = std::max(reqsize / 2, minreqsize);
+
+    probe = PROBE_NONE;
+    hold = HOLDROUNDS;
+    roundstart = Waiter::ds;
+    roundbytes = 0;
+
+    if (cconnections == connections && creqsize == reqsize)
+    {
+        return false;
+    }
+
+    connections = cconnections;
+    reqsize = creqsize;
+
+    LOG_debug << "Transfer error. Reducing to " << connections << " connections and requests of " << reqsize << " bytes";
+    return true;
+}
+
+string DownloadSources::host(const string& url)
+{
+    size_t start = url.find("://");
+    start = (start == string::npos) ? 0 : start + 3;
+
+    size_t end = url.find('/', start);
+    return url.substr(start, (end == string::npos) ? string::npos : end - start);
+}
+
+bool DownloadSources::add(const string& url)
+{
+    string h = host(url);
+
+    for (unsigned i = 0; i < sources.size(); i++)
+    {
+        if (host(sources[i].url) == h)
+        {
+            return false;
+        }
+    }
+
+    Source source;
+    source.url = url;
+    source.speed = 0;
+    source.requests = 0;
+    source.failures = 0;
+    sources.push_back(source);
+
+    return true;
+}
+
+bool DownloadSources::usable(int i) const
+{
+    return sources[i].failures < MAXFAILURES;
+}
+
+m_off_t DownloadSources::expectedspeed(int i) const
+{
+    m_off_t speed = sources[i].speed;
+
+    if (!speed)
+    {
+        for (unsigned j = 0; j < sources.size(); j++)
+        {
+            if (sources[j].speed > speed)
+            {
+                speed = sources[j].speed;
+            }
+        }
+    }
+
+    return speed;
+}
+
+int DownloadSources::select() const
+{
+    int best = -1;
+    double bestcost = 0;
+
+    for (int i = 0; i < int(sources.size()); i++)
+    {
+        // with one request per throughput unit, faster sources get
+        // proportionally more of the requests in flight
+        m_off_t speed = expectedspeed(i);
+        double cost = (sources[i].requests + 1) / (speed ? double(speed) : 1.0);
+
+        if (best >= 0)
+        {
+            if (usable(best) != usable(i))
+            {
+                if (usable(best))
+                {
+                    continue;
+                }
+            }
+            else if (!usable(i))
+            {
+                if (sources[i].failures >= sources[best].failures)
+                {
+                    continue;
+                }
+            }
+            else if (cost >= bestcost)
+            {
+                continue;
+            }
+        }
+
+        best = i;
+        bestcost = cost;
+    }
+
+    return best;
+}
+
+int DownloadSources::race(int from, m_off_t size, m_off_t received, dstime elapsed) const
+{
+    if (elapsed < MINRACEDS)
+    {
+        return -1;
+    }
+
+    // time the request still needs at its pace so far
+    double left = double(size - received) * elapsed / (received ? received : 1);
+
+    int best = -1;
+    double bestds = 0;
+
+    for (int i = 0; i < int(sources.size()); i++)
+    {
+        m_off_t speed = expectedspeed(i);
+
+        if (i == from || !usable(i) || !speed)
+        {
+            continue;
+        }
+
+        double ds = double(size) * 10 / speed;
+        if (left > ds * RACEFACTOR && (best < 0 || ds < bestds))
+        {
+            best = i;
+            bestds = ds;
+        }
+    }
+
+    return best;
+}
+
+void DownloadSources::started(int i)
+{
+    sources[i].requests++;
+}
+
+void DownloadSources::completed(int i, m_off_t size, dstime ds)
+{
+    Source& source = sources[i];
+    m_off_t speed = size * 10 / (ds > 0 ? ds : 1);
+
+    source.speed = source.speed ? (source.speed * 3 + speed) / 4 : speed;
+    source.failures = 0;
+    withdrawn(i);
+}
+
+void DownloadSources::failed(int i, bool rejected)
+{
+    sources[i].failures = rejected ? MAXFAILURES : sources[i].failures + 1;
+    withdrawn(i);
+}
+
+void DownloadSources::withdrawn(int i)
+{
+    if (sources[i].requests > 0)
+    {
+        sources[i].requests--;
+    }
+}
+
 TransferSlot::TransferSlot(Transfer* ctransfer)
     : retrybt(ctransfer->client->rng)
 {
@@ -70,14 +386,28 @@ TransferSlot::TransferSlot(Transfer* ctransfer)
 
     reqs = NULL;
     pendingcmd = NULL;
+    pendingsourcecmd = NULL;
+    sourcesexhausted = false;
 
     transfer = ctransfer;
     transfer->slot = this;
     transfer->state = TRANSFERSTATE_ACTIVE;
 
-    connections = transfer->size > 131072 ? transfer->client->connections[transfer->type] : 1;
+    // adaptive transfers may use up to MAX_NUM_CONNECTIONS connections
+    controller.enabled = transfer->client->adaptivetransfers && transfer->size > 131072;
+    connections = transfer->size > 131072
+            ? (controller.enabled ? int(MegaClient::MAX_NUM_CONNECTIONS) : transfer->client->connections[transfer->type])
+            : 1;
     reqs = new HttpReqXfer*[connections]();
     asyncIO = new AsyncIOContext*[connections]();
+    reqsources = new RequestSource[connections];
+
+    for (int i = connections; i--; )
+    {
+        reqsources[i].source = -1;
+        reqsources[i].twin = -1;
+        reqsources[i].start = 0;
+    }
 
     fa = transfer->client->fsaccess->newfileaccess();
 
@@ -123,13 +453,42 @@ TransferSlot::TransferSlot(Transfer* ctransfer)
     }
 #endif
 
-    LOG_debug << "Creating transfer slot with " << connections << " connections and a max request size of " << maxRequestSize << " bytes";
+    // start from the configured values, request sizes only apply to downloads
+    if (controller.enabled)
+    {
+        int initial = std::min(int(transfer->client->connections[transfer->type]), connections);
+        if (transfer->type == GET)
+        {
+            controller.init(initial, connections, maxRequestSize, 1048576, maxRequestSize);
+        }
+        else
+        {
+            controller.init(initial, connections, 0, 0, 0);
+        }
+    }
+    else
+    {
+        controller.init(connections, connections, maxRequestSize, maxRequestSize, maxRequestSize);
+    }
+
+    LOG_debug << "Creating transfer slot with " << controller.connections << " connections"
+              << (controller.enabled ? " (adaptive)" : "") << " and a max request size of " << maxRequestSize << " bytes";
 }
 
 // delete slot and associated resources, but keep transfer intact (can be
 // reused on a new slot)
 TransferSlot::~TransferSlot()
 {
+    // chunks still queued for encryption/decryption are dropped (and
+    // transferred again), chunks being processed are waited for
+    for (int i = 0; i < connections; i++)
+    {
+        if (reqs[i] && reqs[i]->crypto)
+        {
+            transfer->client->cryptopool->cancel(reqs[i]->crypto);
+        }
+    }
+
     if (transfer->type == GET && !transfer->finished
             && transfer->progresscompleted != transfer->size
             && !transfer->asyncopencontext)
@@ -178,6 +537,16 @@ TransferSlot::~TransferSlot()
                     && downloadRequest->contentlength == downloadRequest->size
                     && downloadRequest->bufpos >= SymmCipher::BLOCKSIZE)
             {
+                // of a raced request, only the copy that got further is kept
+                int twin = reqsources[i].twin;
+                if (twin >= 0 && reqs[twin]->status == REQ_INFLIGHT
+                        && reqs[twin]->contentlength == reqs[twin]->size
+                        && (reqs[twin]->bufpos > downloadRequest->bufpos
+                            || (reqs[twin]->bufpos == downloadRequest->bufpos && twin < i)))
+                {
+                    continue;
+                }
+
                 downloadRequest->finalize(transfer);
                 m_off_t dlpos = downloadRequest->dlpos;
                 m_off_t bufsize = downloadRequest->bufpos;
@@ -225,6 +594,20 @@ TransferSlot::~TransferSlot()
         pendingcmd->cancel();
     }
 
+    if (pendingsourcecmd)
+    {
+        pendingsourcecmd->cancel();
+    }
+
+    if (sources.sources.size() > 1)
+    {
+        for (unsigned i = 0; i < sources.sources.size(); i++)
+        {
+            LOG_debug << "Download source " << DownloadSources::host(sources.sources[i].url) << ": "
+                      << sources.sources[i].speed << " bytes/s, " << sources.sources[i].failures << " failures";
+        }
+    }
+
     if (transfer->asyncopencontext)
     {
         delete transfer->asyncopencontext;
@@ -240,6 +623,7 @@ TransferSlot::~TransferSlot()
 
     delete[] asyncIO;
     delete[] reqs;
+    delete[] reqsources;
 
     if (fa)
     {
@@ -247,6 +631,29 @@ TransferSlot::~TransferSlot()
     }
 }
 
+// encrypt an upload chunk, on the client's crypto pool unless it is
+// configured without threads
+void TransferSlot::prepareupload(int i, string* url, m_off_t pos, m_off_t npos)
+{
+    MegaClient* client = transfer->client;
+    HttpReqUL* req = (HttpReqUL*)reqs[i];
+
+    if (client->cryptothreads > 0)
+    {
+        req->prepareasync(client->transfercryptopool(), url->c_str(), transfer->transfercipher(),
+                          transfer->ctriv, pos, npos);
+        req->status = REQ_CRYPTO;
+    }
+    else
+    {
+        req->prepare(url->c_str(), transfer->transfercipher(), &transfer->chunkmacs,
+                     transfer->ctriv, pos, npos);
+        req->status = REQ_PREPARED;
+    }
+
+    req->pos = ChunkedHash::chunkfloor(pos);
+}
+
 void TransferSlot::toggleport(HttpReqXfer *req)
 {
     if (!memcmp(req->posturl.c_str(), "http:", 5))
@@ -270,6 +677,150 @@ void TransferSlot::toggleport(HttpReqXfer *req)
     }
 }
 
+void TransferSlot::requestsource(MegaClient* client)
+{
+    for (file_list::iterator it = transfer->files.begin(); it != transfer->files.end(); it++)
+    {
+        File* f = *it;
+
+        if (!f->hprivate || f->hforeign || client->nodebyhandle(f->h))
+        {
+            pendingsourcecmd = new CommandGetFileSource(client, this, f->h, f->hprivate,
+                                                        f->privauth.size() ? f->privauth.c_str() : NULL,
+                                                        f->pubauth.size() ? f->pubauth.c_str() : NULL,
+                                                        f->chatauth);
+            client->reqs.add(pendingsourcecmd);
+            return;
+        }
+    }
+
+    sourcesexhausted = true;
+}
+
+void TransferSlot::sourceresult(const string* url)
+{
+    pendingsourcecmd = NULL;
+
+    if (!url || !sources.add(*url))
+    {
+        LOG_debug << "No further download sources";
+        sourcesexhausted = true;
+        return;
+    }
+
+    LOG_debug << "Download source added: " << DownloadSources::host(*url) << " (" << sources.sources.size() << " sources)";
+}
+
+string TransferSlot::sourceurl(MegaClient* client, int s)
+{
+    string url = (s >= 0) ? sources.sources[s].url : transfer->tempurl;
+
+    if (client->usealtdownport && !memcmp(url.c_str(), "http:", 5))
+    {
+        size_t index = url.find("/", 8);
+        if (index != string::npos && url.find(":", 8) == string::npos)
+        {
+            url.insert(index, ":8080");
+        }
+    }
+
+    return url;
+}
+
+bool TransferSlot::racerequest(MegaClient* client, int i)
+{
+    int slowest = -1;
+    int target = -1;
+
+    // race the first lagging request, as it holds back the contiguous progress
+    for (int j = connections; j--; )
+    {
+        if (j == i || !reqs[j] || reqs[j]->status != REQ_INFLIGHT
+                || reqsources[j].source < 0 || reqsources[j].twin >= 0)
+        {
+            continue;
+        }
+
+        HttpReqDL* req = (HttpReqDL*)reqs[j];
+        int s = sources.race(reqsources[j].source, req->size, req->bufpos, Waiter::ds - reqsources[j].start);
+
+        if (s >= 0 && (slowest < 0 || req->dlpos < ((HttpReqDL*)reqs[slowest])->dlpos))
+        {
+            slowest = j;
+            target = s;
+        }
+    }
+
+    if (slowest < 0)
+    {
+        return false;
+    }
+
+    HttpReqDL* req = (HttpReqDL*)reqs[slowest];
+
+    if (!reqs[i])
+    {
+        HttpReqDL* downloadRequest = new HttpReqDL();
+        downloadRequest->bufferpool = &client->downloadbuffers;
+        reqs[i] = downloadRequest;
+    }
+
+    LOG_debug << "Racing chunk at " << req->dlpos << " on " << DownloadSources::host(sources.sources[target].url);
+
+    reqs[i]->prepare(sourceurl(client, target).c_str(), transfer->transfercipher(),
+                     &transfer->chunkmacs, transfer->ctriv,
+                     req->dlpos, req->dlpos + req->size);
+    reqs[i]->pos = req->pos;
+    reqs[i]->status = REQ_PREPARED;
+
+    sources.started(target);
+    reqsources[i].source = target;
+    reqsources[i].start = Waiter::ds;
+    reqsources[i].twin = slowest;
+    reqsources[slowest].twin = i;
+
+    return true;
+}
+
+bool TransferSlot::resolverace(int i)
+{
+    RequestSource& rs = reqsources[i];
+
+    if (rs.source >= 0)
+    {
+        sources.completed(rs.source, reqs[i]->size, Waiter::ds - rs.start);
+        rs.source = -1;
+    }
+
+    int twin = rs.twin;
+    if (twin < 0)
+    {
+        return true;
+    }
+
+    rs.twin = -1;
+    reqsources[twin].twin = -1;
+
+    if (reqs[twin]->status == REQ_CRYPTO || reqs[twin]->status == REQ_ASYNCIO)
+    {
+        // the copy is being written already
+        return false;
+    }
+
+    LOG_debug << "Dropping the slower copy of chunk at " << ((HttpReqDL*)reqs[i])->dlpos;
+
+    reqs[twin]->disconnect();
+    reqs[twin]->status = REQ_READY;
+
+    if (reqsources[twin].source >= 0)
+    {
+        sources.withdrawn(reqsources[twin].source);
+        reqsources[twin].source = -1;
+    }
+
+    return true;
+}
+
 // abort all HTTP connections
 void TransferSlot::disconnect()
 {
@@ -351,6 +902,9 @@ void TransferSlot::doio(MegaClient* client)
                 // verify meta MAC
                 if (transfer->currentmetamac == transfer->metamac)
                 {
+                    TransferBufferPool::Stats stats = client->downloadbuffers.resetstats();
+                    LOG_debug << "Download buffers since the previous download: " << stats.allocations << " allocations, "
+                              << stats.transferred << " bytes (" << stats.allocationspermb() << " allocations/MB)";
                     return transfer->complete();
                 }
                 else
@@ -390,6 +944,22 @@ void TransferSlot::doio(MegaClient* client)
         return;
     }
 
+    if (transfer->type == GET && client->downloadsources > 1 && transfer->size >= MIN_SOURCES_SIZE)
+    {
+        if (sources.sources.empty())
+        {
+            sources.add(transfer->tempurl);
+        }
+
+        // more sources are only worth it while there is enough left to fetch
+        if (!pendingsourcecmd && !sourcesexhausted
+                && int(sources.sources.size()) < client->downloadsources
+                && transfer->size - transfer->progresscompleted >= MIN_SOURCES_SIZE)
+        {
+            requestsource(client);
+        }
+    }
+
     dstime backoff = 0;
     m_off_t p = 0;
 
@@ -406,10 +976,54 @@ void TransferSlot::doio(MegaClient* client)
             switch (reqs[i]->status)
             {
                 case REQ_INFLIGHT:
-                    p += reqs[i]->transferred(client);
+                {
+                    // of a raced request, only the copy ahead is accounted
+                    m_off_t transferred = reqs[i]->transferred(client);
+                    int twin = reqsources[i].twin;
+
+                    if (twin >= 0 && reqs[twin]->status == REQ_INFLIGHT)
+                    {
+                        m_off_t twintransferred = reqs[twin]->transferred(client);
+                        if (twintransferred > transferred || (twintransferred == transferred && twin < i))
+                        {
+                            break;
+                        }
+                    }
+
+                    p += transferred;
                     break;
+                }
+
+                case REQ_CRYPTO:
+                    if (!client->cryptopool->finished(reqs[i]->crypto))
+                    {
+                        if (transfer->type == GET)
+                        {
+                            p += reqs[i]->size;
+                        }
+                        break;
+                    }
+
+                    if (transfer->type == PUT)
+                    {
+                        // posted below
+                        ((HttpReqUL*)reqs[i])->preparecompleted(&transfer->chunkmacs);
+                        reqs[i]->status = REQ_PREPARED;
+                        break;
+                    }
+
+                    // decrypted download chunk: continue with the write
+                    ((HttpReqDL*)reqs[i])->finalizecompleted();
+                    reqs[i]->status = REQ_SUCCESS;
+                    // fall through
 
                 case REQ_SUCCESS:
+                    if (transfer->type == GET && reqs[i]->size == reqs[i]->bufpos && !resolverace(i))
+                    {
+                        reqs[i]->status = REQ_READY;
+                        break;
+                    }
+
                     if (client->orderdownloadedchunks && transfer->type == GET && transfer->progresscompleted != ((HttpReqDL *)reqs[i])->dlpos)
                     {
                         // postponing unsorted chunk
@@ -564,6 +1178,16 @@ void TransferSlot::doio(MegaClient* client)
                         if (reqs[i]->size == reqs[i]->bufpos)
                         {
                             HttpReqDL *downloadRequest = (HttpReqDL *)reqs[i];
+                            if (!downloadRequest->decrypted && client->cryptothreads > 0)
+                            {
+                                // decrypt on the crypto pool, the write
+                                // follows once it has finished
+                                downloadRequest->finalizeasync(transfer, client->transfercryptopool());
+                                reqs[i]->status = REQ_CRYPTO;
+                                p += reqs[i]->size;
+                                break;
+                            }
+
                             if (fa->asyncavailable())
                             {
                                 if (!asyncIO[i])
@@ -704,12 +1328,7 @@ void TransferSlot::doio(MegaClient* client)
                                     }
                                 }
 
-                                reqs[i]->prepare(finaltempurl.c_str(), transfer->transfercipher(),
-                                         &transfer->chunkmacs, transfer->ctriv,
-                                         asyncIO[i]->pos, npos);
-
-                                reqs[i]->pos = ChunkedHash::chunkfloor(asyncIO[i]->pos);
-                                reqs[i]->status = REQ_PREPARED;
+                                prepareupload(i, &finaltempurl, asyncIO[i]->pos, npos);
                             }
                             else
                             {
@@ -824,6 +1443,46 @@ void TransferSlot::doio(MegaClient* client)
                         return transfer->failed(API_EAGAIN);
                     }
 
+                    if (transfer->type == GET && sources.sources.size() > 1
+                            && reqsources[i].source >= 0 && reqs[i]->httpstatus != 509)
+                    {
+                        int source = reqsources[i].source;
+                        sources.failed(source, reqs[i]->httpstatus == 403 || reqs[i]->httpstatus == 404);
+
+                        int twin = reqsources[i].twin;
+                        if (twin >= 0)
+                        {
+                            // the other copy carries on
+                            LOG_debug << "Dropping failed copy of chunk at " << ((HttpReqDL*)reqs[i])->dlpos;
+                            reqsources[twin].twin = -1;
+                            reqsources[i].twin = -1;
+                            reqsources[i].source = -1;
+                            reqs[i]->status = REQ_READY;
+                            break;
+                        }
+
+                        int other = sources.select();
+                        if (other != source && sources.usable(other))
+                        {
+                            HttpReqDL* downloadRequest = (HttpReqDL*)reqs[i];
+                            LOG_debug << "Retrying chunk at " << downloadRequest->dlpos << " on "
+                                      << DownloadSources::host(sources.sources[other].url);
+
+                            downloadRequest->prepare(sourceurl(client, other).c_str(), transfer->transfercipher(),
+                                                     &transfer->chunkmacs, transfer->ctriv,
+                                                     downloadRequest->dlpos, downloadRequest->dlpos + downloadRequest->size);
+                            sources.started(other);
+                            reqsources[i].source = other;
+                            reqsources[i].start = Waiter::ds;
+                            reqs[i]->status = REQ_PREPARED;
+                            break;
+                        }
+
+                        // no other source left: retried below on the same one
+                        sources.started(source);
+                        reqsources[i].start = Waiter::ds;
+                    }
+
                     if (reqs[i]->httpstatus == 509)
                     {
                         if (reqs[i]->timeleft < 0)
@@ -858,6 +1517,8 @@ void TransferSlot::doio(MegaClient* client)
                             failure = true;
                             bool changeport = false;
 
+                            controller.failed();
+
                             if (transfer->type == GET && client->autodownport && !memcmp(transfer->tempurl.c_str(), "http:", 5))
                             {
                                 LOG_debug << "Automatically changing download port";
@@ -889,17 +1550,20 @@ void TransferSlot::doio(MegaClient* client)
 
         if (!failure)
         {
-            if (!reqs[i] || (reqs[i]->status == REQ_READY))
+            // connections above the current count finish their request and stay
+            // idle (unless a failed read has to be retried)
+            if ((!reqs[i] || (reqs[i]->status == REQ_READY))
+                    && (i < controller.connections || (transfer->type == PUT && asyncIO[i])))
             {
                 m_off_t npos = ChunkedHash::chunkceil(transfer->nextpos(), transfer->size);
                 if ((npos > transfer->pos) || !transfer->size || (transfer->type == PUT && asyncIO[i]))
                 {
                     if (transfer->size && transfer->type == GET)
                     {
-                        m_off_t maxReqSize = (transfer->size - transfer->progresscompleted) / connections / 2;
-                        if (maxReqSize > maxRequestSize)
+                        m_off_t maxReqSize = (transfer->size - transfer->progresscompleted) / controller.connections / 2;
+                        if (maxReqSize > controller.reqsize)
                         {
-                            maxReqSize = maxRequestSize;
+                            maxReqSize = controller.reqsize;
                         }
 
                         if (maxReqSize > 0x100000)
@@ -957,7 +1621,16 @@ void TransferSlot::doio(MegaClient* client)
                     LOG_debug << "Starting chunk of size " << (npos - transfer->pos);
                     if (!reqs[i])
                     {
-                        reqs[i] = transfer->type == PUT ? (HttpReqXfer*)new HttpReqUL() : (HttpReqXfer*)new HttpReqDL();
+                        if (transfer->type == PUT)
+                        {
+                            reqs[i] = new HttpReqUL();
+                        }
+                        else
+                        {
+                            HttpReqDL* downloadRequest = new HttpReqDL();
+                            downloadRequest->bufferpool = &client->downloadbuffers;
+                            reqs[i] = downloadRequest;
+                        }
                     }
 
                     bool prepare = true;
@@ -1002,16 +1675,8 @@ void TransferSlot::doio(MegaClient* client)
 
                     if (prepare)
                     {
-                        string finaltempurl = transfer->tempurl;
-                        if (transfer->type == GET && client->usealtdownport
-                                && !memcmp(finaltempurl.c_str(), "http:", 5))
-                        {
-                            size_t index = finaltempurl.find("/", 8);
-                            if(index != string::npos && finaltempurl.find(":", 8) == string::npos)
-                            {
-                                finaltempurl.insert(index, ":8080");
-                            }
-                        }
+                        int source = (transfer->type == GET) ? sources.select() : -1;
+                        string finaltempurl = (transfer->type == GET) ? sourceurl(client, source) : transfer->tempurl;
 
                         if (transfer->type == PUT && client->usealtupport
                                 && !memcmp(finaltempurl.c_str(), "http:", 5))
@@ -1035,11 +1700,25 @@ void TransferSlot::doio(MegaClient* client)
                             return transfer->failed(API_EINTERNAL);
                         }
 
-                        reqs[i]->prepare(finaltempurl.c_str(), transfer->transfercipher(),
-                                                                 &transfer->chunkmacs, transfer->ctriv,
-                                                                 transfer->pos, npos);
-                        reqs[i]->pos = ChunkedHash::chunkfloor(transfer->pos);
-                        reqs[i]->status = REQ_PREPARED;
+                        if (transfer->type == PUT)
+                        {
+                            prepareupload(i, &finaltempurl, transfer->pos, npos);
+                        }
+                        else
+                        {
+                            reqs[i]->prepare(finaltempurl.c_str(), transfer->transfercipher(),
+                                                                     &transfer->chunkmacs, transfer->ctriv,
+                                                                     transfer->pos, npos);
+                            reqs[i]->pos = ChunkedHash::chunkfloor(transfer->pos);
+                            reqs[i]->status = REQ_PREPARED;
+
+                            if (source >= 0)
+                            {
+                                sources.started(source);
+                            }
+                            reqsources[i].source = source;
+                            reqsources[i].start = Waiter::ds;
+                        }
                     }
 
                     if (transfer->pos < npos)
@@ -1047,6 +1726,12 @@ void TransferSlot::doio(MegaClient* client)
                         transfer->pos = npos;
                     }
                 }
+                else if (transfer->type == GET && sources.sources.size() > 1)
+                {
+                    // nothing left to request: idle connections stay ready
+                    // to race requests lagging on a slow source
+                    racerequest(client, i);
+                }
                 else if (reqs[i])
                 {
                     reqs[i]->status = REQ_DONE;
@@ -1070,6 +1755,7 @@ void TransferSlot::doio(MegaClient* client)
             m_off_t diff = p - progressreported;
             speed = speedController.calculateSpeed(diff);
             meanSpeed = speedController.getMeanSpeed();
+            controller.sample(diff);
             if (transfer->type == PUT)
             {
                 client->httpio->updateuploadspeed(diff);
@@ -1093,6 +1779,8 @@ void TransferSlot::doio(MegaClient* client)
         failure = true;
         bool changeport = false;
 
+        controller.failed();
+
         if (transfer->type == GET && client->autodownport && !memcmp(transfer->tempurl.c_str(), "http:", 5))
         {
             LOG_debug << "Automatically changing download port due to a timeout";
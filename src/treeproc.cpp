@@ -74,6 +74,11 @@ void TreeProcDU::proc(MegaClient*, Node* n)
 // mark node as removed and notify
 void TreeProcDel::proc(MegaClient* client, Node* n)
 {
+    if (client->lazynodes && !n->childrenloaded)
+    {
+        client->deletedtrees.push_back(n->nodehandle);
+    }
+
     n->changed.removed = true;
     n->tag = client->reqtag;
     client->notifynode(n);
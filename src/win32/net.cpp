@@ -214,7 +214,7 @@ VOID CALLBACK WinHttpIO::asynccallback(HINTERNET hInternet, DWORD_PTR dwContext,
                 LOG_debug << "Request finished with HTTP status: " << req->httpstatus;
                 req->status = (req->httpstatus == 200
                             && (req->contentlength < 0
-                             || req->contentlength == (req->buf ? req->bufpos : (int)req->in.size())))
+                             || req->contentlength == (req->buf ? req->bufpos : (m_off_t)req->in.size() + req->inpurged)))
                              ? REQ_SUCCESS : REQ_FAILURE;
 
                 if (req->status == REQ_SUCCESS)
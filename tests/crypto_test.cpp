@@ -22,6 +22,7 @@
 #include "mega.h"
 #include "../src/crypto/sodium.cpp"
 #include <math.h>
+#include <chrono>
 #include "gtest/gtest.h"
 
 using namespace mega;
@@ -163,6 +164,190 @@ TEST(Crypto, AES_CCM)
     ASSERT_STREQ(result.data(), plainText.data()) << "CCM decryption: plain text doesn't match the expected value";
 }
 
+// previous block-by-block implementation of SymmCipher::ctr_crypt()
+static void ctrcryptblocks(SymmCipher* key, byte* data, unsigned len, m_off_t pos, SymmCipher::ctr_iv ctriv, byte* mac, bool encrypt, bool initmac = true)
+{
+    byte ctr[SymmCipher::BLOCKSIZE], tmp[SymmCipher::BLOCKSIZE];
+
+    MemAccess::set<int64_t>(ctr, ctriv);
+    SymmCipher::setint64(pos / SymmCipher::BLOCKSIZE, ctr + sizeof ctriv);
+
+    if (mac && initmac)
+    {
+        memcpy(mac, ctr, sizeof ctriv);
+        memcpy(mac + sizeof ctriv, ctr, sizeof ctriv);
+    }
+
+    while ((int)len > 0)
+    {
+        if (encrypt)
+        {
+            SymmCipher::xorblock(data, mac);
+            key->ecb_encrypt(mac);
+            key->ecb_encrypt(ctr, tmp);
+            SymmCipher::xorblock(tmp, data);
+        }
+        else
+        {
+            key->ecb_encrypt(ctr, tmp);
+            SymmCipher::xorblock(tmp, data);
+            SymmCipher::xorblock(data, mac, len >= (unsigned)SymmCipher::BLOCKSIZE ? SymmCipher::BLOCKSIZE : len);
+            key->ecb_encrypt(mac);
+        }
+
+        len -= SymmCipher::BLOCKSIZE;
+        data += SymmCipher::BLOCKSIZE;
+        SymmCipher::incblock(ctr);
+    }
+}
+
+// Test CTR encryption/decryption and chunk MACs (AES-NI kernels, if
+// available, and the portable code against the block-by-block version)
+TEST(Crypto, AES_CTR_MAC)
+{
+    byte keyBytes[SymmCipher::KEYLENGTH];
+    for (unsigned i = 0; i < sizeof keyBytes; i++)
+    {
+        keyBytes[i] = byte(i * 37 + 1);
+    }
+
+    SymmCipher key;
+    key.setkey(keyBytes);
+    SymmCipher::ctr_iv ctriv = 0x0123456789abcdefLL;
+    bool aesni = SymmCipher::aesni;
+
+    const unsigned lens[] = { 1, 15, 16, 17, 127, 128, 129, 4096, 131072 + 5 };
+    for (int kernel = 0; kernel < 2; kernel++)
+    {
+        SymmCipher::aesni = kernel ? aesni : false;
+
+        for (unsigned i = 0; i < sizeof lens / sizeof *lens; i++)
+        {
+            unsigned len = lens[i];
+            m_off_t pos = i * 4096 * 16;
+            string plain(len + SymmCipher::BLOCKSIZE, '\0');
+            for (unsigned j = 0; j < len; j++)
+            {
+                plain[j] = char(j * 7 + i);
+            }
+
+            string expected = plain, encrypted = plain;
+            byte expectedmac[SymmCipher::BLOCKSIZE], mac[SymmCipher::BLOCKSIZE];
+            ctrcryptblocks(&key, (byte*)expected.data(), len, pos, ctriv, expectedmac, true);
+            key.ctr_crypt((byte*)encrypted.data(), len, pos, ctriv, mac, true);
+
+            ASSERT_EQ(expected.substr(0, len), encrypted.substr(0, len)) << "CTR encryption, length " << len;
+            ASSERT_EQ(0, memcmp(mac, expectedmac, sizeof mac)) << "CBC-MAC on encryption, length " << len;
+
+            // the keystream is the encrypted counter block
+            byte ctr[SymmCipher::BLOCKSIZE], keystream[SymmCipher::BLOCKSIZE];
+            MemAccess::set<int64_t>(ctr, ctriv);
+            SymmCipher::setint64(pos / SymmCipher::BLOCKSIZE, ctr + sizeof ctriv);
+            key.ecb_encrypt(ctr, keystream);
+            ASSERT_EQ(byte(plain[0] ^ keystream[0]), byte(encrypted[0]));
+
+            // decryption in two parts, continuing the MAC
+            string decrypted = encrypted;
+            unsigned half = (len / 2) & -SymmCipher::BLOCKSIZE;
+            byte decryptedmac[SymmCipher::BLOCKSIZE];
+            expected = encrypted;
+            ctrcryptblocks(&key, (byte*)expected.data(), len, pos, ctriv, expectedmac, false);
+            key.ctr_crypt((byte*)decrypted.data(), half, pos, ctriv, decryptedmac, false);
+            key.ctr_crypt((byte*)decrypted.data() + half, len - half, pos + half, ctriv, decryptedmac, false, !half);
+
+            ASSERT_EQ(plain.substr(0, len), decrypted.substr(0, len)) << "CTR decryption, length " << len;
+            ASSERT_EQ(0, memcmp(decryptedmac, expectedmac, sizeof mac)) << "CBC-MAC on decryption, length " << len;
+            ASSERT_EQ(0, memcmp(decryptedmac, mac, sizeof mac));
+        }
+
+        // a batch of chunks of different sizes, more than processed in parallel
+        string data(12 * 65536, '\0');
+        for (unsigned j = 0; j < data.size(); j++)
+        {
+            data[j] = char(j * 13);
+        }
+
+        string expected = data;
+        vector<SymmCipher::CtrChunk> chunks;
+        byte macs[12][SymmCipher::BLOCKSIZE], expectedmacs[12][SymmCipher::BLOCKSIZE];
+        m_off_t pos = 0;
+        for (int j = 0; j < 12; j++)
+        {
+            unsigned len = (j + 1) * 8192 - (j == 11 ? 5 : 0);
+            SymmCipher::CtrChunk chunk = { (byte*)data.data() + pos, len, pos, j == 3 ? NULL : macs[j], true };
+            chunks.push_back(chunk);
+            ctrcryptblocks(&key, (byte*)expected.data() + pos, len, pos, ctriv, expectedmacs[j], false);
+            pos += len;
+        }
+
+        key.ctr_crypt(chunks.data(), unsigned(chunks.size()), ctriv, false);
+
+        ASSERT_EQ(expected.substr(0, size_t(pos)), data.substr(0, size_t(pos)));
+        for (int j = 0; j < 12; j++)
+        {
+            ASSERT_TRUE(j == 3 || !memcmp(macs[j], expectedmacs[j], SymmCipher::BLOCKSIZE)) << "CBC-MAC of chunk " << j;
+        }
+    }
+
+    SymmCipher::aesni = aesni;
+}
+
+// throughput of upload requests from 128 KB to MAX_REQ_SIZE (the chunks
+// of the start of a file grow from 128 KB to 1 MB)
+TEST(Crypto, DISABLED_AES_CTR_MAC_benchmark)
+{
+    byte keyBytes[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    SymmCipher key;
+    key.setkey(keyBytes);
+    bool aesni = SymmCipher::aesni;
+
+    for (m_off_t size = 131072; size <= TransferSlot::MAX_REQ_SIZE; size *= 2)
+    {
+        string data(size_t(size) + SymmCipher::BLOCKSIZE, 'x');
+        double mbps[3];
+
+        for (int method = 0; method < 3; method++)
+        {
+            SymmCipher::aesni = method == 2 && aesni;
+            int rounds = int(32 * 1048576 / size);
+
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < rounds; r++)
+            {
+                vector<SymmCipher::CtrChunk> chunks;
+                byte macs[64][SymmCipher::BLOCKSIZE];
+
+                for (m_off_t pos = 0; pos < size; pos = ChunkedHash::chunkceil(pos, size))
+                {
+                    SymmCipher::CtrChunk chunk = { (byte*)data.data() + pos, unsigned(ChunkedHash::chunkceil(pos, size) - pos),
+                                                   pos, macs[chunks.size()], true };
+                    chunks.push_back(chunk);
+                }
+
+                if (method)
+                {
+                    key.ctr_crypt(chunks.data(), unsigned(chunks.size()), 0x1234, true);
+                }
+                else
+                {
+                    for (size_t i = 0; i < chunks.size(); i++)
+                    {
+                        ctrcryptblocks(&key, chunks[i].data, chunks[i].len, chunks[i].pos, 0x1234, chunks[i].mac, true);
+                    }
+                }
+            }
+
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            mbps[method] = rounds * size / 1048576.0 / seconds;
+        }
+
+        std::cout << "CTR + MAC of " << size / 1024 << " KB: " << long(mbps[0]) << " MB/s block by block, "
+                  << long(mbps[1]) << " MB/s portable, " << long(mbps[2]) << " MB/s " << (aesni ? "AES-NI" : "(no AES-NI)") << std::endl;
+    }
+
+    SymmCipher::aesni = aesni;
+}
+
 #ifdef ENABLE_CHAT
 // Test functions of Ed25519:
 // - Binary & Hex fingerprints of public key
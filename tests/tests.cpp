@@ -22,6 +22,18 @@
 #include "mega.h"
 #include "gtest/gtest.h"
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#endif
+
 using namespace mega;
 using ::testing::InitGoogleTest;
 using ::testing::Test;
@@ -196,9 +208,3243 @@ TEST(Cacheable, CacheableReaderWriter)
     ASSERT_EQ(mp2.no_audio, false);
 }
 
+// offline MegaClient to exercise the in-memory node tree
+struct OfflineClient : public MegaApp
+{
+    WAIT_CLASS waiter;
+    HTTPIO_CLASS httpio;
+    FSACCESS_CLASS fsaccess;
+    MegaClient client;
+    handle nexthandle;
+
+    OfflineClient()
+        : client(this, &waiter, &httpio, &fsaccess, NULL, NULL, "N9tSBJDC", "misctests")
+        , nexthandle(1)
+    {
+    }
+
+    Node* makenode(Node* parent, nodetype_t type, const string& name, m_off_t size = 0)
+    {
+        node_vector dp;
+        Node* n = new Node(&client, &dp, nexthandle++, parent ? parent->nodehandle : UNDEF, type, size, UNDEF, NULL, 0);
+        n->attrs.map['n'] = name;
+        n->updatechildname();
+        n->updatechildorders();
+        client.searchindex.update(n);
+        return n;
+    }
+};
+
+TEST(Node, childnodebyname)
+{
+    OfflineClient c;
+    c.client.childnameindexmin = 4;
+
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    Node* folder = c.makenode(root, FOLDERNODE, "dup");
+    Node* file = c.makenode(root, FILENODE, "dup");
+    c.makenode(root, FILENODE, "a");
+    Node* b = c.makenode(root, FILENODE, "b");
+
+    ASSERT_EQ(c.client.childnodebyname(root, "dup"), folder);
+    ASSERT_EQ(c.client.childnodesbyname(root, "dup").size(), 2u);
+    ASSERT_EQ(c.client.childnodesbyname(root, "dup", true).size(), 1u);
+    ASSERT_TRUE(root->childnames != NULL);
+
+    // index must follow renames, moves and deletions
+    b->attrs.map['n'] = "c";
+    c.client.setattr(b);
+    ASSERT_EQ(c.client.childnodebyname(root, "b"), (Node*)NULL);
+    ASSERT_EQ(c.client.childnodebyname(root, "c"), b);
+
+    folder->setparent(NULL);
+    ASSERT_EQ(c.client.childnodebyname(root, "dup"), file);
+    file->setparent(folder);
+    ASSERT_EQ(c.client.childnodebyname(root, "dup"), (Node*)NULL);
+    ASSERT_EQ(c.client.childnodebyname(folder, "dup"), file);
+
+    c.client.nodes.erase(b->nodehandle);
+    delete b;
+    ASSERT_EQ(c.client.childnodebyname(root, "c"), (Node*)NULL);
+    ASSERT_EQ(root->childnames->size(), 1u);
+
+    // name clashes resolve the same way with and without the index: folders
+    // first, then by handle (handles descending in children order here)
+    for (int indexed = 0; indexed < 2; indexed++)
+    {
+        OfflineClient d;
+        d.client.childnameindexmin = indexed ? 1 : 0;
+        Node* r = d.makenode(NULL, ROOTNODE, "");
+        vector<Node*> clashes;
+        for (int i = 0; i < 8; i++)
+        {
+            d.nexthandle = 100 - i;
+            clashes.push_back(d.makenode(r, i == 3 || i == 5 ? FOLDERNODE : FILENODE, "clash"));
+        }
+
+        ASSERT_EQ(d.client.childnodebyname(r, "clash"), clashes[5]);
+        ASSERT_EQ(d.client.childnodebyname(r, "clash", true), clashes[7]);
+        ASSERT_EQ(r->childnames != NULL, !!indexed);
+
+        vector<Node*> all = d.client.childnodesbyname(r, "clash");
+        ASSERT_EQ(all, vector<Node*>(clashes.rbegin(), clashes.rend()));
+    }
+}
+
+// lookup cost should not grow with the number of children
+TEST(Node, DISABLED_childnodebyname_benchmark)
+{
+    const int lookups = 2000;
+    double nsperlookup[3];
+    int sizes[3] = { 1000, 10000, 100000 };
+
+    for (int i = 0; i < 3; i++)
+    {
+        OfflineClient c;
+        Node* root = c.makenode(NULL, ROOTNODE, "");
+
+        for (int j = 0; j < sizes[i]; j++)
+        {
+            c.makenode(root, FILENODE, "file" + std::to_string(j));
+        }
+
+        std::vector<string> names;
+        for (int j = 0; j < lookups; j++)
+        {
+            names.push_back("file" + std::to_string((j * 7919) % sizes[i]));
+        }
+
+        // first lookup builds the index
+        c.client.childnodebyname(root, names[0].c_str());
+
+        auto start = std::chrono::steady_clock::now();
+        for (int j = 0; j < lookups; j++)
+        {
+            ASSERT_TRUE(c.client.childnodebyname(root, names[j].c_str()) != NULL);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        nsperlookup[i] = double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()) / lookups;
+        std::cout << "childnodebyname: " << sizes[i] << " children, " << nsperlookup[i] << " ns/lookup" << std::endl;
+    }
+}
+
 
 int main (int argc, char *argv[])
 {
     InitGoogleTest(&argc, argv);
     return RUN_ALL_TESTS();
 }
+
+TEST(Node, counters)
+{
+    OfflineClient c;
+
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    Node* a = c.makenode(root, FOLDERNODE, "a");
+    Node* b = c.makenode(a, FOLDERNODE, "b");
+    Node* f1 = c.makenode(a, FILENODE, "f1", 100);
+    Node* f2 = c.makenode(b, FILENODE, "f2", 20);
+
+    // previous versions are children of the current file
+    Node* v1 = c.makenode(f2, FILENODE, "f2", 5);
+    c.makenode(v1, FILENODE, "f2", 3);
+
+    ASSERT_EQ(a->numchildfiles, 1);
+    ASSERT_EQ(a->numchildfolders, 1);
+    ASSERT_EQ(root->subtreecounter.files, 2);
+    ASSERT_EQ(root->subtreecounter.folders, 3);
+    ASSERT_EQ(root->subtreecounter.versions, 2);
+    ASSERT_EQ(root->subtreecounter.storage, 120);
+    ASSERT_EQ(root->subtreecounter.versionstorage, 8);
+    ASSERT_EQ(b->subtreecounter.storage, 20);
+    ASSERT_TRUE(root->checkcounters());
+
+    // moving a version out of its file turns it into a current file
+    v1->setparent(a);
+    ASSERT_EQ(a->numchildfiles, 2);
+    ASSERT_EQ(root->subtreecounter.files, 3);
+    ASSERT_EQ(root->subtreecounter.versions, 1);
+    ASSERT_EQ(root->subtreecounter.storage, 125);
+    ASSERT_EQ(b->subtreecounter.versions, 0);
+    ASSERT_TRUE(root->checkcounters());
+
+    b->setparent(root);
+    f1->setsize(50);
+    ASSERT_EQ(a->subtreecounter.storage, 55);
+    ASSERT_EQ(a->numchildfolders, 0);
+    ASSERT_EQ(root->numchildfolders, 2);
+    ASSERT_EQ(root->subtreecounter.storage, 75);
+    ASSERT_TRUE(root->checkcounters());
+
+    c.client.nodes.erase(f2->nodehandle);
+    delete f2;
+    ASSERT_EQ(b->numchildfiles, 0);
+    ASSERT_EQ(root->subtreecounter.files, 2);
+    ASSERT_EQ(root->subtreecounter.storage, 55);
+    ASSERT_TRUE(root->checkcounters());
+
+    // an inconsistent counter is detected
+    a->subtreecounter.files++;
+    ASSERT_FALSE(root->checkcounters());
+    a->subtreecounter.files--;
+}
+
+// a file node with the attributes of a typical upload
+static Node* makefile(OfflineClient& c, Node* parent, int i)
+{
+    Node* n = c.makenode(parent, FILENODE, "IMG_" + std::to_string(100000 + i) + ".jpg", 1000000 + i);
+    n->nodekey.assign(FILENODEKEYLENGTH, char(i));
+    n->owner = 0x0123456789abcdefULL;
+    n->ctime = 1500000000 + i;
+    n->fileattrstring = "1234:0*AbCdEfGhIjK/1234:1*LmNoPqRsTuV";
+
+    FileFingerprint fp;
+    for (int j = 0; j < 4; j++)
+    {
+        fp.crc[j] = int32_t(i * 2654435761u + j);
+    }
+    fp.mtime = 1400000000 + i;
+    fp.serializefingerprint(&n->attrs.map['c']);
+
+    return n;
+}
+
+TEST(Node, serialize)
+{
+    OfflineClient c;
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    Node* folder = c.makenode(root, FOLDERNODE, "folder");
+    folder->nodekey.assign(FOLDERNODEKEYLENGTH, 'k');
+    folder->setpubliclink(0xabcdef, 1600000000, true);
+    byte key[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    folder->sharekey = new SymmCipher(key);
+    folder->outshares = new share_map;
+    (*folder->outshares)[1] = new Share(NULL, FULL, 1500000000);
+    Node* file = makefile(c, folder, 7);
+
+    Node* nodes[] = { root, folder, file };
+    for (int i = 0; i < 3; i++)
+    {
+        for (int legacy = 0; legacy < 2; legacy++)
+        {
+            string d;
+            ASSERT_TRUE(legacy ? nodes[i]->serializelegacy(&d) : nodes[i]->serialize(&d));
+            ASSERT_EQ(d[d.size() - 1] == Node::COMPACTFORMAT, !legacy);
+
+            handle h, ph;
+            nodetype_t t;
+            ASSERT_TRUE(Node::peek(&d, &h, &ph, &t));
+            ASSERT_EQ(h, nodes[i]->nodehandle);
+            ASSERT_EQ(ph, nodes[i]->parent ? nodes[i]->parent->nodehandle : UNDEF);
+            ASSERT_EQ(t, nodes[i]->type);
+
+            newshare_list shares;
+            Node* n = Node::unserialize(&c.client, (const string*)&d, &shares);
+            ASSERT_TRUE(n != NULL);
+            ASSERT_EQ(n->nodehandle, nodes[i]->nodehandle);
+            ASSERT_EQ(n->parenthandle, ph);
+            ASSERT_EQ(n->type, nodes[i]->type);
+            if (n->type == FILENODE)
+            {
+                ASSERT_EQ(n->size, nodes[i]->size);
+            }
+            ASSERT_EQ(n->owner, nodes[i]->owner);
+            ASSERT_EQ(n->ctime, nodes[i]->ctime);
+            ASSERT_EQ(n->nodekey, nodes[i]->nodekey);
+            ASSERT_EQ(n->fileattrstring, nodes[i]->fileattrstring);
+            ASSERT_TRUE(n->attrs.map == nodes[i]->attrs.map);
+            ASSERT_EQ(n->plink != NULL, nodes[i]->plink != NULL);
+            if (n->plink)
+            {
+                ASSERT_EQ(n->plink->ph, nodes[i]->plink->ph);
+                ASSERT_EQ(n->plink->ets, nodes[i]->plink->ets);
+                ASSERT_EQ(n->plink->takendown, nodes[i]->plink->takendown);
+            }
+            ASSERT_EQ(shares.size(), nodes[i]->outshares ? nodes[i]->outshares->size() : 0u);
+            if (shares.size())
+            {
+                ASSERT_EQ(shares.front()->outgoing, -1);
+                ASSERT_EQ(shares.front()->access, FULL);
+                ASSERT_EQ(shares.front()->ts, 1500000000);
+                ASSERT_EQ(shares.front()->pending, UNDEF);
+            }
+
+            // truncated records are rejected
+            string truncated = d.substr(0, d.size() / 2);
+            truncated.push_back(d[d.size() - 1]);
+            newshare_list discarded;
+            ASSERT_TRUE(Node::unserialize(&c.client, (const string*)&truncated, &discarded) == NULL);
+            ASSERT_TRUE(discarded.empty());
+
+            Node::discardshares(&shares);
+            n->nodehandle = UNDEF;
+            delete n;
+        }
+    }
+
+    // a fingerprint that does not survive the round trip is kept as is
+    file->attrs.map['c'] = "invalid";
+    string d;
+    newshare_list shares;
+    ASSERT_TRUE(file->serialize(&d));
+    Node* n = Node::unserialize(&c.client, (const string*)&d, &shares);
+    ASSERT_TRUE(n != NULL);
+    ASSERT_EQ(n->attrs.map['c'], "invalid");
+    n->nodehandle = UNDEF;
+    delete n;
+}
+
+TEST(Node, DISABLED_serialize_benchmark)
+{
+    OfflineClient c;
+    const int count = 20000;
+
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    vector<Node*> nodes;
+    for (int i = 0; i < count; i++)
+    {
+        nodes.push_back(makefile(c, root, i));
+    }
+
+    size_t sizes[2] = { 0, 0 };
+    double rates[2] = { 0, 0 };
+    vector<string> records[2];
+    for (int legacy = 0; legacy < 2; legacy++)
+    {
+        records[legacy].resize(count);
+        for (int i = 0; i < count; i++)
+        {
+            ASSERT_TRUE(legacy ? nodes[i]->serializelegacy(&records[legacy][i]) : nodes[i]->serialize(&records[legacy][i]));
+            sizes[legacy] += records[legacy][i].size();
+        }
+    }
+
+    // best of several alternating passes
+    for (int pass = 0; pass < 10; pass++)
+    {
+        int legacy = pass & 1;
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < count; i++)
+        {
+            newshare_list shares;
+            Node* n = Node::unserialize(&c.client, (const string*)&records[legacy][i], &shares);
+            ASSERT_TRUE(n != NULL);
+            n->nodehandle = UNDEF;
+            delete n;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        rates[legacy] = std::max(rates[legacy], count / std::chrono::duration<double>(elapsed).count());
+    }
+
+    std::cout << "Node records: " << sizes[1] / count << " bytes legacy, " << sizes[0] / count << " bytes compact; "
+              << long(rates[1]) << " nodes/s legacy, " << long(rates[0]) << " nodes/s compact" << std::endl;
+
+    ASSERT_LT(sizes[0], sizes[1]);
+}
+
+// what MegaApiImpl::search() finds by walking the tree
+static void walksearch(Node* n, const char* text, bool recursive, handle_set* results)
+{
+    for (node_list::iterator it = n->children.begin(); it != n->children.end(); it++)
+    {
+        Node* child = *it;
+
+        if (child->type <= FOLDERNODE && strcasestr(child->displayname(), text))
+        {
+            results->insert(child->nodehandle);
+        }
+
+        if (recursive && child->type != FILENODE)
+        {
+            walksearch(child, text, true, results);
+        }
+    }
+}
+
+static void indexsearch(OfflineClient& c, Node* n, const char* text, bool recursive, handle_set* results)
+{
+    handle_set ancestors;
+    handle_vector handles;
+
+    ancestors.insert(n->nodehandle);
+    ASSERT_TRUE(c.client.searchindex.search(text, &ancestors, recursive, &handles));
+    results->insert(handles.begin(), handles.end());
+    ASSERT_EQ(results->size(), handles.size());
+}
+
+TEST(NodeSearchIndex, search)
+{
+    OfflineClient c;
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    Node* docs = c.makenode(root, FOLDERNODE, "Documents");
+    Node* photos = c.makenode(root, FOLDERNODE, "Photos");
+    Node* report = c.makenode(docs, FILENODE, "Report.PDF");
+    c.makenode(report, FILENODE, "report-old.pdf");
+    c.makenode(docs, FILENODE, "notes.txt");
+    Node* trip = c.makenode(photos, FOLDERNODE, "Trip to Paris");
+    for (int i = 0; i < 50; i++)
+    {
+        c.makenode(trip, FILENODE, "IMG_" + std::to_string(1000 + i) + ".JPG");
+    }
+
+    handle_set ancestors;
+    handle_vector handles;
+    ancestors.insert(root->nodehandle);
+    ASSERT_FALSE(c.client.searchindex.search("pdf", &ancestors, true, &handles));
+    ASSERT_TRUE(c.client.buildsearchindex());
+
+    const char* queries[] = { "pdf", "PDF", "report", "img_10", ".jpg", "paris", "o", "", "xyz", "rt.p" };
+    Node* scopes[] = { root, docs, photos, trip, report };
+
+    for (int step = 0; step < 3; step++)
+    {
+        for (size_t i = 0; i < sizeof queries / sizeof *queries; i++)
+        {
+            for (size_t j = 0; j < sizeof scopes / sizeof *scopes; j++)
+            {
+                for (int recursive = 0; recursive < 2; recursive++)
+                {
+                    handle_set expected, found;
+                    walksearch(scopes[j], queries[i], recursive != 0, &expected);
+                    indexsearch(c, scopes[j], queries[i], recursive != 0, &found);
+                    ASSERT_TRUE(expected == found) << queries[i] << " in " << scopes[j]->displayname();
+                }
+            }
+        }
+
+        if (step == 0)
+        {
+            // renames, moves and deletions are applied incrementally
+            report->attrs.map['n'] = "Summary.pdf";
+            c.client.setattr(report);
+            trip->setparent(docs);
+
+            Node* img = c.client.childnodebyname(trip, "IMG_1007.JPG");
+            c.client.nodes.erase(img->nodehandle);
+            delete img;
+
+            c.makenode(photos, FILENODE, "paris.png");
+        }
+        else if (step == 1)
+        {
+            // freed slots are reused
+            for (int i = 0; i < 20; i++)
+            {
+                Node* img = c.client.childnodebyname(trip, ("IMG_" + std::to_string(1020 + i) + ".JPG").c_str());
+                c.client.nodes.erase(img->nodehandle);
+                delete img;
+                c.makenode(photos, FILENODE, "Report " + std::to_string(i) + ".pdf");
+            }
+        }
+    }
+
+    c.client.purgenodesusersabortsc();
+    ASSERT_FALSE(c.client.searchindex.isbuilt());
+}
+
+// same shape as the comparators of the API layer (descending orders
+// compare a node as smaller than itself)
+static bool nameDESC(Node* i, Node* j)
+{
+    int r = strcmp(i->displayname(), j->displayname());
+    return !(r < 0 || (!r && i->nodehandle < j->nodehandle));
+}
+
+static bool sizeASC(Node* i, Node* j)
+{
+    return i->size < j->size || (i->size == j->size && i->nodehandle < j->nodehandle);
+}
+
+static bool ctimeASC(Node* i, Node* j)
+{
+    return i->ctime < j->ctime || (i->ctime == j->ctime && i->nodehandle < j->nodehandle);
+}
+
+// sortedchildren() must match a full sort of the current children
+static bool checkorder(Node* folder, nodecomparator comparator)
+{
+    ChildOrder::Less less = { comparator };
+    node_vector expected(folder->children.begin(), folder->children.end());
+    std::sort(expected.begin(), expected.end(), less);
+
+    const ChildOrder* sorted = folder->sortedchildren(comparator);
+
+    if (node_vector(sorted->nodes.begin(), sorted->nodes.end()) != expected)
+    {
+        return false;
+    }
+
+    // childindex() walks the sorted set, so large folders are sampled
+    for (size_t i = 0; i < expected.size(); i += 1 + expected.size() / 100)
+    {
+        if (folder->childindex(expected[i], comparator) != int(i))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TEST(Node, sortedchildren)
+{
+    OfflineClient c;
+
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    Node* other = c.makenode(root, FOLDERNODE, "other");
+    node_vector files;
+    for (int i = 0; i < 50; i++)
+    {
+        files.push_back(c.makenode(root, FILENODE, "f" + std::to_string(i * 7919 % 50), i * 31 % 17));
+    }
+
+    ASSERT_TRUE(checkorder(root, nameDESC));
+    ASSERT_TRUE(checkorder(root, sizeASC));
+    ASSERT_EQ(root->childindex(files[0], sizeASC), 1);  // after the folder
+    ASSERT_EQ(other->childindex(files[0], sizeASC), -1);
+
+    // additions, renames, size changes, moves and deletions keep both orders
+    c.makenode(root, FILENODE, "f25", 3);
+    c.makenode(root, FILENODE, "zzz", 100);
+    ASSERT_TRUE(checkorder(root, nameDESC));
+    ASSERT_TRUE(checkorder(root, sizeASC));
+
+    files[10]->attrs.map['n'] = "a";
+    files[10]->updatechildorders();
+    files[20]->setsize(1000);
+    ASSERT_TRUE(checkorder(root, nameDESC));
+    ASSERT_TRUE(checkorder(root, sizeASC));
+    ASSERT_EQ(*root->sortedchildren(nameDESC)->nodes.rbegin(), files[10]);
+    ASSERT_EQ(*root->sortedchildren(sizeASC)->nodes.rbegin(), files[20]);
+
+    ASSERT_TRUE(checkorder(root, ctimeASC));
+    files[5]->setctime(files[5]->ctime + 1000);
+    ASSERT_TRUE(checkorder(root, ctimeASC));
+    ASSERT_EQ(*root->sortedchildren(ctimeASC)->nodes.rbegin(), files[5]);
+
+    files[30]->setparent(other);
+    c.client.nodes.erase(files[40]->nodehandle);
+    delete files[40];
+    ASSERT_TRUE(checkorder(root, nameDESC));
+    ASSERT_TRUE(checkorder(root, sizeASC));
+    ASSERT_TRUE(checkorder(other, nameDESC));
+    ASSERT_EQ(root->childindex(files[30], nameDESC), -1);
+    ASSERT_EQ(root->sortedchildren(sizeASC)->nodes.size(), root->children.size());
+
+    // only the most recently listed folders keep their sort orders
+    c.client.maxsortedfolders = 2;
+    Node* third = c.makenode(root, FOLDERNODE, "third");
+    third->sortedchildren(nameDESC);
+    ASSERT_EQ(c.client.sortedfolders.size(), size_t(2));
+    ASSERT_TRUE(root->childorders);
+    ASSERT_FALSE(other->childorders);
+    ASSERT_TRUE(checkorder(other, sizeASC));
+    ASSERT_FALSE(root->childorders);
+    ASSERT_TRUE(third->childorders);
+    ASSERT_TRUE(checkorder(root, sizeASC));
+}
+
+// in-memory statecache
+class MemDbTable : public DbTable
+{
+    std::map<uint32_t, string> records;
+    std::map<uint32_t, string>::iterator cursor;
+
+public:
+    using DbTable::next;
+    using DbTable::put;
+
+    void rewind() { cursor = records.begin(); }
+
+    bool next(uint32_t* id, string* data)
+    {
+        if (cursor == records.end())
+        {
+            return false;
+        }
+
+        *id = cursor->first;
+        *data = cursor->second;
+        cursor++;
+        return true;
+    }
+
+    bool get(uint32_t id, string* data)
+    {
+        std::map<uint32_t, string>::iterator it = records.find(id);
+        return it != records.end() && (data->assign(it->second), true);
+    }
+
+    bool put(uint32_t id, char* data, unsigned len)
+    {
+        records[id].assign(data, len);
+        return true;
+    }
+
+    bool del(uint32_t id) { return records.erase(id) > 0; }
+    void truncate() { records.clear(); }
+    void begin() { }
+    void commit() { }
+    void abort() { }
+    void remove() { records.clear(); }
+
+    MemDbTable(PrnGen& rng) : DbTable(rng) { }
+};
+
+TEST(MegaClient, fetchsc)
+{
+    OfflineClient c;
+    byte key[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    c.client.key.setkey(key);
+
+    // several batches, versions and a parent stored after its children
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    vector<Node*> nodes;
+    nodes.push_back(root);
+    for (int i = 0; i < 50; i++)
+    {
+        Node* folder = c.makenode(root, FOLDERNODE, "folder" + std::to_string(i));
+        folder->nodekey.assign(FOLDERNODEKEYLENGTH, 'k');
+        nodes.push_back(folder);
+
+        for (int j = 0; j < 60; j++)
+        {
+            Node* file = c.makenode(folder, FILENODE, "file" + std::to_string(j), i * 100 + j);
+            file->nodekey.assign(FILENODEKEYLENGTH, 'f');
+            nodes.push_back(file);
+
+            if (j % 10 == 0)
+            {
+                Node* version = c.makenode(file, FILENODE, "file" + std::to_string(j), j);
+                version->nodekey.assign(FILENODEKEYLENGTH, 'v');
+                nodes.push_back(version);
+            }
+        }
+    }
+    std::reverse(nodes.begin(), nodes.end());
+
+    MemDbTable table(c.client.rng);
+    for (size_t i = 0; i < nodes.size(); i++)
+    {
+        ASSERT_TRUE(table.put(MegaClient::CACHEDNODE, nodes[i], &c.client.key));
+    }
+
+    for (int threads = 0; threads <= 4; threads += 2)
+    {
+        OfflineClient d;
+        d.client.key.setkey(key);
+        d.client.fetchscthreads = threads;
+
+        ASSERT_TRUE(d.client.fetchsc(&table));
+        ASSERT_EQ(d.client.nodes.size(), c.client.nodes.size());
+        ASSERT_NE(d.client.fnstats.timeToLinked, NEVER);
+
+        for (size_t i = 0; i < nodes.size(); i++)
+        {
+            Node* n = d.client.nodebyhandle(nodes[i]->nodehandle);
+            ASSERT_TRUE(n != NULL);
+            ASSERT_EQ(n->type, nodes[i]->type);
+            if (n->type == FILENODE)
+            {
+                ASSERT_EQ(n->size, nodes[i]->size);
+            }
+            ASSERT_EQ(n->attrs.map['n'], nodes[i]->attrs.map['n']);
+            ASSERT_EQ(n->parent ? n->parent->nodehandle : UNDEF, nodes[i]->parent ? nodes[i]->parent->nodehandle : UNDEF);
+        }
+
+        Node* droot = d.client.nodebyhandle(root->nodehandle);
+        ASSERT_EQ(d.client.rootnodes[0], root->nodehandle);
+        ASSERT_TRUE(droot->subtreecounter == root->subtreecounter);
+        ASSERT_TRUE(droot->checkcounters());
+    }
+}
+
+// in-memory statecache that logs transactions and can fail writes
+class LoggingDbTable : public MemDbTable
+{
+public:
+    string log;
+    uint32_t failid;
+
+    bool put(uint32_t id, char* data, unsigned len)
+    {
+        log += "p" + std::to_string(id);
+        return id != failid && MemDbTable::put(id, data, len);
+    }
+
+    void begin() { log += "b"; }
+    void commit() { log += "c"; }
+    void abort() { log += "a"; }
+
+    LoggingDbTable(PrnGen& rng) : MemDbTable(rng), failid(UINT32_MAX) { }
+};
+
+TEST(StateCacheWriter, ordering)
+{
+    OfflineClient c;
+    LoggingDbTable* table = new LoggingDbTable(c.client.rng);
+    StateCacheWriter writer(c.client.rng, table);
+
+    // the sequence number record is answered without waiting for the thread
+    string data;
+    ASSERT_FALSE(writer.get(MegaClient::CACHEDSCSN, &data));
+    writer.begin();
+    ASSERT_TRUE(writer.put(MegaClient::CACHEDSCSN, (char*)"scsn", 4));
+    ASSERT_TRUE(writer.get(MegaClient::CACHEDSCSN, &data));
+    ASSERT_EQ(data, "scsn");
+
+    dbrecord_vector records;
+    for (uint32_t i = 1; i <= 100; i++)
+    {
+        records.push_back(pair<uint32_t, string>(i * 16, std::to_string(i)));
+    }
+    ASSERT_TRUE(writer.putrecords(&records));
+
+    vector<uint32_t> ids;
+    ids.push_back(16);
+    ASSERT_TRUE(writer.delrecords(&ids));
+    writer.commit();
+
+    // reads wait for all queued writes
+    ASSERT_FALSE(writer.get(16, &data));
+    ASSERT_TRUE(writer.get(1600, &data));
+    ASSERT_EQ(data, "100");
+    ASSERT_EQ(table->log.substr(0, 6), "bp0p16");
+    ASSERT_EQ(table->log.back(), 'c');
+
+    // a slow thread holds back the client once the queue is full
+    writer.maxpendingbytes = 1;
+    writer.begin();
+    for (uint32_t i = 1; i <= 100; i++)
+    {
+        ASSERT_TRUE(writer.put(i * 16, (char*)records[i - 1].second.data(), unsigned(records[i - 1].second.size())));
+    }
+    writer.commit();
+    ASSERT_TRUE(writer.get(16, &data));
+    ASSERT_GT(writer.stalls, 0u);
+
+    // after a failed write, the transaction is not committed and later
+    // writes report the failure
+    table->log.clear();
+    table->failid = 32;
+    writer.begin();
+    writer.put(32, (char*)"x", 1);
+    writer.commit();
+    writer.get(48, &data);
+    ASSERT_FALSE(writer.put(48, (char*)"y", 1));
+    ASSERT_EQ(table->log, "bp32a");
+}
+
+#ifdef USE_SQLITE
+TEST(SqliteDbTable, nodetable)
+{
+    OfflineClient c;
+    byte key[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    c.client.key.setkey(key);
+
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    Node* folder = c.makenode(root, FOLDERNODE, "folder");
+    folder->nodekey.assign(FOLDERNODEKEYLENGTH, 'k');
+    for (int i = 0; i < 10; i++)
+    {
+        Node* file = c.makenode(folder, FILENODE, "file" + std::to_string(i), i);
+        file->nodekey.assign(FILENODEKEYLENGTH, 'f');
+    }
+
+    // a cache of the previous version, with the nodes in statecache
+    MemDbTable records(c.client.rng);
+    for (node_map::iterator it = c.client.nodes.begin(); it != c.client.nodes.end(); it++)
+    {
+        ASSERT_TRUE(records.put(MegaClient::CACHEDNODE, it->second, &c.client.key));
+    }
+
+    string path = "./";
+    string name = "nodetabletest";
+    std::ostringstream previous;
+    previous << path << "megaclient_statecache" << DbAccess::PREVIOUS_DB_VERSION << "_" << name << ".db";
+
+    sqlite3* db;
+    ASSERT_EQ(sqlite3_open(previous.str().c_str(), &db), SQLITE_OK);
+    ASSERT_EQ(sqlite3_exec(db, "CREATE TABLE statecache (id INTEGER PRIMARY KEY ASC NOT NULL, content BLOB NOT NULL)", NULL, NULL, NULL), SQLITE_OK);
+
+    uint32_t id;
+    string data;
+    records.rewind();
+    while (records.next(&id, &data))
+    {
+        sqlite3_stmt* stmt;
+        ASSERT_EQ(sqlite3_prepare(db, "INSERT INTO statecache (id, content) VALUES (?, ?)", -1, &stmt, NULL), SQLITE_OK);
+        sqlite3_bind_int(stmt, 1, id);
+        sqlite3_bind_blob(stmt, 2, data.data(), int(data.size()), SQLITE_STATIC);
+        ASSERT_EQ(sqlite3_step(stmt), SQLITE_DONE);
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_close(db);
+
+    // opening upgrades the file, loading moves the nodes
+    SqliteDbAccess access(&path);
+    access.currentDbVersion = DbAccess::DB_VERSION;
+    DbTable* table = access.open(c.client.rng, &c.fsaccess, &name);
+    ASSERT_TRUE(table != NULL);
+    ASSERT_TRUE(table->legacynodes);
+
+    {
+        OfflineClient d;
+        d.client.key.setkey(key);
+        ASSERT_TRUE(d.client.fetchsc(table));
+        ASSERT_EQ(d.client.nodes.size(), c.client.nodes.size());
+        ASSERT_FALSE(table->legacynodes);
+        delete table;
+    }
+
+    table = access.open(c.client.rng, &c.fsaccess, &name);
+    ASSERT_TRUE(table != NULL);
+    ASSERT_FALSE(table->legacynodes);
+
+    OfflineClient e;
+    e.client.key.setkey(key);
+    ASSERT_TRUE(e.client.fetchsc(table));
+    ASSERT_EQ(e.client.nodes.size(), c.client.nodes.size());
+
+    // lookups from disk
+    dbrecord_vector children;
+    ASSERT_TRUE(table->getchildren(folder->nodehandle, &children));
+    ASSERT_EQ(children.size(), 10u);
+    ASSERT_TRUE(DbTable::decrypt(children[0].first, &children[0].second, &e.client.key));
+
+    Node* file = e.client.nodebyhandle(folder->children.back()->nodehandle);
+    ASSERT_TRUE(table->getnode(file->nodehandle, &id, &data));
+    ASSERT_EQ(id, file->dbid);
+
+    dbrecord_vector samefingerprint;
+    ASSERT_TRUE(table->getnodesbyfingerprint(file, &samefingerprint));
+    ASSERT_EQ(samefingerprint.size(), 1u);
+    ASSERT_EQ(samefingerprint[0].first, file->dbid);
+
+    table->remove();
+    delete table;
+}
+
+TEST(SqliteDbTable, batchwrites)
+{
+    OfflineClient c;
+    byte key[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    c.client.key.setkey(key);
+
+    string path = "./";
+    string name = "batchwritestest";
+    SqliteDbAccess access(&path);
+    access.currentDbVersion = DbAccess::DB_VERSION;
+    DbTable* table = access.open(c.client.rng, &c.fsaccess, &name);
+    ASSERT_TRUE(table != NULL);
+
+    // two full batches and a remainder
+    int count = 2 * SqliteDbTable::BATCHROWS + 5;
+    dbrecord_vector records;
+    vector<uint32_t> indexes;
+    for (int i = 1; i <= count; i++)
+    {
+        records.push_back(pair<uint32_t, string>(i * 16, "record" + std::to_string(i)));
+        indexes.push_back(i * 16);
+    }
+
+    table->begin();
+    ASSERT_TRUE(table->putrecords(&records));
+    table->commit();
+
+    string data;
+    for (int i = 0; i < count; i++)
+    {
+        ASSERT_TRUE(table->get(records[i].first, &data));
+        ASSERT_EQ(data, records[i].second);
+    }
+
+    indexes.resize(SqliteDbTable::BATCHROWS + 1);
+    ASSERT_TRUE(table->delrecords(&indexes));
+    ASSERT_FALSE(table->get(records[0].first, &data));
+    ASSERT_FALSE(table->get(records[SqliteDbTable::BATCHROWS].first, &data));
+    ASSERT_TRUE(table->get(records[SqliteDbTable::BATCHROWS + 1].first, &data));
+
+    // node records with their indexed columns
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    node_vector nodes;
+    vector<NodeColumns> columns;
+    dbrecord_vector noderecords;
+    for (int i = 0; i < count; i++)
+    {
+        Node* file = c.makenode(root, FILENODE, "file" + std::to_string(i), i);
+        file->nodekey.assign(FILENODEKEYLENGTH, 'f');
+        noderecords.push_back(pair<uint32_t, string>(0, string()));
+        ASSERT_TRUE(table->encode(MegaClient::CACHEDNODE, file, &c.client.key, &noderecords.back().second));
+        noderecords.back().first = file->dbid;
+        nodes.push_back(file);
+        columns.push_back(NodeColumns(file));
+    }
+
+    ASSERT_TRUE(table->putnoderecords(&columns, &noderecords));
+
+    dbrecord_vector children;
+    ASSERT_TRUE(table->getchildren(root->nodehandle, &children));
+    ASSERT_EQ(children.size(), size_t(count));
+
+    uint32_t id;
+    ASSERT_TRUE(table->getnode(nodes.back()->nodehandle, &id, &data));
+    ASSERT_EQ(id, uint32_t(nodes.back()->dbid));
+
+    indexes.clear();
+    for (int i = 0; i < count; i += 2)
+    {
+        indexes.push_back(nodes[i]->dbid);
+    }
+    ASSERT_TRUE(table->delnoderecords(&indexes));
+
+    children.clear();
+    ASSERT_TRUE(table->getchildren(root->nodehandle, &children));
+    ASSERT_EQ(children.size(), size_t(count / 2));
+    ASSERT_FALSE(table->getnode(nodes[0]->nodehandle, &id, &data));
+
+    table->remove();
+    delete table;
+}
+
+TEST(SqliteDbTable, DISABLED_batchwrites_benchmark)
+{
+    OfflineClient c;
+    const int count = 20000;
+
+    string path = "./";
+    string name = "batchbenchmarktest";
+    SqliteDbAccess access(&path);
+    access.currentDbVersion = DbAccess::DB_VERSION;
+    DbTable* table = access.open(c.client.rng, &c.fsaccess, &name);
+    ASSERT_TRUE(table != NULL);
+
+    dbrecord_vector records;
+    for (int i = 1; i <= count; i++)
+    {
+        records.push_back(pair<uint32_t, string>(i * 16, string(256, char(i))));
+    }
+
+    // previous write path: one statement compilation per record
+    std::ostringstream file;
+    file << path << "megaclient_statecache" << DbAccess::DB_VERSION << "_" << name << ".db";
+    sqlite3* db;
+    ASSERT_EQ(sqlite3_open(file.str().c_str(), &db), SQLITE_OK);
+
+    auto start = std::chrono::steady_clock::now();
+    sqlite3_exec(db, "BEGIN", NULL, NULL, NULL);
+    for (int i = 0; i < count; i++)
+    {
+        sqlite3_stmt* stmt;
+        ASSERT_EQ(sqlite3_prepare(db, "INSERT OR REPLACE INTO statecache (id, content) VALUES (?, ?)", -1, &stmt, NULL), SQLITE_OK);
+        sqlite3_bind_int(stmt, 1, records[i].first);
+        sqlite3_bind_blob(stmt, 2, records[i].second.data(), int(records[i].second.size()), SQLITE_STATIC);
+        ASSERT_EQ(sqlite3_step(stmt), SQLITE_DONE);
+        sqlite3_finalize(stmt);
+    }
+    sqlite3_exec(db, "COMMIT", NULL, NULL, NULL);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    double before = count / std::chrono::duration<double>(elapsed).count();
+    sqlite3_exec(db, "DELETE FROM statecache", NULL, NULL, NULL);
+    sqlite3_close(db);
+
+    // cached statements, one by one
+    start = std::chrono::steady_clock::now();
+    table->begin();
+    for (int i = 0; i < count; i++)
+    {
+        ASSERT_TRUE(table->put(records[i].first, &records[i].second));
+    }
+    table->commit();
+    elapsed = std::chrono::steady_clock::now() - start;
+    double cached = count / std::chrono::duration<double>(elapsed).count();
+    table->truncate();
+
+    // cached multi-row statements
+    start = std::chrono::steady_clock::now();
+    table->begin();
+    ASSERT_TRUE(table->putrecords(&records));
+    table->commit();
+    elapsed = std::chrono::steady_clock::now() - start;
+    double batched = count / std::chrono::duration<double>(elapsed).count();
+
+    std::cout << "SqliteDbTable writes: " << long(before) << " rows/s with a statement per row, "
+              << long(cached) << " rows/s cached, " << long(batched) << " rows/s batched" << std::endl;
+
+    table->remove();
+    delete table;
+}
+
+TEST(MegaClient, lazynodes)
+{
+    OfflineClient c;
+    byte key[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    c.client.key.setkey(key);
+
+    Node* root = c.makenode(NULL, ROOTNODE, "");
+    vector<Node*> folders;
+    for (int i = 0; i < 5; i++)
+    {
+        Node* folder = c.makenode(root, FOLDERNODE, "folder" + std::to_string(i));
+        folder->nodekey.assign(FOLDERNODEKEYLENGTH, 'k');
+        folders.push_back(folder);
+
+        for (int j = 0; j < 20; j++)
+        {
+            Node* file = c.makenode(folder, FILENODE, "file" + std::to_string(j), i * 100 + j);
+            file->nodekey.assign(FILENODEKEYLENGTH, 'f');
+        }
+    }
+
+    // a public link, loaded upfront with its ancestors
+    Node* exported = folders[3]->children.front();
+    exported->setpubliclink(4321, 0, false);
+
+    // a file with a real fingerprint
+    Node* fingerprinted = folders[4]->children.back();
+    fingerprinted->crc[0] = 42;
+    fingerprinted->mtime = 1234;
+    fingerprinted->isvalid = true;
+    fingerprinted->serializefingerprint(&fingerprinted->attrs.map['c']);
+    fingerprinted->setfingerprint();
+
+    string path = "./";
+    string name = "lazynodestest";
+    SqliteDbAccess access(&path);
+    access.currentDbVersion = DbAccess::DB_VERSION;
+    DbTable* table = access.open(c.client.rng, &c.fsaccess, &name);
+    ASSERT_TRUE(table != NULL);
+    ASSERT_FALSE(table->legacynodes);
+
+    for (node_map::iterator it = c.client.nodes.begin(); it != c.client.nodes.end(); it++)
+    {
+        ASSERT_TRUE(table->putnode(MegaClient::CACHEDNODE, it->second, &c.client.key));
+    }
+
+    // as after reopening: new records go above the node records not read
+    uint32_t lastid = table->nextid;
+    table->nextid = 0;
+
+    OfflineClient d;
+    d.client.key.setkey(key);
+    d.client.maxresidentnodes = 10;
+    d.client.sctable = table;
+    ASSERT_TRUE(d.client.fetchsc(table));
+    ASSERT_TRUE(d.client.lazynodes);
+    ASSERT_EQ(table->nextid, lastid);
+    ASSERT_EQ(d.client.nodes.size(), 3u);
+    ASSERT_EQ(d.client.rootnodes[0], root->nodehandle);
+    ASSERT_TRUE(d.client.nodes.count(exported->nodehandle) && d.client.nodes.count(folders[3]->nodehandle));
+
+    // lookups by handle load the node and its ancestors
+    Node* file = d.client.nodebyhandle(folders[1]->children.back()->nodehandle);
+    ASSERT_TRUE(file != NULL);
+    ASSERT_EQ(file->parent->nodehandle, folders[1]->nodehandle);
+    ASSERT_EQ(file->parent->parent, d.client.nodebyhandle(root->nodehandle));
+    ASSERT_EQ(d.client.nodes.size(), 5u);
+
+    Node* folder = file->parent;
+    d.client.loadchildren(folder);
+    ASSERT_EQ(folder->children.size(), 20u);
+    ASSERT_EQ(folder->numchildfiles, 20);
+    ASSERT_EQ(d.client.childnodebyname(folder, "file3")->nodehandle, (*std::next(folders[1]->children.begin(), 3))->nodehandle);
+
+    // leaves are evicted first, shared nodes and their ancestors stay
+    d.client.unloadnodes();
+    ASSERT_LE(d.client.nodes.size(), 10u);
+    ASSERT_EQ(d.client.lrunodes.size(), d.client.nodes.size());
+    ASSERT_FALSE(folder->childrenloaded);
+    ASSERT_TRUE(d.client.nodes.count(exported->nodehandle));
+    ASSERT_TRUE(d.client.nodebyhandle(root->nodehandle)->checkcounters());
+
+    // the counters of the whole tree are summed up in the cache
+    Node* lazyroot = d.client.nodebyhandle(root->nodehandle);
+    ASSERT_FALSE(lazyroot->subtreecounter == root->subtreecounter);
+    ASSERT_TRUE(d.client.subtreecounter(lazyroot) == root->subtreecounter);
+    ASSERT_TRUE(d.client.subtreecounter(folder) == folders[1]->subtreecounter);
+
+    d.client.loadchildren(folder);
+    ASSERT_EQ(folder->children.size(), 20u);
+    ASSERT_TRUE(folder->childrenloaded);
+
+    // lookups by fingerprint load the matching nodes
+    FileFingerprint fp;
+    fp = *fingerprinted;
+    Node* match = d.client.nodebyfingerprint(&fp);
+    ASSERT_TRUE(match != NULL);
+    ASSERT_EQ(match->nodehandle, fingerprinted->nodehandle);
+    ASSERT_EQ(match->parent->nodehandle, folders[4]->nodehandle);
+
+    // unknown handles are looked up in the cache only
+    ASSERT_TRUE(d.client.nodebyhandle(9999) == NULL);
+
+    // updates of nodes that are not in memory go to their cached record
+    handle updated = folders[0]->children.front()->nodehandle;
+    ASSERT_FALSE(d.client.nodes.count(updated));
+    ASSERT_TRUE(d.client.updatecachednode(updated, 77, NULL, 12345));
+    ASSERT_FALSE(d.client.nodes.count(updated));
+    Node* reloaded = d.client.nodebyhandle(updated);
+    ASSERT_TRUE(reloaded != NULL);
+    ASSERT_EQ(reloaded->owner, handle(77));
+    ASSERT_EQ(reloaded->ctime, 12345);
+    ASSERT_EQ(reloaded->parent->nodehandle, folders[0]->nodehandle);
+    ASSERT_EQ(reloaded->attrs.map['n'], folders[0]->children.front()->attrs.map['n']);
+
+    // deleting a folder only loads the folder, the records of its children
+    // are deleted with the cache update
+    Node* deleted = d.client.nodebyhandle(folders[2]->nodehandle);
+    ASSERT_TRUE(deleted != NULL);
+    size_t resident = d.client.nodes.size();
+    TreeProcDel td;
+    d.client.proctree(deleted, &td);
+    ASSERT_EQ(d.client.nodes.size(), resident);
+    ASSERT_EQ(d.client.deletedtrees.size(), 1u);
+
+    // meanwhile, the children can't be loaded below the deleted folder
+    ASSERT_TRUE(d.client.nodebyhandle(folders[2]->children.front()->nodehandle) == NULL);
+
+    // ...also while the cache can't be updated (no scsn record yet)
+    d.client.notifypurge();
+    ASSERT_FALSE(d.client.nodes.count(folders[2]->nodehandle));
+    ASSERT_EQ(d.client.deletedtrees.size(), 1u);
+    ASSERT_TRUE(d.client.nodebyhandle(folders[2]->nodehandle) == NULL);
+    ASSERT_TRUE(d.client.nodebyhandle(folders[2]->children.front()->nodehandle) == NULL);
+
+    handle cachedscsn = 1;
+    ASSERT_TRUE(table->put(MegaClient::CACHEDSCSN, (char*)&cachedscsn, sizeof cachedscsn));
+    Base64::btoa((const byte*)&cachedscsn, sizeof cachedscsn, d.client.scsn);
+
+    d.client.notifypurge();
+    ASSERT_FALSE(d.client.nodes.count(folders[2]->nodehandle));
+    ASSERT_TRUE(d.client.deletedtrees.empty());
+
+    dbrecord_vector records;
+    ASSERT_TRUE(table->getchildren(folders[2]->nodehandle, &records));
+    ASSERT_TRUE(records.empty());
+    ASSERT_TRUE(table->getchildren(folders[1]->nodehandle, &records));
+    ASSERT_EQ(records.size(), 20u);
+    uint32_t id;
+    string data;
+    ASSERT_FALSE(table->getnode(folders[2]->nodehandle, &id, &data));
+    ASSERT_TRUE(d.client.nodebyhandle(folders[2]->children.back()->nodehandle) == NULL);
+
+    table->remove();
+}
+#endif
+
+// folders with files whose keys and attributes are encrypted as received
+// from the API - the last folder is an inbound share with its own key, its
+// first file has a corrupt key and its second one a key for an unknown share
+static void makeencryptednodes(OfflineClient* c, int folders, int files)
+{
+    Node* root = c->makenode(NULL, ROOTNODE, "");
+    SymmCipher sharekey;
+    byte sharekeybytes[SymmCipher::KEYLENGTH] = { 9, 8, 7, 6, 5, 4, 3, 2, 1 };
+    sharekey.setkey(sharekeybytes);
+    char me[12], share[12];
+    Base64::btoa((const byte*)&root->nodehandle, MegaClient::NODEHANDLE, me);
+
+    for (int i = 0; i < folders; i++)
+    {
+        Node* parent = root;
+        node_vector dp;
+
+        for (int j = -1; j < files; j++)
+        {
+            nodetype_t type = j < 0 ? FOLDERNODE : FILENODE;
+            handle h = c->nexthandle++;
+            int keylength = type == FILENODE ? FILENODEKEYLENGTH : FOLDERNODEKEYLENGTH;
+            byte key[FILENODEKEYLENGTH];
+            for (int k = 0; k < keylength; k++)
+            {
+                key[k] = byte(h * 31 + k);
+            }
+
+            string rawkey((const char*)key, keylength), attrs, nodekey;
+            SymmCipher cipher;
+            cipher.setkey(&rawkey);
+            string name = (j < 0 ? "folder" : "file") + std::to_string(j < 0 ? i : j);
+            c->client.makeattr(&cipher, &attrs, ("\"n\":\"" + name + "\"").c_str());
+
+            SymmCipher* wrapper = (i == folders - 1 && j >= 0) ? &sharekey : &c->client.key;
+            wrapper->ecb_encrypt(key, NULL, keylength);
+            Base64::btoa(string((const char*)key, keylength), nodekey);
+            nodekey.insert(0, string(wrapper == &sharekey ? share : me) + ":");
+
+            if (i == folders - 1 && j == 0)
+            {
+                nodekey.resize(nodekey.size() - 5);
+            }
+            else if (i == folders - 1 && j == 1)
+            {
+                nodekey.replace(0, 8, "AAAAAAAA");
+            }
+
+            Node* n = new Node(&c->client, &dp, h, parent->nodehandle, type, j < 0 ? -1 : j, UNDEF, NULL, 1500000000);
+            n->nodekey = nodekey;
+            n->attrstring = new string;
+            Base64::btoa(attrs, *n->attrstring);
+
+            if (j < 0)
+            {
+                parent = n;
+
+                if (i == folders - 1)
+                {
+                    n->sharekey = new SymmCipher(sharekey);
+                    Base64::btoa((const byte*)&h, MegaClient::NODEHANDLE, share);
+                }
+            }
+        }
+    }
+}
+
+TEST(MegaClient, applykeys)
+{
+    byte key[SymmCipher::KEYLENGTH] = { 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16 };
+    const int folders = 8, files = 1000;
+
+    OfflineClient serial;
+    serial.client.key.setkey(key);
+    serial.client.applykeysthreads = 0;
+    makeencryptednodes(&serial, folders, files);
+    ASSERT_EQ(serial.client.applykeys(), folders * (files + 1) - 1);
+
+    OfflineClient parallel;
+    parallel.client.key.setkey(key);
+    parallel.client.applykeysthreads = 3;
+    makeencryptednodes(&parallel, folders, files);
+    ASSERT_EQ(parallel.client.applykeys(), folders * (files + 1) - 1);
+
+    // the worker pool is only started for batches split across threads
+    ASSERT_TRUE(serial.client.keypool == NULL);
+    ASSERT_TRUE(parallel.client.keypool != NULL);
+
+    ASSERT_EQ(serial.client.nodes.size(), parallel.client.nodes.size());
+
+    for (node_map::iterator it = serial.client.nodes.begin(); it != serial.client.nodes.end(); it++)
+    {
+        Node* a = it->second;
+        Node* b = parallel.client.nodebyhandle(a->nodehandle);
+        ASSERT_TRUE(b != NULL);
+        ASSERT_EQ(a->nodekey, b->nodekey);
+        ASSERT_EQ(a->attrstring == NULL, b->attrstring == NULL);
+        ASSERT_TRUE(a->attrs.map == b->attrs.map);
+        ASSERT_STREQ(a->displayname(), b->displayname());
+        ASSERT_EQ(a->isvalid, b->isvalid);
+        ASSERT_EQ(a->mtime, b->mtime);
+        ASSERT_EQ(0, memcmp(a->crc, b->crc, sizeof a->crc));
+    }
+
+    // names are indexed, keys in the share are unwrapped with the share key
+    Node* folder = parallel.client.childnodebyname(parallel.client.nodebyhandle(parallel.client.rootnodes[0]), "folder3");
+    ASSERT_TRUE(folder != NULL);
+    ASSERT_TRUE(parallel.client.childnodebyname(folder, "file999") != NULL);
+    Node* share = parallel.client.childnodebyname(parallel.client.nodebyhandle(parallel.client.rootnodes[0]), "folder7");
+    ASSERT_TRUE(share != NULL);
+    ASSERT_TRUE(parallel.client.childnodebyname(share, "file2") != NULL);
+    ASSERT_EQ(parallel.client.fingerprints.size(), serial.client.fingerprints.size());
+
+    // the node with the corrupt key and the one for an unknown share
+    ASSERT_EQ(parallel.client.nodebyhandle(share->nodehandle + 1)->attrstring != NULL, true);
+    ASSERT_EQ(parallel.client.nodebyhandle(share->nodehandle + 2)->attrstring != NULL, true);
+}
+
+// command that records the number of nodes when its result is processed
+class RecordingCommand : public Command
+{
+    size_t* nodes;
+
+public:
+    void procresult()
+    {
+        *nodes = client->nodes.size();
+        client->json.getint();
+    }
+
+    RecordingCommand(size_t* n) : nodes(n) { }
+};
+
+// fetchnodes response with the result of a preceding command: a root, then
+// folders with files (each folder after its first file)
+static string fetchnodesresponse(int folders, int files)
+{
+    char h[12], p[12];
+    string response = "[0,{\"f\":[{\"h\":\"";
+    handle root = 1;
+    Base64::btoa((const byte*)&root, MegaClient::NODEHANDLE, h);
+    response.append(h).append("\",\"t\":2,\"a\":\"\",\"k\":\"\",\"ts\":1500000000}");
+
+    for (handle folder = 2; folder < 2 + handle(folders); folder++)
+    {
+        string records;
+        Base64::btoa((const byte*)&folder, MegaClient::NODEHANDLE, p);
+
+        for (int i = 0; i < files; i++)
+        {
+            handle file = (folder << 20) + i;
+            Base64::btoa((const byte*)&file, MegaClient::NODEHANDLE, h);
+            records.append(",{\"h\":\"").append(h).append("\",\"p\":\"").append(p)
+                   .append("\",\"u\":\"AAAAAAAAAAA\",\"t\":0,\"a\":\"bmFtZQ\",\"k\":\"AAAAAAAAAAA:a2V5a2V5a2V5a2V5a2V5a2V5a2V5a2V5\",\"s\":")
+                   .append(std::to_string(i)).append(",\"ts\":1500000000}");
+
+            if (!i)
+            {
+                Base64::btoa((const byte*)&root, MegaClient::NODEHANDLE, h);
+                records.append(",{\"h\":\"").append(p).append("\",\"p\":\"").append(h)
+                       .append("\",\"u\":\"AAAAAAAAAAA\",\"t\":1,\"a\":\"bmFtZQ\",\"k\":\"AAAAAAAAAAA:a2V5a2V5a2V5a2V5\",\"ts\":1500000000}");
+            }
+        }
+
+        response.append(records);
+    }
+
+    response.append("],\"sn\":\"AAAAAAAAAAA\"}]");
+    return response;
+}
+
+// feed a fetchnodes response to the client in pieces of the given size, as
+// MegaClient::exec() does while it arrives - returns the largest buffer
+static size_t fetchnodes(OfflineClient* c, const string& response, size_t piece, bool incremental, size_t* seen)
+{
+    c->client.fetchingnodes = true;
+    c->client.reqs.add(new RecordingCommand(seen));
+    c->client.reqs.add(new CommandFetchNodes(&c->client));
+    c->client.reqs.nextRequest();
+
+    HttpReq* req = c->client.pendingcs = new HttpReq();
+    req->incremental = incremental;
+    c->client.fnstream = incremental ? MegaClient::FNSTREAM_RESULTS : MegaClient::FNSTREAM_OFF;
+    c->client.fnstreampos = 0;
+    c->client.fnstreamresult = 0;
+
+    size_t peak = 0;
+    for (size_t pos = 0; pos < response.size(); pos += piece)
+    {
+        req->put((void*)(response.data() + pos), unsigned(std::min(piece, response.size() - pos)), true);
+        peak = std::max(peak, req->in.capacity());
+
+        if (c->client.fnstream == MegaClient::FNSTREAM_RESULTS || c->client.fnstream == MegaClient::FNSTREAM_NODES)
+        {
+            c->client.procpartialresponse();
+        }
+    }
+
+    EXPECT_EQ(req->in.size() + req->inpurged, response.size());
+
+    c->client.restorepartialresponse();
+    c->client.json.begin(req->in.c_str());
+    c->client.reqs.procresult(&c->client);
+
+    c->client.pendingcs = NULL;
+    delete req;
+    return peak;
+}
+
+TEST(MegaClient, fetchnodesincremental)
+{
+    const int folders = 20, files = 30;
+    string response = fetchnodesresponse(folders, files);
+    size_t pieces[] = { 1, 7, 100, 4096, response.size() };
+
+    for (size_t i = 0; i < sizeof pieces / sizeof *pieces; i++)
+    {
+        OfflineClient c;
+        Node* old = c.makenode(NULL, ROOTNODE, "");
+        c.makenode(old, FOLDERNODE, "old");
+
+        size_t seen = 0;
+        size_t peak = fetchnodes(&c, response, pieces[i], true, &seen);
+
+        // the preceding result is processed before the tree is purged
+        ASSERT_EQ(seen, 2u);
+        ASSERT_EQ(c.client.nodes.size(), size_t(1 + folders * (files + 1)));
+        ASSERT_EQ(c.client.fnstream, int(MegaClient::FNSTREAM_END));
+        ASSERT_STREQ(c.client.scsn, "AAAAAAAAAAA");
+
+        Node* root = c.client.nodebyhandle(1);
+        ASSERT_TRUE(root != NULL);
+        ASSERT_EQ(root->children.size(), size_t(folders));
+        ASSERT_TRUE(root->checkcounters());
+
+        for (handle folder = 2; folder < 2 + handle(folders); folder++)
+        {
+            Node* n = c.client.nodebyhandle(folder);
+            ASSERT_TRUE(n != NULL);
+            ASSERT_EQ(n->parent, root);
+            ASSERT_EQ(n->children.size(), size_t(files));
+            ASSERT_EQ(c.client.nodebyhandle((folder << 20) + files - 1)->parent, n);
+        }
+
+        if (pieces[i] < 1000)
+        {
+            ASSERT_LT(peak, response.size() / 10);
+        }
+    }
+
+    // unexpected layout: processed as a whole
+    OfflineClient c;
+    c.makenode(NULL, ROOTNODE, "");
+    size_t seen = 0;
+    fetchnodes(&c, "[0,{\"sn\":\"AAAAAAAAAAA\",\"f\":[]}]", 1, true, &seen);
+    ASSERT_EQ(c.client.fnstream, int(MegaClient::FNSTREAM_OFF));
+    ASSERT_EQ(seen, 1u);
+    ASSERT_TRUE(c.client.nodes.empty());
+}
+
+static void waitcrypto(TransferCryptoPool* pool, ChunkCrypto* job)
+{
+    while (!pool->finished(job))
+    {
+        std::this_thread::yield();
+    }
+}
+
+static bool samemacs(chunkmac_map* a, chunkmac_map* b)
+{
+    if (a->size() != b->size())
+    {
+        return false;
+    }
+
+    for (chunkmac_map::iterator it = a->begin(); it != a->end(); it++)
+    {
+        chunkmac_map::iterator match = b->find(it->first);
+        if (match == b->end() || memcmp(it->second.mac, match->second.mac, sizeof it->second.mac))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TEST(TransferCryptoPool, chunks)
+{
+    OfflineClient c;
+    TransferCryptoPool pool(&c.waiter, 4);
+
+    byte key[SymmCipher::KEYLENGTH];
+    for (int i = 0; i < SymmCipher::KEYLENGTH; i++)
+    {
+        key[i] = byte(i * 37 + 1);
+    }
+    SymmCipher cipher(key);
+
+    // spans several chunks, with a partial block at the end
+    const m_off_t size = 3 * 1048576 + 1000;
+    string data;
+    for (m_off_t i = 0; i < size; i++)
+    {
+        data.push_back(char(i * 131 % 251));
+    }
+
+    // upload: encryption, chunk MACs and CRC
+    HttpReqUL syncul, asyncul;
+    chunkmac_map syncmacs, asyncmacs;
+    string padded = data;
+    padded.resize((size + SymmCipher::BLOCKSIZE - 1) & -SymmCipher::BLOCKSIZE);
+    *syncul.out = padded;
+    *asyncul.out = padded;
+
+    syncul.prepare("http://localhost/ul", &cipher, &syncmacs, 0x1234, 0, size);
+    asyncul.prepareasync(&pool, "http://localhost/ul", &cipher, 0x1234, 0, size);
+    waitcrypto(&pool, asyncul.crypto);
+    asyncul.preparecompleted(&asyncmacs);
+
+    ASSERT_TRUE(asyncul.crypto == NULL);
+    ASSERT_EQ(syncul.out->size(), size_t(size));
+    ASSERT_EQ(*syncul.out, *asyncul.out);
+    ASSERT_EQ(syncul.posturl, asyncul.posturl);
+    ASSERT_TRUE(samemacs(&syncmacs, &asyncmacs));
+
+    // download of the encrypted data: decryption and chunk MACs
+    Transfer transfer(&c.client, GET);
+    memcpy(transfer.transferkey, key, sizeof key);
+    transfer.ctriv = 0x1234;
+    transfer.size = size;
+
+    HttpReqDL syncdl, asyncdl;
+    HttpReqDL* dls[] = { &syncdl, &asyncdl };
+    for (int i = 0; i < 2; i++)
+    {
+        dls[i]->prepare("http://localhost/dl", NULL, NULL, 0, 0, size);
+        memcpy(dls[i]->buf, syncul.out->data(), size);
+        dls[i]->bufpos = size;
+    }
+
+    syncdl.finalize(&transfer);
+    asyncdl.finalizeasync(&transfer, &pool);
+    waitcrypto(&pool, asyncdl.crypto);
+    asyncdl.finalizecompleted();
+
+    ASSERT_TRUE(asyncdl.decrypted);
+    ASSERT_TRUE(!memcmp(syncdl.buf, data.data(), size));
+    ASSERT_TRUE(!memcmp(asyncdl.buf, data.data(), size));
+    ASSERT_TRUE(samemacs(&syncdl.chunkmacs, &syncmacs));
+    ASSERT_TRUE(samemacs(&asyncdl.chunkmacs, &syncmacs));
+
+    // finalize() does not decrypt twice
+    asyncdl.finalize(&transfer);
+    ASSERT_TRUE(!memcmp(asyncdl.buf, data.data(), size));
+
+    // queued jobs can be cancelled, running ones are waited for
+    const int jobs = 32;
+    vector<HttpReqUL*> reqs;
+    for (int i = 0; i < jobs; i++)
+    {
+        HttpReqUL* req = new HttpReqUL();
+        *req->out = padded;
+        req->prepareasync(&pool, "http://localhost/ul", &cipher, 0x1234, 0, size);
+        reqs.push_back(req);
+    }
+    for (int i = jobs; i--; )
+    {
+        pool.cancel(reqs[i]->crypto);
+    }
+    for (int i = 0; i < jobs; i++)
+    {
+        delete reqs[i];
+    }
+}
+
+TEST(TransferCryptoPool, DISABLED_chunks_benchmark)
+{
+    OfflineClient c;
+    byte key[SymmCipher::KEYLENGTH] = { 1, 2, 3 };
+    SymmCipher cipher(key);
+
+    // one request of 8 MB for each of 16 parallel transfers
+    const int transfers = 16;
+    const m_off_t size = 8 * 1048576;
+    string data(size, 'x');
+
+    int threads[] = { 0, 1, 2, 4, 8 };
+    for (unsigned t = 0; t < sizeof threads / sizeof *threads; t++)
+    {
+        TransferCryptoPool pool(&c.waiter, threads[t]);
+        vector<HttpReqUL*> reqs;
+        for (int i = 0; i < transfers; i++)
+        {
+            reqs.push_back(new HttpReqUL());
+            reqs.back()->out->assign(data);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < transfers; i++)
+        {
+            reqs[i]->prepareasync(&pool, "http://localhost/ul", &cipher, i, 0, size);
+        }
+
+        chunkmac_map macs;
+        for (int i = 0; i < transfers; i++)
+        {
+            waitcrypto(&pool, reqs[i]->crypto);
+            reqs[i]->preparecompleted(&macs);
+            delete reqs[i];
+        }
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        std::cout << "Encrypting " << transfers << " x " << size / 1048576 << " MB with " << threads[t] << " crypto threads: "
+                  << ms << " ms (" << transfers * size / 1048576 / (ms / 1000) << " MB/s)" << std::endl;
+    }
+}
+
+TEST(TransferBufferPool, buffers)
+{
+    TransferBufferPool pool;
+
+    byte* a = pool.get(NULL, 100000);
+    ASSERT_EQ((uintptr_t)a % TransferBufferPool::ALIGNMENT, 0u);
+    ASSERT_EQ(pool.stats.allocations, 1);
+    memset(a, 1, 100000);
+
+    // idle buffers are reused for sizes they fit without wasting half
+    pool.release(a);
+    ASSERT_EQ(pool.get(NULL, 90000), a);
+    ASSERT_EQ(pool.get(a, 60000), a);
+    byte* b = pool.get(a, 300000);
+    ASSERT_NE(b, a);
+    ASSERT_EQ((uintptr_t)b % TransferBufferPool::ALIGNMENT, 0u);
+    ASSERT_EQ(pool.stats.allocations, 2);
+
+    // too large to be reused for a small request
+    ASSERT_NE(pool.get(NULL, 30000), a);
+    ASSERT_EQ(pool.stats.allocations, 3);
+
+    // idle buffers beyond the limit are freed
+    pool.maxidlebytes = 0;
+    pool.release(b);
+    ASSERT_NE(pool.get(NULL, 300000), (byte*)NULL);
+    ASSERT_EQ(pool.stats.allocations, 4);
+
+    // download requests take their buffers from the pool
+    pool.maxidlebytes = TransferBufferPool::MAXIDLEBYTES;
+    HttpReqDL* req = new HttpReqDL();
+    req->bufferpool = &pool;
+    req->prepare("http://localhost/dl", NULL, NULL, 0, 0, 1048573);
+    byte* buf = req->buf;
+    ASSERT_EQ((uintptr_t)buf % TransferBufferPool::ALIGNMENT, 0u);
+    ASSERT_EQ(req->buflen, 1048573);
+    req->prepare("http://localhost/dl", NULL, NULL, 0, 1048573, 1048573 + 1000000);
+    ASSERT_EQ(req->buf, buf);
+    delete req;
+
+    req = new HttpReqDL();
+    req->bufferpool = &pool;
+    req->prepare("http://localhost/dl", NULL, NULL, 0, 0, 900000);
+    ASSERT_EQ(req->buf, buf);
+    delete req;
+
+    // the counters start from zero again after a reset
+    TransferBufferPool::Stats stats = pool.resetstats();
+    ASSERT_EQ(stats.allocations, 5);
+    ASSERT_EQ(pool.stats.allocations, 0);
+    ASSERT_EQ(pool.stats.allocationspermb(), 0);
+}
+
+#if defined(USE_CURL) && !defined(_WIN32)
+// plain HTTP/1.1 server on the loopback interface that answers every
+// request with "ok" and keeps the connection alive
+struct LoopbackHttpServer
+{
+    int listenfd;
+    int port;
+    std::thread thread;
+    std::atomic<bool> stop;
+
+    std::mutex mutex;
+    vector<string> requestlines;
+    int connections;
+
+    LoopbackHttpServer()
+        : stop(false), connections(0)
+    {
+        struct sockaddr_in addr;
+        socklen_t addrlen = sizeof addr;
+
+        memset(&addr, 0, sizeof addr);
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        listenfd = socket(AF_INET, SOCK_STREAM, 0);
+        bind(listenfd, (struct sockaddr*)&addr, sizeof addr);
+        listen(listenfd, 16);
+        getsockname(listenfd, (struct sockaddr*)&addr, &addrlen);
+        port = ntohs(addr.sin_port);
+
+        thread = std::thread(&LoopbackHttpServer::run, this);
+    }
+
+    ~LoopbackHttpServer()
+    {
+        stop = true;
+        thread.join();
+        close(listenfd);
+    }
+
+    void run()
+    {
+        vector<struct pollfd> fds(1);
+        vector<string> pending(1);
+
+        fds[0].fd = listenfd;
+        fds[0].events = POLLIN;
+
+        while (!stop)
+        {
+            if (poll(fds.data(), fds.size(), 10) <= 0)
+            {
+                continue;
+            }
+
+            for (size_t i = fds.size(); i--; )
+            {
+                if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+                {
+                    continue;
+                }
+
+                if (!i)
+                {
+                    struct pollfd pfd = { accept(listenfd, NULL, NULL), POLLIN, 0 };
+                    fds.push_back(pfd);
+                    pending.push_back(string());
+                    std::lock_guard<std::mutex> g(mutex);
+                    connections++;
+                    continue;
+                }
+
+                char buf[4096];
+                ssize_t r = read(fds[i].fd, buf, sizeof buf);
+
+                if (r <= 0)
+                {
+                    close(fds[i].fd);
+                    fds.erase(fds.begin() + i);
+                    pending.erase(pending.begin() + i);
+                    continue;
+                }
+
+                pending[i].append(buf, r);
+
+                size_t end;
+                while ((end = pending[i].find("\r\n\r\n")) != string::npos)
+                {
+                    size_t length = 0;
+                    size_t cl = pending[i].find("Content-Length: ");
+                    if (cl != string::npos && cl < end)
+                    {
+                        length = atol(pending[i].c_str() + cl + 16);
+                    }
+
+                    if (pending[i].size() < end + 4 + length)
+                    {
+                        break;
+                    }
+
+                    {
+                        std::lock_guard<std::mutex> g(mutex);
+                        requestlines.push_back(pending[i].substr(0, pending[i].find("\r\n")));
+                    }
+                    pending[i].erase(0, end + 4 + length);
+
+                    const char* response = "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok";
+                    EXPECT_EQ(write(fds[i].fd, response, strlen(response)), ssize_t(strlen(response)));
+                }
+            }
+        }
+
+        for (size_t i = 1; i < fds.size(); i++)
+        {
+            close(fds[i].fd);
+        }
+    }
+};
+
+// run the network layer until all requests are done
+static bool runrequests(OfflineClient* c, vector<HttpReq*>* reqs)
+{
+    for (int i = 0; i < 1000; i++)
+    {
+        bool inflight = false;
+        for (size_t j = 0; j < reqs->size(); j++)
+        {
+            inflight |= (*reqs)[j]->status == REQ_INFLIGHT;
+        }
+
+        if (!inflight)
+        {
+            return true;
+        }
+
+        c->waiter.init(1);
+        c->httpio.addevents(&c->waiter, 0);
+        c->waiter.wait();
+        c->httpio.doio();
+    }
+
+    return false;
+}
+
+TEST(CurlHttpIO, http11fallback)
+{
+    LoopbackHttpServer server;
+    OfflineClient c;
+
+    if (!c.httpio.sethttp2(true))
+    {
+        GTEST_SKIP() << "cURL built without HTTP/2 support";
+    }
+
+    string url = "http://127.0.0.1:" + std::to_string(server.port) + "/";
+
+    // parallel downloads from a server without HTTP/2
+    vector<HttpReq*> reqs;
+    for (int i = 0; i < 4; i++)
+    {
+        HttpReq* req = new HttpReq(true);
+        req->type = REQ_BINARY;
+        req->posturl = url + "dl" + std::to_string(i);
+        req->get(&c.client);
+        reqs.push_back(req);
+    }
+
+    ASSERT_TRUE(runrequests(&c, &reqs));
+
+    for (size_t i = 0; i < reqs.size(); i++)
+    {
+        ASSERT_EQ(reqs[i]->status, REQ_SUCCESS);
+        ASSERT_EQ(reqs[i]->httpstatus, 200);
+        ASSERT_EQ(reqs[i]->in, "ok");
+        delete reqs[i];
+    }
+    reqs.clear();
+
+    int connections;
+    {
+        std::lock_guard<std::mutex> g(server.mutex);
+        ASSERT_EQ(server.requestlines.size(), size_t(4));
+        for (size_t i = 0; i < server.requestlines.size(); i++)
+        {
+            ASSERT_EQ(server.requestlines[i].substr(server.requestlines[i].size() - 9), " HTTP/1.1");
+        }
+        connections = server.connections;
+    }
+
+    // an API request after the downloads
+    HttpReq* req = new HttpReq();
+    req->posturl = url + "cs";
+    req->out->assign("[{\"a\":\"ug\"}]");
+    req->post(&c.client);
+    reqs.push_back(req);
+
+    ASSERT_TRUE(runrequests(&c, &reqs));
+    ASSERT_EQ(req->status, REQ_SUCCESS);
+    ASSERT_EQ(req->in, "ok");
+    delete req;
+
+    std::lock_guard<std::mutex> g(server.mutex);
+    ASSERT_EQ(server.requestlines.size(), size_t(5));
+    ASSERT_EQ(server.requestlines.back(), "POST /cs HTTP/1.1");
+#if LIBCURL_VERSION_NUM >= 0x073900 // At least cURL 7.57.0
+    // it reuses an idle connection of the downloads
+    ASSERT_EQ(server.connections, connections);
+#endif
+}
+#endif
+
+#ifndef _WIN32
+// exposes the registered descriptors
+struct WatchingWaiter : public PosixWaiter
+{
+    using PosixWaiter::watched;
+};
+
+TEST(PosixWaiter, watchfd)
+{
+    WatchingWaiter w;
+    int p[2], q[2];
+    ASSERT_EQ(pipe(p), 0);
+    ASSERT_EQ(pipe(q), 0);
+
+    // nothing to read: timeout
+    w.watchfd(p[0], PosixWaiter::WATCH_READ);
+    w.init(0);
+    ASSERT_EQ(w.wait(), int(Waiter::NEEDEXEC));
+    ASSERT_EQ(w.triggeredevents(p[0]), 0);
+
+    // registrations persist across wait() calls
+    ASSERT_EQ(write(p[1], "x", 1), 1);
+    for (int i = 0; i < 2; i++)
+    {
+        w.init(10);
+        ASSERT_EQ(w.wait(), int(Waiter::NEEDEXEC));
+        ASSERT_EQ(w.triggeredevents(p[0]), int(PosixWaiter::WATCH_READ));
+    }
+
+    // ignored descriptors do not request exec()
+    w.watchfd(p[0], PosixWaiter::WATCH_READ, true);
+    w.init(10);
+    ASSERT_EQ(w.wait(), 0);
+    ASSERT_EQ(w.triggeredevents(p[0]), int(PosixWaiter::WATCH_READ));
+
+    // descriptors added to the fd_sets by the app still work alongside
+    ASSERT_EQ(write(q[1], "x", 1), 1);
+    w.init(10);
+    FD_SET(q[0], &w.rfds);
+    w.bumpmaxfd(q[0]);
+    ASSERT_EQ(w.wait(), int(Waiter::NEEDEXEC));
+    ASSERT_TRUE(FD_ISSET(q[0], &w.rfds));
+    ASSERT_EQ(w.triggeredevents(p[0]), int(PosixWaiter::WATCH_READ));
+
+    // change of events and removal
+    w.unwatchfd(p[0]);
+    w.watchfd(p[1], PosixWaiter::WATCH_WRITE);
+    w.init(10);
+    ASSERT_EQ(w.wait(), int(Waiter::NEEDEXEC));
+    ASSERT_EQ(w.triggeredevents(p[0]), 0);
+    ASSERT_EQ(w.triggeredevents(p[1]), int(PosixWaiter::WATCH_WRITE));
+
+    // unwatched before closing and the descriptor number reused
+    w.unwatchfd(p[1]);
+    w.watchfd(p[0], PosixWaiter::WATCH_READ);
+    int reused = p[0];
+    w.unwatchfd(p[0]);
+    close(p[0]);
+    close(p[1]);
+    ASSERT_EQ(pipe(p), 0);
+    ASSERT_EQ(p[0], reused);
+    w.watchfd(p[0], PosixWaiter::WATCH_READ);
+    ASSERT_EQ(write(p[1], "x", 1), 1);
+    w.init(10);
+    ASSERT_EQ(w.wait(), int(Waiter::NEEDEXEC));
+    ASSERT_EQ(w.triggeredevents(p[0]), int(PosixWaiter::WATCH_READ));
+
+    w.unwatchfd(p[0]);
+    w.notify();
+    w.init(~0);
+    ASSERT_EQ(w.wait(), int(Waiter::NEEDEXEC));
+    ASSERT_TRUE(w.triggered.empty() || w.triggered.size() == 1);
+
+    close(p[0]);
+    close(p[1]);
+    close(q[0]);
+    close(q[1]);
+
+    // the filesystem event descriptors are registered once and unwatched
+    // before they are closed
+    PosixFileSystemAccess* fsaccess = new PosixFileSystemAccess;
+    ASSERT_GE(fsaccess->notifyfd, 0);
+    size_t registered = w.watched.size();
+    fsaccess->addevents(&w, 0);
+    ASSERT_TRUE(w.watched.count(fsaccess->notifyfd));
+    ASSERT_GT(w.watched.size(), registered);
+    registered = w.watched.size();
+    fsaccess->addevents(&w, 0);
+    ASSERT_EQ(w.watched.size(), registered);
+    int notifyfd = fsaccess->notifyfd;
+    delete fsaccess;
+    ASSERT_FALSE(w.watched.count(notifyfd));
+}
+
+#endif
+
+#if defined(HAVE_AIO_RT) && !defined(__APPLE__)
+// queue reads or writes of a file in chunks with up to depth operations in flight
+static bool asyncchunks(PosixFileSystemAccess& fsaccess, FileAccess* fa, bool write, byte* data, unsigned chunk, unsigned chunks, unsigned depth)
+{
+    vector<AsyncIOContext*> contexts(depth);
+    vector<string> bufs(depth);
+    bool ok = true;
+
+    for (unsigned i = 0; i < chunks + depth; i++)
+    {
+        unsigned slot = i % depth;
+        if (contexts[slot])
+        {
+            contexts[slot]->finish();
+            ok = ok && !contexts[slot]->failed;
+            if (!write)
+            {
+                ok = ok && !memcmp(bufs[slot].data(), data + contexts[slot]->pos, chunk);
+            }
+            delete contexts[slot];
+            contexts[slot] = NULL;
+        }
+
+        if (i < chunks)
+        {
+            contexts[slot] = write ? fa->asyncfwrite(data + m_off_t(i) * chunk, chunk, m_off_t(i) * chunk)
+                                   : fa->asyncfread(&bufs[slot], chunk, 0, m_off_t(i) * chunk);
+        }
+
+        // one submission per pass, as in MegaClient::exec()
+        if (slot == depth - 1)
+        {
+            fsaccess.processasync();
+        }
+    }
+
+    return ok;
+}
+
+TEST(PosixFileAccess, asyncio)
+{
+    PosixWaiter waiter;
+    PosixFileSystemAccess fsaccess;
+    fsaccess.waiter = &waiter;
+
+    string name = "asyncio.tmp";
+    const unsigned chunk = 65536;
+    const unsigned chunks = 32;
+    string data(chunk * chunks, 0);
+    for (size_t i = 0; i < data.size(); i++)
+    {
+        data[i] = char(i * 7 + i / 4096);
+    }
+
+    for (int uring = 0; uring < 2; uring++)
+    {
+        unlink(name.c_str());
+
+        FileAccess* fa = fsaccess.newfileaccess();
+#ifdef USE_IO_URING
+        if (!uring)
+        {
+            ((PosixFileAccess*)fa)->uring = NULL;
+        }
+#endif
+        ASSERT_TRUE(fa->fopen(&name, false, true));
+        ASSERT_TRUE(asyncchunks(fsaccess, fa, true, (byte*)data.data(), chunk, chunks, 8));
+        delete fa;
+
+        fa = fsaccess.newfileaccess();
+#ifdef USE_IO_URING
+        if (!uring)
+        {
+            ((PosixFileAccess*)fa)->uring = NULL;
+        }
+#endif
+        ASSERT_TRUE(fa->fopen(&name, true, false));
+        ASSERT_EQ(fa->size, m_off_t(data.size()));
+        ASSERT_TRUE(asyncchunks(fsaccess, fa, false, (byte*)data.data(), chunk, chunks, 8));
+
+        // completions are delivered through the waiter
+        string buf;
+        AsyncIOContext* context = fa->asyncfread(&buf, 100, 12, chunk - 50);
+        fsaccess.processasync();
+        for (int i = 0; i < 100 && !context->finished; i++)
+        {
+            waiter.init(10);
+            waiter.wakeupby(&fsaccess, Waiter::NEEDEXEC);
+            waiter.wait();
+            fsaccess.checkevents(&waiter);
+        }
+        ASSERT_TRUE(context->finished);
+        ASSERT_FALSE(context->failed);
+        ASSERT_EQ(buf.size(), 112u);
+        ASSERT_EQ(buf.substr(0, 100), data.substr(chunk - 50, 100));
+        ASSERT_EQ(buf.substr(100), string(12, 0));
+        delete context;
+
+        // reads beyond the end of the file fail
+        context = fa->asyncfread(&buf, chunk, 0, data.size() - chunk / 2);
+        context->finish();
+        ASSERT_TRUE(context->failed);
+        delete context;
+
+        delete fa;
+#ifndef USE_IO_URING
+        break;
+#endif
+    }
+
+    unlink(name.c_str());
+}
+
+TEST(PosixFileAccess, DISABLED_asyncio_benchmark)
+{
+    PosixWaiter waiter;
+    PosixFileSystemAccess fsaccess;
+    fsaccess.waiter = &waiter;
+
+    string name = "asyncio_benchmark.tmp";
+    const unsigned chunk = 1048576;
+    const unsigned chunks = 128;
+    string data(chunk * chunks, 'x');
+
+    for (int uring = 0; uring < 2; uring++)
+    {
+        for (int write = 1; write >= 0; write--)
+        {
+            FileAccess* fa = fsaccess.newfileaccess();
+#ifdef USE_IO_URING
+            if (!uring)
+            {
+                ((PosixFileAccess*)fa)->uring = NULL;
+            }
+#endif
+            ASSERT_TRUE(fa->fopen(&name, !write, !!write));
+
+            auto start = std::chrono::steady_clock::now();
+            ASSERT_TRUE(asyncchunks(fsaccess, fa, !!write, (byte*)data.data(), chunk, chunks, 8));
+            double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+            delete fa;
+
+            std::cout << (write ? "Writing " : "Reading ") << chunks << " x 1 MB with " << (uring ? "io_uring" : "POSIX AIO")
+                      << ": " << ms << " ms (" << chunks / (ms / 1000) << " MB/s)" << std::endl;
+        }
+#ifndef USE_IO_URING
+        break;
+#endif
+    }
+
+    unlink(name.c_str());
+}
+#endif
+
+TEST(ThroughputController, rounds)
+{
+    dstime ds = Waiter::ds;
+    Waiter::ds = 1000;
+
+    ThroughputController c;
+    c.enabled = true;
+    c.init(2, 4, 4194304, 1048576, 16777216);
+
+    // 1 MB/s: requests take 8 s, so another connection is tried
+    Waiter::ds += 30;
+    ASSERT_TRUE(c.sample(3145728));
+    ASSERT_EQ(c.roundspeed, 1048576);
+    ASSERT_EQ(c.connections, 3);
+    ASSERT_EQ(c.reqsize, 4194304);
+
+    // no gain: reverted, then no changes for HOLDROUNDS rounds
+    Waiter::ds += 30;
+    ASSERT_TRUE(c.sample(3145728));
+    ASSERT_EQ(c.connections, 2);
+    for (int i = 0; i < ThroughputController::HOLDROUNDS; i++)
+    {
+        Waiter::ds += 30;
+        ASSERT_FALSE(c.sample(3145728));
+    }
+
+    // incomplete rounds are not evaluated
+    Waiter::ds += 10;
+    ASSERT_FALSE(c.sample(1048576));
+    Waiter::ds += 20;
+    ASSERT_TRUE(c.sample(2097152));
+    ASSERT_EQ(c.connections, 3);
+
+    // gain: kept, and the next increase is tried
+    Waiter::ds += 30;
+    ASSERT_TRUE(c.sample(4718592));
+    ASSERT_EQ(c.connections, 4);
+
+    // at the connection limit, larger requests are tried
+    Waiter::ds += 30;
+    ASSERT_TRUE(c.sample(6291456));
+    ASSERT_EQ(c.connections, 4);
+    ASSERT_EQ(c.reqsize, 8388608);
+
+    // errors halve both, once per round
+    ASSERT_TRUE(c.failed());
+    ASSERT_EQ(c.connections, 2);
+    ASSERT_EQ(c.reqsize, 4194304);
+    ASSERT_FALSE(c.failed());
+    Waiter::ds += 30;
+    ASSERT_TRUE(c.failed());
+    ASSERT_EQ(c.connections, 1);
+    ASSERT_EQ(c.reqsize, 2097152);
+    Waiter::ds += 30;
+    ASSERT_TRUE(c.failed());
+    ASSERT_EQ(c.reqsize, 1048576);
+    Waiter::ds += 30;
+    ASSERT_FALSE(c.failed());
+
+    // fast requests: the request size grows first
+    c.init(2, 4, 1048576, 1048576, 16777216);
+    Waiter::ds += 30;
+    ASSERT_TRUE(c.sample(31457280));
+    ASSERT_EQ(c.connections, 2);
+    ASSERT_EQ(c.reqsize, 2097152);
+
+    // disabled: fixed configuration
+    c.enabled = false;
+    Waiter::ds += 30;
+    ASSERT_FALSE(c.sample(31457280));
+    ASSERT_FALSE(c.failed());
+    ASSERT_EQ(c.connections, 2);
+
+    Waiter::ds = ds;
+}
+
+// stand-in for a latency- and bandwidth-shaped storage server: every request
+// waits one round trip for its first byte, connections share the bandwidth
+// and are limited by their window, and requests running longer than
+// abortds are aborted (like by a proxy) and count as failures
+struct ShapedLink
+{
+    double bandwidth;
+    double window;
+    dstime rttds;
+    dstime abortds;
+};
+
+static m_off_t shapedtransfer(ThroughputController& c, const ShapedLink& link, m_off_t size, dstime duration)
+{
+    vector<double> remaining(c.maxconnections, 0);
+    vector<m_off_t> requested(c.maxconnections, 0);
+    vector<dstime> started(c.maxconnections, 0);
+    m_off_t completed = 0;
+    m_off_t pos = 0;
+    dstime end = Waiter::ds + duration;
+
+    while (Waiter::ds < end && completed < size)
+    {
+        Waiter::ds++;
+
+        int transferring = 0;
+        for (int i = 0; i < c.maxconnections; i++)
+        {
+            if (remaining[i] > 0 && Waiter::ds - started[i] > link.rttds)
+            {
+                transferring++;
+            }
+        }
+
+        double rate = transferring ? std::min(link.bandwidth / transferring, link.window * 10 / link.rttds) : 0;
+        double bytes = 0;
+
+        for (int i = 0; i < c.maxconnections; i++)
+        {
+            if (remaining[i] > 0)
+            {
+                if (Waiter::ds - started[i] > link.abortds)
+                {
+                    c.failed();
+                    remaining[i] = 0;
+                }
+                else if (Waiter::ds - started[i] > link.rttds)
+                {
+                    double b = std::min(remaining[i], rate / 10);
+                    remaining[i] -= b;
+                    bytes += b;
+                    if (remaining[i] <= 0)
+                    {
+                        completed += requested[i];
+                    }
+                }
+            }
+
+            if (remaining[i] <= 0 && i < c.connections && pos < size)
+            {
+                // request sizes as chosen by TransferSlot::doio()
+                m_off_t reqsize = std::min(c.reqsize, (size - pos) / c.connections / 2);
+                reqsize = std::max(reqsize, m_off_t(1048576));
+                remaining[i] = double(reqsize);
+                requested[i] = reqsize;
+                started[i] = Waiter::ds;
+                pos += reqsize;
+            }
+        }
+
+        c.sample(m_off_t(bytes));
+    }
+
+    return completed;
+}
+
+TEST(ThroughputController, shapedlink)
+{
+    dstime ds = Waiter::ds;
+    Waiter::ds = 1000;
+
+    struct
+    {
+        const char* name;
+        ShapedLink link;
+    } links[] = {
+        // 500 ms RTT, 512 KB window (1 MB/s per connection), 8 MB/s
+        { "high latency", { 8388608, 524288, 5, 6000 } },
+        // 1 MB/s shared, requests aborted after 20 s
+        { "congested", { 1048576, 4194304, 1, 200 } },
+    };
+
+    const m_off_t size = m_off_t(4) << 30;
+    const dstime duration = 3000;
+
+    for (unsigned l = 0; l < sizeof links / sizeof *links; l++)
+    {
+        // defaults: 4 download connections, requests of up to 16 MB
+        ThroughputController fixed;
+        fixed.init(4, 4, 16777216, 16777216, 16777216);
+        m_off_t fixedbytes = shapedtransfer(fixed, links[l].link, size, duration);
+
+        ThroughputController adaptive;
+        adaptive.enabled = true;
+        adaptive.init(4, int(MegaClient::MAX_NUM_CONNECTIONS), 16777216, 1048576, 16777216);
+        m_off_t adaptivebytes = shapedtransfer(adaptive, links[l].link, size, duration);
+
+        std::cout << links[l].name << " link, " << duration / 10 << " s: fixed " << fixedbytes / 1048576 << " MB, adaptive "
+                  << adaptivebytes / 1048576 << " MB (" << adaptive.connections << " connections, requests of "
+                  << adaptive.reqsize / 1048576 << " MB)" << std::endl;
+
+        ASSERT_GT(adaptivebytes, fixedbytes + fixedbytes / 4);
+    }
+
+    Waiter::ds = ds;
+}
+
+
+TEST(DownloadSources, selection)
+{
+    dstime ds = Waiter::ds;
+    Waiter::ds = 1000;
+
+    DownloadSources s;
+    ASSERT_EQ(s.select(), -1);
+    ASSERT_TRUE(s.add("http://gfs1.example/dl/abc"));
+    ASSERT_FALSE(s.add("http://gfs1.example/dl/def"));
+    ASSERT_TRUE(s.add("https://gfs2.example:8080/dl/abc"));
+    ASSERT_EQ(DownloadSources::host(s.sources[1].url), "gfs2.example:8080");
+
+    // nothing measured: requests are spread evenly
+    ASSERT_EQ(s.select(), 0);
+    s.started(0);
+    ASSERT_EQ(s.select(), 1);
+    s.started(1);
+    ASSERT_EQ(s.select(), 0);
+
+    // 1 MB/s and 4 MB/s: the faster source takes up to four times the requests
+    s.completed(0, 4194304, 40);
+    s.completed(1, 4194304, 10);
+    ASSERT_EQ(s.sources[0].speed, 1048576);
+    ASSERT_EQ(s.sources[1].speed, 4194304);
+    int counts[2] = { 0, 0 };
+    for (int i = 0; i < 10; i++)
+    {
+        int source = s.select();
+        s.started(source);
+        counts[source]++;
+    }
+    ASSERT_EQ(counts[0], 2);
+    ASSERT_EQ(counts[1], 8);
+
+    // unmeasured sources are assumed to be as fast as the fastest one
+    ASSERT_TRUE(s.add("http://gfs3.example/dl/abc"));
+    ASSERT_EQ(s.expectedspeed(2), 4194304);
+    ASSERT_EQ(s.select(), 2);
+
+    // a request 1 MB into 4 MB after 4 s on the slow source is raced on the
+    // fast one, but not before MINRACEDS and not the other way round
+    ASSERT_EQ(s.race(0, 4194304, 1048576, 40), 1);
+    ASSERT_EQ(s.race(0, 4194304, 0, DownloadSources::MINRACEDS - 1), -1);
+    ASSERT_EQ(s.race(1, 4194304, 2097152, 20), -1);
+
+    // failing sources are left aside, rejected URLs at once
+    for (int i = 0; i < DownloadSources::MAXFAILURES; i++)
+    {
+        s.failed(1);
+    }
+    ASSERT_FALSE(s.usable(1));
+    s.failed(2, true);
+    ASSERT_FALSE(s.usable(2));
+    ASSERT_EQ(s.select(), 0);
+    ASSERT_EQ(s.race(0, 4194304, 1048576, 40), -1);
+
+    // without usable sources, the one with the fewest failures is used
+    s.failed(0, true);
+    s.failed(1);
+    ASSERT_EQ(s.select(), 0);
+
+    // a completed request makes a source usable again
+    s.completed(2, 4194304, 10);
+    ASSERT_TRUE(s.usable(2));
+    ASSERT_EQ(s.select(), 2);
+
+    Waiter::ds = ds;
+}
+
+// stand-ins for storage servers sharing their bandwidth among the requests
+// they serve: the download is run like TransferSlot::doio() does, with a
+// fixed number of connections and request size, racing requests lagging on
+// a slow source once everything has been requested
+static dstime sourcedtransfer(const vector<double>& bandwidths, m_off_t size, int connections, m_off_t reqsize)
+{
+    struct Request
+    {
+        bool active;
+        int source;
+        int twin;
+        m_off_t size;
+        double received;
+        dstime start;
+    };
+
+    DownloadSources s;
+    for (unsigned i = 0; i < bandwidths.size(); i++)
+    {
+        s.add(string("http://gfs") + std::to_string(i) + ".example/dl/abc");
+    }
+
+    vector<Request> reqs(connections);
+    for (int i = 0; i < connections; i++)
+    {
+        reqs[i].active = false;
+        reqs[i].twin = -1;
+    }
+
+    m_off_t pos = 0;
+    m_off_t completed = 0;
+    dstime begin = Waiter::ds;
+
+    while (completed < size && Waiter::ds - begin < 100000)
+    {
+        Waiter::ds++;
+
+        vector<int> active(bandwidths.size(), 0);
+        for (int i = 0; i < connections; i++)
+        {
+            if (reqs[i].active)
+            {
+                active[reqs[i].source]++;
+            }
+        }
+
+        for (int i = 0; i < connections; i++)
+        {
+            Request& r = reqs[i];
+            if (!r.active)
+            {
+                continue;
+            }
+
+            r.received += bandwidths[r.source] / active[r.source] / 10;
+            if (r.received >= r.size)
+            {
+                // the first copy to complete wins
+                if (r.twin >= 0)
+                {
+                    reqs[r.twin].active = false;
+                    reqs[r.twin].twin = -1;
+                    s.withdrawn(reqs[r.twin].source);
+                    r.twin = -1;
+                }
+
+                s.completed(r.source, r.size, Waiter::ds - r.start);
+                completed += r.size;
+                r.active = false;
+            }
+        }
+
+        for (int i = 0; i < connections; i++)
+        {
+            Request& r = reqs[i];
+            if (r.active)
+            {
+                continue;
+            }
+
+            if (pos < size)
+            {
+                r.size = std::min(reqsize, size - pos);
+                r.source = s.select();
+                pos += r.size;
+            }
+            else
+            {
+                int slowest = -1;
+                int target = -1;
+                for (int j = 0; j < connections; j++)
+                {
+                    if (reqs[j].active && reqs[j].twin < 0)
+                    {
+                        int t = s.race(reqs[j].source, reqs[j].size, m_off_t(reqs[j].received), Waiter::ds - reqs[j].start);
+                        if (t >= 0 && (slowest < 0 || reqs[j].start < reqs[slowest].start))
+                        {
+                            slowest = j;
+                            target = t;
+                        }
+                    }
+                }
+
+                if (slowest < 0)
+                {
+                    continue;
+                }
+
+                r.size = reqs[slowest].size;
+                r.source = target;
+                r.twin = slowest;
+                reqs[slowest].twin = i;
+            }
+
+            r.active = true;
+            r.received = 0;
+            r.start = Waiter::ds;
+            s.started(r.source);
+        }
+    }
+
+    return Waiter::ds - begin;
+}
+
+TEST(DownloadSources, standinhosts)
+{
+    dstime ds = Waiter::ds;
+    Waiter::ds = 1000;
+
+    // two servers at 8 MB/s and one at 512 KB/s
+    const m_off_t size = m_off_t(256) << 20;
+
+    struct
+    {
+        const char* name;
+        double bandwidths[3];
+    } cases[] = {
+        { "slow first source", { 524288, 8388608, 8388608 } },
+        { "fast first source", { 8388608, 524288, 8388608 } },
+    };
+
+    for (unsigned c = 0; c < sizeof cases / sizeof *cases; c++)
+    {
+        vector<double> single(cases[c].bandwidths, cases[c].bandwidths + 1);
+        vector<double> multiple(cases[c].bandwidths, cases[c].bandwidths + 3);
+
+        // defaults: 4 download connections, requests of 4 MB
+        dstime singleds = sourcedtransfer(single, size, 4, 4194304);
+        dstime multipleds = sourcedtransfer(multiple, size, 4, 4194304);
+
+        std::cout << cases[c].name << ", " << size / 1048576 << " MB: single source " << singleds / 10.0
+                  << " s, three sources " << multipleds / 10.0 << " s" << std::endl;
+
+        ASSERT_LT(multipleds, singleds * 3 / 4);
+    }
+
+    Waiter::ds = ds;
+}
+
+#ifdef ENABLE_SYNC
+// folder with the given number of files of the given size (and a subfolder)
+static bool makescanfolder(FileSystemAccess* fsaccess, string path, int files, unsigned size)
+{
+    if (!fsaccess->mkdirlocal(&path) && !fsaccess->target_exists)
+    {
+        return false;
+    }
+
+    string data(size, 0);
+    for (int i = 0; i < files; i++)
+    {
+        for (unsigned j = 0; j < size; j++)
+        {
+            data[j] = char(i * 31 + j * 7 + j / 1000);
+        }
+
+        string name = path + "/file" + std::to_string(i);
+        FileAccess* fa = fsaccess->newfileaccess();
+        bool ok = fa->fopen(&name, false, true) && fa->fwrite((const byte*)data.data(), size, 0);
+        delete fa;
+        if (!ok)
+        {
+            return false;
+        }
+    }
+
+    string folder = path + "/folder";
+    return fsaccess->mkdirlocal(&folder) || fsaccess->target_exists;
+}
+
+static void removescanfolder(FileSystemAccess* fsaccess, string path, int files)
+{
+    for (int i = 0; i < files; i++)
+    {
+        string name = path + "/file" + std::to_string(i);
+        fsaccess->unlinklocal(&name);
+    }
+
+    string folder = path + "/folder";
+    fsaccess->rmdirlocal(&folder);
+    fsaccess->rmdirlocal(&path);
+}
+
+// wait for the given number of jobs of a sync
+static void collectscans(SyncScanPool* pool, Waiter* waiter, Sync* sync, size_t count, vector<SyncScanJob*>* results)
+{
+    for (int i = 0; i < 1000 && results->size() < count; i++)
+    {
+        pool->collect(sync, results);
+        if (results->size() < count)
+        {
+            waiter->init(10);
+            waiter->wait();
+        }
+    }
+}
+
+TEST(SyncScanPool, jobs)
+{
+    OfflineClient c;
+    SyncScanPool pool(&c.fsaccess, &c.waiter, 4);
+
+    const int files = 16;
+    string path = "syncscan.tmp";
+    ASSERT_TRUE(makescanfolder(&c.fsaccess, path, files, 100000));
+
+    // the listing has all items with their type
+    Sync* sync = reinterpret_cast<Sync*>(&c);
+    pool.push(new SyncScanJob(sync, SyncScanJob::LIST, path));
+
+    vector<SyncScanJob*> results;
+    collectscans(&pool, &c.waiter, sync, 1, &results);
+    ASSERT_EQ(results.size(), 1u);
+    ASSERT_TRUE(results[0]->finished);
+    ASSERT_TRUE(results[0]->success);
+    ASSERT_EQ(results[0]->entries.size(), size_t(files + 1));
+
+    int listedfiles = 0, listedfolders = 0;
+    for (size_t i = 0; i < results[0]->entries.size(); i++)
+    {
+        if (results[0]->entries[i].localname == "folder")
+        {
+            ASSERT_EQ(results[0]->entries[i].type, FOLDERNODE);
+            listedfolders++;
+        }
+        else
+        {
+            ASSERT_EQ(results[0]->entries[i].type, FILENODE);
+            listedfiles++;
+        }
+    }
+    ASSERT_EQ(listedfiles, files);
+    ASSERT_EQ(listedfolders, 1);
+    delete results[0];
+    results.clear();
+
+    // fingerprints match the ones computed on the client thread, the ctime
+    // is settled as of the time the job was queued
+    m_time_t later = m_time() + 3;
+    for (int i = 0; i < files; i++)
+    {
+        SyncScanJob* job = new SyncScanJob(sync, SyncScanJob::FINGERPRINT, path + "/file" + std::to_string(i));
+        if (i % 2)
+        {
+            job->queued = later;
+        }
+        pool.push(job);
+    }
+    pool.push(new SyncScanJob(sync, SyncScanJob::FINGERPRINT, path + "/folder"));
+    pool.push(new SyncScanJob(sync, SyncScanJob::FINGERPRINT, path + "/missing"));
+
+    collectscans(&pool, &c.waiter, sync, files + 2, &results);
+    ASSERT_EQ(results.size(), size_t(files + 2));
+
+    int fingerprinted = 0;
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        SyncScanJob* job = results[i];
+        if (job->success)
+        {
+            FileAccess* fa = c.fsaccess.newfileaccess();
+            ASSERT_TRUE(fa->fopen(&job->localpath, true, false));
+
+            FileFingerprint fp;
+            fp.genfingerprint(fa);
+            ASSERT_TRUE(fp == job->fingerprint);
+            ASSERT_TRUE(!memcmp(fp.crc, job->fingerprint.crc, sizeof fp.crc));
+            ASSERT_EQ(job->fsid, fa->fsid);
+            if (job->queued == later)
+            {
+                ASSERT_EQ(job->ctime, fa->ctime);
+            }
+            delete fa;
+
+            fingerprinted++;
+        }
+        delete job;
+    }
+    ASSERT_EQ(fingerprinted, files);
+    results.clear();
+
+    // jobs are only collected by their own sync, and cancelled ones are gone
+    Sync* other = reinterpret_cast<Sync*>(&pool);
+    for (int i = 0; i < 64; i++)
+    {
+        pool.push(new SyncScanJob(i % 2 ? other : sync, SyncScanJob::FINGERPRINT, path + "/file" + std::to_string(i % files)));
+    }
+    pool.cancel(other);
+
+    collectscans(&pool, &c.waiter, sync, 32, &results);
+    ASSERT_EQ(results.size(), 32u);
+    for (size_t i = 0; i < results.size(); i++)
+    {
+        ASSERT_TRUE(results[i]->sync == sync);
+        delete results[i];
+    }
+    results.clear();
+
+    pool.collect(other, &results);
+    ASSERT_TRUE(results.empty());
+
+    // left in the pool on destruction
+    pool.push(new SyncScanJob(sync, SyncScanJob::LIST, path));
+
+    removescanfolder(&c.fsaccess, path, files);
+}
+
+// sync on a local folder of an offline client (without state cache)
+static Sync* offlinesync(OfflineClient* c, string* root)
+{
+    if (!c->fsaccess.mkdirlocal(root, false) && !c->fsaccess.target_exists)
+    {
+        return NULL;
+    }
+
+    Node* remoteroot = c->makenode(NULL, FOLDERNODE, "root");
+    string debris = *root + "/.debris";
+    return new Sync(&c->client, root, NULL, &debris, remoteroot, 0, false, 0, NULL);
+}
+
+static LocalNode* synclocalfile(Sync* sync, string* path)
+{
+    LocalNode* l = new LocalNode;
+    l->init(sync, FILENODE, &sync->localroot, path);
+    return l;
+}
+
+static bool writescanfile(FileSystemAccess* fsaccess, string* path, const string& data, m_time_t mtime)
+{
+    FileAccess* fa = fsaccess->newfileaccess();
+    bool ok = fa->fopen(path, false, true) && fa->fwrite((const byte*)data.data(), unsigned(data.size()), 0);
+    delete fa;
+    return ok && fsaccess->setmtimelocal(path, mtime);
+}
+
+// clock of settledctime() a few seconds ahead, so that files written just
+// now have a settled ctime
+static m_time_t laterclock(m_time_t* tt)
+{
+    m_time_t t = m_time() + 3;
+    if (tt)
+    {
+        *tt = t;
+    }
+    return t;
+}
+
+// offline sync on a scratch folder that is removed (along with the sync)
+// even if the test fails halfway
+class SyncFingerprintCache : public ::testing::Test
+{
+protected:
+    OfflineClient c;
+    string root;
+    Sync* sync;
+
+    SyncFingerprintCache()
+    {
+        sync = NULL;
+    }
+
+    void start(const char* folder)
+    {
+        root = folder;
+        sync = offlinesync(&c, &root);
+    }
+
+    void TearDown()
+    {
+        if (sync)
+        {
+            sync->state = SYNC_CANCELED;
+            delete sync;
+        }
+
+        if (root.size())
+        {
+            c.fsaccess.rmdirlocal(&root);
+        }
+    }
+};
+
+TEST_F(SyncFingerprintCache, changes)
+{
+    start("syncfingerprint.tmp");
+    ASSERT_TRUE(sync != NULL);
+
+    string path = root + "/file";
+    string data(100000, 'a');
+    m_time_t mtime = m_time() - 3600;
+    ASSERT_TRUE(writescanfile(&c.fsaccess, &path, data, mtime));
+
+    // the ctime has to be in the past to vouch for the contents
+    sync->settledclock = laterclock;
+
+    LocalNode* l = synclocalfile(sync, &path);
+    sync->startfullscan();
+
+    FileAccess* fa = c.fsaccess.newfileaccess();
+    ASSERT_TRUE(fa->fopen(&path, true, false));
+    ASSERT_NE(fa->ctime, 0);
+    l->setfsid(fa->fsid);
+    ASSERT_TRUE(sync->genfingerprint(l, fa, &path));
+    ASSERT_TRUE(sync->fingerprinted);
+    ASSERT_EQ(l->ctime, fa->ctime);
+    ASSERT_EQ(sync->scanbytesread, m_off_t(FileFingerprint::MAXFULL));
+    delete fa;
+
+    FileFingerprint expected;
+    expected = *l;
+
+    // unchanged: not read again
+    sync->fingerprinted = false;
+    fa = c.fsaccess.newfileaccess();
+    ASSERT_TRUE(fa->fopen(&path, true, false));
+    ASSERT_FALSE(sync->genfingerprint(l, fa, &path));
+    ASSERT_FALSE(sync->fingerprinted);
+    ASSERT_EQ(sync->scanbytesread, m_off_t(FileFingerprint::MAXFULL));
+    ASSERT_EQ(sync->scanbytesskipped, m_off_t(FileFingerprint::MAXFULL));
+    delete fa;
+
+    // changed with the same size and mtime: the ctime tells (the cached
+    // ctime dates back to before the change, as if the file had settled
+    // for a while)
+    sync->settledclock = m_time;
+    l->ctime -= 2;
+    data[0] = 'b';
+    ASSERT_TRUE(writescanfile(&c.fsaccess, &path, data, mtime));
+    fa = c.fsaccess.newfileaccess();
+    ASSERT_TRUE(fa->fopen(&path, true, false));
+    ASSERT_EQ(fa->size, l->size);
+    ASSERT_EQ(fa->mtime, l->mtime);
+    ASSERT_TRUE(sync->genfingerprint(l, fa, &path));
+    ASSERT_TRUE(sync->fingerprinted);
+    ASSERT_EQ(sync->scanbytesread, m_off_t(2 * FileFingerprint::MAXFULL));
+    ASSERT_TRUE(memcmp(expected.crc, l->crc, sizeof l->crc));
+
+    // ...and is too recent to vouch for the new contents
+    ASSERT_EQ(l->ctime, 0);
+    delete fa;
+
+    // the ctime is kept in the state cache, records without it are accepted
+    l->ctime = 1234567890;
+    for (int legacy = 0; legacy < 2; legacy++)
+    {
+        string d;
+        if (legacy)
+        {
+            l->ctime = 0;
+        }
+        ASSERT_TRUE(l->serialize(&d));
+        if (legacy)
+        {
+            // drop the (empty) ctime
+            d.resize(d.size() - 1);
+        }
+
+        LocalNode* u = LocalNode::unserialize(sync, &d);
+        ASSERT_TRUE(u != NULL);
+        ASSERT_EQ(u->ctime, legacy ? 0 : 1234567890);
+        ASSERT_EQ(u->size, l->size);
+        ASSERT_EQ(u->mtime, l->mtime);
+        ASSERT_TRUE(!memcmp(u->crc, l->crc, sizeof l->crc));
+
+        string copy = root + (legacy ? "/legacy" : "/copy");
+        u->localname.clear();
+        u->init(sync, FILENODE, &sync->localroot, &copy);
+    }
+}
+
+// synced folder tree of the given depth and fanout, each folder with two files
+// that match their remote nodes (folders are only created on disk if requested)
+static void makesynctree(OfflineClient* c, LocalNode* l, const string& path, int depth, int fanout, bool disk)
+{
+    for (int i = 0; i < fanout; i++)
+    {
+        string name = "folder" + std::to_string(i);
+        string childpath = path + "/" + name;
+        if (disk)
+        {
+            c->fsaccess.mkdirlocal(&childpath, false);
+        }
+
+        LocalNode* ll = new LocalNode;
+        ll->init(l->sync, FOLDERNODE, l, &childpath);
+        ll->setnode(c->makenode(l->node, FOLDERNODE, name));
+
+        if (depth > 1)
+        {
+            makesynctree(c, ll, childpath, depth - 1, fanout, disk);
+        }
+    }
+
+    for (int i = 0; i < 2; i++)
+    {
+        string name = "file" + std::to_string(i);
+        string childpath = path + "/" + name;
+        Node* n = c->makenode(l->node, FILENODE, name, 1000 + i);
+        n->mtime = 1500000000;
+
+        LocalNode* ll = new LocalNode;
+        ll->init(l->sync, FILENODE, l, &childpath);
+        *(FileFingerprint*)ll = *(FileFingerprint*)n;
+        ll->setnode(n);
+    }
+}
+
+static void removesynctree(FileSystemAccess* fsaccess, string path)
+{
+    DirAccess* da = fsaccess->newdiraccess();
+    if (da->dopen(&path, NULL, false))
+    {
+        string name;
+        nodetype_t type;
+        while (da->dnext(&path, &name, false, &type))
+        {
+            string childpath = path + "/" + name;
+            if (type == FOLDERNODE)
+            {
+                removesynctree(fsaccess, childpath);
+            }
+            else
+            {
+                fsaccess->unlinklocal(&childpath);
+            }
+        }
+    }
+    delete da;
+    fsaccess->rmdirlocal(&path);
+}
+
+// LocalNode tree with the linked remote nodes
+static void dumpsynctree(LocalNode* l, const string& path, string* result)
+{
+    for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
+    {
+        string childpath = path + "/" + it->second->name;
+        result->append(childpath + " " + std::to_string(it->second->type) + " "
+                       + (it->second->node ? std::to_string(it->second->node->nodehandle) : "-") + "\n");
+        dumpsynctree(it->second, childpath, result);
+    }
+}
+
+static LocalNode* synctreechild(LocalNode* l, const char* name)
+{
+    for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
+    {
+        if (it->second->name == name)
+        {
+            return it->second;
+        }
+    }
+    return NULL;
+}
+
+static bool synctreedirty(LocalNode* l)
+{
+    if (l->syncdowndirty || l->syncupdirty)
+    {
+        return true;
+    }
+
+    for (localnode_map::iterator it = l->children.begin(); it != l->children.end(); it++)
+    {
+        if (it->second->type == FOLDERNODE && synctreedirty(it->second))
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+// remote addition, rename and move and a local addition, processed by
+// syncdown() and syncup() with or without the dirty flags
+static void syncdirtypasses(bool full, string* result)
+{
+    OfflineClient c;
+    string root = "syncdirty.tmp";
+    Sync* sync = offlinesync(&c, &root);
+    ASSERT_TRUE(sync != NULL);
+    makesynctree(&c, &sync->localroot, root, 3, 3, true);
+    sync->initializing = false;
+    sync->fullscan = false;
+
+    // the tree is in sync: the initial full passes leave nothing to do
+    string path = root;
+    dstime nds = NEVER;
+    c.client.syncdownfull = true;
+    c.client.syncupfull = true;
+    ASSERT_TRUE(c.client.syncdown(&sync->localroot, &path, true));
+    ASSERT_TRUE(c.client.syncup(&sync->localroot, &nds));
+    ASSERT_TRUE(c.client.synccreate.empty());
+    ASSERT_FALSE(synctreedirty(&sync->localroot));
+    c.client.syncdownfull = full;
+    c.client.syncupfull = full;
+
+    LocalNode* folder0 = synctreechild(&sync->localroot, "folder0");
+    LocalNode* folder1 = synctreechild(&sync->localroot, "folder1");
+    LocalNode* folder2 = synctreechild(&sync->localroot, "folder2");
+
+    Node* added = c.makenode(synctreechild(folder1, "folder2")->node, FOLDERNODE, "added");
+    added->changed.newnode = true;
+    c.client.notifynode(added);
+
+    Node* renamed = synctreechild(folder0, "folder1")->node;
+    renamed->attrs.map['n'] = "renamed";
+    renamed->updatechildname();
+    renamed->changed.attrs = true;
+    c.client.notifynode(renamed);
+
+    Node* moved = synctreechild(folder2, "folder0")->node;
+    moved->attrs.map['n'] = "moved";
+    moved->updatechildname();
+    moved->setparent(synctreechild(folder1, "folder1")->node);
+    moved->changed.parent = true;
+    c.client.notifynode(moved);
+    c.client.notifypurge();
+
+    string local = root + "/folder2/folder2/local";
+    ASSERT_TRUE(c.fsaccess.mkdirlocal(&local, false));
+    LocalNode* l = sync->checkpath(NULL, &local);
+    ASSERT_TRUE(l && l != (LocalNode*)~0);
+
+    // only the branches with changes are flagged
+    if (!full)
+    {
+        ASSERT_FALSE(synctreedirty(synctreechild(folder0, "folder0")));
+        ASSERT_FALSE(synctreedirty(synctreechild(folder1, "folder0")));
+        ASSERT_TRUE(synctreechild(folder1, "folder2")->syncdowndirty);
+    }
+
+    ASSERT_TRUE(c.client.syncdown(&sync->localroot, &path, true));
+    nds = NEVER;
+    ASSERT_TRUE(c.client.syncup(&sync->localroot, &nds));
+
+    dumpsynctree(&sync->localroot, "", result);
+    for (size_t i = 0; i < c.client.synccreate.size(); i++)
+    {
+        string createpath;
+        c.client.synccreate[i]->getlocalpath(&createpath);
+        result->append("create " + createpath + "\n");
+    }
+
+    // a full syncdown() has nothing left to do
+    string before;
+    dumpsynctree(&sync->localroot, "", &before);
+    c.client.syncdownfull = true;
+    ASSERT_TRUE(c.client.syncdown(&sync->localroot, &path, true));
+    string after;
+    dumpsynctree(&sync->localroot, "", &after);
+    ASSERT_EQ(before, after);
+
+    // the pending creation keeps its branch flagged
+    ASSERT_TRUE(synctreechild(synctreechild(folder2, "folder2"), "local")->syncupdirty
+                || synctreechild(folder2, "folder2")->syncupdirty);
+    ASSERT_TRUE(sync->localroot.syncupdirty);
+
+    c.client.synccreate.clear();
+    sync->state = SYNC_CANCELED;
+    delete sync;
+    removesynctree(&c.fsaccess, root);
+}
+
+TEST(Sync, dirtysubtrees)
+{
+    string partial, full;
+    syncdirtypasses(false, &partial);
+    syncdirtypasses(true, &full);
+
+    ASSERT_NE(partial.find("/folder0/renamed 1"), string::npos);
+    ASSERT_NE(partial.find("/folder1/folder1/moved 1"), string::npos);
+    ASSERT_NE(partial.find("/folder1/folder2/added 1"), string::npos);
+    ASSERT_EQ(partial.find("\n/folder2/folder0 "), string::npos);
+    ASSERT_NE(partial.find("create syncdirty.tmp/folder2/folder2/local\n"), string::npos);
+    ASSERT_EQ(partial, full);
+}
+
+#endif
+
+#if defined(ENABLE_SYNC) && defined(USE_FANOTIFY)
+// wait for the filesystem notifications and collect the queued paths
+static void fanotifyevents(OfflineClient* c, Sync* sync, std::set<string>* paths)
+{
+    notify_deque* q = &sync->dirnotify->notifyq[DirNotify::DIREVENTS];
+
+    // until a wakeup brings nothing new
+    for (int i = 0; i < 20; i++)
+    {
+        c->waiter.init(1);
+        c->fsaccess.addevents(&c->waiter, 0);
+        c->waiter.wait();
+        if (!c->fsaccess.checkevents(&c->waiter) && q->size())
+        {
+            break;
+        }
+    }
+
+    for (notify_deque::iterator it = q->begin(); it != q->end(); it++)
+    {
+        ASSERT_EQ(it->localnode, &sync->localroot);
+        paths->insert(it->path);
+    }
+    q->clear();
+}
+
+TEST(PosixFileSystemAccess, fanotify)
+{
+    OfflineClient c;
+
+    if (c.fsaccess.fanotifyfd < 0)
+    {
+        GTEST_SKIP() << "fanotify not permitted";
+    }
+
+    string root = "fanotify.tmp";
+    string outside = "fanotify_outside.tmp";
+    Sync* sync = offlinesync(&c, &root);
+    ASSERT_TRUE(sync != NULL);
+
+    // the whole filesystem is watched, no per-folder watches
+    PosixDirNotify* dirnotify = (PosixDirNotify*)sync->dirnotify.get();
+    ASSERT_FALSE(dirnotify->fanotifyroot.empty());
+    ASSERT_EQ(dirnotify->fanotifyroot[0], '/');
+    ASSERT_TRUE(c.fsaccess.wdnodes.empty());
+
+    string file = root + "/file";
+    string folder = root + "/folder";
+    string nested = folder + "/nested";
+    string renamed = folder + "/renamed";
+    ASSERT_TRUE(writescanfile(&c.fsaccess, &file, "data", m_time()));
+    ASSERT_TRUE(c.fsaccess.mkdirlocal(&folder, false));
+    ASSERT_TRUE(writescanfile(&c.fsaccess, &nested, "data", m_time()));
+    ASSERT_TRUE(c.fsaccess.renamelocal(&nested, &renamed, true));
+    ASSERT_TRUE(writescanfile(&c.fsaccess, &outside, "data", m_time()));
+
+    std::set<string> paths;
+    fanotifyevents(&c, sync, &paths);
+    ASSERT_TRUE(paths.count("file"));
+    ASSERT_TRUE(paths.count("folder"));
+    ASSERT_TRUE(paths.count("folder/nested"));
+    ASSERT_TRUE(paths.count("folder/renamed"));
+    for (std::set<string>::iterator it = paths.begin(); it != paths.end(); it++)
+    {
+        ASSERT_EQ(it->find("outside"), string::npos);
+    }
+
+    // paths below a renamed folder are resolved afresh
+    string moved = root + "/moved";
+    string inmoved = moved + "/file";
+    ASSERT_TRUE(c.fsaccess.renamelocal(&folder, &moved, true));
+    ASSERT_TRUE(writescanfile(&c.fsaccess, &inmoved, "data", m_time()));
+
+    paths.clear();
+    fanotifyevents(&c, sync, &paths);
+    ASSERT_TRUE(paths.count("folder"));
+    ASSERT_TRUE(paths.count("moved"));
+    ASSERT_TRUE(paths.count("moved/file"));
+    ASSERT_FALSE(paths.count("folder/file"));
+
+    // ...while those outside of it are kept
+    bool rootcached = false;
+    for (map<string, string>::iterator it = c.fsaccess.fanotifydirs.begin(); it != c.fsaccess.fanotifydirs.end(); it++)
+    {
+        ASSERT_NE(it->second, dirnotify->fanotifyroot + "/folder");
+        rootcached |= it->second == dirnotify->fanotifyroot;
+    }
+    ASSERT_TRUE(rootcached);
+
+    // the mark goes away with the last sync on the filesystem
+    ASSERT_EQ(c.fsaccess.fanotifymounts.size(), size_t(1));
+    DirNotify* second = c.fsaccess.newdirnotify(&root, &root);
+    ASSERT_EQ(c.fsaccess.fanotifymounts.begin()->second.syncs, 2);
+    delete second;
+    ASSERT_EQ(c.fsaccess.fanotifymounts.begin()->second.syncs, 1);
+
+    sync->state = SYNC_CANCELED;
+    delete sync;
+    ASSERT_TRUE(c.fsaccess.fanotifymounts.empty());
+    ASSERT_TRUE(c.fsaccess.fanotifydirs.empty());
+
+    char buf[4096];
+    ASSERT_TRUE(writescanfile(&c.fsaccess, &outside, "more", m_time()));
+    ASSERT_LT(read(c.fsaccess.fanotifyfd, buf, sizeof buf), 0);
+    c.fsaccess.unlinklocal(&inmoved);
+    string movedrenamed = moved + "/renamed";
+    c.fsaccess.unlinklocal(&movedrenamed);
+    c.fsaccess.rmdirlocal(&moved);
+    c.fsaccess.unlinklocal(&file);
+    c.fsaccess.rmdirlocal(&root);
+    c.fsaccess.unlinklocal(&outside);
+}
+
+#endif
+
+#ifndef _WIN32
+// scratch folder for the listing tests, removed with everything in it even
+// if the test fails halfway
+class PosixDirList : public ::testing::Test
+{
+protected:
+    PosixFileSystemAccess fsaccess;
+    string path;
+
+    bool start(const char* folder)
+    {
+        path = folder;
+        return fsaccess.mkdirlocal(&path, false) || fsaccess.target_exists;
+    }
+
+    void TearDown()
+    {
+        if (path.size())
+        {
+            fsaccess.rmdirlocal(&path);
+        }
+    }
+};
+
+TEST_F(PosixDirList, attributes)
+{
+    ASSERT_TRUE(start("dlist.tmp"));
+
+    for (int i = 0; i < 8; i++)
+    {
+        string name = path + "/file" + std::to_string(i);
+        FileAccess* fa = fsaccess.newfileaccess();
+        ASSERT_TRUE(fa->fopen(&name, false, true));
+        string data(i * 1000, 'x');
+        ASSERT_TRUE(fa->fwrite((const byte*)data.data(), unsigned(data.size()), 0));
+        delete fa;
+    }
+
+    string folder = path + "/folder";
+    ASSERT_TRUE(fsaccess.mkdirlocal(&folder, false) || fsaccess.target_exists);
+
+    // a link to a file, a dangling link and a pipe
+    string link = path + "/link", dangling = path + "/dangling", fifo = path + "/fifo";
+    ASSERT_EQ(symlink("file3", link.c_str()), 0);
+    ASSERT_EQ(symlink("missing", dangling.c_str()), 0);
+    ASSERT_EQ(mkfifo(fifo.c_str(), 0600), 0);
+
+    // a file that can't be opened for reading (unless running as root)
+    string unreadable = path + "/unreadable";
+    FileAccess* fa = fsaccess.newfileaccess();
+    ASSERT_TRUE(fa->fopen(&unreadable, false, true));
+    delete fa;
+    ASSERT_EQ(chmod(unreadable.c_str(), 0200), 0);
+    fa = fsaccess.newfileaccess();
+    bool readable = fa->fopen(&unreadable, true, false);
+    delete fa;
+
+    for (int followsymlinks = 0; followsymlinks < 2; followsymlinks++)
+    {
+        // same records as dnext(), with the attributes of fopen()
+        std::map<string, nodetype_t> expected;
+        DirAccess* da = fsaccess.newdiraccess();
+        ASSERT_TRUE(da->dopen(&path, NULL, false));
+        string localname;
+        nodetype_t type;
+        while (da->dnext(&path, &localname, !!followsymlinks, &type))
+        {
+            expected[localname] = type;
+        }
+        delete da;
+        ASSERT_EQ(expected.size(), size_t(followsymlinks ? 11 : 10));
+
+        // ...except for the items that fopen() would refuse
+        if (!readable)
+        {
+            expected.erase("unreadable");
+        }
+
+        vector<DirEntry> entries;
+        da = fsaccess.newdiraccess();
+        ASSERT_TRUE(da->dopen(&path, NULL, false));
+        da->dlist(&path, &entries, !!followsymlinks);
+        delete da;
+        ASSERT_EQ(entries.size(), expected.size());
+
+        for (size_t i = 0; i < entries.size(); i++)
+        {
+            ASSERT_TRUE(expected.count(entries[i].localname));
+            ASSERT_EQ(entries[i].type, expected[entries[i].localname]);
+            ASSERT_TRUE(entries[i].fsidvalid);
+
+            string name = path + "/" + entries[i].localname;
+            FileAccess* fa = fsaccess.newfileaccess();
+            ASSERT_TRUE(fa->fopen(&name, false, false));
+            ASSERT_EQ(entries[i].type, fa->type);
+            ASSERT_EQ(entries[i].size, fa->size);
+            ASSERT_EQ(entries[i].mtime, fa->mtime);
+            ASSERT_EQ(entries[i].ctime, fa->ctime);
+            ASSERT_EQ(entries[i].fsid, fa->fsid);
+            delete fa;
+        }
+    }
+}
+
+#endif